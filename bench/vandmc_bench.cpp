@@ -0,0 +1,633 @@
+/** \file vandmc_bench.cpp
+ * \brief Microbenchmarks for the hot paths of the vandmc event loop.
+ *
+ * Each benchmark times a single kernel in isolation using fixed inputs
+ * generated from a fixed random seed, so that results may be compared
+ * between builds. Results are printed as a table and may optionally be
+ * written to a file in CSV format.
+ */
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <sstream>
+#include <chrono>
+#include <algorithm>
+
+#include "vandmc_core.hpp"
+#include "detectors.hpp"
+#include "detectorStore.hpp"
+#include "angularGrid.hpp"
+#include "bvh.hpp"
+#include "mesh.hpp"
+#include "slabKernel.hpp"
+#include "materials.hpp"
+#include "kindeux.hpp"
+
+/// Number of pre-generated inputs for each benchmark. Must be a power of two.
+const unsigned int nInputs = 4096;
+
+/// Seed used to generate all benchmark inputs.
+const uint64_t benchSeed = 12345;
+
+class benchResult{
+  public:
+	std::string name; /// The name of the benchmark. Written unquoted to the CSV output, so it must not contain commas.
+	unsigned int ops; /// The number of operations timed.
+	double seconds; /// The total time taken (s).
+	double checksum; /// Sum of all results, used to check that the work was done.
+
+	benchResult(const std::string &name_, const unsigned int &ops_, const double &seconds_, const double &checksum_) :
+		name(name_), ops(ops_), seconds(seconds_), checksum(checksum_) { }
+
+	/// Return the average time per operation (ns).
+	double GetNsPerOp() const { return (ops > 0 ? 1E9*seconds/ops : 0.0); }
+};
+
+/// Return the wall time since start_ (in seconds).
+double elapsed(const std::chrono::steady_clock::time_point &start_){
+	return std::chrono::duration<double>(std::chrono::steady_clock::now()-start_).count();
+}
+
+/// Generate nInputs random unit vectors pointing within maxAngle_ (rad) of the +z axis.
+void generateRays(RandomEngine &rng_, const double &maxAngle_, std::vector<Vector3> &rays){
+	rays.resize(nInputs);
+	double cosMax = std::cos(maxAngle_);
+	for(unsigned int i = 0; i < nInputs; i++){
+		double theta = std::acos(frand(rng_, cosMax, 1.0));
+		double phi = frand(rng_, 0.0, 2*pi);
+		Sphere2Cart(1.0, theta, phi, rays[i]);
+	}
+}
+
+/// Return a new detector of the shape given by a detector file line, or NULL if the shape is not supported.
+Primitive *newPrimitive(const std::string &line_){
+	NewVIKARdet det(line_);
+	Primitive *prim = NULL;
+	if(det.subtype == "planar"){ prim = new Planar(&det); }
+	else if(det.subtype == "cylinder"){ prim = new Cylindrical(&det); }
+	else if(det.subtype == "cone"){ prim = new Conical(&det); }
+	else if(det.subtype == "sphere"){ prim = new Spherical(&det); }
+	else if(det.subtype == "ellipse"){ prim = new Elliptical(&det); }
+	else if(det.subtype == "polygon"){ prim = new Polygonal(&det); }
+	else if(det.subtype == "annular"){ prim = new Annular(&det); }
+	else{ return NULL; }
+	return prim;
+}
+
+/// Time Primitive::IntersectPrimitive for a detector defined by a detector file line.
+benchResult benchIntersect(const std::string &name_, const std::string &line_, const std::vector<Vector3> &rays_, const unsigned int &ops_){
+	Primitive *prim = newPrimitive(line_);
+	if(!prim){ return benchResult(name_, 0, 0.0, 0.0); }
+	prim->Freeze();
+
+	Vector3 origin(0.0, 0.0, 0.0);
+	Vector3 P1, norm;
+	double t1, t2;
+	double checksum = 0.0;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for(unsigned int i = 0; i < ops_; i++){
+		if(prim->IntersectPrimitive(origin, rays_[i & (nInputs-1)], P1, norm, t1, t2)){ checksum += t1; }
+	}
+	double seconds = elapsed(start);
+
+	delete prim;
+	return benchResult(name_, ops_, seconds, checksum);
+}
+
+/// Time Mesh::IntersectPrimitive for a sphere of radius 0.15 m made of 4*nRings_^2 triangles, 1 m downstream along the +z axis.
+benchResult benchMesh(const unsigned int &nRings_, const std::vector<Vector3> &rays_, const unsigned int &ops_){
+	// Split the sphere into nRings_ rings in theta and 2*nRings_ segments in phi, two triangles per patch.
+	std::vector<Vector3> vertices;
+	Vector3 corners[4];
+	for(unsigned int i = 0; i < nRings_; i++){
+		for(unsigned int j = 0; j < 2*nRings_; j++){
+			Sphere2Cart(0.15, pi*i/nRings_, pi*j/nRings_, corners[0]);
+			Sphere2Cart(0.15, pi*(i+1)/nRings_, pi*j/nRings_, corners[1]);
+			Sphere2Cart(0.15, pi*(i+1)/nRings_, pi*(j+1)/nRings_, corners[2]);
+			Sphere2Cart(0.15, pi*i/nRings_, pi*(j+1)/nRings_, corners[3]);
+			vertices.push_back(corners[0]); vertices.push_back(corners[1]); vertices.push_back(corners[2]);
+			vertices.push_back(corners[0]); vertices.push_back(corners[2]); vertices.push_back(corners[3]);
+		}
+	}
+
+	Mesh mesh;
+	mesh.SetTriangles(vertices);
+	mesh.SetPosition(0.0, 0.0, 1.0);
+	mesh.Freeze();
+
+	std::stringstream name;
+	name << "Mesh of " << mesh.GetNumTriangles() << " triangles";
+
+	Vector3 origin(0.0, 0.0, 0.0);
+	Vector3 P1, norm;
+	double t1, t2;
+	double checksum = 0.0;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for(unsigned int i = 0; i < ops_; i++){
+		if(mesh.IntersectPrimitive(origin, rays_[i & (nInputs-1)], P1, norm, t1, t2)){ checksum += t1; }
+	}
+	return benchResult(name.str(), ops_, elapsed(start), checksum);
+}
+
+/// Build a wall of nBars_ small VANDLE bars placed side by side along the x axis, 1 m downstream along the +z axis.
+void buildWall(const unsigned int &nBars_, std::vector<Primitive*> &bars){
+	for(unsigned int i = 0; i < nBars_; i++){
+		Planar *bar = new Planar();
+		bar->SetSmall();
+		bar->SetPosition((i-0.5*(nBars_-1))*bar->GetWidth(), 0.0, 1.0);
+		bar->SetEjectile();
+		bar->Freeze();
+		bars.push_back(bar);
+	}
+}
+
+/// Time intersecting each ray with a wall of bars by calling Primitive::IntersectPrimitive for every bar.
+benchResult benchWallPrimitives(const unsigned int &nBars_, const std::vector<Vector3> &rays_, const unsigned int &ops_){
+	std::vector<Primitive*> bars;
+	buildWall(nBars_, bars);
+
+	Vector3 origin(0.0, 0.0, 0.0);
+	Vector3 P1;
+	double t1, t2;
+	double checksum = 0.0;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for(unsigned int i = 0; i < ops_; i++){
+		for(std::vector<Primitive*>::iterator iter = bars.begin(); iter != bars.end(); iter++){
+			if((*iter)->IntersectPrimitive(origin, rays_[i & (nInputs-1)], P1, t1, t2)){ checksum += t1; }
+		}
+	}
+	double seconds = elapsed(start);
+
+	for(std::vector<Primitive*>::iterator iter = bars.begin(); iter != bars.end(); iter++){ delete (*iter); }
+	return benchResult("Wall of "+std::to_string(nBars_)+" bars (Primitive)", ops_, seconds, checksum);
+}
+
+/** Time intersecting each ray with a wall of bars using a DetectorStore and the slab method kernel for level_.
+  * If singlePrecision_ is true, the bars are selected with the single precision kernels.
+  */
+benchResult benchWallStore(const unsigned int &nBars_, const std::vector<Vector3> &rays_, const SimdLevel &level_, const bool &singlePrecision_, const unsigned int &ops_){
+	std::vector<Primitive*> bars;
+	buildWall(nBars_, bars);
+	DetectorStore store(bars);
+	store.SetSinglePrecision(singlePrecision_);
+	std::string name = "Wall of "+std::to_string(nBars_)+" bars ("+GetSimdName(level_)+(singlePrecision_ ? " float)" : ")");
+
+	// Skip instruction sets which are not supported by this CPU.
+	SimdLevel previous = GetSimdLevel();
+	if(SetSimdLevel(level_) != level_){
+		SetSimdLevel(previous);
+		for(std::vector<Primitive*>::iterator iter = bars.begin(); iter != bars.end(); iter++){ delete (*iter); }
+		return benchResult(name, 0, 0.0, 0.0);
+	}
+
+	Vector3 origin(0.0, 0.0, 0.0);
+	std::vector<DetectorHit> hits;
+	double checksum = 0.0;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for(unsigned int i = 0; i < ops_; i++){
+		hits.clear();
+		store.Intersect(origin, rays_[i & (nInputs-1)], hits);
+		for(std::vector<DetectorHit>::iterator iter = hits.begin(); iter != hits.end(); iter++){ checksum += iter->t1; }
+	}
+	double seconds = elapsed(start);
+
+	SetSimdLevel(previous);
+	for(std::vector<Primitive*>::iterator iter = bars.begin(); iter != bars.end(); iter++){ delete (*iter); }
+	return benchResult(name, ops_, seconds, checksum);
+}
+
+/** Compare the hits found by a DetectorStore in single and double precision for every instruction set, using
+  * a ring of 48 medium bars around a wall of 64 small bars, rays from random points in a 2 cm beam spot and
+  * batches of rays from the origin.
+  * Return the number of rays for which the hits differ.
+  */
+size_t validateSinglePrecision(RandomEngine &rng_){
+	std::vector<NewVIKARdet> entries;
+	entries.push_back(NewVIKARdet("0 0 0 0.3 0 0 eject ring 1.2 0.06 0.03 none 48 1.0 0.1309"));
+	entries.push_back(NewVIKARdet("0 0 1.5 0 0 0 eject wall 0.6 0.03 0.03 none 64 0"));
+	std::vector<Primitive*> bars;
+	BuildDetectors(entries, bars);
+	for(std::vector<Primitive*>::iterator iter = bars.begin(); iter != bars.end(); iter++){ (*iter)->Freeze(); }
+	DetectorStore store(bars);
+
+	std::vector<Vector3> rays;
+	generateRays(rng_, pi/2, rays);
+
+	SimdLevel previous = GetSimdLevel();
+	size_t nDiffer = 0;
+	std::vector<DetectorHit> hitsDouble, hitsFloat;
+	for(int level = SIMD_SCALAR; level <= GetSimdSupport(); level++){
+		SetSimdLevel((SimdLevel)level);
+		for(unsigned int i = 0; i < nInputs; i++){
+			Vector3 origin(frand(rng_, -0.01, 0.01), frand(rng_, -0.01, 0.01), 0.0);
+			hitsDouble.clear();
+			hitsFloat.clear();
+			store.SetSinglePrecision(false);
+			store.Intersect(origin, rays[i], hitsDouble);
+			store.SetSinglePrecision(true);
+			store.Intersect(origin, rays[i], hitsFloat);
+			bool same = (hitsDouble.size() == hitsFloat.size());
+			for(size_t j = 0; j < hitsDouble.size() && same; j++){
+				same = (hitsDouble[j].index == hitsFloat[j].index && hitsDouble[j].t1 == hitsFloat[j].t1 && hitsDouble[j].t2 == hitsFloat[j].t2);
+			}
+			if(!same){ nDiffer++; }
+		}
+
+		// Batches of rays from a common origin.
+		std::vector<unsigned char> hitDouble, hitFloat;
+		store.SetSinglePrecision(false);
+		store.IntersectAny(Vector3(0.0, 0.0, 0.0), rays, hitDouble);
+		store.SetSinglePrecision(true);
+		store.IntersectAny(Vector3(0.0, 0.0, 0.0), rays, hitFloat);
+		for(unsigned int i = 0; i < nInputs; i++){
+			if(hitDouble[i] != hitFloat[i]){ nDiffer++; }
+		}
+	}
+	SetSimdLevel(previous);
+
+	for(std::vector<Primitive*>::iterator iter = bars.begin(); iter != bars.end(); iter++){ delete (*iter); }
+	return nDiffer;
+}
+
+/// Detector file lines for one detector of every shape, used to check that the culling layers do not drop any hits.
+const char *cullingShapes[] = {"0 0 1 0 0 0 generic planar 0.3 0.2 0.03 none",
+                               "0 0 1 0 0 1.5708 generic cylinder 0.05 0.3 0 none",
+                               "0 0 0.8 0 0 -1.5708 generic cone 0.3 0.3 0 none",
+                               "0 0 1 0 0 0 generic sphere 0.3 0 0 none",
+                               "0 0 1 0 0 0 generic ellipse 0.15 0.1 0.03 none",
+                               "0 0 1 0 0 0 generic polygon 0.15 6 0.03 none",
+                               "0 0 1 0 0 0 generic annular 0.05 0.15 0.03 none"};
+
+/// Number of entries in cullingShapes.
+const unsigned int nCullingShapes = 7;
+
+/** Build every detector shape in cullingShapes at several positions and rotations about the origin.
+  * Each detector is built once facing the origin and once rotated about all three axes.
+  */
+void buildCullingShapes(std::vector<Primitive*> &detectors){
+	for(unsigned int i = 0; i < nCullingShapes; i++){
+		Primitive *facing = newPrimitive(cullingShapes[i]);
+		facing->Freeze();
+		detectors.push_back(facing);
+		Primitive *rotated = newPrimitive(cullingShapes[i]);
+		rotated->SetPosition(0.2*i-0.6, 0.1, 1.2);
+		rotated->SetRotation(0.4, 0.3, 0.2+rotated->GetPsi());
+		rotated->Freeze();
+		detectors.push_back(rotated);
+	}
+}
+
+/** Compare the hits found by calling Primitive::IntersectPrimitive for every detector with those found
+  * for the candidates returned by a DetectorBVH, for every detector shape.
+  * Return the number of hits which are missing from the candidates.
+  */
+size_t validateBVH(RandomEngine &rng_){
+	std::vector<Primitive*> detectors;
+	buildCullingShapes(detectors);
+	DetectorBVH tree(detectors);
+
+	std::vector<Vector3> rays;
+	generateRays(rng_, 0.8, rays);
+
+	Vector3 P1, norm;
+	double t1, t2;
+	size_t nMissing = 0;
+	std::vector<BVHCandidate> candidates;
+	for(unsigned int i = 0; i < nInputs; i++){
+		Vector3 origin(frand(rng_, -0.01, 0.01), frand(rng_, -0.01, 0.01), 0.0);
+		tree.GetCandidates(origin, rays[i], candidates);
+		for(std::vector<Primitive*>::iterator iter = detectors.begin(); iter != detectors.end(); iter++){
+			if(!(*iter)->IntersectPrimitive(origin, rays[i], P1, norm, t1, t2)){ continue; }
+			bool found = false;
+			for(std::vector<BVHCandidate>::iterator cand = candidates.begin(); cand != candidates.end() && !found; cand++){
+				found = (cand->prim == (*iter));
+			}
+			if(!found){ nMissing++; }
+		}
+	}
+
+	for(std::vector<Primitive*>::iterator iter = detectors.begin(); iter != detectors.end(); iter++){ delete (*iter); }
+	return nMissing;
+}
+
+/** Compare the hits found by tracing every detector in a DetectorStore with those found when only the
+  * candidates listed by an AngularGrid are traced, for every detector shape and rays from random points
+  * in a 2 cm beam spot.
+  * Return the number of hits which are missing when using the grid.
+  */
+size_t validateGrid(RandomEngine &rng_){
+	std::vector<Primitive*> detectors;
+	buildCullingShapes(detectors);
+	DetectorStore store(detectors);
+	AngularGrid grid(detectors, Vector3(0.0, 0.0, 0.0), 0.015);
+
+	std::vector<Vector3> rays;
+	generateRays(rng_, 0.8, rays);
+
+	const unsigned int *cell;
+	size_t count;
+	size_t nMissing = 0;
+	std::vector<unsigned int> slots;
+	std::vector<DetectorHit> hitsAll, hitsGrid;
+	for(unsigned int i = 0; i < nInputs; i++){
+		Vector3 origin(frand(rng_, -0.01, 0.01), frand(rng_, -0.01, 0.01), 0.0);
+		hitsAll.clear();
+		hitsGrid.clear();
+		slots.clear();
+		store.Trace(origin, rays[i], hitsAll);
+		if(grid.GetCandidates(origin, rays[i], cell, count)){
+			for(size_t j = 0; j < count; j++){ slots.push_back(store.GetSlot(cell[j])); }
+			std::sort(slots.begin(), slots.end());
+			store.Trace(origin, rays[i], slots, hitsGrid);
+		}
+		for(std::vector<DetectorHit>::iterator iter = hitsAll.begin(); iter != hitsAll.end(); iter++){
+			bool found = false;
+			for(std::vector<DetectorHit>::iterator hit = hitsGrid.begin(); hit != hitsGrid.end() && !found; hit++){
+				found = (hit->index == iter->index);
+			}
+			if(!found){ nMissing++; }
+		}
+	}
+
+	for(std::vector<Primitive*>::iterator iter = detectors.begin(); iter != detectors.end(); iter++){ delete (*iter); }
+	return nMissing;
+}
+
+/// Time intersecting each ray with a wall of bars using an AngularGrid to select the bars passed to a DetectorStore.
+benchResult benchWallGrid(const unsigned int &nBars_, const std::vector<Vector3> &rays_, const unsigned int &ops_){
+	std::vector<Primitive*> bars;
+	buildWall(nBars_, bars);
+	DetectorStore store(bars);
+
+	Vector3 origin(0.0, 0.0, 0.0);
+	AngularGrid grid(bars, origin, 0.001);
+
+	const unsigned int *cell;
+	size_t count;
+	std::vector<unsigned int> slots;
+	std::vector<DetectorHit> hits;
+	double checksum = 0.0;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for(unsigned int i = 0; i < ops_; i++){
+		hits.clear();
+		slots.clear();
+		grid.GetCandidates(origin, rays_[i & (nInputs-1)], cell, count);
+		for(size_t j = 0; j < count; j++){ slots.push_back(store.GetSlot(cell[j])); }
+		std::sort(slots.begin(), slots.end());
+		store.Intersect(origin, rays_[i & (nInputs-1)], slots, hits);
+		for(std::vector<DetectorHit>::iterator iter = hits.begin(); iter != hits.end(); iter++){ checksum += iter->t1; }
+	}
+	double seconds = elapsed(start);
+
+	for(std::vector<Primitive*>::iterator iter = bars.begin(); iter != bars.end(); iter++){ delete (*iter); }
+	return benchResult("Wall of "+std::to_string(nBars_)+" bars (angular grid)", ops_, seconds, checksum);
+}
+
+/// Time intersecting each ray with a wall of bars using a DetectorBVH, with or without storing the wall as a DetectorArray.
+benchResult benchWallTree(const unsigned int &nBars_, const std::vector<Vector3> &rays_, const bool &useArray_, const unsigned int &ops_){
+	std::vector<NewVIKARdet> entries(1, NewVIKARdet("0 0 1 0 0 0 eject wall 0.6 0.03 0.03 none "+std::to_string(nBars_)+" 0"));
+	std::vector<Primitive*> bars;
+	std::vector<DetectorArray*> arrays;
+	BuildDetectors(entries, bars, &arrays);
+	for(std::vector<Primitive*>::iterator iter = bars.begin(); iter != bars.end(); iter++){ (*iter)->Freeze(); }
+	DetectorBVH tree(bars, (useArray_ ? arrays : std::vector<DetectorArray*>()));
+
+	Vector3 origin(0.0, 0.0, 0.0);
+	Vector3 P1, norm;
+	double t1, t2;
+	std::vector<BVHCandidate> candidates;
+	double checksum = 0.0;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for(unsigned int i = 0; i < ops_; i++){
+		tree.GetCandidates(origin, rays_[i & (nInputs-1)], candidates);
+		for(std::vector<BVHCandidate>::iterator iter = candidates.begin(); iter != candidates.end(); iter++){
+			if(iter->prim->IntersectPrimitive(origin, rays_[i & (nInputs-1)], P1, norm, t1, t2)){ checksum += t1; }
+		}
+	}
+	double seconds = elapsed(start);
+
+	for(std::vector<Primitive*>::iterator iter = bars.begin(); iter != bars.end(); iter++){ delete (*iter); }
+	for(std::vector<DetectorArray*>::iterator iter = arrays.begin(); iter != arrays.end(); iter++){ delete (*iter); }
+	return benchResult("Wall of "+std::to_string(nBars_)+" bars ("+(useArray_ ? "tree of arrays" : "tree")+")", ops_, seconds, checksum);
+}
+
+/// Time testing batches of nInputs rays against a wall of bars using DetectorStore::IntersectAny.
+benchResult benchWallBatch(const unsigned int &nBars_, const std::vector<Vector3> &rays_, const unsigned int &ops_){
+	std::vector<Primitive*> bars;
+	buildWall(nBars_, bars);
+	DetectorStore store(bars);
+
+	Vector3 origin(0.0, 0.0, 0.0);
+	std::vector<unsigned char> hit;
+	double checksum = 0.0;
+	const unsigned int nBatches = (ops_+nInputs-1)/nInputs;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for(unsigned int i = 0; i < nBatches; i++){
+		checksum += store.IntersectAny(origin, rays_, hit);
+	}
+	double seconds = elapsed(start);
+
+	for(std::vector<Primitive*>::iterator iter = bars.begin(); iter != bars.end(); iter++){ delete (*iter); }
+	return benchResult("Wall of "+std::to_string(nBars_)+" bars (batch of rays)", nBatches*nInputs, seconds, checksum);
+}
+
+/// Time RangeTable::GetNewE for deuterons in CD2.
+benchResult benchGetNewE(Material &mat_, RandomEngine &rng_, const unsigned int &ops_){
+	RangeTable table;
+	table.Init(1000, 0.1, 50.0, 1, 2.0/mev2amu, &mat_);
+	double maxRange = table.GetRange(50.0);
+
+	std::vector<double> energies(nInputs), dists(nInputs);
+	for(unsigned int i = 0; i < nInputs; i++){
+		energies[i] = frand(rng_, 0.1, 50.0);
+		dists[i] = frand(rng_, 0.0, 0.1*maxRange);
+	}
+
+	double checksum = 0.0;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for(unsigned int i = 0; i < ops_; i++){
+		checksum += table.GetNewE(energies[i & (nInputs-1)], dists[i & (nInputs-1)]);
+	}
+	return benchResult("RangeTable::GetNewE", ops_, elapsed(start), checksum);
+}
+
+/// Time Material::StopPower for deuterons in CD2.
+benchResult benchStopPower(Material &mat_, RandomEngine &rng_, const unsigned int &ops_){
+	std::vector<double> energies(nInputs);
+	for(unsigned int i = 0; i < nInputs; i++){
+		energies[i] = frand(rng_, 0.1, 50.0);
+	}
+
+	double checksum = 0.0;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for(unsigned int i = 0; i < ops_; i++){
+		checksum += mat_.StopPower(energies[i & (nInputs-1)], 1, 2.0/mev2amu);
+	}
+	return benchResult("Material::StopPower", ops_, elapsed(start), checksum);
+}
+
+/// Time Kindeux::FillVars for the 9Be(d,n)10B reaction with isotropic angles.
+benchResult benchFillVars(RandomEngine &rng_, const unsigned int &ops_){
+	double exStates[2] = {0.0, 0.718};
+	Kindeux kind;
+	kind.Initialize(2.0, 9.0, 10.0, 1.0, 4.36, 2, exStates);
+	kind.SetRandomEngine(&rng_);
+
+	std::vector<double> energies(nInputs);
+	for(unsigned int i = 0; i < nInputs; i++){
+		energies[i] = frand(rng_, 9.0, 11.0);
+	}
+
+	reactData rdata;
+	Vector3 Ejectile, Recoil;
+	double checksum = 0.0;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for(unsigned int i = 0; i < ops_; i++){
+		rdata.Ereact = energies[i & (nInputs-1)];
+		if(kind.FillVars(rdata, Ejectile, Recoil)){ checksum += rdata.Eeject; }
+	}
+	return benchResult("Kindeux::FillVars", ops_, elapsed(start), checksum);
+}
+
+/// Time AngularDist::Sample for a forward peaked distribution.
+benchResult benchAngularDist(RandomEngine &rng_, const unsigned int &ops_){
+	const unsigned int nPoints = 181;
+	double angles[nPoints], xsections[nPoints];
+	for(unsigned int i = 0; i < nPoints; i++){
+		angles[i] = i*deg2rad;
+		xsections[i] = 10.0*std::exp(-angles[i]/0.5) + 1.0;
+	}
+	AngularDist dist;
+	dist.Initialize(nPoints, angles, xsections);
+
+	double checksum = 0.0;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for(unsigned int i = 0; i < ops_; i++){
+		checksum += dist.Sample(rng_);
+	}
+	return benchResult("AngularDist::Sample", ops_, elapsed(start), checksum);
+}
+
+/// Time rndgauss0.
+benchResult benchGauss(RandomEngine &rng_, const unsigned int &ops_){
+	double checksum = 0.0;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for(unsigned int i = 0; i < ops_; i++){
+		checksum += rndgauss0(rng_, 1.0);
+	}
+	return benchResult("rndgauss0", ops_, elapsed(start), checksum);
+}
+
+/// Time Target::GetInteractionDepth for a tilted target and a spread of beam trajectories.
+benchResult benchInteractionDepth(Material &mat_, RandomEngine &rng_, const unsigned int &ops_){
+	Target targ;
+	targ.SetDensity(mat_.GetDensity());
+	targ.SetThickness(5.0);
+	targ.SetAngle(30.0*deg2rad);
+	targ.GetPrimitive()->Freeze();
+
+	std::vector<Vector3> trajectories;
+	generateRays(rng_, 0.01, trajectories);
+
+	Vector3 offset(0.0, 0.0, -1.0);
+	Vector3 intersect, interact;
+	double checksum = 0.0;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for(unsigned int i = 0; i < ops_; i++){
+		checksum += targ.GetInteractionDepth(rng_, offset, trajectories[i & (nInputs-1)], intersect, interact);
+	}
+	return benchResult("Target::GetInteractionDepth", ops_, elapsed(start), checksum);
+}
+
+void help(char * prog_name_){
+	std::cout << "  SYNTAX: " << prog_name_ << " [ops] [output]\n";
+	std::cout << "   ops    | Number of operations to time for each benchmark (default=1000000).\n";
+	std::cout << "   output | Write the results to a CSV file with this name.\n";
+}
+
+int main(int argc, char* argv[]){
+	if(argc > 3){
+		std::cout << " Error: Invalid number of arguments to " << argv[0] << ". Expected at most 2, received " << argc-1 << ".\n";
+		help(argv[0]);
+		return 1;
+	}
+
+	unsigned int ops = (argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000);
+	if(ops == 0){
+		help(argv[0]);
+		return 1;
+	}
+
+	RandomEngine rng(benchSeed);
+
+	std::cout << " Using " << GetSimdName(GetSimdSupport()) << " slab method kernels.\n";
+
+	// All detectors are centered 1 m downstream along the +z axis, facing the origin.
+	// The rays fill a cone which is a little larger than the detectors, so that some miss.
+	std::vector<Vector3> rays;
+	generateRays(rng, 0.2, rays);
+
+	std::cout << " Single precision boxes differ from double precision for " << validateSinglePrecision(rng) << " rays.\n";
+
+	size_t nMissingTree = validateBVH(rng);
+	std::cout << " Detector tree candidates are missing " << nMissingTree << " hits.\n";
+	size_t nMissingGrid = validateGrid(rng);
+	std::cout << " Angular grid candidates are missing " << nMissingGrid << " hits.\n";
+
+	// Deuterated polyethylene, as used for the beam in the target.
+	Material mat("CD2", 1.06300, 6, 12.0107, 1, 1, 2.01588, 2);
+
+	std::vector<benchResult> results;
+	results.push_back(benchIntersect("Planar::IntersectPrimitive", "0 0 1 0 0 0 generic planar 0.3 0.3 0.03 none", rays, ops));
+	results.push_back(benchIntersect("Cylindrical::IntersectPrimitive", "0 0 1 0 0 1.5708 generic cylinder 0.05 0.3 0 none", rays, ops));
+	results.push_back(benchIntersect("Conical::IntersectPrimitive", "0 0 0.8 0 0 -1.5708 generic cone 0.3 0.3 0 none", rays, ops));
+	results.push_back(benchIntersect("Spherical::IntersectPrimitive", "0 0 1 0 0 0 generic sphere 0.3 0 0 none", rays, ops));
+	results.push_back(benchIntersect("Elliptical::IntersectPrimitive", "0 0 1 0 0 0 generic ellipse 0.15 0.1 0.03 none", rays, ops));
+	results.push_back(benchIntersect("Polygonal::IntersectPrimitive", "0 0 1 0 0 0 generic polygon 0.15 6 0.03 none", rays, ops));
+	results.push_back(benchIntersect("Annular::IntersectPrimitive", "0 0 1 0 0 0 generic annular 0.05 0.15 0.03 none", rays, ops));
+	results.push_back(benchMesh(8, rays, ops));
+	results.push_back(benchMesh(64, rays, ops));
+	results.push_back(benchWallPrimitives(64, rays, ops/64));
+	results.push_back(benchWallStore(64, rays, SIMD_SCALAR, false, ops/64));
+	results.push_back(benchWallStore(64, rays, SIMD_SSE2, false, ops/64));
+	results.push_back(benchWallStore(64, rays, SIMD_AVX2, false, ops/64));
+	results.push_back(benchWallStore(64, rays, SIMD_SCALAR, true, ops/64));
+	results.push_back(benchWallStore(64, rays, SIMD_SSE2, true, ops/64));
+	results.push_back(benchWallStore(64, rays, SIMD_AVX2, true, ops/64));
+	results.push_back(benchWallTree(64, rays, false, ops/64));
+	results.push_back(benchWallTree(64, rays, true, ops/64));
+	results.push_back(benchWallGrid(64, rays, ops/64));
+	results.push_back(benchWallBatch(64, rays, ops/64));
+	results.push_back(benchGetNewE(mat, rng, ops));
+	results.push_back(benchStopPower(mat, rng, ops));
+	results.push_back(benchFillVars(rng, ops));
+	results.push_back(benchAngularDist(rng, ops));
+	results.push_back(benchGauss(rng, ops));
+	results.push_back(benchInteractionDepth(mat, rng, ops));
+
+	std::cout << "\n  " << std::left << std::setw(36) << "Benchmark" << std::right << std::setw(12) << "ns/op" << std::setw(12) << "ops" << std::setw(16) << "checksum" << "\n";
+	for(std::vector<benchResult>::iterator iter = results.begin(); iter != results.end(); iter++){
+		std::cout << "  " << std::left << std::setw(36) << iter->name << std::right << std::fixed << std::setprecision(2) << std::setw(12) << iter->GetNsPerOp();
+		std::cout << std::setw(12) << iter->ops << std::scientific << std::setprecision(6) << std::setw(16) << iter->checksum << "\n";
+		std::cout.unsetf(std::ios_base::floatfield);
+	}
+
+	if(argc > 2){
+		std::ofstream output(argv[2]);
+		if(!output.good()){
+			std::cout << " Error: Failed to open output file \"" << argv[2] << "\"!\n";
+			return 1;
+		}
+		output << "benchmark,ns_per_op,ops,seconds,checksum\n";
+		output << std::setprecision(10);
+		for(std::vector<benchResult>::iterator iter = results.begin(); iter != results.end(); iter++){
+			output << iter->name << "," << iter->GetNsPerOp() << "," << iter->ops << "," << iter->seconds << "," << iter->checksum << "\n";
+		}
+		output.close();
+		std::cout << "\n  Wrote results to \"" << argv[2] << "\"\n";
+	}
+
+	return (nMissingTree+nMissingGrid > 0 ? 1 : 0);
+}
@@ -0,0 +1,72 @@
+/** \file acceptance.hpp
+ * \brief Ejectile detector acceptance map used for biased reaction sampling.
+ *
+ * The AcceptanceMap class stores which regions of ejectile center of mass
+ * angle and azimuthal angle send the ejectile toward at least one ejectile
+ * detector, for every recoil state and for a set of reaction energy bins.
+ * Reaction angles may then be sampled preferentially from the accepted
+ * regions. Every sampled reaction is given a statistical weight so that
+ * weighted histograms remain unbiased.
+ */
+#ifndef ACCEPTANCE_HPP
+#define ACCEPTANCE_HPP
+
+#include <vector>
+
+#include "geometry.hpp"
+
+class Kindeux;
+
+class AcceptanceMap{
+  public:
+	/** Map constructor. nTheta_ and nPhi_ are the number of bins used for the center of mass
+	  * angle and azimuthal angle of the ejectile, nEnergy_ is the number of reaction energy bins
+	  * and mixing_ is the fraction of reactions which are sampled without any bias.
+	  */
+	AcceptanceMap(const unsigned int &nTheta_=120, const unsigned int &nPhi_=120, const unsigned int &nEnergy_=6, const double &mixing_=0.02);
+
+	/// Return true if the map has been built and false otherwise.
+	bool IsInit() const { return init; }
+
+	/// Return the fraction of reactions which are sampled without any bias.
+	double GetMixing() const { return mixing; }
+
+	/// Return the fraction of angle bins for a recoil state which are accepted, averaged over all energy bins.
+	double GetAcceptedFraction(const unsigned int &state_) const;
+
+	/** Build the map for all recoil states of a kinematics object. A bin is accepted if an ejectile
+	  * emitted from origin_ in any part of the bin (or any neighbouring bin) intersects one of the
+	  * detectors. Emin_ and Emax_ are the range of reaction energies to map (MeV). Return false if
+	  * the map cannot be built.
+	  */
+	bool Build(Kindeux *kind_, const std::vector<Primitive*> &detectors_, const Vector3 &origin_, const double &Emin_, const double &Emax_);
+
+	/** Sample a point in the center of mass. Reaction energies outside of the mapped range are
+	  * sampled without bias. Return the statistical weight of the sampled point.
+	  * param[in] rng_ The random number engine to use.
+	  * param[in] state_ The recoil excitation state of the reaction.
+	  * param[in] Ereact_ The energy of the beam particle at the reaction point (MeV).
+	  * param[out] thetaFrac The cumulative fraction of the center of mass angle distribution, in [0, 1).
+	  * param[out] phiFrac The azimuthal angle of the ejectile as a fraction of 2*pi, in [0, 1).
+	  */
+	double Sample(RandomEngine &rng_, const unsigned int &state_, const double &Ereact_, double &thetaFrac, double &phiFrac) const;
+
+  private:
+	unsigned int nTheta; /// The number of center of mass angle bins.
+	unsigned int nPhi; /// The number of azimuthal angle bins.
+	unsigned int nEnergy; /// The number of reaction energy bins.
+	unsigned int nCells; /// The number of angle bins in each energy bin.
+	unsigned int nStates; /// The number of mapped recoil states.
+
+	double mixing; /// The fraction of reactions which are sampled without bias.
+	double Emin; /// The lower edge of the first energy bin (MeV).
+	double Emax; /// The upper edge of the last energy bin (MeV).
+	double Estep; /// The width of each energy bin (MeV).
+
+	bool init; /// Set to true when the map has been built.
+
+	std::vector<unsigned char> mask; /// Set to 1 for all accepted bins.
+	std::vector<std::vector<unsigned int> > cells; /// List of accepted angle bins for each state and energy bin.
+};
+
+#endif
@@ -0,0 +1,88 @@
+/** \file angularGrid.hpp
+ * \brief Angular lookup grid used to find the detectors which may be hit by rays from the target.
+ *
+ * The AngularGrid class divides the directions around a point (normally the target)
+ * into cells of equal size in theta and phi. Each cell stores the detectors whose
+ * angular footprint, as seen from anywhere inside a sphere around that point, overlaps
+ * the cell. The sphere should contain every point where a reaction may occur, so it is
+ * sized from the beam spot and the target thickness. The direction of a ray which starts
+ * inside the sphere then maps directly to a short list of candidate detectors, and rays
+ * which point at an empty cell are rejected without any intersection math. Rays which
+ * start outside the sphere must be tested some other way, for example with a DetectorBVH.
+ */
+#ifndef ANGULAR_GRID_HPP
+#define ANGULAR_GRID_HPP
+
+#include <vector>
+
+#include "geometry.hpp"
+
+/////////////////////////////////////////////////////////////////////
+// AngularGrid
+/////////////////////////////////////////////////////////////////////
+
+class AngularGrid{
+  public:
+	/// Default constructor.
+	AngularGrid(){ Clear(); }
+
+	/// Constructor which builds the grid for a list of detectors.
+	AngularGrid(const std::vector<Primitive*> &detectors_, const Vector3 &center_, const double &radius_, const unsigned int &nTheta_=180, const unsigned int &nPhi_=360);
+
+	/// Return the number of detectors in the grid.
+	size_t GetNumPrimitives() const { return numDetectors; }
+
+	/// Return the total number of cells in the grid.
+	size_t GetNumCells() const { return nTheta*nPhi; }
+
+	/// Return the number of cells which do not contain any detectors.
+	size_t GetNumEmptyCells() const;
+
+	/// Return the average number of detectors listed in each cell.
+	double GetMeanCellSize() const { return (nTheta*nPhi > 0 ? (double)cellItems.size()/(nTheta*nPhi) : 0.0); }
+
+	/// Return the center of the region for which the grid was built.
+	const Vector3 &GetCenter() const { return center; }
+
+	/// Return the radius of the region for which the grid was built (in m).
+	double GetRadius() const { return radius; }
+
+	/// Return true if the grid contains no detectors.
+	bool Empty() const { return (numDetectors == 0); }
+
+	/// Return true if a ray starting at origin_ may be looked up in the grid.
+	bool Contains(const Vector3 &origin_) const { return (numDetectors > 0 && (origin_-center).Square() <= radius*radius); }
+
+	/** Build the grid for a list of detectors, for rays which start within radius_ (in m) of center_.
+	  * The directions are divided into nTheta_ cells in theta and nPhi_ cells in phi. The detectors
+	  * are not owned by the grid, and the grid must be rebuilt if any of them are moved, rotated or resized.
+	  */
+	void Build(const std::vector<Primitive*> &detectors_, const Vector3 &center_, const double &radius_, const unsigned int &nTheta_=180, const unsigned int &nPhi_=360);
+
+	/// Remove all detectors from the grid.
+	void Clear();
+
+	/** Find the detectors which may be hit by the ray (origin_ + t * direction_) for t >= 0. On success, candidates
+	  * points to count indices into the list used to build the grid, in ascending order. The list contains every
+	  * detector which the ray crosses, but the ray may miss some of them. Return false if the ray origin lies outside
+	  * the region for which the grid was built, in which case the detectors must be tested some other way.
+	  */
+	bool GetCandidates(const Vector3 &origin_, const Vector3 &direction_, const unsigned int *&candidates, size_t &count) const;
+
+  private:
+	Vector3 center; /// The center of the region for which the grid was built.
+	double radius; /// The radius of the region for which the grid was built (in m).
+	unsigned int nTheta; /// The number of cells in theta.
+	unsigned int nPhi; /// The number of cells in phi.
+	double thetaStep; /// The size of each cell in theta (rad).
+	double phiStep; /// The size of each cell in phi (rad).
+	size_t numDetectors; /// The number of detectors used to build the grid.
+
+	std::vector<unsigned int> cellStart; /// The first entry of each cell in cellItems, plus one past the end of the last cell.
+	std::vector<unsigned int> cellItems; /// The detector indices listed in every cell, one cell after another.
+
+	/// Return the cell which contains a direction, which must not be the zero vector.
+	unsigned int _getCell(const Vector3 &direction_) const;
+};
+
+#endif
@@ -0,0 +1,154 @@
+/** \file bvh.hpp
+ * \brief Bounding volume hierarchy used to accelerate ray queries on detectors.
+ *
+ * The DetectorBVH class stores a binary tree of axis-aligned bounding boxes
+ * built around a list of detector Primitives. A ray query returns only those
+ * detectors whose bounding box is crossed by the ray, ordered by the distance
+ * at which the ray enters each box. Each candidate must still be tested with
+ * Primitive::IntersectPrimitive, since a bounding box is always larger than
+ * the detector it contains. Regular arrays of bars (see DetectorArray) are
+ * stored in the tree as a single leaf, and the bars which a ray may cross
+ * are found directly from the layout of the array instead of testing the
+ * bounding box of every bar.
+ */
+#ifndef BVH_HPP
+#define BVH_HPP
+
+#include <vector>
+
+#include "geometry.hpp"
+
+class DetectorArray;
+
+/////////////////////////////////////////////////////////////////////
+// BoundingBox
+/////////////////////////////////////////////////////////////////////
+
+class BoundingBox{
+  public:
+	Vector3 lower; /// The corner of the box with the smallest coordinates (in m).
+	Vector3 upper; /// The corner of the box with the largest coordinates (in m).
+
+	/// Default constructor. The box is empty until it is extended.
+	BoundingBox();
+
+	/// Constructor using the two corners of the box.
+	BoundingBox(const Vector3 &lower_, const Vector3 &upper_) : lower(lower_), upper(upper_) { }
+
+	/// Return true if the box does not contain any points.
+	bool Empty() const { return (lower.axis[0] > upper.axis[0]); }
+
+	/// Return the center of the box.
+	Vector3 GetCenter() const { return (lower + upper)*0.5; }
+
+	/// Grow the box so that it contains a point.
+	void Extend(const Vector3 &point_);
+
+	/// Grow the box so that it contains another box.
+	void Extend(const BoundingBox &box_);
+
+	/// Grow the box by a distance dist_ (in m) in every direction.
+	void Pad(const double &dist_);
+
+	/** Find the range of the ray (offset_ + t * direction_) which lies inside the box, for t >= 0.
+	  * invDirection_ is the inverse of each component of the ray direction, which may be infinite.
+	  * tEntry and tExit are the values of t at which the ray enters and leaves the box.
+	  * Return true if the ray crosses the box and false otherwise.
+	  */
+	bool Intersect(const Vector3 &offset_, const Vector3 &invDirection_, double &tEntry, double &tExit) const;
+};
+
+/////////////////////////////////////////////////////////////////////
+// BVHCandidate
+/////////////////////////////////////////////////////////////////////
+
+struct BVHCandidate{
+	Primitive *prim; /// The detector whose bounding box was crossed.
+	unsigned int index; /// The index of the detector in the list used to build the tree.
+	double tEntry; /// The ray parameter at which the ray enters the bounding box.
+
+	BVHCandidate() : prim(NULL), index(0), tEntry(0.0) { }
+
+	BVHCandidate(Primitive *prim_, const unsigned int &index_, const double &tEntry_) : prim(prim_), index(index_), tEntry(tEntry_) { }
+};
+
+/////////////////////////////////////////////////////////////////////
+// DetectorBVH
+/////////////////////////////////////////////////////////////////////
+
+class DetectorBVH{
+  public:
+	/// Default constructor.
+	DetectorBVH() : maxLeafSize(2), numDetectors(0), numArrays(0) { }
+
+	/// Constructor which builds the tree for a list of detectors.
+	DetectorBVH(const std::vector<Primitive*> &detectors_, const unsigned int &maxLeafSize_=2);
+
+	/// Constructor which builds the tree for a list of detectors, some of which may belong to arrays.
+	DetectorBVH(const std::vector<Primitive*> &detectors_, const std::vector<DetectorArray*> &arrays_, const unsigned int &maxLeafSize_=2);
+
+	/// Return the number of detectors in the tree.
+	size_t GetNumPrimitives() const { return numDetectors; }
+
+	/// Return the number of detector arrays stored as a single leaf of the tree.
+	size_t GetNumArrays() const { return numArrays; }
+
+	/// Return the number of nodes in the tree.
+	size_t GetNumNodes() const { return nodes.size(); }
+
+	/// Return true if the tree contains no detectors.
+	bool Empty() const { return (numDetectors == 0); }
+
+	/** Build the tree for a list of detectors. The detectors are not owned by the tree, and the
+	  * tree must be rebuilt if any of them are moved, rotated or resized.
+	  */
+	void Build(const std::vector<Primitive*> &detectors_);
+
+	/** Build the tree for a list of detectors, some of which may belong to arrays. Each array whose
+	  * bars are all in the list is stored as a single leaf, and all other arrays are ignored. Neither
+	  * the detectors nor the arrays are owned by the tree.
+	  */
+	void Build(const std::vector<Primitive*> &detectors_, const std::vector<DetectorArray*> &arrays_);
+
+	/// Remove all detectors from the tree.
+	void Clear();
+
+	/** Find all detectors whose bounding box is crossed by the ray (offset_ + t * direction_) for t >= 0.
+	  * The candidates are sorted by the ray parameter at which the ray enters each bounding box.
+	  * The candidates vector is cleared before searching. Return the number of candidates found.
+	  */
+	size_t GetCandidates(const Vector3 &offset_, const Vector3 &direction_, std::vector<BVHCandidate> &candidates) const;
+
+	/** Find the closest detector which is intersected by the ray (offset_ + t * direction_).
+	  * P1, norm, t1 and t2 are the same as for Primitive::IntersectPrimitive, for the detector found.
+	  * Return a pointer to the detector, or NULL if no detector is intersected.
+	  */
+	Primitive *GetClosest(const Vector3 &offset_, const Vector3 &direction_, Vector3 &P1, Vector3 &norm, double &t1, double &t2) const;
+
+  private:
+	struct node{
+		BoundingBox box; /// Bounding box of all detectors below this node.
+		unsigned int first; /// Index of the first detector (leaf) or the left child node (branch).
+		unsigned int count; /// The number of detectors in a leaf node, or zero for a branch node.
+	};
+
+	unsigned int maxLeafSize; /// The largest number of detectors stored in a leaf node.
+
+	size_t numDetectors; /// The number of detectors in the tree.
+	size_t numArrays; /// The number of arrays stored as a single leaf.
+
+	std::vector<node> nodes; /// Nodes of the tree. The root node is stored first.
+	std::vector<Primitive*> prims; /// Detectors and arrays ordered so that each leaf stores a contiguous range.
+	std::vector<unsigned int> indices; /// The index of each detector in the list used to build the tree, or the position of the first bar of each array in barPrims.
+	std::vector<BoundingBox> boxes; /// The bounding box of each detector or array.
+	std::vector<DetectorArray*> arrays; /// The array stored at each position, or NULL for a single detector.
+
+	std::vector<Primitive*> barPrims; /// The bars of every array, one array after another.
+	std::vector<unsigned int> barIndices; /// The index of each bar in the list used to build the tree.
+	std::vector<BoundingBox> barBoxes; /// The bounding box of each bar.
+
+	/// Recursively split the detectors in the range [first_, last_) and fill node nodeIndex_.
+	void _build(const unsigned int &nodeIndex_, const unsigned int &first_, const unsigned int &last_, std::vector<Vector3> &centers_);
+};
+
+#endif
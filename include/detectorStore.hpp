@@ -0,0 +1,203 @@
+/** \file detectorStore.hpp
+ * \brief Compiled, structure-of-arrays copy of a list of detectors used for ray tracing.
+ *
+ * The DetectorStore class is built once from a list of frozen detector Primitives.
+ * Detectors are grouped by shape (box, cylinder and sphere) and the position, local
+ * axes, half extents and role flags of each group are stored in contiguous arrays.
+ * Each group is intersected by its own non-virtual kernel, so tracing a ray does not
+ * chase pointers or make a virtual call per detector. Boxes use the vectorised slab
+ * method kernels in slabKernel.hpp. Shapes without a kernel (cones,
+ * ellipses, polygons and annuli) are kept in a generic group which falls back to
+ * Primitive::IntersectPrimitive. The Primitive classes remain the authoring interface,
+ * and the store must be rebuilt if any of its detectors are moved, rotated or resized.
+ *
+ * The store also keeps a single precision copy of the boxes, slightly enlarged so that
+ * each float box always contains the real one. In single precision mode (see
+ * SetSinglePrecision) rays are first clipped against the float boxes, which tests
+ * twice as many boxes per vector register, and only the boxes which pass are clipped
+ * again in double precision. The hits are therefore exactly the same in both modes.
+ * Building with USE_FLOAT_GEOMETRY makes single precision mode the default.
+ */
+#ifndef DETECTOR_STORE_HPP
+#define DETECTOR_STORE_HPP
+
+#include <vector>
+
+#include "geometry.hpp"
+
+template <typename T> struct SlabBoxesT;
+typedef SlabBoxesT<double> SlabBoxes;
+typedef SlabBoxesT<float> SlabBoxesF;
+
+/// Role flags stored for each detector.
+enum DetectorRole {DETECTOR_RECOIL=1, DETECTOR_EJECTILE=2, DETECTOR_GAMMA=4, DETECTOR_VETO=8};
+
+/// Default precision used by the detector store to select the boxes which may be hit (see DetectorStore::SetSinglePrecision).
+#ifdef USE_FLOAT_GEOMETRY
+const bool defaultSinglePrecision = true;
+#else
+const bool defaultSinglePrecision = false;
+#endif
+
+/// Shape groups used by the detector store, in the order in which they are stored.
+enum DetectorShape {SHAPE_BOX=0, SHAPE_CYLINDER=1, SHAPE_SPHERE=2, SHAPE_GENERIC=3, SHAPE_COUNT=4};
+
+/////////////////////////////////////////////////////////////////////
+// DetectorHit
+/////////////////////////////////////////////////////////////////////
+
+struct DetectorHit{
+	Primitive *prim; /// The detector which was hit.
+	unsigned int index; /// The index of the detector in the list used to build the store.
+	unsigned int flags; /// The role flags of the detector (see DetectorRole).
+	double t1; /// The ray parameter of the first intersection point in front of the ray origin.
+	double t2; /// The ray parameter of the second intersection point. Negative if the ray starts inside the detector.
+	Vector3 P1; /// The first intersection point in global coordinates (in m).
+
+	DetectorHit() : prim(NULL), index(0), flags(0), t1(0.0), t2(0.0) { }
+
+	/// Return the ray parameter at which the ray enters the detector, or zero if the ray starts inside it.
+	double GetEntry() const { return (t2 < 0.0 ? 0.0 : t1); }
+
+	/// Return the ray parameter at which the ray leaves the detector.
+	double GetExit() const { return (t2 < 0.0 ? t1 : t2); }
+
+	/// Return true if this hit is entered before rhs along the ray. Hits entered at the same point are ordered by index.
+	bool EntersBefore(const DetectorHit &rhs) const { return (GetEntry() < rhs.GetEntry() || (GetEntry() == rhs.GetEntry() && index < rhs.index)); }
+};
+
+/////////////////////////////////////////////////////////////////////
+// DetectorStore
+/////////////////////////////////////////////////////////////////////
+
+class DetectorStore{
+  public:
+	/// Default constructor.
+	DetectorStore() : singlePrecision(defaultSinglePrecision) { Clear(); }
+
+	/// Constructor which builds the store for a list of detectors.
+	DetectorStore(const std::vector<Primitive*> &detectors_);
+
+	/// Return the number of detectors in the store.
+	size_t GetNumPrimitives() const { return slots.size(); }
+
+	/// Return the number of detectors in one of the shape groups.
+	size_t GetNumPrimitives(const DetectorShape &shape_) const { return groupStart[shape_+1]-groupStart[shape_]; }
+
+	/// Return true if the store contains no detectors.
+	bool Empty() const { return slots.empty(); }
+
+	/// Return true if boxes are selected with the single precision slab kernels.
+	bool GetSinglePrecision() const { return singlePrecision; }
+
+	/** Select whether boxes are first tested with the single precision slab kernels, and only
+	  * the boxes which may be hit are tested again in double precision. This does not change the
+	  * hits which are found, only the speed at which they are found.
+	  */
+	void SetSinglePrecision(const bool &state_=true){ singlePrecision = state_; }
+
+	/// Return the store slot of the detector at index_ in the list used to build the store.
+	unsigned int GetSlot(const unsigned int &index_) const { return slots[index_]; }
+
+	/** Build the store for a list of frozen detectors. The detectors are not owned by the store,
+	  * and the store must be rebuilt if any of them are moved, rotated or resized.
+	  */
+	void Build(const std::vector<Primitive*> &detectors_);
+
+	/// Remove all detectors from the store.
+	void Clear();
+
+	/** Intersect the ray (offset_ + t * direction_) with every detector whose role
+	  * flags match mask_, or with every detector if mask_ is zero.
+	  * Hits are appended to the hits vector grouped by shape, and not in detector list order.
+	  * Return the number of hits added.
+	  */
+	size_t Intersect(const Vector3 &offset_, const Vector3 &direction_, std::vector<DetectorHit> &hits, const unsigned int &mask_=0) const;
+
+	/** Intersect the ray (offset_ + t * direction_) with a subset of the detectors, given by their store
+	  * slots (see GetSlot). The slots must be sorted in ascending order so that each shape group is
+	  * processed in one batch. Hits are appended to the hits vector in slot order.
+	  * Return the number of hits added.
+	  */
+	size_t Intersect(const Vector3 &offset_, const Vector3 &direction_, const std::vector<unsigned int> &slots_, std::vector<DetectorHit> &hits, const unsigned int &mask_=0) const;
+
+	/** Trace the ray (offset_ + t * direction_) through every detector whose role flags match mask_,
+	  * or through every detector if mask_ is zero. Hits are appended to the hits vector in the order
+	  * in which the ray enters the detectors (see DetectorHit::EntersBefore).
+	  * Return the number of hits added.
+	  */
+	size_t Trace(const Vector3 &offset_, const Vector3 &direction_, std::vector<DetectorHit> &hits, const unsigned int &mask_=0) const;
+
+	/** Trace the ray (offset_ + t * direction_) through a subset of the detectors, given by their sorted
+	  * store slots (see GetSlot), in a single pass over all shape groups. Hits are appended to the hits
+	  * vector in the order in which the ray enters the detectors (see DetectorHit::EntersBefore).
+	  * Return the number of hits added.
+	  */
+	size_t Trace(const Vector3 &offset_, const Vector3 &direction_, const std::vector<unsigned int> &slots_, std::vector<DetectorHit> &hits, const unsigned int &mask_=0) const;
+
+	/** Test rays from a common origin_ against every detector. hit[i] is set to 1 if the ray along
+	  * directions_[i] crosses at least one detector and to 0 otherwise. Boxes are tested against many
+	  * rays at a time by the vectorised slab method kernel. None of the directions may be the zero vector.
+	  * Return the number of rays which hit a detector.
+	  */
+	size_t IntersectAny(const Vector3 &origin_, const std::vector<Vector3> &directions_, std::vector<unsigned char> &hit) const;
+
+  private:
+	struct ray{
+		Vector3 offset; /// The point where the ray originates wrt the global origin (in m).
+		Vector3 direction; /// The direction of the ray wrt the global origin.
+	};
+
+	// Per-detector data, in store slot order. Each shape group occupies a contiguous range of slots.
+	std::vector<Primitive*> prims; /// The detector in each slot.
+	std::vector<unsigned int> indices; /// The index of each slot in the list used to build the store.
+	std::vector<unsigned int> flags; /// The role flags of each slot.
+	std::vector<double> posX, posY, posZ; /// Center of each detector (in m).
+	std::vector<double> xAxisX, xAxisY, xAxisZ; /// Local x axis of each detector.
+	std::vector<double> yAxisX, yAxisY, yAxisZ; /// Local y axis of each detector.
+	std::vector<double> zAxisX, zAxisY, zAxisZ; /// Local z axis of each detector.
+	std::vector<double> halfX, halfY, halfZ; /// Half of the size of each detector along its local axes (in m).
+	std::vector<double> radius2; /// Squared radius of each cylinder or sphere (in m^2).
+	std::vector<float> boxData; /// Single precision copy of the position, axes and padded half sizes of each detector, one array after another.
+
+	bool singlePrecision; /// Set to true if boxes are selected with the single precision slab kernels.
+
+	std::vector<unsigned int> slots; /// The store slot of each detector in the list used to build the store.
+	std::vector<unsigned int> allSlots; /// Every store slot, in ascending order.
+	unsigned int groupStart[SHAPE_COUNT+1]; /// The first slot of each shape group.
+
+	/// Return pointers to the arrays of all detectors, for use by the slab method kernels.
+	SlabBoxes _getBoxes() const;
+
+	/// Return pointers to the single precision arrays of all detectors, for use by the slab method kernels.
+	SlabBoxesF _getBoxesF() const;
+
+	/// Fill the single precision copy of the detector arrays.
+	void _buildSinglePrecision();
+
+	/// Append one detector to the end of the store arrays.
+	void _add(Primitive *prim_, const unsigned int &index_);
+
+	/// Fill a hit for the detector in slot_ and append it to the hits vector.
+	void _addHit(const ray &ray_, const unsigned int &slot_, const double &t1_, const double &t2_, std::vector<DetectorHit> &hits) const;
+
+	/// Clip a ray against at most kernelChunk boxes, given by their slots, in double precision and add the hits.
+	void _clipBoxes(const ray &ray_, const unsigned int *slots_, const size_t &count_, const unsigned int &mask_, std::vector<DetectorHit> &hits) const;
+
+	/// Intersect a ray with count_ boxes, given by their slots, using the slab method.
+	void _intersectBoxes(const ray &ray_, const unsigned int *slots_, const size_t &count_, const unsigned int &mask_, std::vector<DetectorHit> &hits) const;
+
+	/// Intersect a ray with count_ capped cylinders, given by their slots.
+	void _intersectCylinders(const ray &ray_, const unsigned int *slots_, const size_t &count_, const unsigned int &mask_, std::vector<DetectorHit> &hits) const;
+
+	/// Intersect a ray with count_ spheres, given by their slots.
+	void _intersectSpheres(const ray &ray_, const unsigned int *slots_, const size_t &count_, const unsigned int &mask_, std::vector<DetectorHit> &hits) const;
+
+	/// Intersect a ray with count_ detectors of any shape, given by their slots, using Primitive::IntersectPrimitive.
+	void _intersectGeneric(const ray &ray_, const unsigned int *slots_, const size_t &count_, const unsigned int &mask_, std::vector<DetectorHit> &hits) const;
+
+	/// Intersect a ray with a sorted list of slots, dispatching each run of slots to the kernel of its shape group.
+	void _intersect(const ray &ray_, const unsigned int *slots_, const size_t &count_, const unsigned int &mask_, std::vector<DetectorHit> &hits) const;
+};
+
+#endif
@@ -11,6 +11,7 @@
 #define DETECTORS_H
 
 #include <string>
+#include <vector>
 
 #include "geometry.hpp"
 
@@ -19,10 +20,11 @@
 /////////////////////////////////////////////////////////////////////
 
 struct NewVIKARdet{
-	float data[9];
+	float data[12];
 	std::string type;
 	std::string subtype;
 	std::string material;
+	std::string filename; /// The mesh file used by mesh detectors.
 	unsigned int location;
 	
 	NewVIKARdet();
@@ -34,41 +36,97 @@ struct NewVIKARdet{
 	std::string DumpDet();
 };
 
+/////////////////////////////////////////////////////////////////////
+// DetectorArray
+/////////////////////////////////////////////////////////////////////
+
+/// The largest number of bar ranges returned by DetectorArray::GetBarRanges.
+const unsigned int maxBarRanges = 4;
+
+/** A regular array of bars built from a single detector file entry. Each bar is a separate
+  * Planar detector owned by the list of detectors it is added to, and the array only keeps
+  * pointers to its bars. The geometry of the array itself is a box which contains all of
+  * its bars, so a ray which misses the box cannot hit any of them, and the regular layout
+  * of the bars gives the bars which a ray may hit without testing each of them.
+  */
+class DetectorArray : public Primitive {
+  protected:
+	std::vector<Primitive*> bars; /// The bars in the array (not owned).
+
+  public:
+	/// Default constructor.
+	DetectorArray() : Primitive() { }
+
+	/// Constructor using a NewVIKARdet object.
+	DetectorArray(NewVIKARdet *det_) : Primitive(det_) { }
+
+	/// Destructor. The bars are not deleted.
+	virtual ~DetectorArray(){ }
+
+	/// Return the number of bars in the array.
+	unsigned int GetNumBars() const { return bars.size(); }
+
+	/** Return a pointer to a bar in this array
+	  * Return null if the bar does not exist.
+	  */
+	Primitive *GetBar(const unsigned int &bar_) const { return (bar_ < bars.size() ? bars[bar_] : NULL); }
+
+	/// Return the bars in the array.
+	const std::vector<Primitive*> &GetBars() const { return bars; }
+
+	/** Build the bars of the array from its detector file entry and append them to a list of detectors,
+	  * which takes ownership of them. Return the number of bars added.
+	  */
+	virtual unsigned int AddBars(const NewVIKARdet &det_, std::vector<Primitive*> &detectors) = 0;
+
+	/** Find the bars which may be crossed by the ray (offset_ + t * direction_) for t >= 0.
+	  * Range i covers count[i] bars starting with bar first[i]. Both arrays must hold at least
+	  * maxBarRanges entries. The ranges are sorted and do not overlap. Every bar crossed by
+	  * the ray lies in one of the ranges. Return the number of ranges found.
+	  */
+	virtual unsigned int GetBarRanges(const Vector3 &offset_, const Vector3 &direction_, unsigned int *first, unsigned int *count) const = 0;
+};
+
 /////////////////////////////////////////////////////////////////////
 // Wall
 /////////////////////////////////////////////////////////////////////
 
-class Wall: public Primitive{
-    private:
-	unsigned int num_bars; /// The number of bars in the array wall.
-	Primitive *bars; /// The array of detectors in the wall.
-	bool init; /// True if the wall has been initialized.
-	
-    public:
-    /// Default constructor.
-	Wall(){ bars = NULL; init = false; num_bars = 0; }
-	
-	/// Destructor.
-	~Wall(){ if(init){ delete[] bars; } }
-	
-	/** Initialize the wall object.
-	  * Spacing is the physical distance between the edges of bars.
+/** A flat wall of identical bars placed side by side along the local x axis of the wall.
+  * Detector file format:
+  * X(m) Y(m) Z(m) Theta(rad) Phi(rad) Psi(rad) Type wall Length(m) Width(m) Depth(m) Material Nbars Spacing(m).
+  * Length, Width and Depth are the size of each bar and Spacing is the gap between the edges of neighbouring bars.
+  */
+class Wall : public DetectorArray {
+  private:
+	double spacing; /// The physical distance between the edges of neighbouring bars (m).
+	double barWidth; /// The width of each bar along the local x axis (m).
+
+  public:
+	/// Default constructor.
+	Wall() : DetectorArray(), spacing(0.0), barWidth(0.0) { }
+
+	/// Constructor using a NewVIKARdet object.
+	Wall(NewVIKARdet *det_) : DetectorArray(det_), spacing(0.0), barWidth(0.0) { }
+
+	/// Return the distance between the edges of neighbouring bars (m).
+	double GetSpacing() const { return spacing; }
+
+	/// Return the distance between the centers of neighbouring bars (m).
+	double GetPitch() const { return barWidth + spacing; }
+
+	/** Build the bars of the wall and append them to a list of detectors.
 	  * This method leaves a distance of spacing/2 on each side of the wall
 	  * so that walls having the same bar spacing will align properly.
+	  * Return the number of bars added.
 	  */
-	void Initialize(unsigned int, double, double, double, double);
-	
-	/// Return the total number of detectors.
-	unsigned int GetNumBars(){ return num_bars; }
-	
-	/** Return a pointer to a bar in this wall
-	  * Return null if the bar does not exist.
+	unsigned int AddBars(const NewVIKARdet &det_, std::vector<Primitive*> &detectors);
+
+	/** Find the bars which may be crossed by the ray (offset_ + t * direction_) for t >= 0. The ray is clipped
+	  * against the box of the wall, and the bars are found directly from the local x coordinates at which the
+	  * ray enters and leaves the box. Return the number of ranges found (zero or one).
 	  */
-	Primitive *GetBar(unsigned int);
-	
-	/// Return a pointer to the array of Primitive detectors.
-	Primitive *GetBars(){ return bars; }
-	
+	unsigned int GetBarRanges(const Vector3 &offset_, const Vector3 &direction_, unsigned int *first, unsigned int *count) const;
+
 	/// Test the Primitive wall class.
 	void WallTest();
 	
@@ -78,6 +136,51 @@ class Wall: public Primitive{
 	std::string DumpDetWall();
 };
 
+/////////////////////////////////////////////////////////////////////
+// Ring
+/////////////////////////////////////////////////////////////////////
+
+/** A ring of identical bars around an axis parallel to the global y axis. Bar i is centered at an angle
+  * Theta + i*Step (measured from the +z axis towards the +x axis) and is rotated by (Theta + i*Step, Phi, Psi),
+  * so bars with Phi = Psi = 0 face the axis of the ring. Detector file format:
+  * X(m) Y(m) Z(m) Theta(rad) Phi(rad) Psi(rad) Type ring Length(m) Width(m) Depth(m) Material Nbars Radius(m) Step(rad).
+  * X, Y and Z are the center of the ring, and Length, Width and Depth are the size of each bar.
+  */
+class Ring : public DetectorArray {
+  private:
+	double radius; /// The distance from the axis of the ring to the center of each bar (m).
+	double startAngle; /// The angle of the first bar (rad).
+	double stepAngle; /// The angle between neighbouring bars (rad).
+	double innerRadius; /// No part of a bar is closer to the axis of the ring than this (m).
+	double outerRadius; /// No part of a bar is further from the axis of the ring than this (m).
+	double halfHeight; /// No part of a bar is further from the plane of the ring than this (m).
+	double halfAngle; /// No part of a bar is further than this angle from the center of the bar, seen from the axis (rad).
+
+  public:
+	/// Default constructor.
+	Ring() : DetectorArray(), radius(0.0), startAngle(0.0), stepAngle(0.0), innerRadius(0.0), outerRadius(0.0), halfHeight(0.0), halfAngle(0.0) { }
+
+	/// Constructor using a NewVIKARdet object.
+	Ring(NewVIKARdet *det_) : DetectorArray(det_), radius(0.0), startAngle(0.0), stepAngle(0.0), innerRadius(0.0), outerRadius(0.0), halfHeight(0.0), halfAngle(0.0) { }
+
+	/// Return the distance from the axis of the ring to the center of each bar (m).
+	double GetRadius() const { return radius; }
+
+	/// Return the angle between neighbouring bars (rad).
+	double GetStepAngle() const { return stepAngle; }
+
+	/** Build the bars of the ring and append them to a list of detectors.
+	  * Return the number of bars added.
+	  */
+	unsigned int AddBars(const NewVIKARdet &det_, std::vector<Primitive*> &detectors);
+
+	/** Find the bars which may be crossed by the ray (offset_ + t * direction_) for t >= 0. The ray is clipped
+	  * against the annulus which contains the bars, and the bars are found directly from the angles at which the
+	  * ray enters and leaves the annulus. Return the number of ranges found.
+	  */
+	unsigned int GetBarRanges(const Vector3 &offset_, const Vector3 &direction_, unsigned int *first, unsigned int *count) const;
+};
+
 /////////////////////////////////////////////////////////////////////
 // Elliptical
 /////////////////////////////////////////////////////////////////////
@@ -104,6 +207,11 @@ class Elliptical : public Primitive {
 
 	void SetRadii(const double &rLong_, const double &rShort_);
 
+	/** Get the lower and upper corners of a box which contains the ellipse, in the
+	  * local detector frame and relative to the position of the detector (in m).
+	  */
+	void GetLocalBounds(Vector3 &lower, Vector3 &upper);
+
 	/** Check if a point (in local coordinates) is within the bounds of the primitive
 	  * Return true if the coordinates are within the primitive and false otherwise.
 	  * The Elliptical class checks if the face intersect is within 
@@ -135,6 +243,11 @@ class Polygonal : public Primitive {
 	/// Return the chord length of the polygon (m).
 	double GetChordLength() { return poly.GetChordLength(); }
 	
+	/** Get the lower and upper corners of a box which contains the polygon, in the
+	  * local detector frame and relative to the position of the detector (in m).
+	  */
+	void GetLocalBounds(Vector3 &lower, Vector3 &upper);
+
 	/** Check if a point (in local coordinates) is within the bounds of the primitive
 	  * Return true if the coordinates are within the primitive and false otherwise.
 	  * The Elliptical class checks if the face intersect is within 
@@ -168,6 +281,11 @@ class Annular : public Primitive {
 
 	void SetRadii(const double &inRadius_, const double &outRadius_);
   
+	/** Get the lower and upper corners of a box which contains the annulus, in the
+	  * local detector frame and relative to the position of the detector (in m).
+	  */
+	void GetLocalBounds(Vector3 &lower, Vector3 &upper);
+
 	/** Check if a point (in local coordinates) is within the bounds of the primitive
 	  * Return true if the coordinates are within the primitive and false otherwise.
 	  * The Elliptical class checks if the face intersect is within 
@@ -178,11 +296,24 @@ class Annular : public Primitive {
 /// Read in a detector efficiency file
 unsigned int ReadEffFile(const char*, double*, double*);
 
+/** Read the entries of a NewVIKAR detector file without building any detectors.
+  * Returns the number of entries read, or -1 if the file could not be opened.
+  */
+int ReadDetFile(const char* fname_, std::vector<NewVIKARdet> &entries);
+
+/** Build detectors from a list of NewVIKAR detector file entries and add them to a vector of pointers.
+  * Wall and ring entries add one Planar detector for each of their bars. If arrays is not NULL, a
+  * DetectorArray for each wall and ring entry is added to it, and the caller takes ownership of them.
+  * Returns the number of detectors in the vector.
+  */
+int BuildDetectors(const std::vector<NewVIKARdet> &entries, std::vector<Primitive*> &detectors, std::vector<DetectorArray*> *arrays=NULL);
+
 /** Read NewVIKAR detector file and load detectors into a vector of pointers.
   * Returns the number of detectors loaded from the file.
   * Assumes the following detector file format for each detector in file
   * X(m) Y(m) Z(m) Theta(rad) Phi(rad) Psi(rad) Type Subtype Length(m) Width(m) Depth(m) Material.
+  * Wall and ring entries have extra fields after the material (see Wall and Ring).
   */
-int ReadDetFile(const char* fname_, std::vector<Primitive*> &detectors);
+int ReadDetFile(const char* fname_, std::vector<Primitive*> &detectors, std::vector<DetectorArray*> *arrays=NULL);
 
 #endif
@@ -85,7 +85,7 @@ class RegularPolygon{
 
 class Primitive{  
   protected:
-	bool need_set; /// True if the global face coordinates need set.
+	bool frozen; /// True if the detector may no longer be moved, rotated or resized.
     bool use_material; /// True if a material is to be used for energy loss.
     unsigned int material_id; /// The ID of the material to use for energy loss.
 	unsigned int front_face; /// The ID of the front face.
@@ -96,6 +96,11 @@ class Primitive{
 	Vector3 GlobalFace[6]; /// The center of the six detector faces in 3d space (in m).
 	Matrix3 rotationMatrix; /// The rotation matrix of the detector.
 	double length, width, depth; /// Physical size of the detector (in m).
+	double halfWidth, halfLength, halfDepth; /// Half of the size of the detector along the local x, y and z axes (in m).
+	double widthRadius2; /// Square of the radius of the bounding cylinder, (width/2)^2 (in m^2).
+	double lengthRadius2; /// Square of the radius of the bounding sphere, (length/2)^2 (in m^2).
+	double coneCos, coneSin; /// Cosine and sine of the opening angle of the bounding cone, atan(width/(2*length)).
+	double coneCos2, coneSin2; /// Squared cosine and sine of the opening angle of the bounding cone.
 	double theta, phi, psi; /// Rotation of the detector (in radians).
 	bool use_recoil; /// True if this detector is to be used to detect recoil particles.
 	bool use_eject; /// True if this detector is to be used to detect ejectile particles.
@@ -104,7 +109,9 @@ class Primitive{
 	std::string type, subtype; /// The type and subtype of the detector.
 	std::string material_name; /// The name of the material to use for energy loss calculations.
 
-	/** Set the global face coordinates (wrt global origin)
+	/** Set the global face coordinates (wrt global origin) and all other constants which
+	  * depend on the size, position or rotation of the detector. This is called every time
+	  * the detector is changed, so ray tracing never needs to check if they are up to date.
 	  * Each vertex is the center coordinate of one of the faces.
 	  */
 	void _set_face_coords();
@@ -118,6 +125,15 @@ class Primitive{
 	
 	virtual ~Primitive(){}
 	
+	/** Mark the detector as frozen. A frozen detector must not be moved, rotated or resized,
+	  * which is checked by assertions in debug builds. Detectors should be frozen once they
+	  * are set up, e.g. after calling ReadDetFile, and before being shared between threads.
+	  */
+	void Freeze(){ frozen = true; }
+
+	/// Return true if the detector has been frozen.
+	bool IsFrozen() const { return frozen; }
+
 	/// Return the ID of the material to use for energy loss calculations.
 	unsigned int GetMaterial(){ return material_id; }
 
@@ -174,10 +190,23 @@ class Primitive{
 
 	/// Return the local detector frame coordinates of a global coordinate
 	void GetLocalCoords(const Vector3&, double&, double&, double&);
+
+	/** Get the lower and upper corners of a box which contains the detector, in the
+	  * local detector frame and relative to the position of the detector (in m).
+	  */
+	virtual void GetLocalBounds(Vector3 &lower, Vector3 &upper);
+
+	/** Get the lower and upper corners of the smallest axis-aligned box (in the global
+	  * frame) which contains the local detector bounds (in m).
+	  */
+	void GetBoundingBox(Vector3 &lower, Vector3 &upper);
 	
 	/// Get a vector pointing to a 3d point inside of this geometry
 	void GetRandomPointInside(Vector3& output);
 
+	/// Get a vector pointing to a 3d point inside of this geometry, using the random number engine rng_
+	void GetRandomPointInside(Vector3& output, RandomEngine &rng_);
+
 	bool IsRecoilDet(){ return use_recoil; }
 
 	bool IsEjectileDet(){ return use_eject; }
@@ -321,6 +350,67 @@ class Planar : public Primitive {
 	void SetMedium(){ SetSize(1.2, 0.06, 0.03); }
 
 	void SetLarge(){ SetSize(2.0, 0.05, 0.05); }
+
+	/// Alternate version of IntersectPrimitive which does not return the normal vector.
+	using Primitive::IntersectPrimitive;
+
+	/** Calculate the intersection of a ray of the form (offset_ + t * direction_) with this 
+	  * rectangular box. The ray is transformed into the local detector frame once and clipped
+	  * against the three pairs of faces (the slab method), which gives the same result as
+	  * Primitive::IntersectPrimitive without testing each face separately.
+	  * offset_ is the point where the ray originates wrt the global origin.
+	  * direction_ is the direction of the ray wrt the global origin.
+	  * t1 is the parameter of the front intersection point given by P1 = offset_ + direction_*t1.
+	  * t2 is the parameter of the back intersection point given by P2 = offset_ + direction_*t2.
+	  * norm is the normal vector to the surface at point P1.
+	  * Return true if the box is intersected, and false otherwise.
+	  */
+	bool IntersectPrimitive(const Vector3& offset_, const Vector3& direction_, Vector3 &P1, Vector3 &norm, double &t1, double &t2);
+};
+
+/////////////////////////////////////////////////////////////////////
+// ThinSlab
+/////////////////////////////////////////////////////////////////////
+
+/** A flat slab with a finite thickness along its local z axis and no edges, used for thin targets.
+  * Only the two faces normal to the local z axis are ever crossed, so the points where a ray enters
+  * and leaves the slab are found from a single pair of plane equations. The width and length of the
+  * slab are kept for bounding boxes and random points, but are ignored by the intersection.
+  */
+class ThinSlab : public Primitive {
+  public:
+	/// Default constructor.
+	ThinSlab() : Primitive() {}
+
+	/** Find the ray parameters at which the ray (offset_ + t * direction_) crosses the front (tFront)
+	  * and back (tBack) faces of the slab, where the front face is the one the ray crosses first. The
+	  * parameters may be negative if the faces are behind the ray origin. Return false if the ray is
+	  * parallel to the faces.
+	  */
+	bool GetCrossings(const Vector3 &offset_, const Vector3 &direction_, double &tFront, double &tBack) const {
+		const double speed = direction_.Dot(detZ);
+		if(speed == 0.0){ return false; }
+		const double height = (offset_-position).Dot(detZ);
+		const double tLower = (-halfDepth-height)/speed;
+		const double tUpper = (halfDepth-height)/speed;
+		tFront = (speed > 0.0 ? tLower : tUpper);
+		tBack = (speed > 0.0 ? tUpper : tLower);
+		return true;
+	}
+
+	/// Alternate version of IntersectPrimitive which does not return the normal vector.
+	using Primitive::IntersectPrimitive;
+
+	/** Calculate the intersection of a ray of the form (offset_ + t * direction_) with the slab.
+	  * offset_ is the point where the ray originates wrt the global origin.
+	  * direction_ is the direction of the ray wrt the global origin.
+	  * t1 is the parameter of the front intersection point given by P1 = offset_ + direction_*t1.
+	  * t2 is the parameter of the back intersection point given by P2 = offset_ + direction_*t2.
+	  * If the ray starts inside the slab, t1 is the exit point and t2 is not set.
+	  * norm is the normal vector to the surface at point P1.
+	  * Return true if the slab is intersected, and false otherwise.
+	  */
+	bool IntersectPrimitive(const Vector3& offset_, const Vector3& direction_, Vector3 &P1, Vector3 &norm, double &t1, double &t2);
 };
 
 /////////////////////////////////////////////////////////////////////
@@ -336,6 +426,11 @@ class Cylindrical : public Primitive {
 	
 	/// Constructor using a NewVIKARDet object.
 	Cylindrical(NewVIKARdet *det_) : Primitive(det_) {}
+
+	/** Get the lower and upper corners of a box which contains the detector, in the
+	  * local detector frame and relative to the position of the detector (in m).
+	  */
+	void GetLocalBounds(Vector3 &lower, Vector3 &upper);
 	
 	/** Calculate the intersection of a ray of the form (offset_ + t * direction_) with this 
 	  * primitive shape offset_ is the point where the ray originates wrt the global origin.
@@ -354,16 +449,18 @@ class Cylindrical : public Primitive {
 
 class Conical : public Primitive { 
   private:
-	double alpha; /// The opening angle of the cone.
-	double sin_alpha; /// The sine of the opening angle.
-	double cos_alpha; /// The cosine of the opening angle.
   
   public:
   	/// Default constructor.
 	Conical() : Primitive() {}
 	
 	/// Constructor using a NewVIKARDet object.
-	Conical(NewVIKARdet *det_);
+	Conical(NewVIKARdet *det_) : Primitive(det_) {}
+
+	/** Get the lower and upper corners of a box which contains the detector, in the
+	  * local detector frame and relative to the position of the detector (in m).
+	  */
+	void GetLocalBounds(Vector3 &lower, Vector3 &upper);
 	
 	/** Calculate the intersection of a ray of the form (offset_ + t * direction_) with this 
 	  * primitive shape offset_ is the point where the ray originates wrt the global origin.
@@ -389,6 +486,11 @@ class Spherical : public Primitive {
 	
 	/// Constructor using a NewVIKARDet object.
 	Spherical(NewVIKARdet *det_) : Primitive(det_) {}
+
+	/** Get the lower and upper corners of a box which contains the detector, in the
+	  * local detector frame and relative to the position of the detector (in m).
+	  */
+	void GetLocalBounds(Vector3 &lower, Vector3 &upper);
 	
 	/** Calculate the intersection of a ray of the form (offset_ + t * direction_) with this 
 	  * primitive shape offset_ is the point where the ray originates wrt the global origin.
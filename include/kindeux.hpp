@@ -18,6 +18,8 @@
 
 class AngularDist;
 class Target;
+class RandomEngine;
+class AcceptanceMap;
 
 class reactData{
   public:
@@ -26,9 +28,10 @@ class reactData{
 	double Erecoil;
 	double Eexcited;
 	double comAngle;
+	double weight;
 	unsigned int state;
 
-	reactData() : Ereact(0.0), Eeject(0.0), Erecoil(0.0), Eexcited(0.0), comAngle(0.0), state(0) { }
+	reactData() : Ereact(0.0), Eeject(0.0), Erecoil(0.0), Eexcited(0.0), comAngle(0.0), weight(1.0), state(0) { }
 };
 
 class Californium{
@@ -47,6 +50,8 @@ class Californium{
         Californium();
 
         double sample();
+
+        double sample(RandomEngine &rng_);
 };
 
 class Kindeux{
@@ -66,6 +71,10 @@ class Kindeux{
 	
 	Californium cf;
 
+	RandomEngine *rng; // Random number engine (NULL uses the default engine)
+	
+	const AcceptanceMap *acceptance; // Detector acceptance map used for biased sampling (NULL for no bias)
+
 	/// Get the excitation of the recoil particle.
 	bool get_excitations(double &recoilE, unsigned int &state);
 	
@@ -104,6 +113,9 @@ class Kindeux{
    	/// Return the number of recoil states being used.
    	unsigned int GetNrecoilStates(){ return NrecoilStates; }
    	
+   	/// Return the excitation energy of a given recoil state (MeV).
+   	double GetRecoilExState(const unsigned int &index_){ return (RecoilExStates && index_ < (NrecoilStates > 0 ? NrecoilStates : 1) ? RecoilExStates[index_] : 0.0); }
+   	
    	/// Return the number of reactions for a given state.
    	unsigned int GetNreactions(const unsigned int &index_){ return (index_ < NrecoilStates ? Nreactions[index_] : 0); }
    	
@@ -112,6 +124,18 @@ class Kindeux{
    
 	/// Return true if this reaction is in inverse kinematics and false otherwise.
 	bool GetInverseKinematics(){ return inverse; }
+
+	/// Return the random number engine used by this object.
+	RandomEngine &GetRandomEngine();
+
+	/// Set the random number engine used by this object (NULL uses the default engine).
+	void SetRandomEngine(RandomEngine *rng_){ rng = rng_; }
+
+	/// Set the acceptance map used to bias the sampling of reaction angles (NULL for no bias).
+	void SetAcceptanceMap(const AcceptanceMap *acceptance_){ acceptance = acceptance_; }
+
+	/// Return the ejectile center of mass angle of a state at which the cumulative angular distribution reaches frac_ (rad).
+	double GetComAngle(const unsigned int &state_, const double &frac_);
 	
    	/// Initialize Kindeux object with reaction parameters.
    	void Initialize(double Mbeam_, double Mtarg_, double Mrecoil_, double Meject_, double Qvalue_, unsigned int NrecoilStates_, double *RecoilExStates_);
@@ -10,6 +10,11 @@
 #ifndef MATERIALS_H
 #define MATERIALS_H
 
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+
 #include "detectors.hpp"
 
 /////////////////////////////////////////////////////////////////////
@@ -34,8 +39,12 @@ extern const double ionpot[13];
 /////////////////////////////////////////////////////////////////////
 
 class Primitive;
+class ThreadPool;
 class Efficiency;
 class Material;
+class MaterialLibrary;
+class StoppingPowerModel;
+class TabulatedStoppingPower;
 class Particle;
 class Target;
 class RangeTable;
@@ -181,6 +190,17 @@ class Material{
 
 	/// Return the number of unique elements per material molecule.
 	unsigned int GetNumElements(){ return num_elements; } 
+
+	/** Get the atomic number, atomic mass (u), ionization potential (MeV) and fractional weight of one of the
+	  * unique elements in the material. Return false if there is no such element.
+	  */
+	bool GetElement(const unsigned int &index_, double &Z, double &A, double &I, double &weight_);
+
+	/** Return a string which describes every parameter used to calculate the stopping power in the
+	  * material (name, density and the number, Z, A and ionization potential of each element).
+	  * Two materials with the same signature give the same stopping power.
+	  */
+	std::string GetSignature();
 	
 	/// Load a material from a file.
 	bool ReadMatFile(const char* filename_);
@@ -201,26 +221,226 @@ class Material{
 	void Print(std::ofstream *file_);
 };
 
+/////////////////////////////////////////////////////////////////////
+// StoppingPowerModel
+/////////////////////////////////////////////////////////////////////
+
+/** Interface for a model of the stopping power which may be used to build a RangeTable in place of
+  * Material::StopPower.
+  */
+class StoppingPowerModel{
+  public:
+	/// Destructor.
+	virtual ~StoppingPowerModel(){ }
+
+	/** Return a string which describes the model and its settings. Two models with the same
+	  * signature give the same stopping power.
+	  */
+	virtual std::string GetSignature() = 0;
+
+	/** Calculate the stopping power (in MeV/m) in a material for a particle with charge Z_ and mass mass_
+	  * (in MeV/c^2) at count_ kinetic energies (in MeV), and store them in powers. A whole block of energies is
+	  * requested at once, so that the material only needs to be looked up once per block. powers may be the
+	  * same array as energies_. This may be called by several threads at once.
+	  */
+	virtual void StopPower(Material *mat_, const double &Z_, const double &mass_, const double *energies_, double *powers, const unsigned int &count_) = 0;
+
+	/// Return the stopping power (in MeV/m) in a material for a particle with kinetic energy energy_ (in MeV).
+	double StopPower(Material *mat_, const double &energy_, const double &Z_, const double &mass_);
+};
+
+/////////////////////////////////////////////////////////////////////
+// TabulatedStoppingPower
+/////////////////////////////////////////////////////////////////////
+
+/** The electronic stopping power tabulated against the velocity of the particle, including the corrections
+  * which Material::StopPower leaves out. The stopping power of each element for protons is tabulated once, on a
+  * grid of kinetic energies evenly spaced in log(energy). Above a few hundred keV it is the Bethe formula with
+  * the shell correction of Barkas and Berger, and at low energy it is the Lindhard-Scharff stopping, which is
+  * proportional to the velocity. The two are joined in the same way as the fits of Andersen and Ziegler,
+  * 1/S = 1/S_low + 1/S_high. The first time a material is used, the tables of its elements are combined
+  * by Bragg additivity and the density effect of the whole material is added (in the high energy limit of
+  * Sternheimer). A heavier ion loses energy like a proton with the same velocity, scaled by the square of
+  * its effective charge (Ziegler). Stopping powers are then interpolated in log(energy) and
+  * log(stopping power), and the table entry is found directly from the logarithm of the energy.
+  */
+class TabulatedStoppingPower : public StoppingPowerModel {
+  public:
+	/** Constructor. The tables cover proton kinetic energies from minE_ to maxE_ (in MeV), with
+	  * entriesPerDecade_ entries for each factor of 10 in energy.
+	  */
+	TabulatedStoppingPower(const double &minE_=1E-4, const double &maxE_=1E4, const unsigned int &entriesPerDecade_=200);
+
+	/// Return a string which describes the model and its settings.
+	std::string GetSignature();
+
+	using StoppingPowerModel::StopPower;
+
+	/** Calculate the stopping power (in MeV/m) in a material for a particle with charge Z_ and mass mass_
+	  * (in MeV/c^2) at count_ kinetic energies (in MeV), and store them in powers. The material is tabulated
+	  * the first time it is used. This may be called by several threads at once.
+	  */
+	void StopPower(Material *mat_, const double &Z_, const double &mass_, const double *energies_, double *powers, const unsigned int &count_);
+
+	/// Return the number of entries in each table.
+	unsigned int GetEntries() const { return num_entries; }
+
+	/// Return the number of elements which have been tabulated.
+	size_t GetNumElements();
+
+	/// Return the number of materials which have been tabulated.
+	size_t GetNumMaterials();
+
+	/** Calculate the electronic stopping power (in MeV cm^2/g) of an element with atomic number Z_, atomic
+	  * mass A_ (in u) and ionization potential I_ (in MeV) for a proton with kinetic energy energy_ (in MeV).
+	  * This is the function which is tabulated for each element.
+	  */
+	static double ElementStopPower(const double &Z_, const double &A_, const double &I_, const double &energy_);
+
+	/// Return the effective charge of an ion with atomic number Z_ moving at beta_ (relative to c). It is never less than one.
+	static double EffectiveCharge(const double &Z_, const double &beta_);
+
+  private:
+	double minE; /// The lowest proton kinetic energy in the tables (MeV).
+	double maxE; /// The highest proton kinetic energy in the tables (MeV).
+	double logMin; /// Natural log of minE.
+	double logStep; /// Step size in the natural log of energy.
+	unsigned int perDecade; /// Number of table entries for each factor of 10 in energy.
+	unsigned int num_entries; /// Number of entries in each table.
+
+	std::unordered_map<std::string, std::vector<double> > elements; /// Log of the stopping power for protons (MeV cm^2/g) of each element, by Z, A and I.
+	std::unordered_map<std::string, std::vector<double> > materials; /// Log of the stopping power for protons (MeV/m) of each material, by material signature.
+	std::mutex lock; /// Mutex protecting the element and material tables while they are added.
+
+	/// Return the table for an element, tabulating it if needed. The lock must be held.
+	const std::vector<double> &_getElement(const double &Z_, const double &A_, const double &I_);
+
+	/// Return the table for a material, combining the tables of its elements if needed.
+	const std::vector<double> &_getMaterial(Material *mat_);
+
+	/// Interpolate the stopping power from a table for a proton with kinetic energy energy_ (in MeV).
+	double _interpolate(const std::vector<double> &table_, const double &energy_) const;
+};
+
+/////////////////////////////////////////////////////////////////////
+// MaterialLibrary
+/////////////////////////////////////////////////////////////////////
+
+/** A collection of materials which may be found by name. Materials are listed from material (.mat) files,
+  * named after the file without its extension, and each file is only read the first time its material is
+  * requested. The materials are kept in a hash table, so looking one up does not depend on how many there are.
+  */
+class MaterialLibrary{
+  public:
+	/// Default constructor.
+	MaterialLibrary() : nLoaded(0) { }
+
+	/** Add every material (.mat) file in a directory. A file replaces any material with the same name.
+	  * Return the number of files added, or -1 if the directory could not be opened.
+	  */
+	int AddDirectory(const std::string &dirname_);
+
+	/// Add a material file, named after the file without its directory or .mat extension. It replaces any material with the same name.
+	void AddFile(const std::string &fname_);
+
+	/// Add a material which has already been built. It replaces any material with the same name.
+	void Add(const Material &mat_);
+
+	/// Add the materials which were built into vandmc before material files were supported.
+	void AddDefaults();
+
+	/// Return true if the library contains a material with the given name.
+	bool Contains(const std::string &name_) const { return (entries.find(name_) != entries.end()); }
+
+	/** Return the material with the given name, reading its file the first time it is requested. The material
+	  * is owned by the library. Return NULL if there is no such material or if its file could not be read.
+	  */
+	Material *Get(const std::string &name_);
+
+	/// Return the number of materials in the library.
+	size_t GetNumMaterials() const { return entries.size(); }
+
+	/// Return the number of material files which have been read.
+	unsigned int GetNumLoaded() const { return nLoaded; }
+
+	/// Fill a vector with the names of all materials in the library, in alphabetical order.
+	void GetNames(std::vector<std::string> &names) const;
+
+  private:
+	struct entry{
+		std::string filename; /// The material file, or empty if the material was added directly.
+		Material material; /// The material, which is only valid once it has been loaded.
+		bool loaded; /// Set to true once the material has been read from its file.
+		bool failed; /// Set to true if the material file could not be read.
+	};
+
+	std::unordered_map<std::string, entry> entries; /// Materials by name.
+	unsigned int nLoaded; /// Number of material files which have been read.
+};
+
 /////////////////////////////////////////////////////////////////////
 // RangeTable
 /////////////////////////////////////////////////////////////////////
 
 class RangeTable{
   private:
+	/// Ways of finding the table interval which contains a value (see _find).
+	enum lookupMethod {LOOKUP_SEARCH, LOOKUP_ENERGY, LOOKUP_RANGE};
+
 	std::vector<double> energy; /// Array for storing energy values.
 	std::vector<double> dedx; /// Array for storing stopping power.
 	std::vector<double> range; /// Array for storing range values.
 	std::vector<double> birks; /// Array for storing light response.
 	double step; /// Energy step size (MeV).
+	double logStart; /// Natural log of the first energy in the table.
+	double logStep; /// Step size in the natural log of energy.
 	unsigned int num_entries; /// Number of table array entries.
 	bool use_table; /// True if the table is to be used for energy loss calculations.
 	bool use_birks; /// True if the birks light response table may be used for calculations.
+	bool uniform; /// True if the energy array is evenly spaced by step (or by logStep in log(energy) if logarithmic is set).
+	bool logarithmic; /// True if the energy array is evenly spaced in log(energy) by logStep.
+	std::vector<unsigned int> rangeIndex; /// The table interval containing the lower edge of each bucket, for buckets evenly spaced in log(range).
+	double logRangeStart; /// Natural log of the second range in the table (the first is zero).
+	double logRangeStep; /// Size of each range index bucket in the natural log of range.
 	
 	/// Initialize range table arrays.
 	bool _initialize(const unsigned int &num_entries_);
+
+	/** Fill the arrays with num_entries_ energies evenly spaced in log(energy) from startE_ to stopE_
+	  * using model_ (or Material if model_ is NULL). middle_ is filled with minus the stopping power at the
+	  * middle (in log(energy)) of the interval below each entry. If pool_ is not NULL, the stopping powers
+	  * are calculated using all of its threads.
+	  */
+	void _fillLog(const unsigned int &num_entries_, const double &startE_, const double &stopE_, const double &Z_, const double &mass_, Material *mat_, ThreadPool *pool_, StoppingPowerModel *model_, std::vector<double> &middle_);
+
+	/** Fill the arrays with twice as many intervals as the log-spaced table coarse_, whose stopping powers at
+	  * the middle of each interval are coarseMiddle_. The entries and middles of coarse_ become the entries of
+	  * this table, so only the stopping powers at the new middles (returned in middle_) are calculated.
+	  */
+	void _refineLog(const RangeTable &coarse_, const std::vector<double> &coarseMiddle_, const double &Z_, const double &mass_, Material *mat_, ThreadPool *pool_, StoppingPowerModel *model_, std::vector<double> &middle_);
+
+	/** Calculate the ranges of a log-spaced table from the stopping powers at each entry and at the middle
+	  * of the interval below each entry (middle_), using Simpson's rule in log(energy).
+	  */
+	void _integrateLog(const std::vector<double> &middle_);
+
+	/// Fill dedx_ with minus the stopping power (MeV/m) at count_ energies, using model_ or Material if model_ is NULL.
+	static void _stopPower(const double &Z_, const double &mass_, Material *mat_, StoppingPowerModel *model_, const double *energies_, double *dedx_, const unsigned int &count_);
+
+	/// As _stopPower, but if pool_ is not NULL the energies are split into blocks which are calculated using all of its threads.
+	static void _stopPowerBlocks(const double &Z_, const double &mass_, Material *mat_, StoppingPowerModel *model_, ThreadPool *pool_, const double *energies_, double *dedx_, const unsigned int &count_);
 	
+	/** Build the index used to find the table interval containing a range without searching the table.
+	  * The range grows roughly as a power of the energy, so the index buckets are evenly spaced in log(range)
+	  * and each holds about one table entry. The index is empty if the ranges are not ascending.
+	  */
+	void _indexRange();
+
+	/// Return the index of the table interval containing val_ in the ascending array x_.
+	unsigned int _find(const std::vector<double> &x_, const double &val_, const lookupMethod &method_);
+
 	/// Interpolate between two points
-	double _interpolate(const std::vector<double> &x_, const std::vector<double> &y_, const double &val_);
+	double _interpolate(const std::vector<double> &x_, const std::vector<double> &y_, const double &val_, const lookupMethod &method_=LOOKUP_SEARCH);
 	
   public:
   	/// Default constructor.
@@ -235,8 +455,23 @@ class RangeTable{
 	/// Initialize arrays but do not fill them.
 	bool Init(const unsigned int &num_entries_); 
 
-	/// Initialize arrays and fill them using Material.
-	bool Init(const unsigned int &num_entries_, const double &startE_, const double &stopE_, const double &Z_, const double &mass_, Material *mat_); 
+	/// Initialize arrays and fill them using model_, or using Material if model_ is NULL.
+	bool Init(const unsigned int &num_entries_, const double &startE_, const double &stopE_, const double &Z_, const double &mass_, Material *mat_, StoppingPowerModel *model_=NULL); 
+
+	/** Initialize arrays and fill them using Material, with energies evenly spaced in log(energy) from startE_
+	  * to stopE_ (in MeV). The number of entries is doubled until the energy found by interpolating the table
+	  * at the range halfway (in log(energy)) between any two entries is within tolerance_ (relative) of the
+	  * exact value, or until the table would have more than max_entries_ entries, in which case a warning is
+	  * printed. Each doubling reuses the stopping powers already calculated. If the stopping power is not
+	  * positive anywhere in the table, the table starts at the maximum of the stopping power above the highest
+	  * such energy instead (the bare Bethe formula falls to zero and then becomes negative at low energy).
+	  * Return false if the stopping power is not positive at stopE_. The energy of an entry is found directly
+	  * from its logarithm, so lookups by energy do not need to search the table. Lookups by range start from an
+	  * index evenly spaced in log(range). If pool_ is not NULL, the stopping powers are calculated using all of
+	  * its threads. The table does not depend on pool_. The stopping powers are calculated using model_, or using
+	  * Material if model_ is NULL.
+	  */
+	bool InitAdaptive(const double &startE_, const double &stopE_, const double &Z_, const double &mass_, Material *mat_, const double &tolerance_=1E-6, const unsigned int &max_entries_=100000, ThreadPool *pool_=NULL, StoppingPowerModel *model_=NULL);
 
 	/// Initialize the birks light response array.
 	bool InitBirks(double L0_, double kB_, double C_=0.0);
@@ -250,10 +485,15 @@ class RangeTable{
 	/// Return the number of entries in the array.
 	unsigned int GetEntries(){ return num_entries; } 
 
+	/// Return true if the energy array is evenly spaced in log(energy).
+	bool IsLogarithmic(){ return logarithmic; }
+
 	/// Get the particle range at a given energy using linear interpolation.
 	double GetRange(const double &energy_); 
 
-	/// Get the particle energy at a given range using linear interpolation.
+	/** Get the particle energy at a given range using linear interpolation. The table interval is found
+	  * from the range index, or by a binary search if the table was changed by Set.
+	  */
 	double GetEnergy(const double &range_); 
 
 	/// Get the scintillator light response due to a particle traversing a material with given kinetic energy.
@@ -270,6 +510,17 @@ class RangeTable{
 	
 	/// Return the range and energy for an entry in the table.
 	bool GetEntry(const unsigned int &entry_, double &E, double &R);
+
+	/** Write the table to a binary file along with a key describing how it was built. The file is
+	  * written under a temporary name and then renamed, so other processes never see a partial file.
+	  * Return false if the table is not initialized or the file could not be written.
+	  */
+	bool Write(const char *filename_, const std::string &key_);
+
+	/** Read a table written by Write. The file is memory mapped and only used if it was written with
+	  * exactly the same key_ and is complete. Return false if the file could not be used.
+	  */
+	bool Read(const char *filename_, const std::string &key_);
 	
 	/// Print range table entries to the screen.
 	void Print();
@@ -420,7 +671,15 @@ class Target : public Particle {
 	double rad_length; /// The radiation length of the material (mg/cm^2).
 	double angle; /// Angle of target wrt the beam axis (rad).
 	
-	Primitive *physical; /// The physical target geometry.
+	ThinSlab *physical; /// The physical target geometry.
+
+	std::vector<double> depthTable; /// Fraction of the path through the target at evenly spaced values of the cumulative depth distribution.
+
+	/// Initialize all variables with default values.
+	void _initialize();
+
+	/// Return the fraction of the path through the target at which a reaction occurs, for a uniform random number frac_.
+	double _sampleDepth(const double &frac_) const;
 	
   public:
   	/// Default constructor.
@@ -429,6 +688,9 @@ class Target : public Particle {
 	/// Constructor to set the number of target elements.
 	Target(unsigned int);
 
+	/// Destructor.
+	~Target();
+
 	void SetThickness(double thickness_); /// Set the thickness of the target (in mg/cm^2).
 	void SetRealThickness(double thickness_); /// Set the actual thickness of the target (in cm).
 	void SetAngle(double angle_); /// Set the angle of the target about the z-axis (in rad).
@@ -446,13 +708,40 @@ class Target : public Particle {
 	double GetNumberDensity(){ return Ndensity; } /// Return the molecular density of the material (p/cm^3).
 	double GetMolarMass(){ return Mmass; } /// Return the molar mass of the material (g/mol).
 	double GetRadLength(){ return rad_length; } /// Return the radiation length of the target (mg/cm^2).
-	Primitive *GetPrimitive(){ return physical; } /// Return a pointer to the 3d geometry object
+	ThinSlab *GetPrimitive(){ return physical; } /// Return a pointer to the 3d geometry object
+	bool HasDepthDistribution(){ return !depthTable.empty(); } /// Return true if reactions are not distributed uniformly through the target.
+
+	/** Set the distribution of reaction depths along the path of the beam through the target.
+	  * weights_ gives the relative reaction probability at evenly spaced fractions of the path,
+	  * from the front face (first entry) to the back face (last entry), and the probability
+	  * is interpolated linearly between them. The distribution is converted into an inverse
+	  * cumulative distribution with num_bins_ bins so that each depth is drawn in constant time.
+	  * Return false if fewer than two weights are given, or if any weight is negative or all are zero.
+	  */
+	bool SetDepthDistribution(const std::vector<double> &weights_, const unsigned int &num_bins_=1000);
+
+	/** Weight the reaction depth by the reaction cross section at the energy of the beam at each depth.
+	  * energy_ and xsection_ give the excitation function (MeV and any units), and beam_table_ is the range
+	  * table of the beam in the target. The beam enters the target with energy Ebeam_ (MeV) and travels
+	  * the thickness the beam sees along the z-axis. The cross section is zero outside the excitation function.
+	  * Return false if the excitation function is empty or the cross section is zero throughout the target.
+	  */
+	bool SetExcitationFunction(const std::vector<double> &energy_, const std::vector<double> &xsection_, RangeTable &beam_table_, const double &Ebeam_, const unsigned int &num_points_=100);
+
+	/// Remove the depth distribution, so that reactions occur uniformly through the target.
+	void ClearDepthDistribution(){ depthTable.clear(); }
 	
 	/// Get the depth into the target at which the reaction occurs.
 	double GetInteractionDepth(const Vector3 &offset_, const Vector3 &direction_, Vector3 &intersect, Vector3 &interact);
 
+	/// Get the depth into the target at which the reaction occurs, using the random number engine rng_.
+	double GetInteractionDepth(RandomEngine &rng_, const Vector3 &offset_, const Vector3 &direction_, Vector3 &intersect, Vector3 &interact);
+
 	/// Determine the new direction of a particle inside the target due to angular straggling.
 	bool AngleStraggling(const Vector3 &direction_, double A_, double Z, double E_, Vector3 &new_direction);
+
+	/// Determine the new direction of a particle inside the target due to angular straggling, using the random number engine rng_.
+	bool AngleStraggling(RandomEngine &rng_, const Vector3 &direction_, double A_, double Z, double E_, Vector3 &new_direction);
 };
 
 #endif
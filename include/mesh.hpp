@@ -0,0 +1,130 @@
+/** \file mesh.hpp
+ * \brief Detectors whose shape is given by a closed triangle mesh.
+ *
+ * The Mesh class is a Primitive whose surface is a list of triangles read from
+ * an STL file (ASCII or binary). The triangles are stored in the local detector
+ * frame and sorted into a bounding volume hierarchy of their own, so tracing a
+ * ray through the mesh only tests the triangles near the ray and takes a time
+ * which grows with the logarithm of the number of triangles. Each triangle is
+ * tested with a watertight ray/triangle intersection, so a ray which passes
+ * exactly through a shared edge or vertex is never lost between two triangles.
+ * The mesh should be closed and its triangles wound counter-clockwise when seen
+ * from outside (the STL convention), so that the normals point outwards.
+ */
+#ifndef MESH_HPP
+#define MESH_HPP
+
+#include <string>
+#include <vector>
+
+#include "geometry.hpp"
+#include "bvh.hpp"
+
+/// The result of reading the triangles of an STL file (see ReadSTL).
+enum STLResult {STL_SUCCESS=0, STL_READ_FAILED=1, STL_PARSE_FAILED=2, STL_NO_TRIANGLES=3};
+
+/////////////////////////////////////////////////////////////////////
+// Mesh
+/////////////////////////////////////////////////////////////////////
+
+/** A detector with the shape of a closed triangle mesh.
+  * Detector file format:
+  * X(m) Y(m) Z(m) Theta(rad) Phi(rad) Psi(rad) Type mesh Scale(m) 0 0 Material Filename.
+  * Scale is the size of one STL unit (e.g. 0.001 for a file in mm), and a relative Filename
+  * is taken relative to the directory of the detector file. The mesh coordinates are placed
+  * relative to the position of the detector and rotated with it.
+  */
+class Mesh : public Primitive {
+  public:
+	/// Default constructor.
+	Mesh() : Primitive() { }
+
+	/** Constructor using a NewVIKARdet object. The mesh is loaded from the file given by the entry.
+	  * If the file could not be loaded, a warning is printed and the mesh is left empty.
+	  */
+	Mesh(NewVIKARdet *det_);
+
+	/// Return the number of triangles in the mesh.
+	size_t GetNumTriangles() const { return vertices.size()/3; }
+
+	/// Return the number of nodes in the triangle hierarchy.
+	size_t GetNumNodes() const { return nodes.size(); }
+
+	/// Return true if the mesh contains no triangles.
+	bool Empty() const { return vertices.empty(); }
+
+	/** Load the triangles of an ASCII or binary STL file, replacing any existing triangles. All coordinates
+	  * are multiplied by scale_ to convert them into m. The size of the detector is set to the size of the
+	  * box which contains the mesh. Return STL_SUCCESS, or the step which failed.
+	  */
+	STLResult LoadSTL(const std::string &fname_, const double &scale_=1.0);
+
+	/** Replace the triangles of the mesh. vertices_ holds three corners (in m, in the local detector frame)
+	  * for each triangle, wound counter-clockwise when seen from outside. The size of the detector is set to
+	  * the size of the box which contains the mesh. Return false if the number of vertices is not a multiple of 3.
+	  */
+	bool SetTriangles(const std::vector<Vector3> &vertices_);
+
+	/** Get the lower and upper corners of a box which contains the mesh, in the
+	  * local detector frame and relative to the position of the detector (in m).
+	  */
+	void GetLocalBounds(Vector3 &lower, Vector3 &upper);
+
+	/// Alternate version of IntersectPrimitive which does not return the normal vector.
+	using Primitive::IntersectPrimitive;
+
+	/** Calculate the intersection of a ray of the form (offset_ + t * direction_) with the mesh.
+	  * offset_ is the point where the ray originates wrt the global origin.
+	  * direction_ is the direction of the ray wrt the global origin.
+	  * t1 is the parameter of the front intersection point given by P1 = offset_ + direction_*t1.
+	  * t2 is the parameter of the back intersection point given by P2 = offset_ + direction_*t2.
+	  * If the ray starts inside the mesh, t1 is the exit point and t2 is not set. For a mesh
+	  * which is not convex, only the first part of the mesh which the ray passes through is used.
+	  * norm is the outward normal vector to the surface at point P1.
+	  * Return true if the mesh is intersected, and false otherwise.
+	  */
+	bool IntersectPrimitive(const Vector3& offset_, const Vector3& direction_, Vector3 &P1, Vector3 &norm, double &t1, double &t2);
+
+  private:
+	struct node{
+		BoundingBox box; /// Bounding box of all triangles below this node (local frame).
+		unsigned int first; /// Index of the first triangle (leaf) or the left child node (branch).
+		unsigned int count; /// The number of triangles in a leaf node, or zero for a branch node.
+	};
+
+	/// A point where a ray crosses the surface of the mesh.
+	struct crossing{
+		double t; /// The ray parameter of the crossing.
+		unsigned int triangle; /// The triangle which was crossed.
+		bool entering; /// True if the ray enters the mesh through the triangle.
+	};
+
+	std::vector<Vector3> vertices; /// The three corners of each triangle in the local frame (in m).
+	std::vector<Vector3> normals; /// The outward unit normal of each triangle in the local frame.
+	std::vector<node> nodes; /// The nodes of the triangle hierarchy. The root node is the first node.
+	BoundingBox bounds; /// The box which contains every triangle (local frame).
+
+	/// Build the triangle hierarchy and set the size of the detector from the triangles.
+	void _build();
+
+	/// Recursively build the node nodeIndex_ for the triangles from first_ up to (but not including) last_.
+	void _buildNode(const unsigned int &nodeIndex_, const unsigned int &first_, const unsigned int &last_, std::vector<unsigned int> &order, const std::vector<Vector3> &centers);
+
+	/** Find the closest two crossings of a local ray (origin_ + t * direction_) with the surface for t >= 0.
+	  * Return the number of crossings found (0, 1 or 2).
+	  */
+	unsigned int _findCrossings(const Vector3 &origin_, const Vector3 &direction_, crossing *found) const;
+
+	/** Intersect a local ray with a triangle using the watertight algorithm of Woop, Benthin and Wald (2013).
+	  * shear_ holds the shear constants and axes_ the permuted axes of the ray. Return true and set t if the
+	  * ray crosses the triangle at t >= 0.
+	  */
+	bool _intersectTriangle(const unsigned int &triangle_, const Vector3 &origin_, const int *axes_, const double *shear_, double &t) const;
+};
+
+/** Read the triangles of an ASCII or binary STL file into a list of vertices (three per triangle).
+  * Return STL_SUCCESS, STL_READ_FAILED if the file could not be read or STL_PARSE_FAILED if it is not an STL file.
+  */
+STLResult ReadSTL(const std::string &fname_, std::vector<Vector3> &vertices);
+
+#endif
@@ -0,0 +1,66 @@
+/** \file profiler.hpp
+ * \brief A low overhead profiler for timing the stages of a loop.
+ *
+ * The StageProfiler class accumulates the wall time and the number of calls
+ * of a fixed number of stages. Stages are timed as laps: each call to Mark()
+ * adds the time since the previous call to Start() or Mark() to one stage.
+ * This needs a single clock read per stage. A disabled profiler never reads
+ * the clock.
+ */
+#ifndef PROFILER_HPP
+#define PROFILER_HPP
+
+#include <vector>
+#include <chrono>
+
+class StageProfiler{
+  public:
+	/// Profiler constructor. nStages_ is the number of stages to time.
+	StageProfiler(const unsigned int &nStages_=0);
+
+	/// Return true if the profiler is timing stages and false otherwise.
+	bool IsEnabled() const { return enabled; }
+
+	/// Return the number of stages timed by the profiler.
+	unsigned int GetNumStages() const { return times.size(); }
+
+	/// Return the total time spent in a stage (in seconds).
+	double GetTime(const unsigned int &stage_) const;
+
+	/// Return the number of calls to a stage.
+	unsigned long long GetCalls(const unsigned int &stage_) const { return (stage_ < calls.size() ? calls[stage_] : 0); }
+
+	/// Return the total time spent in all stages (in seconds).
+	double GetTotalTime() const;
+
+	/// Enable or disable timing.
+	void SetEnabled(const bool &enabled_=true){ enabled = enabled_; }
+
+	/// Start timing. The next call to Mark() is timed from now.
+	void Start(){ if(enabled){ last = std::chrono::steady_clock::now(); } }
+
+	/** Add the time since the last call to Start() or Mark() to a stage and restart timing.
+	  * If count_ is false, the time is added without counting a call to the stage.
+	  */
+	void Mark(const unsigned int &stage_, const bool &count_=true){
+		if(!enabled){ return; }
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		times[stage_] += now - last;
+		if(count_){ calls[stage_]++; }
+		last = now;
+	}
+
+	/// Add the times and calls of another profiler with the same number of stages.
+	void Merge(const StageProfiler &other_);
+
+	/// Zero the times and calls of all stages.
+	void Reset();
+
+  private:
+	bool enabled; /// Set to true if the profiler is timing stages.
+	std::chrono::steady_clock::time_point last; /// The time of the last call to Start() or Mark().
+	std::vector<std::chrono::steady_clock::duration> times; /// Total time spent in each stage.
+	std::vector<unsigned long long> calls; /// Number of calls to each stage.
+};
+
+#endif
@@ -0,0 +1,87 @@
+/** \file slabKernel.hpp
+ * \brief Vectorised slab method kernels for intersecting rays with rectangular boxes.
+ *
+ * The kernels clip rays against boxes stored as structures of arrays (see
+ * DetectorStore) and return the range of the ray parameter which lies inside
+ * each box. One kernel tests a single ray against many boxes, the other tests
+ * many rays against a single box. Each kernel has a scalar version, an SSE2
+ * version (2 doubles per register) and an AVX2 version (4 doubles per register,
+ * 8 boxes or rays per loop iteration). The widest version supported by the CPU
+ * is selected at runtime. All versions perform the same floating point
+ * operations in the same order, so they give identical results.
+ *
+ * Both kernels also come in single precision, for boxes stored as floats (see
+ * SlabBoxesF). The float versions test twice as many boxes or rays per register
+ * (4 with SSE2, 8 with AVX2) and read half as much memory. They are accurate to
+ * about 1E-7 of the distances involved, which is fine for deciding which boxes a
+ * ray may hit but not for the final intersection points.
+ */
+#ifndef SLAB_KERNEL_HPP
+#define SLAB_KERNEL_HPP
+
+#include <cstddef>
+
+/// Instruction sets which may be used by the slab kernels, from narrowest to widest.
+enum SimdLevel {SIMD_SCALAR=0, SIMD_SSE2=1, SIMD_AVX2=2};
+
+/////////////////////////////////////////////////////////////////////
+// SlabBoxes
+/////////////////////////////////////////////////////////////////////
+
+/// Pointers to the structure-of-arrays data of a set of boxes. Box i is centered on (posX[i], posY[i], posZ[i]).
+template <typename T>
+struct SlabBoxesT{
+	const T *posX, *posY, *posZ; /// Center of each box (in m).
+	const T *xAxisX, *xAxisY, *xAxisZ; /// Local x axis of each box.
+	const T *yAxisX, *yAxisY, *yAxisZ; /// Local y axis of each box.
+	const T *zAxisX, *zAxisY, *zAxisZ; /// Local z axis of each box.
+	const T *halfX, *halfY, *halfZ; /// Half of the size of each box along its local axes (in m).
+};
+
+/// Boxes stored in double precision.
+typedef SlabBoxesT<double> SlabBoxes;
+
+/// Boxes stored in single precision.
+typedef SlabBoxesT<float> SlabBoxesF;
+
+/////////////////////////////////////////////////////////////////////
+// Kernels
+/////////////////////////////////////////////////////////////////////
+
+/// Return the widest instruction set supported by both the build and the CPU.
+SimdLevel GetSimdSupport();
+
+/// Return the instruction set currently used by the slab kernels.
+SimdLevel GetSimdLevel();
+
+/** Select the instruction set used by the slab kernels. Levels which are not supported are
+  * reduced to the widest supported level. This is not thread safe, so it should be called before
+  * any threads are started. Return the level which was selected.
+  */
+SimdLevel SetSimdLevel(const SimdLevel &level_);
+
+/// Return the name of an instruction set.
+const char *GetSimdName(const SimdLevel &level_);
+
+/** Clip the ray (origin_ + t * direction_) against count_ boxes, given by their indices_ into boxes_.
+  * tEntry[i] and tExit[i] are set to the ray parameters at which the ray enters and leaves box
+  * indices_[i]. The ray crosses the box in front of its origin if (tEntry[i] <= tExit[i] && tExit[i] >= 0).
+  * The direction must not be the zero vector.
+  */
+void SlabRayVsBoxes(const double *origin_, const double *direction_, const SlabBoxes &boxes_, const unsigned int *indices_, const size_t &count_, double *tEntry, double *tExit);
+
+/** Clip count_ rays against the box at index_ in boxes_. The origins and directions of the rays
+  * are given as structures of arrays. tEntry[i] and tExit[i] are the same as for SlabRayVsBoxes,
+  * for ray i. None of the directions may be the zero vector.
+  */
+void SlabRaysVsBox(const double *originX_, const double *originY_, const double *originZ_, const double *directionX_, const double *directionY_, const double *directionZ_,
+                   const size_t &count_, const SlabBoxes &boxes_, const unsigned int &index_, double *tEntry, double *tExit);
+
+/// Single precision version of SlabRayVsBoxes.
+void SlabRayVsBoxes(const float *origin_, const float *direction_, const SlabBoxesF &boxes_, const unsigned int *indices_, const size_t &count_, float *tEntry, float *tExit);
+
+/// Single precision version of SlabRaysVsBox.
+void SlabRaysVsBox(const float *originX_, const float *originY_, const float *originZ_, const float *directionX_, const float *directionY_, const float *directionZ_,
+                   const size_t &count_, const SlabBoxesF &boxes_, const unsigned int &index_, float *tEntry, float *tExit);
+
+#endif
@@ -0,0 +1,56 @@
+/** \file threadPool.hpp
+ * \brief A small fixed-size pool of worker threads.
+ *
+ * The ThreadPool class keeps a set of worker threads alive for the
+ * lifetime of the pool and hands them batches of indexed jobs. Each
+ * call to Execute() blocks until every job in the batch has finished,
+ * so the caller may safely read back per-job results afterwards.
+ */
+#ifndef THREAD_POOL_HPP
+#define THREAD_POOL_HPP
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+class ThreadPool{
+  public:
+	/** Pool constructor. nThreads_ is the number of threads to use. If nThreads_
+	  * is less than two, no threads are started and all jobs run on the calling thread.
+	  */
+	ThreadPool(const unsigned int &nThreads_=1);
+
+	/// Destructor. Stops and joins all worker threads.
+	~ThreadPool();
+
+	/// Return the number of threads used by the pool.
+	unsigned int GetNumThreads() const { return nThreads; }
+
+	/** Call func_(index) for every index in [0, nJobs_) using all available threads.
+	  * The order in which jobs are started is not defined. Block until all jobs are done.
+	  */
+	void Execute(const unsigned int &nJobs_, const std::function<void(const unsigned int &)> &func_);
+
+	/// Return the number of hardware threads available on this machine (at least 1).
+	static unsigned int GetHardwareThreads();
+
+  private:
+	std::vector<std::thread> threads; /// Array of worker threads.
+	std::mutex lock; /// Mutex protecting the job state below.
+	std::condition_variable startCondition; /// Signalled when a new batch of jobs is ready.
+	std::condition_variable doneCondition; /// Signalled when the current batch of jobs is done.
+	const std::function<void(const unsigned int &)> *job; /// The function to call for each job.
+	unsigned int nThreads; /// The number of threads used by the pool.
+	unsigned int nJobs; /// The number of jobs in the current batch.
+	unsigned int nextJob; /// The index of the next job to start.
+	unsigned int nFinished; /// The number of jobs in the current batch which are done.
+	unsigned int generation; /// Incremented every time a new batch of jobs is started.
+	bool quit; /// Set to true when the worker threads should exit.
+
+	/// Main loop for each of the worker threads.
+	void _work();
+};
+
+#endif
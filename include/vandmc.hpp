@@ -3,6 +3,13 @@
 
 #include <iostream>
 #include <string>
+#include <chrono>
+#include <deque>
+#include <map>
+#include <unordered_map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 // SimpleScan
 #include "optionHandler.hpp"
@@ -13,6 +20,11 @@
 #include "materials.hpp"
 #include "detectors.hpp"
 #include "vandmcStructures.hpp"
+#include "acceptance.hpp"
+#include "bvh.hpp"
+#include "angularGrid.hpp"
+#include "detectorStore.hpp"
+#include "profiler.hpp"
 
 ///////////////////////////////////////////////////////////////////////////////
 // class vandmcParameter
@@ -78,6 +90,14 @@ class vandmcParameterReader{
 	
 	bool FindString(const std::string &str, std::string &val);
 
+	/// Return true if str is the name of a valid config file parameter.
+	bool IsValidName(const std::string &str);
+
+	/** Replace all values of the parameter str with a single value. Return false if str is not
+	  * the name of a valid config file parameter.
+	  */
+	bool SetValue(const std::string &str, const std::string &val);
+
   private:
 	std::vector<vandmcParameter> validParameters;
 
@@ -88,21 +108,435 @@ class vandmcParameterReader{
 	void initialize();
 };
 
+class vandmc;
+
+class TFile;
+class TTree;
+
+/// Event loop stages timed by the profiler (see --profile).
+enum vandmcStage {PROFILE_BEAM, PROFILE_DEPTH, PROFILE_BEAM_ELOSS, PROFILE_STRAGGLING, PROFILE_KINEMATICS, PROFILE_ROTATION, PROFILE_PRODUCT_ELOSS,
+                  PROFILE_VETO, PROFILE_RECOIL, PROFILE_EJECTILE, PROFILE_GAMMA, PROFILE_DET_ELOSS, PROFILE_OUTPUT, PROFILE_BACKGROUND, PROFILE_TREE_FILL, PROFILE_STAGES};
+
+///////////////////////////////////////////////////////////////////////////////
+// class vandmcEvent
+///////////////////////////////////////////////////////////////////////////////
+
+/// Output data for a single entry in the output tree.
+class vandmcEvent{
+  public:
+	ReactionProductStructure eject; // Ejectile and gamma detector hits
+	ReactionProductStructure recoil; // Recoil detector hits
+	ReactionObjectStructure reaction; // Reaction information
+	double weight; // Statistical weight of the event
+
+	/// Default constructor.
+	vandmcEvent() : weight(1.0) { }
+
+	/// Zero all output data structures.
+	void Zero(){
+		eject.Zero();
+		recoil.Zero();
+		reaction.Zero();
+		weight = 1.0;
+	}
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// class vandmcEventBuffer
+///////////////////////////////////////////////////////////////////////////////
+
+/** A block of output events. Events are allocated once and reused every time the
+  * buffer is cleared, so filling a buffer does not allocate once it has grown to
+  * the size of a typical round of events.
+  */
+class vandmcEventBuffer{
+  public:
+	/// Buffer constructor. capacity_ is the number of events to allocate up front.
+	vandmcEventBuffer(const size_t &capacity_=1);
+
+	/// Destructor.
+	~vandmcEventBuffer();
+
+	/// Return the number of completed events in the buffer.
+	size_t GetNumEvents() const { return nEvents; }
+
+	/// Return a pointer to a completed event.
+	vandmcEvent *GetEvent(const size_t &index_){ return (index_ < nEvents ? events[index_] : NULL); }
+
+	/// Return a pointer to the event currently being filled.
+	vandmcEvent *GetCurrent(){ return events[nEvents]; }
+
+	/// Mark the current event as complete. Return a pointer to the next (zeroed) event to fill.
+	vandmcEvent *Commit();
+
+	/// Discard all completed events.
+	void Clear();
+
+  private:
+	std::vector<vandmcEvent*> events; /// Array of events, including the one currently being filled.
+	size_t nEvents; /// Number of completed events in the buffer.
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// class vandmcWriter
+///////////////////////////////////////////////////////////////////////////////
+
+/** Writes output events to the output tree on a separate thread. The writer owns the
+  * output file and tree and a fixed pool of event buffers. Buffers filled by the event
+  * loop are pushed onto a queue and written in the order they were pushed, so the
+  * tree is identical to one filled directly by the event loop. When all buffers are
+  * in use, GetFreeBuffer() blocks until the writer thread has emptied one.
+  */
+class vandmcWriter{
+  public:
+	/** Writer constructor. nBuffers_ is the number of event buffers in the pool and
+	  * capacity_ is the number of events to allocate up front for each buffer.
+	  */
+	vandmcWriter(const unsigned int &nBuffers_, const size_t &capacity_);
+
+	/// Destructor. Stops the writer thread and closes the output file, if needed.
+	~vandmcWriter();
+
+	/// Return a pointer to the output file, or NULL if it is not open.
+	TFile *GetFile(){ return file; }
+
+	/// Return the number of entries in the output tree.
+	long long GetEntries();
+
+	/** Open the output file and create the output tree. The eject_, recoil_, reaction_ and weight_
+	  * flags select which branches are added to the tree. Return false if the file cannot be opened.
+	  */
+	bool Open(const std::string &filename_, const bool &eject_, const bool &recoil_, const bool &reaction_, const bool &weight_);
+
+	/** Start the writer thread. The output file must not be used by any other thread until
+	  * Finish() is called.
+	  */
+	void Start();
+
+	/// Return an empty buffer from the pool, waiting for the writer thread if none are free.
+	vandmcEventBuffer *GetFreeBuffer();
+
+	/// Add a filled buffer to the end of the write queue.
+	void Push(vandmcEventBuffer *buffer_);
+
+	/// Wait until all queued buffers are written and stop the writer thread.
+	void Finish();
+
+	/// Write the output tree to the output file and close it.
+	void Close();
+
+	/// Return the profiler used to time tree fills.
+	StageProfiler *GetProfiler(){ return &profiler; }
+
+  private:
+	TFile *file; /// The output file.
+	TTree *tree; /// The output tree.
+	long long nEntries; /// The number of entries in the output tree when it was written.
+
+	ReactionProductStructure EJECTdata; /// Branch data for ejectile and gamma detector hits.
+	ReactionProductStructure RECOILdata; /// Branch data for recoil detector hits.
+	ReactionObjectStructure REACTIONdata; /// Branch data for reaction information.
+	double EVENTweight; /// Branch data for the statistical weight of the event.
+	bool writeReaction; /// Set to true if the reaction branch is filled.
+
+	StageProfiler profiler; /// Timer for tree fills.
+
+	std::vector<vandmcEventBuffer*> buffers; /// All buffers owned by the writer.
+	std::deque<vandmcEventBuffer*> freeBuffers; /// Buffers which are ready to be filled.
+	std::deque<vandmcEventBuffer*> fullBuffers; /// Buffers which are waiting to be written.
+
+	std::thread thread; /// The writer thread.
+	std::mutex lock; /// Mutex protecting the buffer queues.
+	std::condition_variable freeCondition; /// Signalled when a buffer is returned to the pool.
+	std::condition_variable fullCondition; /// Signalled when a buffer is queued or the writer should stop.
+	bool running; /// Set to true while the writer thread is running.
+	bool quit; /// Set to true when the writer thread should stop after emptying the queue.
+
+	/// Main loop for the writer thread.
+	void _write();
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// class vandmcWorker
+///////////////////////////////////////////////////////////////////////////////
+
+/** Simulates events for a single event loop thread. Each worker owns all of the
+  * state which changes from event to event (kinematics, random number state, output
+  * staging and counters) and only reads from the setup stored in the vandmc object.
+  */
+class vandmcWorker{
+  public:
+	unsigned int NgoodDetections; // Number of wanted particles detected in ejectile detectors.
+	unsigned int Ndetected; // Total number of particles detected in ejectile detectors.
+	unsigned int Nsimulated; // Total number of simulated particles.
+	unsigned int NdetHit; // Total number of particles which collided with a detector.
+	unsigned int Nreactions; // Total number of particles which react with the target.
+	unsigned int NrecoilHits;
+	unsigned int NejectileHits;
+	unsigned int NgammaHits;
+	unsigned int NvetoEvents;
+	unsigned int beam_stopped;
+	unsigned int recoil_stopped;
+	unsigned int eject_stopped;
+	double WgoodDetections; // Sum of the statistical weights of all good detections.
+
+	/** Worker constructor. sim_ is the simulation object which holds the setup, id_ is the
+	  * index of this worker and seed_ is the seed of its random number stream. The
+	  * worker uses stream number id_ of the random number engine.
+	  */
+	vandmcWorker(vandmc *sim_, const unsigned int &id_, const uint64_t &seed_);
+
+	/// Destructor.
+	~vandmcWorker();
+
+	/// Initialize the kinematics object for this worker. Return false if setup fails.
+	bool Initialize();
+
+	/// Simulate events until nWanted_ more good detections have been made.
+	void Process(const unsigned int &nWanted_);
+
+	/// Return the kinematics object used by this worker.
+	Kindeux *GetKindeux(){ return &kind; }
+
+	/// Return the profiler used to time the stages of this worker's event loop.
+	StageProfiler *GetProfiler(){ return &profiler; }
+
+	/** Give the worker an empty event buffer to fill and return the buffer it was filling.
+	  * The buffers are not owned by the worker.
+	  */
+	vandmcEventBuffer *SwapBuffer(vandmcEventBuffer *buffer_);
+
+  private:
+	vandmc *sim; // Pointer to the simulation setup
+	unsigned int id; // Index of this worker
+	RandomEngine rng; // This worker's random number stream
+	StageProfiler profiler; // Timer for each stage of the event loop
+	unsigned int backgroundWait;
+
+	Kindeux kind; // Kinematics object for this worker
+	reactData rdata; // Struct for storing reaction information
+
+	vandmcEventBuffer *buffer; // Staging buffer of output events (not owned)
+	vandmcEvent *current; // The event currently being filled
+
+	Vector3 Ejectile, Recoil;
+	Vector3 HitDetect1;
+	Vector3 RecoilSphere;
+	Vector3 EjectSphere;
+	Vector3 lab_beam_start; // The originating point of the beam particle in the lab frame
+	Vector3 lab_beam_trajectory; // The original trajectory of the beam particle before it enters the target
+	Vector3 lab_beam_interaction; // The position of the reaction inside the target
+	Vector3 lab_beam_stragtraject; // The angular straggled trajectory of the beam particle just before the reaction occurs
+	Vector3 targ_surface; // The intersection point between the beam particle and the target surface (wrt beam focus)
+	Matrix3 rotation_matrix; // The rotation matrix used to transform vectors from the beam particle frame to the lab frame
+
+	double hit_x, hit_y, hit_z; // Hit coordinates on the surface of a detector
+	double recoil_tof; // Time of flight of the recoil for the current event (s)
+	double Zdepth; // Interaction depth inside of the target (m)
+	double range_beam;
+	double Ebeam;
+	double ErecoilMod;
+	double EejectMod;
+	double Egamma;
+
+	int recoil_detections; // Number of recoil detections in the current event
+	int eject_detections; // Number of ejectile detections in the current event
+	int gamma_detections; // Number of gamma detections in the current event
+
+	std::vector<BVHCandidate> candidates; // Detectors which may be hit by the current ray
+	std::vector<unsigned int> slots; // Detector store slots of the current candidates
+	std::vector<DetectorHit> recoil_hits; // Recoil and veto detectors hit by the recoil, in the order it reaches them
+	std::vector<DetectorHit> eject_hits; // Ejectile and veto detectors hit by the ejectile, in the order it reaches them
+	std::vector<DetectorHit> gamma_hits; // Gamma detectors hit by the gamma ray, in the order it reaches them
+
+	/// Move the current event into the staging buffer and start a new one.
+	void commitEvent();
+
+	/// Find the detectors hit by the ejectile and recoil. Return true if either of them hits a veto detector.
+	bool traceVeto();
+
+	/// Trace the recoil through the recoil detectors it hits, in the order it reaches them.
+	void traceRecoil();
+
+	/// Trace the ejectile through the ejectile detectors it hits, in the order it reaches them.
+	void traceEjectile();
+
+	/// Trace a gamma ray through the gamma detectors it hits until it is detected.
+	void traceGamma();
+
+	/// Find the detectors with any of the roles in mask_ which are hit by a ray from the reaction point, in the order the ray reaches them.
+	size_t findHits(const Vector3 &direction_, const unsigned int &mask_, std::vector<DetectorHit> &hits_);
+
+	/// Trace a particle (0=recoil, 1=ejectile, 2=gamma) through a single detector hit. Return true if the detector was hit.
+	bool traceDetector(const int &type_, const DetectorHit &hit_, const Vector3 &direction_);
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// class vandmcCache
+///////////////////////////////////////////////////////////////////////////////
+
+/** Setup data which may be shared between several simulations run by the same process.
+  * Material libraries, range tables and detector files are built once and reused by every
+  * simulation whose inputs are identical, so a parameter sweep only pays for the
+  * parts of the setup which actually change between its variants.
+  *
+  * Range tables may also be kept in a cache directory on disk, so that they are reused
+  * by later runs. Each file is named after a hash of everything used to build the table
+  * (the material signature, the stopping power model, the particle charge and mass, the energy
+  * range and the number of entries) and also stores the full key, so a table is rebuilt whenever
+  * any of them change.
+  */
+class vandmcCache{
+  public:
+	/// Default constructor.
+	vandmcCache() : directoryWarning(false), tabulated(NULL), nTableHits(0), nDiskHits(0), nDetectorHits(0) { }
+
+	/// Destructor.
+	~vandmcCache();
+
+	/** Return the library of materials for a directory of material (.mat) files, building it the first time it
+	  * is requested. The library also contains the materials built into vandmc, which are replaced by any files
+	  * with the same name. An empty dirname_ gives only the built-in materials. The library is owned by the cache.
+	  * Return NULL if the directory could not be opened.
+	  */
+	MaterialLibrary *GetMaterialLibrary(const std::string &dirname_);
+
+	/** Return the stopping power model with a given name, used to build range tables. "tabulated" gives a
+	  * TabulatedStoppingPower, which is built the first time it is requested and is owned by the cache. Return
+	  * NULL for "bethe" (and any other name), which builds range tables using Material::StopPower.
+	  */
+	StoppingPowerModel *GetStoppingPowerModel(const std::string &name_);
+
+	/** Set the directory used to store range tables between runs, creating it if needed. An empty
+	  * string disables the directory. Return false if the directory could not be created.
+	  */
+	bool SetDirectory(const std::string &directory_);
+
+	/// Return the directory used to store range tables between runs (empty if disabled).
+	const std::string &GetDirectory() const { return directory; }
+
+	/** Return a range table for a particle with charge Z_ and mass mass_ (in MeV/c^2) in a material.
+	  * The table is built (or loaded from the cache directory) the first time it is requested and
+	  * shared by all later requests with identical arguments. The stopping powers are calculated using model_, or
+	  * using Material if model_ is NULL. The returned table is owned by the cache.
+	  */
+	RangeTable *GetRangeTable(const unsigned int &num_entries_, const double &startE_, const double &stopE_, const double &Z_, const double &mass_, Material *mat_, StoppingPowerModel *model_=NULL);
+
+	/** Return a range table with log-spaced energies for a particle with charge Z_ and mass mass_ (in MeV/c^2) in a
+	  * material, built with RangeTable::InitAdaptive to a relative energy tolerance of tolerance_. The table is shared
+	  * in the same way as those returned by GetRangeTable. The returned table is owned by the cache.
+	  */
+	RangeTable *GetAdaptiveRangeTable(const double &startE_, const double &stopE_, const double &Z_, const double &mass_, Material *mat_, const double &tolerance_=1E-6, StoppingPowerModel *model_=NULL);
+
+	/// A range table requested from GetAdaptiveRangeTables.
+	struct tableRequest{
+		double startE, stopE; /// Energy range of the table (MeV).
+		double Z, mass; /// Charge and mass (MeV/c^2) of the particle.
+		Material *mat; /// The material the particle travels through.
+		RangeTable *table; /// Set to the table, which is owned by the cache.
+
+		tableRequest(const double &startE_, const double &stopE_, const double &Z_, const double &mass_, Material *mat_) : startE(startE_), stopE(stopE_), Z(Z_), mass(mass_), mat(mat_), table(NULL) { }
+	};
+
+	/** Find, load or build the log-spaced range tables for a list of requests, and set the table of each request.
+	  * Tables which must be built are built using pool_. If there are at least as many of them as there are threads,
+	  * several tables are built at once. Otherwise the tables are built one at a time, with the entries of each table
+	  * split between the threads. The tables are the same however they are built. The stopping powers are calculated
+	  * using model_, or using Material if model_ is NULL.
+	  */
+	void GetAdaptiveRangeTables(std::vector<tableRequest> &requests_, const double &tolerance_, ThreadPool *pool_, StoppingPowerModel *model_=NULL);
+
+	/** Build new detectors from a detector setup file and add them to a vector of pointers. The file
+	  * is only read the first time it is requested. The detectors, and the walls and rings added
+	  * to arrays_ if it is not NULL, are owned by the caller.
+	  * Returns the number of detectors in the vector, or -1 if the file could not be opened.
+	  */
+	int GetDetectors(const std::string &fname_, std::vector<Primitive*> &detectors_, std::vector<DetectorArray*> *arrays_=NULL);
+
+	/// Return the number of range tables which were reused instead of built.
+	unsigned int GetNumTableHits() const { return nTableHits; }
+
+	/// Return the number of range tables which were loaded from the cache directory instead of built.
+	unsigned int GetNumDiskHits() const { return nDiskHits; }
+
+	/// Return the number of detector files which were reused instead of read.
+	unsigned int GetNumDetectorHits() const { return nDetectorHits; }
+
+  private:
+	/// Arguments which uniquely identify a range table.
+	struct tableKey{
+		std::string material; /// Signature of the material, so that materials which share a name but differ are kept apart.
+		std::string model; /// Signature of the stopping power model, or empty for Material::StopPower.
+		unsigned int entries; /// Number of entries, or zero for an adaptive table.
+		double tolerance; /// Relative energy tolerance of an adaptive table, or zero.
+		double startE, stopE;
+		double Z, mass;
+
+		bool operator < (const tableKey &rhs) const;
+	};
+
+	/// Return a string which describes everything used to build a range table.
+	static std::string getTableKey(const unsigned int &num_entries_, const double &tolerance_, const double &startE_, const double &stopE_, const double &Z_, const double &mass_, Material *mat_, StoppingPowerModel *model_);
+
+	/// Find, load or build a range table with num_entries_ linear entries, or an adaptive table if num_entries_ is zero.
+	RangeTable *getRangeTable(const unsigned int &num_entries_, const double &tolerance_, const double &startE_, const double &stopE_, const double &Z_, const double &mass_, Material *mat_, StoppingPowerModel *model_);
+
+	/** Return a range table with num_entries_ linear entries (or an adaptive table if num_entries_ is zero) which has
+	  * already been built, or load it from the cache directory, and set filled to true. Otherwise, add a new empty
+	  * table, set filled to false and set tableKey_ to the key which must be passed to storeRangeTable once it is filled.
+	  */
+	RangeTable *findRangeTable(const unsigned int &num_entries_, const double &tolerance_, const double &startE_, const double &stopE_, const double &Z_, const double &mass_, Material *mat_, StoppingPowerModel *model_, bool &filled, std::string &tableKey_);
+
+	/// Store a newly filled range table in the cache directory, if there is one.
+	void storeRangeTable(RangeTable *table_, const std::string &tableKey_);
+
+	/// Return the name of the file in the cache directory which stores the range table with a given key.
+	std::string getTableFilename(const std::string &tableKey_) const;
+
+	std::string directory; /// Directory used to store range tables between runs.
+	bool directoryWarning; /// Set to true once a warning has been printed for a table which could not be written.
+
+	std::map<std::string, MaterialLibrary*> libraries; /// Material libraries by directory.
+	TabulatedStoppingPower *tabulated; /// The tabulated stopping power model, or NULL if it has not been requested.
+	std::map<tableKey, RangeTable*> tables; /// Range tables which have already been built.
+	std::map<std::string, std::vector<NewVIKARdet> > detectorFiles; /// Entries of detector files which have already been read.
+
+	unsigned int nTableHits; /// Number of range tables which were reused.
+	unsigned int nDiskHits; /// Number of range tables which were loaded from the cache directory.
+	unsigned int nDetectorHits; /// Number of detector files which were reused.
+};
+
 ///////////////////////////////////////////////////////////////////////////////
 // class vandmc
 ///////////////////////////////////////////////////////////////////////////////
 
 class vandmc{
+	friend class vandmcWorker;
+
   public:
 	vandmc(){ initialize(); }
 
 	bool Execute(int argc, char *argv[]);
 
+	/** Run a single simulation using the current options. Shared setup data is taken from
+	  * cache_, or built from scratch if cache_ is NULL.
+	  */
+	bool Run(vandmcCache *cache_=NULL);
+
   private:
 	Kindeux kind; // Main kinematics object
 	Target targ; // The physical target
 	Efficiency bar_eff; // VANDLE bar efficiencies
 	std::vector<Primitive*> vandle_bars; // Vector of Primitive detectors
+	std::vector<DetectorArray*> detector_arrays; // Walls and rings of detectors in vandle_bars
+	std::vector<Primitive*> veto_dets; // Detectors which veto events (not owned)
+	std::vector<Primitive*> recoil_dets; // Detectors which detect recoils (not owned)
+	std::vector<Primitive*> eject_dets; // Detectors which detect ejectiles (not owned)
+	std::vector<Primitive*> gamma_dets; // Detectors which detect gamma rays (not owned)
+	std::vector<Primitive*> particle_dets; // Detectors which detect recoils or ejectiles (not owned)
+	DetectorBVH detector_tree; // Bounding volume hierarchy of all detectors
+	DetectorStore detector_store; // Structure-of-arrays copy of all detectors
+	AngularGrid detector_grid; // Angular lookup grid of all detectors, as seen from the target
 
 	RangeTable beam_targ; // Range table for beam in target
 	RangeTable eject_targ; // Pointer to the range table for ejectile in target
@@ -113,29 +547,12 @@ class vandmc{
 	Particle recoil_part; // Recoil particle
 	Particle eject_part;// Ejectile particle
 	Particle beam_part; // Beam particle
-	
-	double hit_x, hit_y, hit_z; // Hit coordinates on the surface of a detector
 
-	Vector3 ZeroVector; // The zero vector
-	Vector3 Ejectile, Recoil, Gamma;
-	Vector3 HitDetect1, HitDetect2;
-	Vector3 RecoilSphere;
-	Vector3 EjectSphere;
-	Vector3 GammaSphere;
 	Vector3 lab_beam_focus; // The focal point for the beam. Non-cylindrical beam particles will originate from this point.
-	Vector3 lab_beam_start; // The originating point of the beam particle in the lab frame
-	Vector3 lab_beam_trajectory; // The original trajectory of the beam particle before it enters the target
-	Vector3 lab_beam_interaction; // The position of the reaction inside the target
-	Vector3 lab_beam_stragtraject; // The angular straggled trajectory of the beam particle just before the reaction occurs
-	Vector3 targ_surface; // The intersection point between the beam particle and the target surface (wrt beam focus)
-	Vector3 interaction; // The interaction point inside the target (wrt beam focus)
-	Matrix3 rotation_matrix; // The rotation matrix used to transform vectors from the beam particle frame to the lab frame
 
-	double Zdepth; // Interaction depth inside of the target (m)
-	double range_beam;
-		
 	unsigned int num_materials;
-	std::vector<Material> materials; // Array of materials
+	std::vector<Material> materials; // Array of the materials used by the target and the detectors
+	std::unordered_map<std::string, unsigned int> material_ids; // Index of each material in the array by name
 	
 	unsigned int targ_mat_id; // The ID number of the target material
 	std::string targ_mat_name; // The name of the target material
@@ -146,20 +563,18 @@ class vandmc{
 	double *totXsect;
 	double gsQvalue;
 
-	double Ebeam, Ebeam0;
-	double ErecoilMod;
-	double EejectMod;
-	double Egamma;
+	double Ebeam0;
 		
 	double beamspot; // Beamspot diameter (m) (on the surface of the target)
 	double beamEspread; // Beam energy spread (MeV)
 	double beamAngdiv; // Beam angular divergence (radians)
+	double rangeTolerance; // Relative energy tolerance of the range tables
+	std::string stoppingModel; // Stopping power model used to build the range tables (bethe or tabulated)
 
 	double timeRes; // Pixie-16 time resolution (s)
 	double BeamRate; // Beam rate (1/s)
 
 	unsigned int backgroundRate;
-	unsigned int backgroundWait;
 	double detWindow;
 	bool bgPerDetection;
 	
@@ -179,7 +594,13 @@ class vandmc{
 	unsigned int NdetGamma; // Total number of gamma detectors
 	unsigned int NdetVeto; // Total number of particle vetos
 	unsigned int BeamType; // The type of beam to simulate (0=gaussian, 1=cylindrical, 2=halo)
-	clock_t timer; // Clock object for calculating time taken and remaining
+	unsigned int beam_stopped; // Number of beam particles which stopped in the target
+	unsigned int recoil_stopped; // Number of recoil particles which stopped in the target
+	unsigned int eject_stopped; // Number of ejectile particles which stopped in the target
+	double WgoodDetections; // Sum of the statistical weights of all good detections.
+	unsigned int nThreads; // Number of event loop threads
+	uint64_t randomSeed; // Seed used to generate the random number stream of each thread
+	std::chrono::steady_clock::time_point timer; // Wall clock for calculating time taken and remaining
 
 	bool InverseKinematics;
 	bool InCoincidence;
@@ -189,8 +610,12 @@ class vandmc{
 	bool SupplyRates;
 	bool BeamFocus;
 	bool DoRutherford;
+	bool use_target_eloss;
+	bool useBias; // Sample reaction angles preferentially inside the ejectile detector acceptance
+	bool doProfile; // Time each stage of the event loop
 	bool echoMode;
 	bool printParams;
+	bool batchMode; // Run without prompting the user or pausing
 	unsigned int ADists;
 	
 	bool have_recoil_det;
@@ -199,8 +624,18 @@ class vandmc{
 	bool have_veto_det;
 
 	std::string detector_filename;
+	std::string excitation_filename; // Excitation function used to weight the reaction depth in the target (empty for uniform)
 	std::string input_filename;
 	std::string output_filename;
+	std::string sweep_filename;
+	std::string cache_dirname; // Directory used to store range tables between runs (empty to disable)
+	std::string material_dirname; // Directory of material (.mat) files (empty for the built-in materials only)
+
+	std::vector<vandmcParameter> overrides; // Config file parameters which replace those in the input file
+	int sweepIndex; // Index of this simulation in a parameter sweep (-1 if not part of a sweep)
+	vandmcCache *cache; // Setup data shared with other simulations (not owned)
+
+	AcceptanceMap *acceptance; // Ejectile detector acceptance map used for biased sampling
 
 	vandmcParameterReader reader; // Config file
 	optionHandler handler;
@@ -214,6 +649,25 @@ class vandmc{
 	bool setup(int argc, char *argv[]);
 	
 	void print();
+
+	/** Read a sweep file. Each line of the file defines one variant of the input configuration
+	  * as a tab-separated list of NAME=VALUE overrides. Return false if the file cannot be read.
+	  */
+	bool readSweep(const char *fname, std::vector<std::vector<vandmcParameter> > &variants);
+
+	/// Run one simulation for each variant in the sweep file, sharing setup data between them.
+	bool runSweep();
+
+	/** Copy a material from a library to the array of materials, unless it is already in the array.
+	  * Return false if the library does not contain the material.
+	  */
+	bool addMaterial(MaterialLibrary *library_, const std::string &name_);
+
+	/// Setup a kinematics object for nStates_ recoil states using the reaction parameters.
+	bool initKinematics(Kindeux &kind_, const unsigned int &nStates_);
+
+	/// Return the wall time since the start of the event loop (in seconds).
+	float getElapsedTime();
 };
 
 #endif
@@ -16,6 +16,7 @@
 #include <string>
 #include <string.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <iostream>
 #include <fstream>
 #include <sstream>
@@ -123,6 +124,63 @@ class Line{
 	bool Intersect(const Ray &ray_, Vector3 &p);
 };
 
+/** Pseudo-random number engine using the xoshiro256** generator (D. Blackman
+  * and S. Vigna). Each engine has its own state, so engines on different threads
+  * never interfere. A seed is shared between streams and each stream is started
+  * 2^128 draws apart from the previous one using the jump polynomial.
+  */
+class RandomEngine{
+  private:
+	uint64_t state[4]; /// The internal state of the generator.
+	uint64_t seed; /// The seed used to initialize the generator.
+	unsigned int stream; /// The ID of the stream selected by the jump function.
+
+	/// Rotate a 64-bit integer left by k bits.
+	static uint64_t rotl(const uint64_t &x, const int &k){ return (x << k) | (x >> (64 - k)); }
+
+  public:
+	/// Engine constructor. Use stream number stream_ of seed seed_.
+	RandomEngine(const uint64_t &seed_=0, const unsigned int &stream_=0){ Seed(seed_, stream_); }
+
+	/// Reset the engine to the start of stream number stream_ of seed seed_.
+	void Seed(const uint64_t &seed_, const unsigned int &stream_=0);
+
+	/// Advance the engine by 2^128 draws.
+	void Jump();
+
+	/// Return the seed used to initialize the engine.
+	uint64_t GetSeed() const { return seed; }
+
+	/// Return the ID of the stream used by the engine.
+	unsigned int GetStream() const { return stream; }
+
+	/// Return the next 64-bit random integer.
+	uint64_t Next(){
+		const uint64_t retval = rotl(state[1] * 5, 7) * 9;
+		const uint64_t t = state[1] << 17;
+		state[2] ^= state[0];
+		state[3] ^= state[1];
+		state[1] ^= state[2];
+		state[0] ^= state[3];
+		state[2] ^= t;
+		state[3] = rotl(state[3], 45);
+		return retval;
+	}
+
+	/// Return a random number uniformly distributed on [0, 1).
+	double Uniform(){ return (Next() >> 11) * (1.0/9007199254740992.0); }
+};
+
+/** Set the seed of the random number engines used by functions which are not passed an explicit engine.
+  * Each thread reseeds its engine with its own stream of seed_ the next time it asks for it.
+  */
+void SetDefaultRandomSeed(const uint64_t &seed_);
+
+/** Return the random number engine used by functions which are not passed an explicit engine. Each thread
+  * gets its own stream of the default seed, numbered in the order in which the threads first ask for it.
+  */
+RandomEngine &GetDefaultRandomEngine();
+
 class AngularDist{
   private:
 	double *com_theta; /// Array for storing the center of mass angle of the distribution (rad).
@@ -158,8 +216,14 @@ class AngularDist{
 	/// Return the total reaction cross section (mb).
 	double GetReactionXsection(){ return reaction_xsection; }
 	
+	/// Return the angle at which the cumulative distribution reaches a fraction frac_ of the total (rad).
+	double GetAngle(const double &frac_);
+
 	/// Return a random angle sampled from the distribution (rad).
-	double Sample();
+	double Sample(RandomEngine &rng_);
+
+	/// Return a random angle sampled from the distribution (rad) using the default engine.
+	double Sample(){ return Sample(GetDefaultRandomEngine()); }
 };
 
 /////////////////////////////////////////////////////////////////////
@@ -168,8 +232,11 @@ class AngularDist{
 
 bool IsInVector(const std::string &input_, const std::vector<std::string> &str_vector_);
 void RandomGauss(double fwhm_, double offset_, Vector3 &beam);
+void RandomGauss(RandomEngine &rng_, double fwhm_, double offset_, Vector3 &beam);
 void RandomCircle(double radius_, double offset_, Vector3 &beam);
+void RandomCircle(RandomEngine &rng_, double radius_, double offset_, Vector3 &beam);
 void RandomHalo(double fwhm_, double offset_, Vector3 &beam);
+void RandomHalo(RandomEngine &rng_, double fwhm_, double offset_, Vector3 &beam);
 bool SetBool(std::string input_, std::string text_, bool &output);
 bool SetBool(std::string input_, bool &output);
 bool Prompt(std::string prompt_);
@@ -181,14 +248,20 @@ double dabs(double);
 double min(double, double);
 double max(double, double);
 double frand();
+double frand(RandomEngine&);
 double frand(double, double);
+double frand(RandomEngine&, double, double);
 void UnitSphereRandom(Vector3&);
+void UnitSphereRandom(RandomEngine&, Vector3&);
 void UnitSphereRandom(double&, double&);
+void UnitSphereRandom(RandomEngine&, double&, double&);
 double UnitCircleRandom();
+double UnitCircleRandom(RandomEngine&);
 double WrapValue(double, double, double);
 unsigned int GetLines(const char*);
 double radlength(unsigned int, unsigned int);
 double rndgauss0(double);
+double rndgauss0(RandomEngine&, double);
 void straggleA(double&, double, double, double, double, double);
 double Interpolate(double, double, double, double, double);
 bool Interpolate(const double &x, double &y, double *x_, double *y_, const size_t &len_);
@@ -0,0 +1,209 @@
+/** \file acceptance.cpp
+ * \brief Ejectile detector acceptance map used for biased reaction sampling.
+ */
+#include <algorithm>
+
+#include "acceptance.hpp"
+#include "kindeux.hpp"
+#include "bvh.hpp"
+#include "detectorStore.hpp"
+
+/** Largest number of detectors for which each row of test rays is traced as one batch. Every ray
+  * of a batch is tested against every box which it may hit, so for larger setups it is faster to
+  * let the bounding volume hierarchy select the candidates for each ray.
+  */
+const size_t maxBatchDetectors = 64;
+
+/////////////////////////////////////////////////////////////////////
+// AcceptanceMap
+/////////////////////////////////////////////////////////////////////
+
+/** Map constructor. nTheta_ and nPhi_ are the number of bins used for the center of mass
+  * angle and azimuthal angle of the ejectile, nEnergy_ is the number of reaction energy bins
+  * and mixing_ is the fraction of reactions which are sampled without any bias.
+  */
+AcceptanceMap::AcceptanceMap(const unsigned int &nTheta_/*=120*/, const unsigned int &nPhi_/*=120*/, const unsigned int &nEnergy_/*=6*/, const double &mixing_/*=0.02*/) :
+	nTheta(nTheta_ > 0 ? nTheta_ : 1), nPhi(nPhi_ > 0 ? nPhi_ : 1), nEnergy(nEnergy_ > 0 ? nEnergy_ : 1), nCells(0), nStates(0),
+	mixing(mixing_), Emin(0.0), Emax(0.0), Estep(0.0), init(false) {
+	nCells = nTheta*nPhi;
+
+	// The unbiased fraction must be non-zero, otherwise any region missed by
+	// the map could never be sampled and the weights would be biased.
+	if(mixing <= 0.0 || mixing > 1.0){ mixing = 0.02; }
+}
+
+/// Return the fraction of angle bins for a recoil state which are accepted, averaged over all energy bins.
+double AcceptanceMap::GetAcceptedFraction(const unsigned int &state_) const {
+	if(!init || state_ >= nStates){ return 1.0; }
+	double total = 0.0;
+	for(unsigned int i = 0; i < nEnergy; i++){
+		total += cells[state_*nEnergy+i].size();
+	}
+	return total/(nEnergy*nCells);
+}
+
+/** Build the map for all recoil states of a kinematics object. A bin is accepted if an ejectile
+  * emitted from origin_ in any part of the bin (or any neighbouring bin) intersects one of the
+  * detectors. Emin_ and Emax_ are the range of reaction energies to map (MeV). Return false if
+  * the map cannot be built.
+  */
+bool AcceptanceMap::Build(Kindeux *kind_, const std::vector<Primitive*> &detectors_, const Vector3 &origin_, const double &Emin_, const double &Emax_){
+	init = false;
+	if(!kind_ || detectors_.empty() || Emax_ <= Emin_){ return false; }
+
+	nStates = (kind_->GetNrecoilStates() > 0 ? kind_->GetNrecoilStates() : 1);
+	Emin = Emin_;
+	Emax = Emax_;
+	Estep = (Emax-Emin)/nEnergy;
+
+	mask.assign(nStates*nEnergy*nCells, 0);
+	cells.assign(nStates*nEnergy, std::vector<unsigned int>());
+
+	// Each bin is tested at its center, its corners and the midpoints of its edges.
+	const unsigned int nSubTheta = 2*nTheta+1;
+	const unsigned int nSubPhi = 2*nPhi+1;
+	std::vector<unsigned char> hits(nSubTheta*nSubPhi);
+	std::vector<unsigned char> raw(nEnergy*nCells);
+
+	// Small setups trace each row of test rays as one batch. Otherwise, only the detectors
+	// whose bounding box is crossed by a ray need to be tested.
+	const bool batchRays = (detectors_.size() <= maxBatchDetectors);
+	DetectorBVH tree;
+	if(!batchRays){ tree.Build(detectors_); }
+	DetectorStore store(detectors_);
+	std::vector<BVHCandidate> candidates;
+	std::vector<unsigned int> slots;
+	std::vector<DetectorHit> detHits;
+	std::vector<Vector3> directions(nSubPhi);
+	std::vector<unsigned char> rowHits;
+
+	for(unsigned int state = 0; state < nStates; state++){
+		double excitation = kind_->GetRecoilExState(state);
+		for(unsigned int ebin = 0; ebin < nEnergy; ebin++){
+			double energy = Emin + (ebin+0.5)*Estep;
+			for(unsigned int i = 0; i < nSubTheta; i++){
+				unsigned char *rowHit = &hits[i*nSubPhi];
+				double labTheta = kind_->ConvertAngle2Lab(energy, excitation, kind_->GetComAngle(state, i/(2.0*nTheta)));
+				if(labTheta != labTheta){ // The reaction is not allowed at this energy.
+					std::fill(rowHit, rowHit+nSubPhi, 0);
+					continue;
+				}
+				for(unsigned int j = 0; j < nSubPhi; j++){
+					Sphere2Cart(Vector3(1.0, labTheta, 2*pi*j/(2.0*nPhi)), directions[j]);
+				}
+				if(batchRays){
+					store.IntersectAny(origin_, directions, rowHits);
+					std::copy(rowHits.begin(), rowHits.end(), rowHit);
+					continue;
+				}
+				for(unsigned int j = 0; j < nSubPhi; j++){
+					rowHit[j] = 0;
+					if(tree.GetCandidates(origin_, directions[j], candidates) == 0){ continue; }
+					slots.clear();
+					for(std::vector<BVHCandidate>::const_iterator iter = candidates.begin(); iter != candidates.end(); iter++){
+						slots.push_back(store.GetSlot(iter->index));
+					}
+					std::sort(slots.begin(), slots.end());
+					detHits.clear();
+					if(store.Intersect(origin_, directions[j], slots, detHits) > 0){ rowHit[j] = 1; }
+				}
+			}
+
+			// A bin is hit if any of its test points are hit.
+			for(unsigned int i = 0; i < nTheta; i++){
+				for(unsigned int j = 0; j < nPhi; j++){
+					unsigned char &cell = raw[ebin*nCells+i*nPhi+j];
+					cell = 0;
+					for(unsigned int di = 0; di <= 2 && !cell; di++){
+						for(unsigned int dj = 0; dj <= 2; dj++){
+							if(hits[(2*i+di)*nSubPhi+2*j+dj]){
+								cell = 1;
+								break;
+							}
+						}
+					}
+				}
+			}
+		}
+
+		// Accept all neighbours of hit bins to account for the finite beam spot, beam divergence
+		// and straggling, which are not included in the map. Phi wraps around.
+		for(unsigned int ebin = 0; ebin < nEnergy; ebin++){
+			std::vector<unsigned int> &list = cells[state*nEnergy+ebin];
+			for(unsigned int i = 0; i < nTheta; i++){
+				for(unsigned int j = 0; j < nPhi; j++){
+					bool accept = false;
+					for(int de = -1; de <= 1 && !accept; de++){
+						int e = ebin + de;
+						if(e < 0 || e >= (int)nEnergy){ continue; }
+						for(int di = -1; di <= 1 && !accept; di++){
+							int t = i + di;
+							if(t < 0 || t >= (int)nTheta){ continue; }
+							for(int dj = -1; dj <= 1; dj++){
+								int p = (j + dj + nPhi) % nPhi;
+								if(raw[e*nCells+t*nPhi+p]){
+									accept = true;
+									break;
+								}
+							}
+						}
+					}
+					if(accept){
+						mask[(state*nEnergy+ebin)*nCells+i*nPhi+j] = 1;
+						list.push_back(i*nPhi+j);
+					}
+				}
+			}
+		}
+	}
+
+	return (init = true);
+}
+
+/** Sample a point in the center of mass. Reaction energies outside of the mapped range are
+  * sampled without bias. Return the statistical weight of the sampled point.
+  * param[in] rng_ The random number engine to use.
+  * param[in] state_ The recoil excitation state of the reaction.
+  * param[in] Ereact_ The energy of the beam particle at the reaction point (MeV).
+  * param[out] thetaFrac The cumulative fraction of the center of mass angle distribution, in [0, 1).
+  * param[out] phiFrac The azimuthal angle of the ejectile as a fraction of 2*pi, in [0, 1).
+  */
+double AcceptanceMap::Sample(RandomEngine &rng_, const unsigned int &state_, const double &Ereact_, double &thetaFrac, double &phiFrac) const {
+	const std::vector<unsigned int> *list = NULL;
+	unsigned int index = 0;
+	if(init && state_ < nStates && Ereact_ >= Emin && Ereact_ < Emax){
+		unsigned int ebin = (unsigned int)((Ereact_-Emin)/Estep);
+		if(ebin >= nEnergy){ ebin = nEnergy-1; }
+		index = state_*nEnergy+ebin;
+		list = &cells[index];
+	}
+
+	if(!list || list->empty()){ // Sample without bias.
+		thetaFrac = rng_.Uniform();
+		phiFrac = rng_.Uniform();
+		return 1.0;
+	}
+
+	// Select a bin. The proposal is a mixture of the unbiased distribution and a
+	// uniform distribution over the accepted bins.
+	unsigned int cell;
+	if(rng_.Uniform() < mixing){
+		cell = (unsigned int)(rng_.Uniform()*nCells);
+		if(cell >= nCells){ cell = nCells-1; }
+	}
+	else{
+		unsigned int entry = (unsigned int)(rng_.Uniform()*list->size());
+		if(entry >= list->size()){ entry = list->size()-1; }
+		cell = (*list)[entry];
+	}
+
+	// Select a point uniformly inside the bin.
+	thetaFrac = ((cell / nPhi) + rng_.Uniform())/nTheta;
+	phiFrac = ((cell % nPhi) + rng_.Uniform())/nPhi;
+
+	// Every bin has an unbiased probability of 1/nCells.
+	double probability = mixing;
+	if(mask[index*nCells+cell]){ probability += (1.0-mixing)*nCells/list->size(); }
+
+	return 1.0/probability;
+}
@@ -0,0 +1,182 @@
+/** \file angularGrid.cpp
+ * \brief Angular lookup grid used to find the detectors which may be hit by rays from the target.
+ */
+#include <algorithm>
+#include <limits>
+#include <cmath>
+
+#include "angularGrid.hpp"
+
+/// Padding added to every detector bounding sphere to guard against rounding errors (m).
+const double spherePadding = 1E-6;
+
+/// Padding added to every angular comparison to guard against rounding errors (rad).
+const double anglePadding = 1E-9;
+
+/** Return true if the ray (offset_ + t * direction_) crosses the box between lower_ and upper_,
+  * grown by pad_ in every direction, for t >= 0.
+  */
+bool clipBounds(const Vector3 &offset_, const Vector3 &direction_, const Vector3 &lower_, const Vector3 &upper_, const double &pad_){
+	double tEntry = 0.0;
+	double tExit = std::numeric_limits<double>::max();
+	for(int i = 0; i < 3; i++){
+		double low = lower_.axis[i] - pad_ - offset_.axis[i];
+		double high = upper_.axis[i] + pad_ - offset_.axis[i];
+		if(direction_.axis[i] == 0.0){
+			if(low > 0.0 || high < 0.0){ return false; }
+			continue;
+		}
+		double t1 = low/direction_.axis[i];
+		double t2 = high/direction_.axis[i];
+		if(t1 > t2){ std::swap(t1, t2); }
+		if(t1 > tEntry){ tEntry = t1; }
+		if(t2 < tExit){ tExit = t2; }
+		if(tEntry > tExit){ return false; }
+	}
+	return true;
+}
+
+/////////////////////////////////////////////////////////////////////
+// AngularGrid
+/////////////////////////////////////////////////////////////////////
+
+/// Constructor which builds the grid for a list of detectors.
+AngularGrid::AngularGrid(const std::vector<Primitive*> &detectors_, const Vector3 &center_, const double &radius_, const unsigned int &nTheta_/*=180*/, const unsigned int &nPhi_/*=360*/){
+	Build(detectors_, center_, radius_, nTheta_, nPhi_);
+}
+
+/// Return the number of cells which do not contain any detectors.
+size_t AngularGrid::GetNumEmptyCells() const {
+	size_t count = 0;
+	for(unsigned int i = 0; i < nTheta*nPhi; i++){
+		if(cellStart[i+1] == cellStart[i]){ count++; }
+	}
+	return count;
+}
+
+/** Build the grid for a list of detectors, for rays which start within radius_ (in m) of center_.
+  * The directions are divided into nTheta_ cells in theta and nPhi_ cells in phi. The detectors
+  * are not owned by the grid, and the grid must be rebuilt if any of them are moved, rotated or resized.
+  */
+void AngularGrid::Build(const std::vector<Primitive*> &detectors_, const Vector3 &center_, const double &radius_, const unsigned int &nTheta_/*=180*/, const unsigned int &nPhi_/*=360*/){
+	Clear();
+	if(detectors_.empty() || nTheta_ == 0 || nPhi_ == 0 || radius_ < 0.0){ return; }
+
+	center = center_;
+	radius = radius_;
+	nTheta = nTheta_;
+	nPhi = nPhi_;
+	thetaStep = pi/nTheta;
+	phiStep = 2*pi/nPhi;
+	numDetectors = detectors_.size();
+
+	// The unit vector through the center of each cell.
+	std::vector<Vector3> cellAxes(nTheta*nPhi);
+	for(unsigned int i = 0; i < nTheta; i++){
+		for(unsigned int j = 0; j < nPhi; j++){
+			Sphere2Cart(1.0, (i+0.5)*thetaStep, (j+0.5)*phiStep, cellAxes[i*nPhi+j]);
+		}
+	}
+
+	// Every direction in a cell lies within this angle of the direction through its center.
+	// Moving half a cell in theta and then half a cell in phi reaches any point in the cell,
+	// and a step in phi is longest where sin(theta) is largest.
+	std::vector<double> cellSize(nTheta);
+	for(unsigned int i = 0; i < nTheta; i++){
+		double maxSin = (i*thetaStep <= pi/2 && (i+1)*thetaStep >= pi/2 ? 1.0 : std::max(std::sin(i*thetaStep), std::sin((i+1)*thetaStep)));
+		cellSize[i] = thetaStep/2 + maxSin*phiStep/2 + anglePadding;
+	}
+
+	std::vector<std::vector<unsigned int> > cells(nTheta*nPhi);
+	Vector3 lower, upper, position, unitX, unitY, unitZ;
+	for(unsigned int index = 0; index < numDetectors; index++){
+		Primitive *prim = detectors_[index];
+
+		// Place a sphere around the detector bounding box.
+		prim->GetBoundingBox(lower, upper);
+		Vector3 axis = (lower + upper)*0.5 - center;
+		double reach = (upper - lower).Length()/2 + spherePadding + radius;
+		double dist = axis.Normalize();
+
+		// Any ray which starts inside the region and crosses the sphere points into a cone of half angle
+		// asin(reach/dist) around the axis, since the set of vectors from the region to the sphere is
+		// itself a sphere of radius reach. If the region and the sphere overlap, the ray may point anywhere.
+		double coneAngle = (dist > reach ? std::asin(reach/dist) : pi);
+		double axisTheta = std::acos(std::max(-1.0, std::min(1.0, axis.axis[2])));
+
+		// The detector bounds and the center of the region in the local detector frame.
+		prim->GetLocalBounds(lower, upper);
+		prim->GetPosition(position);
+		prim->GetUnitVector(1, unitX);
+		prim->GetUnitVector(4, unitY);
+		prim->GetUnitVector(0, unitZ);
+		Vector3 localCenter((center-position).Dot(unitX), (center-position).Dot(unitY), (center-position).Dot(unitZ));
+		double farthest = dist + reach;
+
+		for(unsigned int i = 0; i < nTheta; i++){
+			// Two directions are at least as far apart as their polar angles.
+			if(axisTheta + coneAngle + anglePadding < i*thetaStep || axisTheta - coneAngle - anglePadding > (i+1)*thetaStep){ continue; }
+			double limit = coneAngle + cellSize[i];
+			double cosLimit = (limit < pi ? std::cos(limit) : -1.0);
+
+			// A ray in the cell which starts inside the region stays within this distance of the ray through
+			// the center of the cell from the center of the region, up to the far side of the detector.
+			double spread = radius + spherePadding + farthest*cellSize[i];
+			for(unsigned int j = 0; j < nPhi; j++){
+				const Vector3 &cellAxis = cellAxes[i*nPhi+j];
+				if(axis.Dot(cellAxis) < cosLimit){ continue; }
+				Vector3 localAxis(cellAxis.Dot(unitX), cellAxis.Dot(unitY), cellAxis.Dot(unitZ));
+				if(clipBounds(localCenter, localAxis, lower, upper, spread)){ cells[i*nPhi+j].push_back(index); }
+			}
+		}
+	}
+
+	// Pack the cell lists into a single array.
+	cellStart.resize(nTheta*nPhi+1);
+	cellStart[0] = 0;
+	for(unsigned int i = 0; i < nTheta*nPhi; i++){
+		cellStart[i+1] = cellStart[i] + cells[i].size();
+	}
+	cellItems.reserve(cellStart.back());
+	for(unsigned int i = 0; i < nTheta*nPhi; i++){
+		cellItems.insert(cellItems.end(), cells[i].begin(), cells[i].end());
+	}
+}
+
+/// Remove all detectors from the grid.
+void AngularGrid::Clear(){
+	center = Vector3(0.0, 0.0, 0.0);
+	radius = 0.0;
+	nTheta = 0;
+	nPhi = 0;
+	thetaStep = 0.0;
+	phiStep = 0.0;
+	numDetectors = 0;
+	cellStart.clear();
+	cellItems.clear();
+}
+
+/** Find the detectors which may be hit by the ray (origin_ + t * direction_) for t >= 0. On success, candidates
+  * points to count indices into the list used to build the grid, in ascending order. The list contains every
+  * detector which the ray crosses, but the ray may miss some of them. Return false if the ray origin lies outside
+  * the region for which the grid was built, in which case the detectors must be tested some other way.
+  */
+bool AngularGrid::GetCandidates(const Vector3 &origin_, const Vector3 &direction_, const unsigned int *&candidates, size_t &count) const {
+	if(!Contains(origin_)){ return false; }
+	unsigned int cell = _getCell(direction_);
+	candidates = cellItems.data() + cellStart[cell];
+	count = cellStart[cell+1] - cellStart[cell];
+	return true;
+}
+
+/// Return the cell which contains a direction, which must not be the zero vector.
+unsigned int AngularGrid::_getCell(const Vector3 &direction_) const {
+	double cosTheta = direction_.axis[2]/direction_.Length();
+	double theta = std::acos(std::max(-1.0, std::min(1.0, cosTheta)));
+	double phi = std::atan2(direction_.axis[1], direction_.axis[0]);
+	if(phi < 0.0){ phi += 2*pi; }
+
+	unsigned int i = std::min((unsigned int)(theta/thetaStep), nTheta-1);
+	unsigned int j = std::min((unsigned int)(phi/phiStep), nPhi-1);
+	return i*nPhi+j;
+}
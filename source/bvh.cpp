@@ -0,0 +1,317 @@
+/** \file bvh.cpp
+ * \brief Bounding volume hierarchy used to accelerate ray queries on detectors.
+ */
+#include <algorithm>
+#include <map>
+#include <limits>
+#include <cmath>
+
+#include "bvh.hpp"
+#include "detectors.hpp"
+
+/// Padding added to every detector bounding box to guard against rounding errors (m).
+const double boxPadding = 1E-6;
+
+/// Sort candidates by the ray parameter at which the ray enters their bounding box.
+bool compareCandidates(const BVHCandidate &lhs, const BVHCandidate &rhs){
+	if(lhs.tEntry != rhs.tEntry){ return (lhs.tEntry < rhs.tEntry); }
+	return (lhs.index < rhs.index);
+}
+
+/////////////////////////////////////////////////////////////////////
+// BoundingBox
+/////////////////////////////////////////////////////////////////////
+
+/// Default constructor. The box is empty until it is extended.
+BoundingBox::BoundingBox(){
+	const double big = std::numeric_limits<double>::max();
+	lower = Vector3(big, big, big);
+	upper = Vector3(-big, -big, -big);
+}
+
+/// Grow the box so that it contains a point.
+void BoundingBox::Extend(const Vector3 &point_){
+	for(int i = 0; i < 3; i++){
+		if(point_.axis[i] < lower.axis[i]){ lower.axis[i] = point_.axis[i]; }
+		if(point_.axis[i] > upper.axis[i]){ upper.axis[i] = point_.axis[i]; }
+	}
+}
+
+/// Grow the box so that it contains another box.
+void BoundingBox::Extend(const BoundingBox &box_){
+	if(box_.Empty()){ return; }
+	Extend(box_.lower);
+	Extend(box_.upper);
+}
+
+/// Grow the box by a distance dist_ (in m) in every direction.
+void BoundingBox::Pad(const double &dist_){
+	if(Empty()){ return; }
+	for(int i = 0; i < 3; i++){
+		lower.axis[i] -= dist_;
+		upper.axis[i] += dist_;
+	}
+}
+
+/** Find the range of the ray (offset_ + t * direction_) which lies inside the box, for t >= 0.
+  * invDirection_ is the inverse of each component of the ray direction, which may be infinite.
+  * tEntry and tExit are the values of t at which the ray enters and leaves the box.
+  * Return true if the ray crosses the box and false otherwise.
+  */
+bool BoundingBox::Intersect(const Vector3 &offset_, const Vector3 &invDirection_, double &tEntry, double &tExit) const {
+	tEntry = 0.0;
+	tExit = std::numeric_limits<double>::max();
+	for(int i = 0; i < 3; i++){
+		if(std::isinf(invDirection_.axis[i])){ // The ray is parallel to this pair of planes.
+			if(offset_.axis[i] < lower.axis[i] || offset_.axis[i] > upper.axis[i]){ return false; }
+			continue;
+		}
+		double t0 = (lower.axis[i]-offset_.axis[i])*invDirection_.axis[i];
+		double t1 = (upper.axis[i]-offset_.axis[i])*invDirection_.axis[i];
+		if(t0 > t1){ std::swap(t0, t1); }
+		if(t0 > tEntry){ tEntry = t0; }
+		if(t1 < tExit){ tExit = t1; }
+		if(tEntry > tExit){ return false; }
+	}
+	return true;
+}
+
+/////////////////////////////////////////////////////////////////////
+// DetectorBVH
+/////////////////////////////////////////////////////////////////////
+
+/// Constructor which builds the tree for a list of detectors.
+DetectorBVH::DetectorBVH(const std::vector<Primitive*> &detectors_, const unsigned int &maxLeafSize_/*=2*/) : maxLeafSize(maxLeafSize_ > 0 ? maxLeafSize_ : 1) {
+	Build(detectors_);
+}
+
+/// Constructor which builds the tree for a list of detectors, some of which may belong to arrays.
+DetectorBVH::DetectorBVH(const std::vector<Primitive*> &detectors_, const std::vector<DetectorArray*> &arrays_, const unsigned int &maxLeafSize_/*=2*/) : maxLeafSize(maxLeafSize_ > 0 ? maxLeafSize_ : 1) {
+	Build(detectors_, arrays_);
+}
+
+/** Build the tree for a list of detectors. The detectors are not owned by the tree, and the
+  * tree must be rebuilt if any of them are moved, rotated or resized.
+  */
+void DetectorBVH::Build(const std::vector<Primitive*> &detectors_){
+	Build(detectors_, std::vector<DetectorArray*>());
+}
+
+/** Build the tree for a list of detectors, some of which may belong to arrays. Each array whose
+  * bars are all in the list is stored as a single leaf, and all other arrays are ignored. Neither
+  * the detectors nor the arrays are owned by the tree.
+  */
+void DetectorBVH::Build(const std::vector<Primitive*> &detectors_, const std::vector<DetectorArray*> &arrays_){
+	Clear();
+	if(detectors_.empty()){ return; }
+
+	numDetectors = detectors_.size();
+
+	std::map<Primitive*, unsigned int> detectorIndices;
+	for(unsigned int i = 0; i < numDetectors; i++){
+		detectorIndices[detectors_[i]] = i;
+	}
+
+	// Store the bars of each array whose bars are all in the list. These bars are
+	// then found through their array instead of being added to the tree themselves.
+	std::vector<bool> inArray(numDetectors, false);
+	std::vector<Primitive*> unsortedPrims;
+	std::vector<unsigned int> unsortedIndices;
+	std::vector<DetectorArray*> unsortedArrays;
+	for(std::vector<DetectorArray*>::const_iterator iter = arrays_.begin(); iter != arrays_.end(); iter++){
+		const std::vector<Primitive*> &bars = (*iter)->GetBars();
+		if(bars.empty()){ continue; }
+
+		bool complete = true;
+		for(std::vector<Primitive*>::const_iterator bar = bars.begin(); bar != bars.end(); bar++){
+			std::map<Primitive*, unsigned int>::iterator index = detectorIndices.find(*bar);
+			if(index == detectorIndices.end() || inArray[index->second]){
+				complete = false;
+				break;
+			}
+		}
+		if(!complete){ continue; }
+
+		unsortedPrims.push_back(*iter);
+		unsortedIndices.push_back(barPrims.size());
+		unsortedArrays.push_back(*iter);
+		for(std::vector<Primitive*>::const_iterator bar = bars.begin(); bar != bars.end(); bar++){
+			unsigned int index = detectorIndices[*bar];
+			inArray[index] = true;
+			barPrims.push_back(*bar);
+			barIndices.push_back(index);
+			barBoxes.push_back(BoundingBox());
+			(*bar)->GetBoundingBox(barBoxes.back().lower, barBoxes.back().upper);
+			barBoxes.back().Pad(boxPadding);
+		}
+		numArrays++;
+	}
+
+	// All other detectors are added to the tree one at a time.
+	for(unsigned int i = 0; i < numDetectors; i++){
+		if(inArray[i]){ continue; }
+		unsortedPrims.push_back(detectors_[i]);
+		unsortedIndices.push_back(i);
+		unsortedArrays.push_back(NULL);
+	}
+
+	const unsigned int count = unsortedPrims.size();
+
+	// Calculate the bounding box of each detector or array in the global frame.
+	std::vector<Vector3> centers(count);
+	boxes.resize(count);
+	indices.resize(count);
+	for(unsigned int i = 0; i < count; i++){
+		unsortedPrims[i]->GetBoundingBox(boxes[i].lower, boxes[i].upper);
+		boxes[i].Pad(boxPadding);
+		centers[i] = boxes[i].GetCenter();
+		indices[i] = i;
+	}
+
+	// A median split tree never has more than 2*count-1 nodes.
+	nodes.reserve(2*count);
+	nodes.push_back(node());
+	_build(0, 0, count, centers);
+
+	// Store the detectors and their boxes in leaf order.
+	std::vector<BoundingBox> unsorted;
+	unsorted.swap(boxes);
+	prims.resize(count);
+	boxes.resize(count);
+	arrays.resize(count);
+	for(unsigned int i = 0; i < count; i++){
+		unsigned int index = indices[i];
+		prims[i] = unsortedPrims[index];
+		boxes[i] = unsorted[index];
+		arrays[i] = unsortedArrays[index];
+		indices[i] = unsortedIndices[index];
+	}
+}
+
+/// Remove all detectors from the tree.
+void DetectorBVH::Clear(){
+	numDetectors = 0;
+	numArrays = 0;
+	nodes.clear();
+	prims.clear();
+	indices.clear();
+	boxes.clear();
+	arrays.clear();
+	barPrims.clear();
+	barIndices.clear();
+	barBoxes.clear();
+}
+
+/** Find all detectors whose bounding box is crossed by the ray (offset_ + t * direction_) for t >= 0.
+  * The candidates are sorted by the ray parameter at which the ray enters each bounding box.
+  * The candidates vector is cleared before searching. Return the number of candidates found.
+  */
+size_t DetectorBVH::GetCandidates(const Vector3 &offset_, const Vector3 &direction_, std::vector<BVHCandidate> &candidates) const {
+	candidates.clear();
+	if(nodes.empty()){ return 0; }
+
+	Vector3 invDirection(1.0/direction_.axis[0], 1.0/direction_.axis[1], 1.0/direction_.axis[2]);
+
+	// The tree is balanced, so its depth is never more than log2 of the number of detectors.
+	unsigned int stack[64];
+	unsigned int stackSize = 0;
+	stack[stackSize++] = 0;
+
+	double tEntry, tExit;
+	unsigned int first[maxBarRanges], count[maxBarRanges];
+	while(stackSize > 0){
+		const node &current = nodes[stack[--stackSize]];
+		if(!current.box.Intersect(offset_, invDirection, tEntry, tExit)){ continue; }
+		if(current.count == 0){ // Branch node.
+			stack[stackSize++] = current.first;
+			stack[stackSize++] = current.first+1;
+			continue;
+		}
+		for(unsigned int i = current.first; i < current.first+current.count; i++){
+			if(!boxes[i].Intersect(offset_, invDirection, tEntry, tExit)){ continue; }
+			if(!arrays[i]){
+				candidates.push_back(BVHCandidate(prims[i], indices[i], tEntry));
+				continue;
+			}
+
+			// Only test the bars which the layout of the array says the ray may cross.
+			unsigned int numRanges = arrays[i]->GetBarRanges(offset_, direction_, first, count);
+			for(unsigned int j = 0; j < numRanges; j++){
+				for(unsigned int bar = indices[i]+first[j]; bar < indices[i]+first[j]+count[j]; bar++){
+					if(barBoxes[bar].Intersect(offset_, invDirection, tEntry, tExit)){
+						candidates.push_back(BVHCandidate(barPrims[bar], barIndices[bar], tEntry));
+					}
+				}
+			}
+		}
+	}
+
+	std::sort(candidates.begin(), candidates.end(), compareCandidates);
+
+	return candidates.size();
+}
+
+/** Find the closest detector which is intersected by the ray (offset_ + t * direction_).
+  * P1, norm, t1 and t2 are the same as for Primitive::IntersectPrimitive, for the detector found.
+  * Return a pointer to the detector, or NULL if no detector is intersected.
+  */
+Primitive *DetectorBVH::GetClosest(const Vector3 &offset_, const Vector3 &direction_, Vector3 &P1, Vector3 &norm, double &t1, double &t2) const {
+	std::vector<BVHCandidate> candidates;
+	if(GetCandidates(offset_, direction_, candidates) == 0){ return NULL; }
+
+	Primitive *closest = NULL;
+	Vector3 tempP1, tempNorm;
+	double tempT1, tempT2;
+	for(std::vector<BVHCandidate>::iterator iter = candidates.begin(); iter != candidates.end(); iter++){
+		// No detector further along the ray can be closer than the current closest hit.
+		if(closest && iter->tEntry > t1){ break; }
+		if(iter->prim->IntersectPrimitive(offset_, direction_, tempP1, tempNorm, tempT1, tempT2) && (!closest || tempT1 < t1)){
+			closest = iter->prim;
+			P1 = tempP1;
+			norm = tempNorm;
+			t1 = tempT1;
+			t2 = tempT2;
+		}
+	}
+
+	return closest;
+}
+
+/// Recursively split the detectors in the range [first_, last_) and fill node nodeIndex_.
+void DetectorBVH::_build(const unsigned int &nodeIndex_, const unsigned int &first_, const unsigned int &last_, std::vector<Vector3> &centers_){
+	// Find the bounding box of all detectors in this node and of their centers.
+	BoundingBox box, centerBox;
+	for(unsigned int i = first_; i < last_; i++){
+		box.Extend(boxes[indices[i]]);
+		centerBox.Extend(centers_[indices[i]]);
+	}
+	nodes[nodeIndex_].box = box;
+
+	// Split along the axis with the largest spread of detector centers.
+	Vector3 spread = centerBox.upper - centerBox.lower;
+	int axis = 0;
+	if(spread.axis[1] > spread.axis[axis]){ axis = 1; }
+	if(spread.axis[2] > spread.axis[axis]){ axis = 2; }
+
+	if(last_-first_ <= maxLeafSize || spread.axis[axis] <= 0.0){ // Leaf node.
+		nodes[nodeIndex_].first = first_;
+		nodes[nodeIndex_].count = last_-first_;
+		return;
+	}
+
+	// Place the detectors on either side of the median center.
+	unsigned int middle = (first_+last_)/2;
+	std::vector<unsigned int>::iterator begin = indices.begin();
+	std::nth_element(begin+first_, begin+middle, begin+last_,
+	                 [&centers_, axis](const unsigned int &lhs, const unsigned int &rhs){ return (centers_[lhs].axis[axis] < centers_[rhs].axis[axis]); });
+
+	// Add the two children next to each other so only the index of the left child is needed.
+	unsigned int left = nodes.size();
+	nodes[nodeIndex_].first = left;
+	nodes[nodeIndex_].count = 0;
+	nodes.push_back(node());
+	nodes.push_back(node());
+
+	_build(left, first_, middle, centers_);
+	_build(left+1, middle, last_, centers_);
+}
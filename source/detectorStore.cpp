@@ -0,0 +1,547 @@
+/** \file detectorStore.cpp
+ * \brief Compiled, structure-of-arrays copy of a list of detectors used for ray tracing.
+ */
+#include <algorithm>
+#include <limits>
+#include <cmath>
+
+#include "detectorStore.hpp"
+#include "slabKernel.hpp"
+
+/// The number of boxes passed to the slab method kernel at a time.
+const size_t kernelChunk = 64;
+
+/// Relative padding added to the squared radius of bounding spheres to guard against rounding errors.
+const double boundsPadding = 1E-6;
+
+/** Padding added to the half sizes of the single precision boxes, per m of distance from the global
+  * origin, so that rounding to float never causes a box to be missed. About 100 times the float epsilon.
+  */
+const double floatPadding = 1E-5;
+
+/// The number of arrays in the single precision copy of the detector arrays.
+const size_t floatArrays = 15;
+
+/// Return the shape group used to store a detector.
+DetectorShape getShape(Primitive *prim_){
+	if(dynamic_cast<Planar*>(prim_)){ return SHAPE_BOX; }
+	if(dynamic_cast<Cylindrical*>(prim_)){ return SHAPE_CYLINDER; }
+	if(dynamic_cast<Spherical*>(prim_)){ return SHAPE_SPHERE; }
+	return SHAPE_GENERIC;
+}
+
+/** Clip the range [tEntry, tExit] of a ray against one pair of box faces at -halfSize_ and +halfSize_
+  * along a local axis. origin_ and direction_ are the components of the ray along that axis. Set
+  * clipped to true if the ray is not parallel to the faces. Return false if the ray misses the slab.
+  */
+inline bool clipSlab(const double &origin_, const double &direction_, const double &halfSize_, double &tEntry, double &tExit, bool &clipped){
+	if(direction_ == 0.0){ return (origin_ >= -halfSize_ && origin_ <= halfSize_); } // The ray is parallel to this pair of faces.
+	const double tLower = (-halfSize_-origin_)/direction_;
+	const double tUpper = (halfSize_-origin_)/direction_;
+	const double tNear = (direction_ > 0.0 ? tLower : tUpper);
+	const double tFar = (direction_ > 0.0 ? tUpper : tLower);
+	if(tNear > tEntry){ tEntry = tNear; }
+	if(tFar < tExit){ tExit = tFar; }
+	clipped = true;
+	return true;
+}
+
+/** Order the two solutions of a ray-quadric intersection in the same way as Primitive::SphereIntersect.
+  * Return false if there is no solution, or if both solutions are behind the ray origin.
+  */
+inline bool orderRoots(double &t1, double &t2){
+	if(std::isnan(t1) || std::isnan(t2)){ return false; }
+	if(((t1 > 0 && t2 > 0) && t1 > t2) || t2 > 0){ // t2 is closer to the ray origin.
+		double temp = t1;
+		t1 = t2;
+		t2 = temp;
+	}
+	return (t1 >= 0 || t2 >= 0);
+}
+
+/// Return true if lhs_ is entered before rhs_ along the ray.
+inline bool entersBefore(const DetectorHit &lhs_, const DetectorHit &rhs_){
+	return lhs_.EntersBefore(rhs_);
+}
+
+/////////////////////////////////////////////////////////////////////
+// DetectorStore
+/////////////////////////////////////////////////////////////////////
+
+/// Constructor which builds the store for a list of detectors.
+DetectorStore::DetectorStore(const std::vector<Primitive*> &detectors_) : singlePrecision(defaultSinglePrecision) {
+	Build(detectors_);
+}
+
+/** Build the store for a list of frozen detectors. The detectors are not owned by the store,
+  * and the store must be rebuilt if any of them are moved, rotated or resized.
+  */
+void DetectorStore::Build(const std::vector<Primitive*> &detectors_){
+	Clear();
+	if(detectors_.empty()){ return; }
+
+	const unsigned int count = detectors_.size();
+
+	std::vector<DetectorShape> shapes(count);
+	for(unsigned int i = 0; i < count; i++){
+		shapes[i] = getShape(detectors_[i]);
+	}
+
+	// Add the detectors one shape group at a time, keeping detector list order within each group.
+	slots.resize(count);
+	allSlots.resize(count);
+	for(int shape = 0; shape < SHAPE_COUNT; shape++){
+		groupStart[shape] = prims.size();
+		for(unsigned int i = 0; i < count; i++){
+			if(shapes[i] != shape){ continue; }
+			slots[i] = prims.size();
+			_add(detectors_[i], i);
+		}
+	}
+	groupStart[SHAPE_COUNT] = prims.size();
+
+	for(unsigned int i = 0; i < count; i++){
+		allSlots[i] = i;
+	}
+
+	_buildSinglePrecision();
+}
+
+/// Remove all detectors from the store.
+void DetectorStore::Clear(){
+	prims.clear();
+	indices.clear();
+	flags.clear();
+	posX.clear(); posY.clear(); posZ.clear();
+	xAxisX.clear(); xAxisY.clear(); xAxisZ.clear();
+	yAxisX.clear(); yAxisY.clear(); yAxisZ.clear();
+	zAxisX.clear(); zAxisY.clear(); zAxisZ.clear();
+	halfX.clear(); halfY.clear(); halfZ.clear();
+	radius2.clear();
+	boxData.clear();
+	slots.clear();
+	allSlots.clear();
+	for(int i = 0; i <= SHAPE_COUNT; i++){
+		groupStart[i] = 0;
+	}
+}
+
+/** Intersect the ray (offset_ + t * direction_) with every detector whose role
+  * flags match mask_, or with every detector if mask_ is zero.
+  * Hits are appended to the hits vector grouped by shape, and not in detector list order.
+  * Return the number of hits added.
+  */
+size_t DetectorStore::Intersect(const Vector3 &offset_, const Vector3 &direction_, std::vector<DetectorHit> &hits, const unsigned int &mask_/*=0*/) const {
+	if(allSlots.empty()){ return 0; }
+	const size_t initialSize = hits.size();
+	ray current = {offset_, direction_};
+	_intersect(current, allSlots.data(), allSlots.size(), mask_, hits);
+	return hits.size()-initialSize;
+}
+
+/** Intersect the ray (offset_ + t * direction_) with a subset of the detectors, given by their store
+  * slots (see GetSlot). The slots must be sorted in ascending order so that each shape group is
+  * processed in one batch. Hits are appended to the hits vector in slot order.
+  * Return the number of hits added.
+  */
+size_t DetectorStore::Intersect(const Vector3 &offset_, const Vector3 &direction_, const std::vector<unsigned int> &slots_, std::vector<DetectorHit> &hits, const unsigned int &mask_/*=0*/) const {
+	if(slots_.empty()){ return 0; }
+	const size_t initialSize = hits.size();
+	ray current = {offset_, direction_};
+	_intersect(current, slots_.data(), slots_.size(), mask_, hits);
+	return hits.size()-initialSize;
+}
+
+/** Trace the ray (offset_ + t * direction_) through every detector whose role flags match mask_,
+  * or through every detector if mask_ is zero. Hits are appended to the hits vector in the order
+  * in which the ray enters the detectors (see DetectorHit::EntersBefore).
+  * Return the number of hits added.
+  */
+size_t DetectorStore::Trace(const Vector3 &offset_, const Vector3 &direction_, std::vector<DetectorHit> &hits, const unsigned int &mask_/*=0*/) const {
+	const size_t initialSize = hits.size();
+	const size_t count = Intersect(offset_, direction_, hits, mask_);
+	if(count > 1){ std::sort(hits.begin()+initialSize, hits.end(), entersBefore); }
+	return count;
+}
+
+/** Trace the ray (offset_ + t * direction_) through a subset of the detectors, given by their sorted
+  * store slots (see GetSlot), in a single pass over all shape groups. Hits are appended to the hits
+  * vector in the order in which the ray enters the detectors (see DetectorHit::EntersBefore).
+  * Return the number of hits added.
+  */
+size_t DetectorStore::Trace(const Vector3 &offset_, const Vector3 &direction_, const std::vector<unsigned int> &slots_, std::vector<DetectorHit> &hits, const unsigned int &mask_/*=0*/) const {
+	const size_t initialSize = hits.size();
+	const size_t count = Intersect(offset_, direction_, slots_, hits, mask_);
+	if(count > 1){ std::sort(hits.begin()+initialSize, hits.end(), entersBefore); }
+	return count;
+}
+
+/** Test rays from a common origin_ against every detector. hit[i] is set to 1 if the ray along
+  * directions_[i] crosses at least one detector and to 0 otherwise. Boxes are tested against many
+  * rays at a time by the vectorised slab method kernel. None of the directions may be the zero vector.
+  * Return the number of rays which hit a detector.
+  */
+size_t DetectorStore::IntersectAny(const Vector3 &origin_, const std::vector<Vector3> &directions_, std::vector<unsigned char> &hit) const {
+	const size_t count = directions_.size();
+	hit.assign(count, 0);
+	if(count == 0 || prims.empty()){ return 0; }
+
+	size_t nHit = 0;
+	if(groupStart[SHAPE_BOX+1] > groupStart[SHAPE_BOX]){
+		// Split the rays into structures of arrays for the kernel.
+		std::vector<double> originX(count, origin_.axis[0]), originY(count, origin_.axis[1]), originZ(count, origin_.axis[2]);
+		std::vector<double> directionX(count), directionY(count), directionZ(count), length2(count);
+		for(size_t i = 0; i < count; i++){
+			directionX[i] = directions_[i].axis[0];
+			directionY[i] = directions_[i].axis[1];
+			directionZ[i] = directions_[i].axis[2];
+			length2[i] = directions_[i].Square();
+		}
+
+		std::vector<double> selectedX(count), selectedY(count), selectedZ(count);
+		std::vector<double> tEntry(count), tExit(count);
+		std::vector<size_t> selected(count);
+
+		// Single precision copies of the rays, used to select the rays which may hit each box.
+		std::vector<float> originXF, originYF, originZF, directionXF, directionYF, directionZF;
+		std::vector<float> selectedXF, selectedYF, selectedZF, tEntryF, tExitF;
+		if(singlePrecision){
+			originXF.assign(count, origin_.axis[0]); originYF.assign(count, origin_.axis[1]); originZF.assign(count, origin_.axis[2]);
+			directionXF.assign(directionX.begin(), directionX.end());
+			directionYF.assign(directionY.begin(), directionY.end());
+			directionZF.assign(directionZ.begin(), directionZ.end());
+			selectedXF.resize(count); selectedYF.resize(count); selectedZF.resize(count);
+			tEntryF.resize(count); tExitF.resize(count);
+		}
+
+		const SlabBoxes boxes = _getBoxes();
+		const SlabBoxesF boxesF = _getBoxesF();
+		for(unsigned int s = groupStart[SHAPE_BOX]; s < groupStart[SHAPE_BOX+1] && nHit < count; s++){
+			// Only rays which point into the cone around the bounding sphere of the box can hit it.
+			const double centerX = posX[s]-origin_.axis[0];
+			const double centerY = posY[s]-origin_.axis[1];
+			const double centerZ = posZ[s]-origin_.axis[2];
+			const double radius2 = (halfX[s]*halfX[s] + halfY[s]*halfY[s] + halfZ[s]*halfZ[s])*(1.0+boundsPadding);
+			const double limit2 = centerX*centerX + centerY*centerY + centerZ*centerZ - radius2;
+			size_t nSelected = 0;
+			for(size_t i = 0; i < count; i++){
+				const double proj = directionX[i]*centerX + directionY[i]*centerY + directionZ[i]*centerZ;
+				if(hit[i] || (limit2 > 0.0 && (proj < 0.0 || proj*proj < length2[i]*limit2))){ continue; }
+				selectedX[nSelected] = directionX[i];
+				selectedY[nSelected] = directionY[i];
+				selectedZ[nSelected] = directionZ[i];
+				if(singlePrecision){
+					selectedXF[nSelected] = directionXF[i];
+					selectedYF[nSelected] = directionYF[i];
+					selectedZF[nSelected] = directionZF[i];
+				}
+				selected[nSelected++] = i;
+			}
+			if(nSelected == 0){ continue; }
+
+			if(singlePrecision){ // Only keep the rays which cross the enlarged float box.
+				SlabRaysVsBox(originXF.data(), originYF.data(), originZF.data(), selectedXF.data(), selectedYF.data(), selectedZF.data(), nSelected, boxesF, s, tEntryF.data(), tExitF.data());
+				size_t nKept = 0;
+				for(size_t i = 0; i < nSelected; i++){
+					if(tEntryF[i] > tExitF[i] || tExitF[i] < 0.0f){ continue; }
+					selectedX[nKept] = selectedX[i];
+					selectedY[nKept] = selectedY[i];
+					selectedZ[nKept] = selectedZ[i];
+					selected[nKept++] = selected[i];
+				}
+				nSelected = nKept;
+				if(nSelected == 0){ continue; }
+			}
+
+			SlabRaysVsBox(originX.data(), originY.data(), originZ.data(), selectedX.data(), selectedY.data(), selectedZ.data(), nSelected, boxes, s, tEntry.data(), tExit.data());
+			for(size_t i = 0; i < nSelected; i++){
+				if(tEntry[i] > tExit[i] || tExit[i] < 0.0){ continue; }
+				hit[selected[i]] = 1;
+				nHit++;
+			}
+		}
+	}
+
+	// Test the remaining shapes one ray at a time, skipping rays which have already hit a box.
+	const unsigned int first = groupStart[SHAPE_BOX+1];
+	if(first < groupStart[SHAPE_COUNT]){
+		std::vector<DetectorHit> hits;
+		ray current;
+		current.offset = origin_;
+		for(size_t i = 0; i < count; i++){
+			if(hit[i]){ continue; }
+			current.direction = directions_[i];
+			hits.clear();
+			_intersect(current, allSlots.data()+first, groupStart[SHAPE_COUNT]-first, 0, hits);
+			if(!hits.empty()){
+				hit[i] = 1;
+				nHit++;
+			}
+		}
+	}
+
+	return nHit;
+}
+
+/// Return pointers to the arrays of all detectors, for use by the slab method kernels.
+SlabBoxes DetectorStore::_getBoxes() const {
+	SlabBoxes boxes = {posX.data(), posY.data(), posZ.data(),
+	                   xAxisX.data(), xAxisY.data(), xAxisZ.data(),
+	                   yAxisX.data(), yAxisY.data(), yAxisZ.data(),
+	                   zAxisX.data(), zAxisY.data(), zAxisZ.data(),
+	                   halfX.data(), halfY.data(), halfZ.data()};
+	return boxes;
+}
+
+/// Return pointers to the single precision arrays of all detectors, for use by the slab method kernels.
+SlabBoxesF DetectorStore::_getBoxesF() const {
+	const size_t count = prims.size();
+	const float *data = boxData.data();
+	SlabBoxesF boxes = {data, data+count, data+2*count,
+	                    data+3*count, data+4*count, data+5*count,
+	                    data+6*count, data+7*count, data+8*count,
+	                    data+9*count, data+10*count, data+11*count,
+	                    data+12*count, data+13*count, data+14*count};
+	return boxes;
+}
+
+/** Fill the single precision copy of the detector arrays. The half sizes are enlarged in proportion to the
+  * distance of the box from the global origin, so that the float box always contains the double box.
+  */
+void DetectorStore::_buildSinglePrecision(){
+	const size_t count = prims.size();
+	const std::vector<double> *arrays[floatArrays] = {&posX, &posY, &posZ, &xAxisX, &xAxisY, &xAxisZ, &yAxisX, &yAxisY, &yAxisZ,
+	                                                  &zAxisX, &zAxisY, &zAxisZ, &halfX, &halfY, &halfZ};
+	boxData.resize(floatArrays*count);
+	for(size_t i = 0; i < floatArrays; i++){
+		std::copy(arrays[i]->begin(), arrays[i]->end(), boxData.begin()+i*count);
+	}
+	for(size_t s = 0; s < count; s++){
+		const double reach = 1.0 + std::sqrt(posX[s]*posX[s] + posY[s]*posY[s] + posZ[s]*posZ[s]) + halfX[s] + halfY[s] + halfZ[s];
+		boxData[12*count+s] = halfX[s] + floatPadding*reach;
+		boxData[13*count+s] = halfY[s] + floatPadding*reach;
+		boxData[14*count+s] = halfZ[s] + floatPadding*reach;
+	}
+}
+
+/// Append one detector to the end of the store arrays.
+void DetectorStore::_add(Primitive *prim_, const unsigned int &index_){
+	Vector3 position, unitX, unitY, unitZ;
+	prim_->GetPosition(position);
+	prim_->GetUnitVector(1, unitX); // +x local axis
+	prim_->GetUnitVector(4, unitY); // +y local axis
+	prim_->GetUnitVector(0, unitZ); // +z local axis
+
+	unsigned int roles = 0;
+	if(prim_->IsRecoilDet()){ roles |= DETECTOR_RECOIL; }
+	if(prim_->IsEjectileDet()){ roles |= DETECTOR_EJECTILE; }
+	if(prim_->IsGammaDet()){ roles |= DETECTOR_GAMMA; }
+	if(prim_->IsVeto()){ roles |= DETECTOR_VETO; }
+
+	const double width = prim_->GetWidth();
+	const double length = prim_->GetLength();
+	const double depth = prim_->GetDepth();
+
+	prims.push_back(prim_);
+	indices.push_back(index_);
+	flags.push_back(roles);
+	posX.push_back(position.axis[0]); posY.push_back(position.axis[1]); posZ.push_back(position.axis[2]);
+	xAxisX.push_back(unitX.axis[0]); xAxisY.push_back(unitX.axis[1]); xAxisZ.push_back(unitX.axis[2]);
+	yAxisX.push_back(unitY.axis[0]); yAxisY.push_back(unitY.axis[1]); yAxisZ.push_back(unitY.axis[2]);
+	zAxisX.push_back(unitZ.axis[0]); zAxisY.push_back(unitZ.axis[1]); zAxisZ.push_back(unitZ.axis[2]);
+	halfX.push_back(width/2.0); halfY.push_back(length/2.0); halfZ.push_back(depth/2.0);
+
+	// Spheres use the length of the detector as their diameter, and cylinders use the width.
+	radius2.push_back(getShape(prim_) == SHAPE_SPHERE ? length*length/4.0 : width*width/4.0);
+}
+
+/// Fill a hit for the detector in slot_ and append it to the hits vector.
+void DetectorStore::_addHit(const ray &ray_, const unsigned int &slot_, const double &t1_, const double &t2_, std::vector<DetectorHit> &hits) const {
+	hits.push_back(DetectorHit());
+	DetectorHit &hit = hits.back();
+	hit.prim = prims[slot_];
+	hit.index = indices[slot_];
+	hit.flags = flags[slot_];
+	hit.t1 = t1_;
+	hit.t2 = t2_;
+	hit.P1 = ray_.offset + ray_.direction*t1_;
+}
+
+/// Clip a ray against at most kernelChunk boxes, given by their slots, in double precision and add the hits.
+void DetectorStore::_clipBoxes(const ray &ray_, const unsigned int *slots_, const size_t &count_, const unsigned int &mask_, std::vector<DetectorHit> &hits) const {
+	double tEntry[kernelChunk], tExit[kernelChunk];
+	SlabRayVsBoxes(ray_.offset.axis, ray_.direction.axis, _getBoxes(), slots_, count_, tEntry, tExit);
+	for(size_t i = 0; i < count_; i++){
+		const unsigned int s = slots_[i];
+		if(mask_ && !(flags[s] & mask_)){ continue; }
+		if(tEntry[i] > tExit[i] || tExit[i] < 0.0){ continue; } // The ray does not cross the box in front of its origin.
+		if(tEntry[i] >= 0.0){ _addHit(ray_, s, tEntry[i], tExit[i], hits); }
+		else{ _addHit(ray_, s, tExit[i], tEntry[i], hits); } // The ray starts inside the box.
+	}
+}
+
+/** Intersect a ray with count_ boxes, given by their slots, using the vectorised slab method kernel.
+  * This is the same calculation as Planar::IntersectPrimitive. If the ray starts inside a box, t1 is
+  * the exit point and t2 is the (negative) entry point. In single precision mode, only the boxes which
+  * the ray crosses in single precision are clipped again in double precision.
+  */
+void DetectorStore::_intersectBoxes(const ray &ray_, const unsigned int *slots_, const size_t &count_, const unsigned int &mask_, std::vector<DetectorHit> &hits) const {
+	const double *direction = ray_.direction.axis;
+	if(direction[0] == 0.0 && direction[1] == 0.0 && direction[2] == 0.0){ return; }
+
+	if(!singlePrecision){
+		for(size_t first = 0; first < count_; first += kernelChunk){
+			_clipBoxes(ray_, slots_+first, (count_-first < kernelChunk ? count_-first : kernelChunk), mask_, hits);
+		}
+		return;
+	}
+
+	const SlabBoxesF boxes = _getBoxesF();
+	const float originF[3] = {(float)ray_.offset.axis[0], (float)ray_.offset.axis[1], (float)ray_.offset.axis[2]};
+	const float directionF[3] = {(float)direction[0], (float)direction[1], (float)direction[2]};
+	float tEntry[kernelChunk], tExit[kernelChunk];
+	unsigned int selected[kernelChunk];
+	for(size_t first = 0; first < count_; first += kernelChunk){
+		const size_t count = (count_-first < kernelChunk ? count_-first : kernelChunk);
+		SlabRayVsBoxes(originF, directionF, boxes, slots_+first, count, tEntry, tExit);
+		size_t nSelected = 0;
+		for(size_t i = 0; i < count; i++){
+			const unsigned int s = slots_[first+i];
+			if(mask_ && !(flags[s] & mask_)){ continue; }
+			if(tEntry[i] > tExit[i] || tExit[i] < 0.0f){ continue; }
+			selected[nSelected++] = s;
+		}
+		if(nSelected > 0){ _clipBoxes(ray_, selected, nSelected, 0, hits); }
+	}
+}
+
+/** Intersect a ray with count_ capped cylinders, given by their slots. This is the same calculation
+  * as Cylindrical::IntersectPrimitive. If the ray enters through one of the endcaps, t1 is moved to
+  * the endcap and t2 is left on the curved surface.
+  */
+void DetectorStore::_intersectCylinders(const ray &ray_, const unsigned int *slots_, const size_t &count_, const unsigned int &mask_, std::vector<DetectorHit> &hits) const {
+	const double *offset = ray_.offset.axis;
+	const double *direction = ray_.direction.axis;
+	for(size_t i = 0; i < count_; i++){
+		const unsigned int s = slots_[i];
+		if(mask_ && !(flags[s] & mask_)){ continue; }
+
+		const double dPx = offset[0]-posX[s];
+		const double dPy = offset[1]-posY[s];
+		const double dPz = offset[2]-posZ[s];
+
+		// Components of the ray along the axis of the cylinder (the local y axis).
+		const double originY = dPx*yAxisX[s] + dPy*yAxisY[s] + dPz*yAxisZ[s];
+		const double directionY = direction[0]*yAxisX[s] + direction[1]*yAxisY[s] + direction[2]*yAxisZ[s];
+
+		// Components of the ray perpendicular to the axis of the cylinder.
+		const double A1x = direction[0]-yAxisX[s]*directionY;
+		const double A1y = direction[1]-yAxisY[s]*directionY;
+		const double A1z = direction[2]-yAxisZ[s]*directionY;
+		const double C1x = dPx-yAxisX[s]*originY;
+		const double C1y = dPy-yAxisY[s]*originY;
+		const double C1z = dPz-yAxisZ[s]*originY;
+
+		// Check if the ray intersects the infinite cylinder.
+		const double A2 = A1x*A1x + A1y*A1y + A1z*A1z;
+		const double B2 = 2.0*(C1x*A1x + C1y*A1y + C1z*A1z);
+		const double C2 = (C1x*C1x + C1y*C1y + C1z*C1z) - radius2[s];
+		double t1 = (-B2 + std::sqrt(B2*B2-4.0*A2*C2))/(2.0*A2);
+		double t2 = (-B2 - std::sqrt(B2*B2-4.0*A2*C2))/(2.0*A2);
+		if(!orderRoots(t1, t2)){ continue; }
+
+		// Check if the intersection point is within the cylinder endcaps.
+		const double rx = dPx + direction[0]*t1;
+		const double ry = dPy + direction[1]*t1;
+		const double rz = dPz + direction[2]*t1;
+		double z1 = std::sqrt((rx*rx + ry*ry + rz*rz) - radius2[s]);
+		if(rx*yAxisX[s] + ry*yAxisY[s] + rz*yAxisZ[s] < 0.0){ z1 *= -1; }
+
+		if(std::fabs(z1) > halfY[s] || std::isnan(z1)){ // Check for intersections with the +y and -y endcaps.
+			bool struck = false;
+			for(int cap = 0; cap < 2; cap++){
+				const double tCap = ((cap == 0 ? halfY[s] : -halfY[s])-originY)/directionY;
+				if(!(tCap >= 0)){ continue; }
+				const double hx = dPx + direction[0]*tCap;
+				const double hy = dPy + direction[1]*tCap;
+				const double hz = dPz + direction[2]*tCap;
+				const double px = hx*xAxisX[s] + hy*xAxisY[s] + hz*xAxisZ[s];
+				const double pz = hx*zAxisX[s] + hy*zAxisY[s] + hz*zAxisZ[s];
+				if((px*px + pz*pz) <= radius2[s]){ // The endcap was struck.
+					t1 = tCap;
+					struck = true;
+					break;
+				}
+			}
+			if(!struck){ continue; }
+		}
+
+		_addHit(ray_, s, t1, t2, hits);
+	}
+}
+
+/** Intersect a ray with count_ spheres, given by their slots. This is the same calculation
+  * as Spherical::IntersectPrimitive.
+  */
+void DetectorStore::_intersectSpheres(const ray &ray_, const unsigned int *slots_, const size_t &count_, const unsigned int &mask_, std::vector<DetectorHit> &hits) const {
+	const double *offset = ray_.offset.axis;
+	const double *direction = ray_.direction.axis;
+	const double A = direction[0]*direction[0] + direction[1]*direction[1] + direction[2]*direction[2];
+	for(size_t i = 0; i < count_; i++){
+		const unsigned int s = slots_[i];
+		if(mask_ && !(flags[s] & mask_)){ continue; }
+
+		// Vector pointing from the center of the sphere to the start of the ray.
+		const double Rx = offset[0]-posX[s];
+		const double Ry = offset[1]-posY[s];
+		const double Rz = offset[2]-posZ[s];
+
+		const double B = 2.0*(Rx*direction[0] + Ry*direction[1] + Rz*direction[2]);
+		const double C = (Rx*Rx + Ry*Ry + Rz*Rz) - radius2[s];
+		double t1 = (-B + std::sqrt(B*B-4.0*A*C))/(2.0*A);
+		double t2 = (-B - std::sqrt(B*B-4.0*A*C))/(2.0*A);
+		if(!orderRoots(t1, t2)){ continue; }
+
+		_addHit(ray_, s, t1, t2, hits);
+	}
+}
+
+/** Intersect a ray with count_ detectors of any shape, given by their slots, using Primitive::IntersectPrimitive.
+  * t2 is set to -1 for detectors which do not set it when the ray starts inside them.
+  */
+void DetectorStore::_intersectGeneric(const ray &ray_, const unsigned int *slots_, const size_t &count_, const unsigned int &mask_, std::vector<DetectorHit> &hits) const {
+	Vector3 P1;
+	double t1, t2;
+	for(size_t i = 0; i < count_; i++){
+		const unsigned int s = slots_[i];
+		if(mask_ && !(flags[s] & mask_)){ continue; }
+		t2 = -1.0;
+		if(!prims[s]->IntersectPrimitive(ray_.offset, ray_.direction, P1, t1, t2)){ continue; }
+		hits.push_back(DetectorHit());
+		DetectorHit &hit = hits.back();
+		hit.prim = prims[s];
+		hit.index = indices[s];
+		hit.flags = flags[s];
+		hit.t1 = t1;
+		hit.t2 = t2;
+		hit.P1 = P1;
+	}
+}
+
+/// Intersect a ray with a sorted list of slots, dispatching each run of slots to the kernel of its shape group.
+void DetectorStore::_intersect(const ray &ray_, const unsigned int *slots_, const size_t &count_, const unsigned int &mask_, std::vector<DetectorHit> &hits) const {
+	size_t first = 0;
+	for(int shape = 0; shape < SHAPE_COUNT && first < count_; shape++){
+		// Find the run of slots which belong to this shape group.
+		size_t last = first;
+		while(last < count_ && slots_[last] < groupStart[shape+1]){ last++; }
+		if(last == first){ continue; }
+
+		if(shape == SHAPE_BOX){ _intersectBoxes(ray_, slots_+first, last-first, mask_, hits); }
+		else if(shape == SHAPE_CYLINDER){ _intersectCylinders(ray_, slots_+first, last-first, mask_, hits); }
+		else if(shape == SHAPE_SPHERE){ _intersectSpheres(ray_, slots_+first, last-first, mask_, hits); }
+		else{ _intersectGeneric(ray_, slots_+first, last-first, mask_, hits); }
+
+		first = last;
+	}
+}
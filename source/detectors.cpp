@@ -7,21 +7,54 @@
  * \author C. R. Thornsberry
  * \date Feb. 26th, 2016
  */
+#include <algorithm>
+#include <limits>
+#include <cmath>
+
 #include "detectors.hpp"
+#include "mesh.hpp"
+
+/// Padding added to the bounds of every detector array to guard against rounding errors (m).
+const double arrayPadding = 1E-6;
+
+/// Padding added to the angular bounds of every ring to guard against rounding errors (rad).
+const double angularPadding = 1E-9;
+
+/** Clip the ray (offset_ + t * direction_), given in a local frame, against the box between -half_ and half_.
+  * tEntry and tExit are the values of t >= 0 at which the ray enters and leaves the box.
+  * Return true if the ray crosses the box and false otherwise.
+  */
+bool clipSlabs(const double *offset_, const double *direction_, const double *half_, double &tEntry, double &tExit){
+	tEntry = 0.0;
+	tExit = std::numeric_limits<double>::max();
+	for(int i = 0; i < 3; i++){
+		if(direction_[i] == 0.0){
+			if(std::fabs(offset_[i]) > half_[i]){ return false; }
+			continue;
+		}
+		double t1 = (-half_[i]-offset_[i])/direction_[i];
+		double t2 = (half_[i]-offset_[i])/direction_[i];
+		if(t1 > t2){ std::swap(t1, t2); }
+		if(t1 > tEntry){ tEntry = t1; }
+		if(t2 < tExit){ tExit = t2; }
+		if(tEntry > tExit){ return false; }
+	}
+	return true;
+}
 
 /////////////////////////////////////////////////////////////////////
 // NewVIKARdet
 /////////////////////////////////////////////////////////////////////
 
 NewVIKARdet::NewVIKARdet(){ 
-	for(unsigned int i = 0; i < 9; i++){ data[i] = 0.0; }
+	for(unsigned int i = 0; i < 12; i++){ data[i] = 0.0; }
 	type = "unknown";
 	subtype = "unknown"; 
 	material = "none";
 }
 
 NewVIKARdet::NewVIKARdet(std::string input_){
-	for(unsigned int i = 0; i < 9; i++){ data[i] = 0.0; }
+	for(unsigned int i = 0; i < 12; i++){ data[i] = 0.0; }
 	SetValues(input_);
 }
 
@@ -46,6 +79,8 @@ void NewVIKARdet::SetValues(std::string input){
 			else if(current_index == 9){ data[7] = atof(temp_str.c_str()); }
 			else if(current_index == 10){ data[8] = atof(temp_str.c_str()); }
 			else if(current_index == 11){ material = temp_str; }
+			else if(current_index == 12 && subtype == "mesh"){ filename = temp_str; }
+			else if(current_index <= 14){ data[current_index-3] = atof(temp_str.c_str()); }
 			else{ break; }
 			current_index++;
 			temp_str = "";
@@ -58,6 +93,8 @@ std::string NewVIKARdet::DumpDet(){
 	std::stringstream stream;
 	stream << data[0] << "\t" << data[1] << "\t" << data[2] << "\t" << data[3] << "\t" << data[4] << "\t" << data[5];
 	stream << "\t" << type << "\t" << subtype << "\t" << data[6] << "\t" << data[7] << "\t" << data[8];
+	if(subtype == "wall" || subtype == "ring"){ stream << "\t" << material << "\t" << data[9] << "\t" << data[10] << "\t" << data[11]; }
+	else if(subtype == "mesh"){ stream << "\t" << material << "\t" << filename; }
 	return stream.str();
 }
 
@@ -66,49 +103,79 @@ std::string NewVIKARdet::DumpDet(){
 //  Used to generate flat walls of bars
 /////////////////////////////////////////////////////////////////////
 
-/** Initialize the wall object.
-  * Spacing is the physical distance between the edges of bars.
+/** Build the bars of the wall and append them to a list of detectors.
   * This method leaves a distance of spacing/2 on each side of the wall
   * so that walls having the same bar spacing will align properly.
+  * Return the number of bars added.
   */
-void Wall::Initialize(unsigned int num_bars_, double spacing, double bar_length, double bar_width, double bar_depth){
+unsigned int Wall::AddBars(const NewVIKARdet &det_, std::vector<Primitive*> &detectors){
 	// Bar spacing for Large bar walls = 0.01350 m (4 bars per 10" = 0.254 m)
 	// Bar spacing for Small bar ribs = 0.01488 m (7 bars per 36 deg @ 0.5 m)
-	if(init){ 
+	unsigned int num_bars = (det_.data[9] > 0.0 ? (unsigned int)det_.data[9] : 0);
+	if(!bars.empty()){ 
 		std::cout << " Warning: Wall already initialized\n";
-		return; 
+		return 0; 
 	}  
-	else if(num_bars_ == 0){
+	else if(num_bars == 0){
 		std::cout << " Warning: Cannot initialize zero bars\n";
-		return; 
+		return 0; 
 	}
-		
-	num_bars = num_bars_;
-	bars = new Primitive[num_bars];
 
-	length = bar_length;
-	width = num_bars*(spacing + bar_width);  
-	depth = bar_depth;
+	spacing = det_.data[10];
+	barWidth = det_.data[7];
+
+	// The wall is a box which contains all of its bars.
+	SetSize(det_.data[6], num_bars*(spacing + barWidth), det_.data[8]);
+
+	NewVIKARdet entry = det_;
 	for(unsigned int i = 0; i < num_bars; i++){
-		bars[i].SetSize(bar_length, bar_width, bar_depth);
-		bars[i].SetRotation(theta, phi, psi);
-		bars[i].SetPosition(position + detX*((-width/2.0+spacing/2.0+bar_width/2.0)+i*(bar_width+spacing)));
+		Planar *bar = new Planar(&entry);
+		bar->SetPosition(position + detX*((-width/2.0+spacing/2.0+barWidth/2.0)+i*(barWidth+spacing)));
+		detectors.push_back(bar);
+		bars.push_back(bar);
 	}
 
-	init = true;
+	return num_bars;
 }
 
-/** Return a pointer to a bar in this wall
-  * Return null if the bar does not exist.
+/** Find the bars which may be crossed by the ray (offset_ + t * direction_) for t >= 0. The ray is clipped
+  * against the box of the wall, and the bars are found directly from the local x coordinates at which the
+  * ray enters and leaves the box. Return the number of ranges found (zero or one).
   */
-Primitive* Wall::GetBar(unsigned int bar){ 
-	if(init && bar < num_bars){ return &bars[bar]; }
-	return NULL;
+unsigned int Wall::GetBarRanges(const Vector3 &offset_, const Vector3 &direction_, unsigned int *first, unsigned int *count) const {
+	if(bars.empty()){ return 0; }
+
+	// Transform the ray into the local frame of the wall.
+	const Vector3 ray = offset_ - position;
+	const double offset[3] = {ray.Dot(detX), ray.Dot(detY), ray.Dot(detZ)};
+	const double direction[3] = {direction_.Dot(detX), direction_.Dot(detY), direction_.Dot(detZ)};
+	const double half[3] = {halfWidth+arrayPadding, halfLength+arrayPadding, halfDepth+arrayPadding};
+
+	double tEntry, tExit;
+	if(!clipSlabs(offset, direction, half, tEntry, tExit)){ return 0; }
+
+	// Find the bars which overlap the range of x covered by the ray inside the wall.
+	double x1 = offset[0] + tEntry*direction[0];
+	double x2 = offset[0] + tExit*direction[0];
+	if(x1 > x2){ std::swap(x1, x2); }
+
+	const double pitch = barWidth + spacing;
+	const double left = -halfWidth + spacing/2.0; // The left edge of the first bar.
+	long lowest = 0, highest = bars.size()-1;
+	if(pitch > 0.0){
+		lowest = std::max(lowest, (long)std::ceil((x1 - arrayPadding - left - barWidth)/pitch));
+		highest = std::min(highest, (long)std::floor((x2 + arrayPadding - left)/pitch));
+	}
+	if(lowest > highest){ return 0; }
+
+	first[0] = lowest;
+	count[0] = highest-lowest+1;
+	return 1;
 }
 
 /// Test the Primitive wall class.
 void Wall::WallTest(){
-	if(!init){ std::cout << " Initialized: No\n"; return; }
+	if(bars.empty()){ std::cout << " Initialized: No\n"; return; }
 	else{ std::cout << " Initialized: Yes\n"; }
 	
 	std::cout << " Length: " << length << std::endl;
@@ -121,19 +188,203 @@ void Wall::WallTest(){
   */
 std::string Wall::DumpDetWall(){
 	std::string output = "";
-	if(!init){ 
+	if(bars.empty()){ 
 		std::cout << " Warning: Wall is un-initialized\n";
 		return output; 
 	}
 	
 	// Get detector strings for all detectors in wall
-	for(unsigned int i = 0; i < num_bars; i++){
-		output += bars[i].DumpDet();
+	for(unsigned int i = 0; i < bars.size(); i++){
+		output += bars[i]->DumpDet();
 	}
 	
 	return output;
 }
 
+/////////////////////////////////////////////////////////////////////
+// Ring class
+//  Used to generate rings of bars around the y axis
+/////////////////////////////////////////////////////////////////////
+
+/** Build the bars of the ring and append them to a list of detectors.
+  * Return the number of bars added.
+  */
+unsigned int Ring::AddBars(const NewVIKARdet &det_, std::vector<Primitive*> &detectors){
+	unsigned int num_bars = (det_.data[9] > 0.0 ? (unsigned int)det_.data[9] : 0);
+	if(!bars.empty()){ 
+		std::cout << " Warning: Ring already initialized\n";
+		return 0; 
+	}  
+	else if(num_bars == 0){
+		std::cout << " Warning: Cannot initialize zero bars\n";
+		return 0; 
+	}
+
+	radius = det_.data[10];
+	startAngle = det_.data[3];
+	stepAngle = det_.data[11];
+
+	NewVIKARdet entry = det_;
+	for(unsigned int i = 0; i < num_bars; i++){
+		double angle = startAngle + i*stepAngle;
+		Planar *bar = new Planar(&entry);
+		bar->SetRotation(angle, det_.data[4], det_.data[5]);
+		bar->SetPosition(position + Vector3(radius*std::sin(angle), 0.0, radius*std::cos(angle)));
+		detectors.push_back(bar);
+		bars.push_back(bar);
+	}
+
+	// Rotating a bar about the y axis does not change the length of its local axes projected onto the
+	// plane of the ring, or their components along the y axis, so the extent of every bar is the same.
+	Vector3 unit;
+	double half[3] = {bars[0]->GetWidth()/2.0, bars[0]->GetLength()/2.0, bars[0]->GetDepth()/2.0};
+	unsigned int faces[3] = {1, 4, 0};
+	double planar = 0.0, vertical = 0.0;
+	for(int i = 0; i < 3; i++){
+		bars[0]->GetUnitVector(faces[i], unit);
+		planar += std::sqrt(unit.axis[0]*unit.axis[0] + unit.axis[2]*unit.axis[2])*half[i];
+		vertical += std::fabs(unit.axis[1])*half[i];
+	}
+	innerRadius = (radius > planar ? radius-planar : 0.0);
+	outerRadius = radius + planar;
+	halfHeight = vertical;
+	halfAngle = (planar < radius ? std::asin(planar/radius) : pi);
+
+	// The ring is a box around the cylinder which contains all of its bars.
+	SetRotation(0.0, 0.0, 0.0);
+	SetSize(2.0*halfHeight, 2.0*outerRadius, 2.0*outerRadius);
+
+	return num_bars;
+}
+
+/** Find the bars which may be crossed by the ray (offset_ + t * direction_) for t >= 0. The ray is clipped
+  * against the annulus which contains the bars, and the bars are found directly from the angles at which the
+  * ray enters and leaves the annulus. Return the number of ranges found.
+  */
+unsigned int Ring::GetBarRanges(const Vector3 &offset_, const Vector3 &direction_, unsigned int *first, unsigned int *count) const {
+	if(bars.empty()){ return 0; }
+
+	// Bars which are wide enough to reach the axis may be hit from any angle.
+	const unsigned int num_bars = bars.size();
+	if(innerRadius <= 0.0 || stepAngle == 0.0 || num_bars*std::fabs(stepAngle) > 2*pi+angularPadding){
+		first[0] = 0;
+		count[0] = num_bars;
+		return 1;
+	}
+
+	const Vector3 ray = offset_ - position;
+	const double ox = ray.axis[0], oy = ray.axis[1], oz = ray.axis[2];
+	const double dx = direction_.axis[0], dy = direction_.axis[1], dz = direction_.axis[2];
+
+	// Clip the ray against the two planes which bound the ring.
+	double tMin = 0.0, tMax = std::numeric_limits<double>::max();
+	if(dy == 0.0){
+		if(std::fabs(oy) > halfHeight+arrayPadding){ return 0; }
+	}
+	else{
+		double t1 = (-halfHeight-arrayPadding-oy)/dy;
+		double t2 = (halfHeight+arrayPadding-oy)/dy;
+		if(t1 > t2){ std::swap(t1, t2); }
+		tMin = std::max(tMin, t1);
+		tMax = std::min(tMax, t2);
+		if(tMin > tMax){ return 0; }
+	}
+
+	// Find the parts of the ray which lie between the inner and outer cylinders.
+	const double rIn = innerRadius-arrayPadding, rOut = outerRadius+arrayPadding;
+	const double a = dx*dx + dz*dz;
+	const double b = ox*dx + oz*dz;
+	const double r2 = ox*ox + oz*oz;
+	double segments[2][2];
+	unsigned int numSegments = 0;
+	if(a == 0.0){ // The ray is parallel to the axis.
+		if(r2 > rOut*rOut || r2 < rIn*rIn){ return 0; }
+		segments[numSegments][0] = tMin;
+		segments[numSegments++][1] = tMax;
+	}
+	else{
+		double disc = b*b - a*(r2 - rOut*rOut);
+		if(disc < 0.0){ return 0; }
+		double root = std::sqrt(disc);
+		double tOuter1 = std::max(tMin, (-b-root)/a);
+		double tOuter2 = std::min(tMax, (-b+root)/a);
+		if(tOuter1 > tOuter2){ return 0; }
+
+		disc = b*b - a*(r2 - rIn*rIn);
+		if(disc <= 0.0){ // The ray does not enter the inner cylinder.
+			segments[numSegments][0] = tOuter1;
+			segments[numSegments++][1] = tOuter2;
+		}
+		else{
+			root = std::sqrt(disc);
+			double tInner1 = (-b-root)/a;
+			double tInner2 = (-b+root)/a;
+			if(tOuter1 < tInner1){
+				segments[numSegments][0] = tOuter1;
+				segments[numSegments++][1] = std::min(tOuter2, tInner1);
+			}
+			if(tOuter2 > tInner2){
+				segments[numSegments][0] = std::max(tOuter1, tInner2);
+				segments[numSegments++][1] = tOuter2;
+			}
+		}
+	}
+
+	// Each segment stays outside the inner cylinder, so it covers less than half a turn around the axis.
+	// Bar i is centered at the angle startAngle + i*stepAngle, so reverse the angles if the step is negative.
+	const double sign = (stepAngle > 0.0 ? 1.0 : -1.0);
+	const double step = std::fabs(stepAngle);
+	const double pad = halfAngle + angularPadding;
+	long lower[maxBarRanges], upper[maxBarRanges];
+	unsigned int numRanges = 0;
+	for(unsigned int i = 0; i < numSegments; i++){
+		double angle1 = sign*std::atan2(ox+segments[i][0]*dx, oz+segments[i][0]*dz);
+		double angle2 = sign*std::atan2(ox+segments[i][1]*dx, oz+segments[i][1]*dz);
+		double sweep = std::remainder(angle2-angle1, 2*pi);
+		double start = (sweep >= 0.0 ? angle1 : angle2) - pad;
+		sweep = std::fabs(sweep) + 2*pad;
+		if(sweep >= 2*pi){
+			first[0] = 0;
+			count[0] = num_bars;
+			return 1;
+		}
+
+		// The angle of the start of the segment relative to the first bar, from 0 to 2*pi.
+		double relative = std::fmod(start - sign*startAngle, 2*pi);
+		if(relative < 0.0){ relative += 2*pi; }
+
+		// The segment may wrap past the first bar, so check both turns.
+		for(int turn = 0; turn < 2; turn++){
+			long lowest = std::max(0L, (long)std::ceil((relative - turn*2*pi)/step));
+			long highest = std::min((long)num_bars-1, (long)std::floor((relative + sweep - turn*2*pi)/step));
+			if(lowest <= highest){
+				lower[numRanges] = lowest;
+				upper[numRanges++] = highest;
+			}
+		}
+	}
+
+	// Sort the ranges and merge any which overlap, so that no bar is listed twice.
+	for(unsigned int i = 1; i < numRanges; i++){
+		for(unsigned int j = i; j > 0 && lower[j] < lower[j-1]; j--){
+			std::swap(lower[j], lower[j-1]);
+			std::swap(upper[j], upper[j-1]);
+		}
+	}
+	unsigned int numMerged = 0;
+	for(unsigned int i = 0; i < numRanges; i++){
+		if(numMerged > 0 && lower[i] <= (long)(first[numMerged-1]+count[numMerged-1])){
+			long last = std::max(upper[i], (long)(first[numMerged-1]+count[numMerged-1]-1));
+			count[numMerged-1] = last-first[numMerged-1]+1;
+			continue;
+		}
+		first[numMerged] = lower[i];
+		count[numMerged++] = upper[i]-lower[i]+1;
+	}
+
+	return numMerged;
+}
+
 /////////////////////////////////////////////////////////////////////
 // Elliptical
 /////////////////////////////////////////////////////////////////////
@@ -145,6 +396,15 @@ void Elliptical::SetRadii(const double &rLong_, const double &rShort_){
 	width = rShort*2.0;
 }
 
+/** Get the lower and upper corners of a box which contains the ellipse, in the
+  * local detector frame and relative to the position of the detector (in m).
+  * The long axis of the ellipse lies along the local x axis.
+  */
+void Elliptical::GetLocalBounds(Vector3 &lower, Vector3 &upper){
+	lower = Vector3(-rLong, -rShort, -depth/2.0);
+	upper = Vector3(rLong, rShort, depth/2.0);
+}
+
 /** Check if a point (in local coordinates) is within the bounds of the primitive
   * Return true if the coordinates are within the primitive and false otherwise.
   * The Elliptical class checks if the face intersect is within 
@@ -160,6 +420,16 @@ bool Elliptical::CheckBounds(const unsigned int &face_, const double &x_, const
 // Polygon
 /////////////////////////////////////////////////////////////////////
 
+/** Get the lower and upper corners of a box which contains the polygon, in the
+  * local detector frame and relative to the position of the detector (in m).
+  * The corners of the polygon lie on a circle of radius GetRadius().
+  */
+void Polygonal::GetLocalBounds(Vector3 &lower, Vector3 &upper){
+	const double radius = poly.GetRadius();
+	lower = Vector3(-radius, -radius, -depth/2.0);
+	upper = Vector3(radius, radius, depth/2.0);
+}
+
 /** Check if a point (in local coordinates) is within the bounds of the primitive
   * Return true if the coordinates are within the primitive and false otherwise.
   * The Elliptical class checks if the face intersect is within 
@@ -183,6 +453,14 @@ void Annular::SetRadii(const double &inRadius_, const double &outRadius_){
 	width = outRadius*2.0;
 }
 
+/** Get the lower and upper corners of a box which contains the annulus, in the
+  * local detector frame and relative to the position of the detector (in m).
+  */
+void Annular::GetLocalBounds(Vector3 &lower, Vector3 &upper){
+	lower = Vector3(-outRadius, -outRadius, -depth/2.0);
+	upper = Vector3(outRadius, outRadius, depth/2.0);
+}
+
 /** Check if a point (in local coordinates) is within the bounds of the primitive
   * Return true if the coordinates are within the primitive and false otherwise.
   * The Elliptical class checks if the face intersect is within 
@@ -201,38 +479,69 @@ bool Annular::CheckBounds(const unsigned int &face_, const double &x_, const dou
   * Assumes the following detector file format for each detector in file
   * X(m) Y(m) Z(m) Theta(rad) Phi(rad) Psi(rad) Type Subtype Length(m) Width(m) Depth(m) Material.
   */
-int ReadDetFile(const char* fname_, std::vector<Primitive*> &detectors){
-	// Read VIKAR detector setup file or manually setup simple systems
+int ReadDetFile(const char* fname_, std::vector<NewVIKARdet> &entries){
 	std::ifstream detfile(fname_);
 	if(!detfile.good()){ return -1; }
 
-	std::vector<NewVIKARdet*> temp_detectors;
 	std::string line;
-
 	while(true){
 		getline(detfile, line);
 		if(detfile.eof()){ break; }
 		if(line[0] == '#'){ continue; } // Commented line
 
-		temp_detectors.push_back(new NewVIKARdet(line));
+		entries.push_back(NewVIKARdet(line));
+
+		// Mesh files are found relative to the directory of the detector file.
+		NewVIKARdet &entry = entries.back();
+		if(entry.subtype == "mesh" && !entry.filename.empty() && entry.filename[0] != '/'){
+			std::string path(fname_);
+			size_t index = path.find_last_of('/');
+			if(index != std::string::npos){ entry.filename = path.substr(0, index+1) + entry.filename; }
+		}
 	}	
 	detfile.close();
 
-	// Fill the detector
+	return entries.size();
+}
+
+int BuildDetectors(const std::vector<NewVIKARdet> &entries, std::vector<Primitive*> &detectors, std::vector<DetectorArray*> *arrays/*=NULL*/){
 	unsigned int index = 0;
-	for(std::vector<NewVIKARdet*>::iterator iter = temp_detectors.begin(); iter != temp_detectors.end(); iter++){
-		if((*iter)->type == "vandle" || (*iter)->subtype == "planar"){ detectors.push_back(new Planar((*iter))); }
-		else if((*iter)->subtype == "cylinder"){ detectors.push_back(new Cylindrical((*iter))); }
-		else if((*iter)->subtype == "sphere"){ detectors.push_back(new Spherical((*iter))); }
-		else if((*iter)->subtype == "cone"){ detectors.push_back(new Conical((*iter))); }
-		else if((*iter)->subtype == "ellipse"){ detectors.push_back(new Elliptical((*iter))); }
-		else if((*iter)->subtype == "polygon"){ detectors.push_back(new Polygonal((*iter))); }
-		else if((*iter)->subtype == "annular"){ detectors.push_back(new Annular((*iter))); }
+	for(std::vector<NewVIKARdet>::const_iterator iter = entries.begin(); iter != entries.end(); iter++){
+		NewVIKARdet entry = (*iter);
+		if(entry.subtype == "wall" || entry.subtype == "ring"){
+			// Arrays add a detector for each of their bars.
+			DetectorArray *array;
+			if(entry.subtype == "wall"){ array = new Wall(&entry); }
+			else{ array = new Ring(&entry); }
+			
+			unsigned int num_bars = array->AddBars(entry, detectors);
+			for(unsigned int i = 0; i < num_bars; i++){
+				detectors[detectors.size()-num_bars+i]->SetLocation(index++);
+			}
+			
+			if(arrays && num_bars > 0){ arrays->push_back(array); }
+			else{ delete array; }
+			continue;
+		}
+		else if(entry.type == "vandle" || entry.subtype == "planar"){ detectors.push_back(new Planar(&entry)); }
+		else if(entry.subtype == "cylinder"){ detectors.push_back(new Cylindrical(&entry)); }
+		else if(entry.subtype == "sphere"){ detectors.push_back(new Spherical(&entry)); }
+		else if(entry.subtype == "cone"){ detectors.push_back(new Conical(&entry)); }
+		else if(entry.subtype == "ellipse"){ detectors.push_back(new Elliptical(&entry)); }
+		else if(entry.subtype == "polygon"){ detectors.push_back(new Polygonal(&entry)); }
+		else if(entry.subtype == "annular"){ detectors.push_back(new Annular(&entry)); }
+		else if(entry.subtype == "mesh"){
+			Mesh *mesh = new Mesh(&entry);
+			if(mesh->Empty()){ // The reason has already been reported by the Mesh constructor.
+				delete mesh;
+				continue;
+			}
+			detectors.push_back(mesh);
+		}
 		else{ 
-			std::cout << " Unknown detector of type = " << (*iter)->type << " and subtype = " << (*iter)->subtype << std::endl;
+			std::cout << " Unknown detector of type = " << entry.type << " and subtype = " << entry.subtype << std::endl;
 			continue; 
 		}
-		delete (*iter);
 		
 		// Set the detector ID number based on its location in the detector setup file.
 		detectors.back()->SetLocation(index++);
@@ -240,3 +549,12 @@ int ReadDetFile(const char* fname_, std::vector<Primitive*> &detectors){
 	
 	return detectors.size();
 }
+
+int ReadDetFile(const char* fname_, std::vector<Primitive*> &detectors, std::vector<DetectorArray*> *arrays/*=NULL*/){
+	// Read VIKAR detector setup file or manually setup simple systems
+	std::vector<NewVIKARdet> entries;
+	if(ReadDetFile(fname_, entries) < 0){ return -1; }
+
+	// Fill the detector
+	return BuildDetectors(entries, detectors, arrays);
+}
@@ -10,6 +10,9 @@
  * \author C. R. Thornsberry
  * \date Feb. 26th, 2016
  */
+#include <cassert>
+#include <limits>
+
 #include "geometry.hpp"
 #include "detectors.hpp"
 
@@ -106,7 +109,7 @@ Primitive::Primitive(){
 	length = 1.0;
 	width = 1.0;
 	depth = 1.0;
-	need_set = true;
+	frozen = false;
 	use_recoil = false;
 	use_eject = false;
 	use_gamma = false;
@@ -115,6 +118,7 @@ Primitive::Primitive(){
 	type = "unknown";
 	subtype = "unknown";
 	material_name = "";
+	_set_face_coords();
 }
 
 /// Constructor using a NewVIKARDet object.
@@ -126,9 +130,12 @@ Primitive::Primitive(NewVIKARdet *det_){
 	detX = Vector3(1.0, 0.0, 0.0);
 	detY = Vector3(0.0, 1.0, 0.0);
 	detZ = Vector3(0.0, 0.0, 1.0);
+	length = 1.0;
+	width = 1.0;
+	depth = 1.0;
+	frozen = false;
 	SetPosition(det_->data[0], det_->data[1], det_->data[2]);
 	SetRotation(det_->data[3], det_->data[4], det_->data[5]);
-	need_set = true;
 	SetSize(det_->data[6], det_->data[7], det_->data[8]);
 	use_recoil = (det_->type=="dual" || det_->type=="recoil");
 	use_eject = (det_->type=="vandle" || det_->type=="dual" || det_->type == "neutron" || det_->type=="eject");
@@ -140,19 +147,34 @@ Primitive::Primitive(NewVIKARdet *det_){
 	material_name = det_->material;	
 }
 
-/** Set the global face coordinates (wrt global origin)
+/** Set the global face coordinates (wrt global origin) and all other constants which
+  * depend on the size, position or rotation of the detector. This is called every time
+  * the detector is changed, so ray tracing never needs to check if they are up to date.
   * Each vertex is the center coordinate of one of the faces.
   */
 void Primitive::_set_face_coords(){
+	halfWidth = width/2.0;
+	halfLength = length/2.0;
+	halfDepth = depth/2.0;
+
 	// Calculate the center points of each face
-	GlobalFace[0] = position-detZ*(depth/2.0); // Front face
-	GlobalFace[1] = position+detX*(width/2.0); // Right face
-	GlobalFace[2] = position+detZ*(depth/2.0); // Back face
-	GlobalFace[3] = position-detX*(width/2.0); // Left face
-	GlobalFace[4] = position+detY*(length/2.0); // Top face
-	GlobalFace[5] = position-detY*(length/2.0); // Bottom face
+	GlobalFace[0] = position-detZ*halfDepth; // Front face
+	GlobalFace[1] = position+detX*halfWidth; // Right face
+	GlobalFace[2] = position+detZ*halfDepth; // Back face
+	GlobalFace[3] = position-detX*halfWidth; // Left face
+	GlobalFace[4] = position+detY*halfLength; // Top face
+	GlobalFace[5] = position-detY*halfLength; // Bottom face
 
-	need_set = false;
+	// Radii of the bounding cylinder and sphere.
+	widthRadius2 = width*width/4.0;
+	lengthRadius2 = length*length/4.0;
+
+	// Opening angle of the bounding cone.
+	double coneAngle = std::atan2(halfWidth, length);
+	coneCos = std::cos(coneAngle);
+	coneSin = std::sin(coneAngle);
+	coneCos2 = length*length / (length*length + width*width/4.0);
+	coneSin2 = width*width / (4.0*length*length + width*width);
 }
 
 /// Return the unit vector of one of the faces. Returns the zero vector if the face is undefined
@@ -174,10 +196,43 @@ void Primitive::GetLocalCoords(const Vector3 &world_coords, double &x, double &y
 	z = temp.Dot(detZ);
 }
 
+/** Get the lower and upper corners of a box which contains the detector, in the
+  * local detector frame and relative to the position of the detector (in m).
+  */
+void Primitive::GetLocalBounds(Vector3 &lower, Vector3 &upper){
+	lower = Vector3(-width/2.0, -length/2.0, -depth/2.0);
+	upper = Vector3(width/2.0, length/2.0, depth/2.0);
+}
+
+/** Get the lower and upper corners of the smallest axis-aligned box (in the global
+  * frame) which contains the local detector bounds (in m).
+  */
+void Primitive::GetBoundingBox(Vector3 &lower, Vector3 &upper){
+	Vector3 localLower, localUpper;
+	GetLocalBounds(localLower, localUpper);
+	
+	// The center of the local box in the global frame and its half-widths along the local axes.
+	Vector3 center = position + detX*((localLower.axis[0]+localUpper.axis[0])/2.0) + 
+	                 detY*((localLower.axis[1]+localUpper.axis[1])/2.0) + detZ*((localLower.axis[2]+localUpper.axis[2])/2.0);
+	Vector3 half = (localUpper - localLower)*0.5;
+	
+	// Project each of the rotated local axes onto the global axes.
+	for(int i = 0; i < 3; i++){
+		double extent = fabs(detX.axis[i])*half.axis[0] + fabs(detY.axis[i])*half.axis[1] + fabs(detZ.axis[i])*half.axis[2];
+		lower.axis[i] = center.axis[i] - extent;
+		upper.axis[i] = center.axis[i] + extent;
+	}
+}
+
 /// Get a vector pointing to a 3d point inside of this geometry
 void Primitive::GetRandomPointInside(Vector3& output){
+	GetRandomPointInside(output, GetDefaultRandomEngine());
+}
+
+/// Get a vector pointing to a 3d point inside of this geometry, using the random number engine rng_
+void Primitive::GetRandomPointInside(Vector3& output, RandomEngine &rng_){
 	// Get a random point inside the 3d detector
-	Vector3 temp = Vector3(frand(-length/2, length/2), frand(-width/2, width/2), frand(-depth/2, depth/2));
+	Vector3 temp = Vector3(frand(rng_, -length/2, length/2), frand(rng_, -width/2, width/2), frand(rng_, -depth/2, depth/2));
 	
 	// Rotate the random point based on the detector rotation
 	rotationMatrix.Transform(temp);
@@ -201,34 +256,39 @@ void Primitive::SetFrontFace(unsigned int front_face_){
 
 /// Set the physical size of the detector.
 void Primitive::SetSize(double length_, double width_, double depth_){
+	assert(!frozen);
 	width = width_; 
 	length = length_; 
 	depth = depth_;
-	need_set = true;
+	_set_face_coords();
 }
 
 /// Set the position of the center of the detector using a 3d vector (in meters).
 void Primitive::SetPosition(const Vector3 &pos){
+	assert(!frozen);
 	position = pos;
-	need_set = true;
+	_set_face_coords();
 }
 
 /// Set the cartesian position of the center of the detector in 3d space (in meters).
 void Primitive::SetPosition(double x, double y, double z){
+	assert(!frozen);
 	position.axis[0] = x; position.axis[1] = y; position.axis[2] = z;
-	need_set = true;
+	_set_face_coords();
 }
 
 /// Set the polar position of the center of the detector in 3d space (meters and radians).
 void Primitive::SetPolarPosition(double r, double theta, double phi){
+	assert(!frozen);
 	Sphere2Cart(r, theta, phi, position);
-	need_set = true;
+	_set_face_coords();
 }
 
 /** Get the local unit vectors using 3d matrix rotation
   * X and Y are face axes, Z is the axis into or out of the detector.
   */
 void Primitive::SetRotation(double theta_, double phi_, double psi_){
+	assert(!frozen);
 	theta = theta_; phi = phi_; psi = psi_;
 	
 	double sin_theta = std::sin(theta); double cos_theta = std::cos(theta);
@@ -245,7 +305,7 @@ void Primitive::SetRotation(double theta_, double phi_, double psi_){
 	
 	// Normalize the unit vectors
 	detX.Normalize(); detY.Normalize(); detZ.Normalize();
-	need_set = true;
+	_set_face_coords();
 	
 	// Set the rotation matrix
 	rotationMatrix.SetUnitX(detX);
@@ -259,10 +319,11 @@ void Primitive::SetRotation(double theta_, double phi_, double psi_){
   *  and should therefore only be used for testing and debugging.
   */
 void Primitive::SetUnitVectors(const Vector3 &unitX, const Vector3 &unitY, const Vector3 &unitZ){
+	assert(!frozen);
 	detX = unitX; detY = unitY; detZ = unitZ;
 	
 	detX.Normalize(); detY.Normalize(); detZ.Normalize();
-	need_set = true;
+	_set_face_coords();
 	
 	// Set the rotation matrix
 	rotationMatrix.SetUnitX(detX);
@@ -275,13 +336,13 @@ void Primitive::SetUnitVectors(const Vector3 &unitX, const Vector3 &unitY, const
   */
 bool Primitive::CheckBounds(const unsigned int &face_, const double &x_, const double &y_, const double &z_){
 	if(face_ == 0 || face_ == 2){ // Front face (upstream) or back face (downstream)
-		if((x_ >= -width/2.0 && x_ <= width/2.0) && (y_ >= -length/2.0 && y_ <= length/2.0)){ return true; }
+		if((x_ >= -halfWidth && x_ <= halfWidth) && (y_ >= -halfLength && y_ <= halfLength)){ return true; }
 	}
 	else if(face_ == 1 || face_ == 3){ // Right face (beam-right) or left face (beam-left)
-		if((z_ >= -depth/2.0 && z_ <= depth/2.0) && (y_ >= -length/2.0 && y_ <= length/2.0)){ return true; }
+		if((z_ >= -halfDepth && z_ <= halfDepth) && (y_ >= -halfLength && y_ <= halfLength)){ return true; }
 	}
 	else if(face_ == 4 || face_ == 5){ // Top face (+y) or bottom face (-y)
-		if((x_ >= -width/2.0 && x_ <= width/2.0) && (z_ >= -depth/2.0 && z_ <= depth/2.0)){ return true; }
+		if((x_ >= -halfWidth && x_ <= halfWidth) && (z_ >= -halfDepth && z_ <= halfDepth)){ return true; }
 	}
 	
 	return false;	
@@ -297,8 +358,6 @@ bool Primitive::CheckBounds(const unsigned int &face_, const double &x_, const d
   * face 5 is along the -y local axis.
   */
 bool Primitive::PlaneIntersect(const Vector3 &offset_, const Vector3 &direction_, unsigned int face_, double &t){
-	if(need_set){ _set_face_coords(); }
-	
 	Vector3 unit;
 	GetUnitVector(face_, unit);
 	
@@ -313,8 +372,6 @@ bool Primitive::PlaneIntersect(const Vector3 &offset_, const Vector3 &direction_
   * as the "width" of the detector. That is, the size along the x-axis.
   */
 bool Primitive::CylinderIntersect(const Vector3 &offset_, const Vector3 &direction_, double &t1, double &t2){
-	if(need_set){ _set_face_coords(); }
-	
 	// position is the position of the center of the detector.
 	// The direction of the cylinder is given by the local unit vector detY.
 	Vector3 dP = offset_ - position;
@@ -323,7 +380,7 @@ bool Primitive::CylinderIntersect(const Vector3 &offset_, const Vector3 &directi
 	
 	double A2 = A1.Square();
 	double B2 = 2.0 * C1.Dot(A1);
-	double C2 = C1.Square() - width*width/4.0;
+	double C2 = C1.Square() - widthRadius2;
 	
 	t1 = (-B2 + std::sqrt(B2*B2-4.0*A2*C2))/(2.0*A2);
 	t2 = (-B2 - std::sqrt(B2*B2-4.0*A2*C2))/(2.0*A2);
@@ -345,21 +402,15 @@ bool Primitive::CylinderIntersect(const Vector3 &offset_, const Vector3 &directi
   * as atan(width/length).
   */
 bool Primitive::ConeIntersect(const Vector3 &offset_, const Vector3 &direction_, double &t1, double &t2){
-	if(need_set){ _set_face_coords(); }
-	
 	Vector3 dP = offset_ - position;
 	Vector3 A1 = direction_ - detY*detY.Dot(direction_);
 	double B1 = direction_.Dot(detY);
 	Vector3 C1 = dP - detY*detY.Dot(dP);
 	double D1 = dP.Dot(detY);
 	
-	// The squared cosine and sine of the opening angle of the cone.
-	double cos2_alpha = length*length / (length*length + width*width/4.0);
-	double sin2_alpha = width*width / (4.0*length*length + width*width);
-	
-	double A2 = cos2_alpha*A1.Square() - sin2_alpha*B1*B1;
-	double B2 = 2*cos2_alpha*A1.Dot(C1) - 2*sin2_alpha*B1*D1;
-	double C2 = cos2_alpha*C1.Square() - sin2_alpha*D1*D1;
+	double A2 = coneCos2*A1.Square() - coneSin2*B1*B1;
+	double B2 = 2*coneCos2*A1.Dot(C1) - 2*coneSin2*B1*D1;
+	double C2 = coneCos2*C1.Square() - coneSin2*D1*D1;
 	
 	t1 = (-B2 + std::sqrt(B2*B2-4.0*A2*C2))/(2.0*A2);
 	t2 = (-B2 - std::sqrt(B2*B2-4.0*A2*C2))/(2.0*A2);
@@ -382,12 +433,10 @@ bool Primitive::ConeIntersect(const Vector3 &offset_, const Vector3 &direction_,
   * the size along the y-axis.
   */
 bool Primitive::SphereIntersect(const Vector3 &offset_, const Vector3 &direction_, double &t1, double &t2){
-	if(need_set){ _set_face_coords(); }
-	
 	Vector3 R = offset_ - position; // Vector pointing from the center of the detector to the start position of the ray.
 	double A = direction_.Square();
 	double B = 2.0 * R.Dot(direction_); 
-	double C = R.Square() - length*length/4.0;
+	double C = R.Square() - lengthRadius2;
 	
 	t1 = (-B + std::sqrt(B*B-4.0*A*C))/(2.0*A);
 	t2 = (-B - std::sqrt(B*B-4.0*A*C))/(2.0*A);
@@ -413,8 +462,6 @@ bool Primitive::SphereIntersect(const Vector3 &offset_, const Vector3 &direction
   * Return true if the prism is intersected, and false otherwise.
   */
 bool Primitive::IntersectPrimitive(const Vector3& offset_, const Vector3& direction_, Vector3 &P1, Vector3 &norm, double &t1, double &t2){
-	if(need_set){ _set_face_coords(); }
-	
 	int face_count = 0;
 	int face1 = -1;
 	double temp_t;
@@ -475,7 +522,6 @@ double Primitive::GetApparentThickness(const Vector3 &offset_, const Vector3 &di
   * centers of all six faces of the VANDLE detector and its center coordinate.
   */
 std::string Primitive::DumpVertex(){
-	if(need_set){ _set_face_coords(); }
 	std::stringstream stream;
 	for(unsigned int i = 0; i < 6; i++){
 		stream << GlobalFace[i].axis[0] << "\t" << GlobalFace[i].axis[1] << "\t" << GlobalFace[i].axis[2] << "\n";
@@ -488,7 +534,6 @@ std::string Primitive::DumpVertex(){
   * X(m) Y(m) Z(m) Theta(rad) Phi(rad) Psi(rad) Type Subtype Length(m) Width(m) Depth(m) Material.
   */
 std::string Primitive::DumpDet(){
-	if(need_set){ _set_face_coords(); }
 	std::stringstream stream;
 	stream << position.axis[0] << "\t" << position.axis[1] << "\t" << position.axis[2];
 	stream << "\t" << theta << "\t" << phi << "\t" << psi;
@@ -510,6 +555,7 @@ Planar::Planar(NewVIKARdet *det_) : Primitive(det_) {
 		if(det_->subtype == "small"){ SetSmall(); }
 		else if(det_->subtype == "medium"){ SetMedium(); }
 		else if(det_->subtype == "large"){ SetLarge(); }
+		else if(det_->subtype == "wall" || det_->subtype == "ring"){ SetSize(det_->data[6], det_->data[7], det_->data[8]); } // Bars of an array.
 		else{ 
 			std::cout << " Warning! Unknown VANDLE subtype = " << det_->subtype << "!\n";
 			SetSize(det_->data[6], det_->data[7], det_->data[8]);			
@@ -518,6 +564,109 @@ Planar::Planar(NewVIKARdet *det_) : Primitive(det_) {
 	else{ SetSize(det_->data[6], det_->data[7], det_->data[8]); }
 }
 
+/** Calculate the intersection of a ray of the form (offset_ + t * direction_) with this 
+  * rectangular box. The ray is transformed into the local detector frame once and clipped
+  * against the three pairs of faces (the slab method), which gives the same result as
+  * Primitive::IntersectPrimitive without testing each face separately.
+  * offset_ is the point where the ray originates wrt the global origin.
+  * direction_ is the direction of the ray wrt the global origin.
+  * t1 is the parameter of the front intersection point given by P1 = offset_ + direction_*t1.
+  * t2 is the parameter of the back intersection point given by P2 = offset_ + direction_*t2.
+  * norm is the normal vector to the surface at point P1.
+  * Return true if the box is intersected, and false otherwise.
+  */
+bool Planar::IntersectPrimitive(const Vector3& offset_, const Vector3& direction_, Vector3 &P1, Vector3 &norm, double &t1, double &t2){
+	// Faces on the negative and positive side of the local x, y and z axes.
+	static const int lowerFace[3] = {3, 5, 0};
+	static const int upperFace[3] = {1, 4, 2};
+
+	// Transform the ray into the local detector frame.
+	Vector3 dP = offset_ - position;
+	const double origin[3] = {dP.Dot(detX), dP.Dot(detY), dP.Dot(detZ)};
+	const double direction[3] = {direction_.Dot(detX), direction_.Dot(detY), direction_.Dot(detZ)};
+	const double halfSize[3] = {halfWidth, halfLength, halfDepth};
+
+	double tEntry = -std::numeric_limits<double>::max();
+	double tExit = std::numeric_limits<double>::max();
+	int entryFace = -1;
+	int exitFace = -1;
+	for(int i = 0; i < 3; i++){
+		if(direction[i] == 0.0){ // The ray is parallel to this pair of faces.
+			if(origin[i] < -halfSize[i] || origin[i] > halfSize[i]){ return false; }
+			continue;
+		}
+
+		// The ray enters through the lower face when travelling along the positive axis.
+		const bool positive = (direction[i] > 0.0);
+		const double tLower = (-halfSize[i]-origin[i])/direction[i];
+		const double tUpper = (halfSize[i]-origin[i])/direction[i];
+		const double tNear = (positive ? tLower : tUpper);
+		const double tFar = (positive ? tUpper : tLower);
+
+		if(tNear > tEntry){
+			tEntry = tNear;
+			entryFace = (positive ? lowerFace[i] : upperFace[i]);
+		}
+		if(tFar < tExit){
+			tExit = tFar;
+			exitFace = (positive ? upperFace[i] : lowerFace[i]);
+		}
+	}
+
+	// Check that the ray crosses the box in front of its origin.
+	if(entryFace < 0 || tEntry > tExit || tExit < 0.0){ return false; }
+
+	if(tEntry >= 0.0){
+		t1 = tEntry;
+		t2 = tExit;
+	}
+	else{ // The ray starts inside the box, so only the exit face is in front of it (t2 is not set).
+		t1 = tExit;
+		entryFace = exitFace;
+	}
+
+	P1 = offset_ + direction_*t1;
+
+	// Get the surface normal at point P1.
+	GetUnitVector(entryFace, norm);
+
+	return true;
+}
+
+/////////////////////////////////////////////////////////////////////
+// ThinSlab
+/////////////////////////////////////////////////////////////////////
+
+/** Calculate the intersection of a ray of the form (offset_ + t * direction_) with the slab.
+  * offset_ is the point where the ray originates wrt the global origin.
+  * direction_ is the direction of the ray wrt the global origin.
+  * t1 is the parameter of the front intersection point given by P1 = offset_ + direction_*t1.
+  * t2 is the parameter of the back intersection point given by P2 = offset_ + direction_*t2.
+  * If the ray starts inside the slab, t1 is the exit point and t2 is not set.
+  * norm is the normal vector to the surface at point P1.
+  * Return true if the slab is intersected, and false otherwise.
+  */
+bool ThinSlab::IntersectPrimitive(const Vector3& offset_, const Vector3& direction_, Vector3 &P1, Vector3 &norm, double &t1, double &t2){
+	double tFront, tBack;
+	if(!GetCrossings(offset_, direction_, tFront, tBack) || tBack < 0.0){ return false; }
+
+	// The ray leaves through the +z face (face 2) when travelling along the local z axis.
+	const bool forward = (direction_.Dot(detZ) > 0.0);
+	if(tFront >= 0.0){
+		t1 = tFront;
+		t2 = tBack;
+		GetUnitVector((forward ? 0 : 2), norm);
+	}
+	else{ // The ray starts inside the slab, so only the exit face is in front of it (t2 is not set).
+		t1 = tBack;
+		GetUnitVector((forward ? 2 : 0), norm);
+	}
+
+	P1 = offset_ + direction_*t1;
+
+	return true;
+}
+
 /////////////////////////////////////////////////////////////////////
 // Cylindrical
 /////////////////////////////////////////////////////////////////////
@@ -531,8 +680,6 @@ Planar::Planar(NewVIKARdet *det_) : Primitive(det_) {
   * Return true if the cylinder is intersected, and false otherwise.
   */
 bool Cylindrical::IntersectPrimitive(const Vector3& offset_, const Vector3& direction_, Vector3 &P1, Vector3 &norm, double &t1, double &t2){
-	if(need_set){ _set_face_coords(); }
-	
 	// Check if the ray intersects the infinite cylinder with r = width/2.0.
 	if(!CylinderIntersect(offset_, direction_, t1, t2)){ return false; }
 	
@@ -542,11 +689,11 @@ bool Cylindrical::IntersectPrimitive(const Vector3& offset_, const Vector3& dire
 	int face1 = 0;
 	
 	// Check if the intersection points are within the cylinder endcaps.
-	double z1 = std::sqrt(r1.Square() - width*width/4.0);
+	double z1 = std::sqrt(r1.Square() - widthRadius2);
 	
 	if(r1.CosAngle(detY) < 0.0){ z1 *= -1; }
 	
-	bool check1 = fabs(z1) <= length/2.0;
+	bool check1 = fabs(z1) <= halfLength;
 	
 	if(!check1){ // Point P1 is outside of the bounds of the cylinder.
 		double temp_t;
@@ -555,7 +702,7 @@ bool Cylindrical::IntersectPrimitive(const Vector3& offset_, const Vector3& dire
 			if(PlaneIntersect(offset_, direction_, i, temp_t)){
 				// Transform the intersection point into local coordinates and check if they're within the bounds
 				GetLocalCoords((offset_ + direction_*temp_t), px, py, pz);
-				if((px*px + pz*pz) <= width*width/4.0){ // The face was struck
+				if((px*px + pz*pz) <= widthRadius2){ // The face was struck
 					P1 = offset_ + direction_*temp_t; 
 					t1 = temp_t;
 					face1 = i;
@@ -577,15 +724,25 @@ bool Cylindrical::IntersectPrimitive(const Vector3& offset_, const Vector3& dire
 	return true;
 }
 
+/** Get the lower and upper corners of a box which contains the cylinder, in the
+  * local detector frame and relative to the position of the detector (in m).
+  */
+void Cylindrical::GetLocalBounds(Vector3 &lower, Vector3 &upper){
+	lower = Vector3(-width/2.0, -length/2.0, -width/2.0);
+	upper = Vector3(width/2.0, length/2.0, width/2.0);
+}
+
 /////////////////////////////////////////////////////////////////////
 // Conical
 /////////////////////////////////////////////////////////////////////
 
-/// Constructor using a NewVIKARDet object.
-Conical::Conical(NewVIKARdet *det_) : Primitive(det_) {
-	alpha = std::atan2(width/2.0, length); 
-	sin_alpha = std::sin(alpha);
-	cos_alpha = std::cos(alpha);
+/** Get the lower and upper corners of a box which contains the cone, in the local
+  * detector frame and relative to the position of the detector (in m). The apex
+  * of the cone is at the position of the detector and it opens along the -y axis.
+  */
+void Conical::GetLocalBounds(Vector3 &lower, Vector3 &upper){
+	lower = Vector3(-width/2.0, -length, -width/2.0);
+	upper = Vector3(width/2.0, 0.0, width/2.0);
 }
 
 /** Calculate the intersection of a ray of the form (offset_ + t * direction_) with this cone.
@@ -597,8 +754,6 @@ Conical::Conical(NewVIKARdet *det_) : Primitive(det_) {
   * Return true if the cylinder is intersected, and false otherwise.
   */
 bool Conical::IntersectPrimitive(const Vector3& offset_, const Vector3& direction_, Vector3 &P1, Vector3 &norm, double &t1, double &t2){
-	if(need_set){ _set_face_coords(); }
-	
 	// Check if the ray intersects the infinite cylinder with r = width/2.0.
 	if(!ConeIntersect(offset_, direction_, t1, t2)){ return false; }
 	
@@ -609,7 +764,7 @@ bool Conical::IntersectPrimitive(const Vector3& offset_, const Vector3& directio
 	int face1 = 0;
 
 	// Check if the intersection points are within the cone.
-	double z1 = r1.Length()*cos_alpha;
+	double z1 = r1.Length()*coneCos;
 	
 	bool check1 = fabs(z1) <= length;
 	
@@ -619,7 +774,7 @@ bool Conical::IntersectPrimitive(const Vector3& offset_, const Vector3& directio
 		if(PlaneIntersect(offset_, direction_, 5, temp_t)){
 			// Transform the intersection point into local coordinates and check if they're within the bounds
 			GetLocalCoords((offset_ + direction_*temp_t), px, py, pz);
-			if((px*px + pz*pz) <= width*width/4.0){ // The face was struck
+			if((px*px + pz*pz) <= widthRadius2){ // The face was struck
 				t1 = temp_t;
 				face1 = 5;
 			}
@@ -630,7 +785,7 @@ bool Conical::IntersectPrimitive(const Vector3& offset_, const Vector3& directio
 		if(!check1){ return false; } // Found no intersection with the endcaps.
 		Vector3 rprime = P1 - position + detY*z1;
 		rprime.Normalize();
-		norm = rprime*cos_alpha + detY*sin_alpha;
+		norm = rprime*coneCos + detY*coneSin;
 	}
 	else{ // Get the normal of one of the endcaps.
 		GetUnitVector(face1, norm); 
@@ -643,6 +798,14 @@ bool Conical::IntersectPrimitive(const Vector3& offset_, const Vector3& directio
 // Spherical
 /////////////////////////////////////////////////////////////////////
 
+/** Get the lower and upper corners of a box which contains the sphere, in the
+  * local detector frame and relative to the position of the detector (in m).
+  */
+void Spherical::GetLocalBounds(Vector3 &lower, Vector3 &upper){
+	lower = Vector3(-length/2.0, -length/2.0, -length/2.0);
+	upper = Vector3(length/2.0, length/2.0, length/2.0);
+}
+
 /** Calculate the intersection of a ray of the form (offset_ + t * direction_) with this sphere.
   * offset_ is the point where the ray originates wrt the global origin.
   * direction_ is the direction of the ray wrt the global origin.
@@ -652,8 +815,6 @@ bool Conical::IntersectPrimitive(const Vector3& offset_, const Vector3& directio
   * Return true if the sphere is intersected, and false otherwise.
   */
 bool Spherical::IntersectPrimitive(const Vector3& offset_, const Vector3& direction_, Vector3 &P1, Vector3 &norm, double &t1, double &t2){
-	if(need_set){ _set_face_coords(); }
-	
 	// Check if the ray intersects the sphere with r = length/2.0.
 	if(!SphereIntersect(offset_, direction_, t1, t2)){ return false; }
 	
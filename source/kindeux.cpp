@@ -12,6 +12,7 @@
  */
 #include "vandmc_core.hpp"
 #include "kindeux.hpp"
+#include "acceptance.hpp"
 
 /////////////////////////////////////////////////////////////////////
 // Californium
@@ -36,7 +37,11 @@ Californium::Californium(){
 }
 
 double Californium::sample(){
-        double sampleIntegral = frand(0, totalIntegral);
+        return sample(GetDefaultRandomEngine());
+}
+
+double Californium::sample(RandomEngine &rng_){
+        double sampleIntegral = frand(rng_, 0, totalIntegral);
         for(size_t i = 1; i < 101; i++){
                 if(integral[i-1] < sampleIntegral && integral[i] >= sampleIntegral){
                         return (energy[i-1] + 0.1*(sampleIntegral-integral[i-1])/(integral[i]-integral[i-1]));
@@ -59,6 +64,8 @@ Kindeux::Kindeux(){
 	Xsections = NULL;
 	Nreactions = NULL;
 	distributions = NULL;
+	rng = NULL;
+	acceptance = NULL;
 	Mbeam = 0.0; Mtarg = 0.0;
 	Mrecoil = 0.0; Meject = 0.0;
 	Qvalue = 0.0;
@@ -206,6 +213,23 @@ bool Kindeux::SetRutherford(double coeff_){
 	return true;
 }
 
+/// Return the random number engine used by this object.
+RandomEngine &Kindeux::GetRandomEngine(){
+	return (rng ? *rng : GetDefaultRandomEngine());
+}
+
+/** Return the ejectile center of mass angle of a state at which the cumulative
+  * angular distribution reaches frac_ (rad). States without an angular distribution
+  * are isotropic.
+  */
+double Kindeux::GetComAngle(const unsigned int &state_, const double &frac_){
+	if(ang_dist && state_ < NrecoilStates){
+		double angle = distributions[state_].GetAngle(frac_);
+		if(angle >= 0.0){ return angle; }
+	}
+	return std::acos(2*frac_-1); // Uniformly distributed on the unit sphere.
+}
+
 /** Get the excitation of the recoil particle based on angular distributions
   *  if they are available or isotropic distributions if they are not.
   * Returns true if a reaction occured and false otherwise.
@@ -221,7 +245,7 @@ bool Kindeux::get_excitations(double &recoilE, unsigned int &state){
 	}
 	else if(ang_dist){	
 		// Angular dist weighted
-		double rand_xsection = frand()*total_xsection;
+		double rand_xsection = GetRandomEngine().Uniform()*total_xsection;
 		for(unsigned int i = 0; i < NrecoilStates-1; i++){
 			if(rand_xsection >= Xsections[i] && rand_xsection <= Xsections[i+1]){
 				// State i has been selected
@@ -238,7 +262,7 @@ bool Kindeux::get_excitations(double &recoilE, unsigned int &state){
 	}
 	else{ 
 		// Isotropic
-		state = (unsigned int)(frand()*NrecoilStates);
+		state = (unsigned int)(GetRandomEngine().Uniform()*NrecoilStates);
 		recoilE = RecoilExStates[state];
 		Nreactions[state]++;
 	}
@@ -265,6 +289,8 @@ bool Kindeux::FillVars(reactData &react, Vector3 &Ejectile, int recoil_state/*=-
   */
 bool Kindeux::FillVars(reactData &react, Vector3 &Ejectile, Vector3 &Recoil, int recoil_state/*=-1*/, int solution/*=-1*/, double theta/*=-1*/){
 	double EjectPhi, EjectTheta;
+	RandomEngine &engine = GetRandomEngine();
+	react.weight = 1.0;
 	if(!nsource){
 		if(recoil_state >= 0 && (unsigned int)recoil_state < NrecoilStates){ // Select the state to use
 			react.state = recoil_state;
@@ -284,18 +310,25 @@ bool Kindeux::FillVars(reactData &react, Vector3 &Ejectile, Vector3 &Recoil, int
 	
 		if(theta >= 0.0){
 			double temp;
-			UnitSphereRandom(temp, EjectPhi);
+			UnitSphereRandom(engine, temp, EjectPhi);
 		
 			if(theta >= 0.0){ react.comAngle = theta; }
 			else{ react.comAngle = temp; }
 		}
+		else if(acceptance){
+			// Sample the CoM angle and phi of the ejectile preferentially in the detector acceptance
+			double thetaFrac, phiFrac;
+			react.weight = acceptance->Sample(engine, react.state, react.Ereact, thetaFrac, phiFrac);
+			react.comAngle = GetComAngle(react.state, thetaFrac);
+			EjectPhi = 2*pi*phiFrac;
+		}
 		else if(ang_dist){
 			// Sample the angular distributions for the CoM angle of the ejectile
-			react.comAngle = distributions[react.state].Sample();
-			if(react.comAngle > 0.0){ EjectPhi = 2*pi*frand(); } // Randomly select phi of the ejectile
-			else{ UnitSphereRandom(react.comAngle, EjectPhi); } // Failed to sample the distribution
+			react.comAngle = distributions[react.state].Sample(engine);
+			if(react.comAngle > 0.0){ EjectPhi = 2*pi*engine.Uniform(); } // Randomly select phi of the ejectile
+			else{ UnitSphereRandom(engine, react.comAngle, EjectPhi); } // Failed to sample the distribution
 		}
-		else{ UnitSphereRandom(react.comAngle, EjectPhi); } // Randomly select a uniformly distributed point on the unit sphere
+		else{ UnitSphereRandom(engine, react.comAngle, EjectPhi); } // Randomly select a uniformly distributed point on the unit sphere
 
 		EjectTheta = std::atan2(std::sin(react.comAngle),(std::cos(react.comAngle)+(Vcm/VejectCoM))); // Ejectile angle in the lab
 		double temp_value = std::sqrt(VejectCoM*VejectCoM-pow(Vcm*std::sin(EjectTheta),2.0));
@@ -312,7 +345,7 @@ bool Kindeux::FillVars(reactData &react, Vector3 &Ejectile, Vector3 &Recoil, int
 			// Veject is double valued, so we randomly choose one of the values
 			// for the velocity, and hence, the energy of the ejectile
 			if(solution < 0){
-				if(frand() >= 0.5){ Ejectile_V += temp_value; }
+				if(engine.Uniform() >= 0.5){ Ejectile_V += temp_value; }
 				else{ Ejectile_V = Ejectile_V - temp_value; }
 			}
 			else if(solution == 0){ Ejectile_V += temp_value; }
@@ -327,8 +360,8 @@ bool Kindeux::FillVars(reactData &react, Vector3 &Ejectile, Vector3 &Recoil, int
 		Recoil = Vector3(1.0, std::asin(((std::sqrt(2*Meject*react.Eeject))/(std::sqrt(2*Mrecoil*react.Erecoil)))*std::sin(EjectTheta)), WrapValue(EjectPhi+pi,0.0,2*pi));
 	}
 	else{
-		react.Eeject = cf.sample();
-		UnitSphereRandom(EjectTheta, EjectPhi);
+		react.Eeject = cf.sample(engine);
+		UnitSphereRandom(engine, EjectTheta, EjectPhi);
 	}
 
 	Ejectile = Vector3(1.0, EjectTheta, EjectPhi); // Ejectile direction unit vector
@@ -7,8 +7,20 @@
  * \author C. R. Thornsberry
  * \date Feb. 26th, 2016
  */
+#include <algorithm>
+#include <limits>
+#include <sstream>
+#include <iomanip>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <dirent.h>
+
 #include "vandmc_core.hpp"
 #include "materials.hpp"
+#include "threadPool.hpp"
 
 /////////////////////////////////////////////////////////////////////
 // Constant Globals 
@@ -40,6 +52,30 @@ const float potentials[100] = {19.2, 41.8, 40, 63.7, 76, 78, 82, 95, 115, 137,
 // RangeTable
 /////////////////////////////////////////////////////////////////////
 
+/// Number of table entries calculated by each job when the stopping powers are calculated in parallel.
+const unsigned int rangeTableBlockSize = 256;
+
+/// Identifies range table files written by RangeTable::Write. Change the last character if the layout changes.
+const char rangeTableMagic[8] = {'V', 'M', 'C', 'R', 'T', 'A', 'B', '2'};
+
+/** Header at the start of a range table file. It is followed by the key (padded with zeros to a multiple
+  * of 8 bytes) and by the energy, stopping power and range arrays, each holding entries doubles.
+  */
+struct rangeTableHeader{
+	char magic[8]; /// Always equal to rangeTableMagic.
+	uint32_t keyLength; /// Length of the key (bytes).
+	uint32_t entries; /// Number of table entries.
+	double step; /// Energy step size (MeV).
+	double logStep; /// Step size in the natural log of energy.
+	uint32_t logarithmic; /// One if the energies are evenly spaced in log(energy), zero otherwise.
+	uint32_t reserved; /// Always zero.
+};
+
+/// Return the size of a range table key once padded to a multiple of 8 bytes.
+inline size_t paddedKeyLength(const size_t &length_){
+	return (length_+7)/8*8;
+}
+
 /// Initialize range table arrays.
 bool RangeTable::_initialize(const unsigned int &num_entries_){
 	if(use_table){ return false; }
@@ -48,31 +84,196 @@ bool RangeTable::_initialize(const unsigned int &num_entries_){
 	dedx.assign(num_entries, 0.0);
 	range.assign(num_entries, 0.0);
 	use_table = true;
+	uniform = false;
+	logarithmic = false;
+	rangeIndex.clear();
 	return true;
 }
 
-/// Interpolate between two points
-double RangeTable::_interpolate(const std::vector<double> &x_, const std::vector<double> &y_, const double &val_){
-	if(x_.empty() || y_.empty() || x_.size() != y_.size()){ return -1; }
-	else if(val_ < x_[0]){ return 0.0; }
-	for(unsigned int i = 0; i < num_entries-1; i++){
-		if(val_ == x_[i]){ return y_[i]; }
-		else if(val_ == x_[i+1]){ return y_[i+1]; }
-		else if(val_ >= x_[i] && val_ <= x_[i+1]){
-			// Interpolate and return the result
-			return (((y_[i+1]-y_[i])/(x_[i+1]-x_[i]))*(val_-x_[i])+y_[i]);
+/** Fill the arrays with num_entries_ energies evenly spaced in log(energy) from startE_ to stopE_
+  * using model_ (or Material if model_ is NULL). middle_ is filled with minus the stopping power at the
+  * middle (in log(energy)) of the interval below each entry. If pool_ is not NULL, the stopping powers
+  * are calculated using all of its threads.
+  */
+void RangeTable::_fillLog(const unsigned int &num_entries_, const double &startE_, const double &stopE_, const double &Z_, const double &mass_, Material *mat_, ThreadPool *pool_, StoppingPowerModel *model_, std::vector<double> &middle_){
+	num_entries = num_entries_;
+	energy.assign(num_entries, 0.0);
+	dedx.assign(num_entries, 0.0);
+	range.assign(num_entries, 0.0);
+	middle_.assign(num_entries, 0.0);
+
+	step = 0.0;
+	logStart = std::log(startE_);
+	logStep = (std::log(stopE_)-logStart)/(num_entries-1);
+
+	// The middle of each interval in log(energy) is the geometric mean of its ends. Using the same expression
+	// here and in _refineLog means the middles of this table are exactly the new entries of a finer one.
+	for(unsigned int i = 0; i < num_entries; i++){
+		energy[i] = (i == 0 ? startE_ : (i == num_entries-1 ? stopE_ : std::exp(logStart + i*logStep))); // Energy in MeV
+		if(i > 0){ middle_[i] = std::sqrt(energy[i-1]*energy[i]); } // Replaced by the stopping power below.
+	}
+	_stopPowerBlocks(Z_, mass_, mat_, model_, pool_, energy.data(), dedx.data(), num_entries); // Stopping power in MeV/m
+	_stopPowerBlocks(Z_, mass_, mat_, model_, pool_, &middle_[1], &middle_[1], num_entries-1);
+
+	_integrateLog(middle_);
+}
+
+/** Fill the arrays with twice as many intervals as the log-spaced table coarse_, whose stopping powers at
+  * the middle of each interval are coarseMiddle_. The entries and middles of coarse_ become the entries of
+  * this table, so only the stopping powers at the new middles (returned in middle_) are calculated.
+  */
+void RangeTable::_refineLog(const RangeTable &coarse_, const std::vector<double> &coarseMiddle_, const double &Z_, const double &mass_, Material *mat_, ThreadPool *pool_, StoppingPowerModel *model_, std::vector<double> &middle_){
+	num_entries = 2*coarse_.num_entries-1;
+	energy.assign(num_entries, 0.0);
+	dedx.assign(num_entries, 0.0);
+	range.assign(num_entries, 0.0);
+	middle_.assign(num_entries, 0.0);
+
+	step = 0.0;
+	logStart = coarse_.logStart;
+	logStep = coarse_.logStep/2.0;
+
+	for(unsigned int i = 0; i < coarse_.num_entries; i++){
+		energy[2*i] = coarse_.energy[i];
+		dedx[2*i] = coarse_.dedx[i];
+		if(i > 0){
+			energy[2*i-1] = std::sqrt(coarse_.energy[i-1]*coarse_.energy[i]);
+			dedx[2*i-1] = coarseMiddle_[i];
 		}
 	}
-	return -1;
+	for(unsigned int i = 1; i < num_entries; i++){
+		middle_[i] = std::sqrt(energy[i-1]*energy[i]); // Replaced by the stopping power below.
+	}
+	_stopPowerBlocks(Z_, mass_, mat_, model_, pool_, &middle_[1], &middle_[1], num_entries-1);
+
+	_integrateLog(middle_);
+}
+
+/** Calculate the ranges of a log-spaced table from the stopping powers at each entry and at the middle
+  * of the interval below each entry (middle_), using Simpson's rule in log(energy).
+  */
+void RangeTable::_integrateLog(const std::vector<double> &middle_){
+	// dR/d(log(E)) = E/S(E), where dedx = -S(E).
+	range[0] = 0.0;
+	for(unsigned int i = 1; i < num_entries; i++){
+		const double width = std::log(energy[i]/energy[i-1]);
+		range[i] = range[i-1] - (energy[i-1]/dedx[i-1] + 4.0*std::sqrt(energy[i-1]*energy[i])/middle_[i] + energy[i]/dedx[i])*width/6.0;
+	}
+}
+
+/// Fill dedx_ with minus the stopping power (MeV/m) at count_ energies, using model_ or Material if model_ is NULL.
+void RangeTable::_stopPower(const double &Z_, const double &mass_, Material *mat_, StoppingPowerModel *model_, const double *energies_, double *dedx_, const unsigned int &count_){
+	if(model_){ model_->StopPower(mat_, Z_, mass_, energies_, dedx_, count_); }
+	else{
+		for(unsigned int i = 0; i < count_; i++){ dedx_[i] = mat_->StopPower(energies_[i], Z_, mass_); }
+	}
+	for(unsigned int i = 0; i < count_; i++){ dedx_[i] *= -1; }
+}
+
+/// As _stopPower, but if pool_ is not NULL the energies are split into blocks which are calculated using all of its threads.
+void RangeTable::_stopPowerBlocks(const double &Z_, const double &mass_, Material *mat_, StoppingPowerModel *model_, ThreadPool *pool_, const double *energies_, double *dedx_, const unsigned int &count_){
+	std::function<void(const unsigned int &)> job = [&](const unsigned int &block_){
+		const unsigned int first = block_*rangeTableBlockSize;
+		const unsigned int stop = std::min(count_, first+rangeTableBlockSize);
+		_stopPower(Z_, mass_, mat_, model_, energies_+first, dedx_+first, stop-first);
+	};
+	const unsigned int nBlocks = (count_+rangeTableBlockSize-1)/rangeTableBlockSize;
+	if(pool_ && nBlocks > 1){ pool_->Execute(nBlocks, job); }
+	else{
+		for(unsigned int i = 0; i < nBlocks; i++){ job(i); }
+	}
+}
+
+/** Build the index used to find the table interval containing a range without searching the table.
+  * The range grows roughly as a power of the energy, so the index buckets are evenly spaced in log(range)
+  * and each holds about one table entry. The index is empty if the ranges are not ascending.
+  */
+void RangeTable::_indexRange(){
+	rangeIndex.clear();
+	if(num_entries < 3 || !(range[1] > 0.0)){ return; }
+	for(unsigned int i = 1; i < num_entries; i++){
+		if(!(range[i] > range[i-1])){ return; }
+	}
+
+	logRangeStart = std::log(range[1]);
+	logRangeStep = (std::log(range[num_entries-1])-logRangeStart)/num_entries;
+	if(!(logRangeStep > 0.0)){ return; }
+
+	// The lower edges of the buckets are ascending, so the table only needs to be walked once.
+	const unsigned int last = num_entries-2;
+	rangeIndex.assign(num_entries, 0);
+	unsigned int i = 1;
+	for(unsigned int bucket = 0; bucket < num_entries; bucket++){
+		const double edge = std::exp(logRangeStart + bucket*logRangeStep);
+		while(i < last && edge > range[i+1]){ i++; }
+		rangeIndex[bucket] = i;
+	}
+}
+
+/** Return the index of the table interval containing val_ in the ascending array x_.
+  * val_ must lie in the range [x_.front(), x_.back()]. For LOOKUP_ENERGY, x_ is taken
+  * to be evenly spaced by step (or by logStep in log(energy)) and the index is
+  * calculated directly. For LOOKUP_RANGE, x_ is taken to be the range array and the
+  * search starts from the range index. Otherwise, a binary search is used.
+  */
+unsigned int RangeTable::_find(const std::vector<double> &x_, const double &val_, const lookupMethod &method_){
+	const unsigned int last = num_entries-2;
+	if(method_ == LOOKUP_SEARCH){
+		unsigned int i = std::upper_bound(x_.begin(), x_.begin()+num_entries, val_) - x_.begin();
+		return (i > 0 ? (i-1 < last ? i-1 : last) : 0);
+	}
+
+	// Calculate the index directly and correct for any rounding error, or for the spacing within a bucket.
+	unsigned int i;
+	if(method_ == LOOKUP_RANGE){
+		if(!(val_ > x_[1])){ return 0; }
+		const double position = (std::log(val_)-logRangeStart)/logRangeStep;
+		i = rangeIndex[(position > 0.0 ? (position < num_entries-1 ? (unsigned int)position : num_entries-1) : 0)];
+	}
+	else{
+		const double position = (logarithmic ? (std::log(val_)-logStart)/logStep : (val_-x_[0])/step);
+		i = (position > 0.0 ? (position < last ? (unsigned int)position : last) : 0);
+	}
+	while(i > 0 && val_ < x_[i]){ i--; }
+	while(i < last && val_ > x_[i+1]){ i++; }
+	return i;
+}
+
+/// Interpolate between two points
+double RangeTable::_interpolate(const std::vector<double> &x_, const std::vector<double> &y_, const double &val_, const lookupMethod &method_/*=LOOKUP_SEARCH*/){
+	if(x_.empty() || y_.empty() || x_.size() != y_.size() || num_entries < 2){ return -1; }
+	else if(val_ < x_[0]){ return 0.0; }
+	else if(!(val_ <= x_[num_entries-1])){ return -1; } // Also catches NaN.
+
+	unsigned int i = _find(x_, val_, method_);
+	if(val_ == x_[i]){ return y_[i]; }
+	else if(val_ == x_[i+1]){ return y_[i+1]; }
+
+	// Interpolate and return the result
+	return (((y_[i+1]-y_[i])/(x_[i+1]-x_[i]))*(val_-x_[i])+y_[i]);
 }
 
 RangeTable::RangeTable(){ 
+	step = 0.0;
+	logStart = 0.0;
+	logStep = 0.0;
+	logRangeStart = 0.0;
+	logRangeStep = 0.0;
+	num_entries = 0;
 	use_table = false; 
 	use_birks = false;
+	uniform = false;
+	logarithmic = false;
 }
 
 /// Constructor to set the number of table entries.
 RangeTable::RangeTable(const unsigned int &num_entries_){
+	step = 0.0;
+	logStart = 0.0;
+	logStep = 0.0;
+	logRangeStart = 0.0;
+	logRangeStep = 0.0;
+	use_table = false;
 	_initialize(num_entries_);
 	use_birks = false;
 }
@@ -86,16 +287,16 @@ bool RangeTable::Init(const unsigned int &num_entries_){
 	return _initialize(num_entries_);
 }
 
-/// Initialize arrays and fill them using Material.
-bool RangeTable::Init(const unsigned int &num_entries_, const double &startE_, const double &stopE_, const double &Z_, const double &mass_, Material *mat_){
+/// Initialize arrays and fill them using model_, or using Material if model_ is NULL.
+bool RangeTable::Init(const unsigned int &num_entries_, const double &startE_, const double &stopE_, const double &Z_, const double &mass_, Material *mat_, StoppingPowerModel *model_/*=NULL*/){
 	if(!_initialize(num_entries_)){ return false; }
 	
 	// Use Material to fill the stopping power arrays.
 	step = (stopE_-startE_)/(num_entries_-1);
 	for(unsigned int i = 0; i < num_entries_; i++){
 		energy[i] = startE_ + i*step; // Energy in MeV
-		dedx[i] = -1*mat_->StopPower(energy[i], Z_, mass_); // Stopping power in MeV/m;
 	}
+	_stopPower(Z_, mass_, mat_, model_, energy.data(), dedx.data(), num_entries_); // Stopping power in MeV/m
 	
 	range[0] = 0.0;
 	
@@ -103,10 +304,96 @@ bool RangeTable::Init(const unsigned int &num_entries_, const double &startE_, c
 	for(unsigned int i = 1; i < num_entries_; i++){
 		range[i] = range[i-1] - 0.5*(1.0/dedx[i-1] + 1.0/dedx[i])*step;
 	}
+
+	// The energy array is evenly spaced, so it may be indexed directly.
+	uniform = (step > 0.0);
+	_indexRange();
 	
 	return true;
 }
 
+/** Initialize arrays and fill them using Material, with energies evenly spaced in log(energy) from startE_
+  * to stopE_ (in MeV). The number of entries is doubled until the energy found by interpolating the table
+  * at the range halfway (in log(energy)) between any two entries is within tolerance_ (relative) of the
+  * exact value, or until the table would have more than max_entries_ entries, in which case a warning is
+  * printed. Each doubling reuses the stopping powers already calculated. If the stopping power is not
+  * positive anywhere in the table, the table starts at the maximum of the stopping power above the highest
+  * such energy instead (the bare Bethe formula falls to zero and then becomes negative at low energy).
+  * Return false if the stopping power is not positive at stopE_. The energy of an entry is found directly
+  * from its logarithm, so lookups by energy do not need to search the table. Lookups by range start from an
+  * index evenly spaced in log(range). If pool_ is not NULL, the stopping powers are calculated using all of
+  * its threads. The table does not depend on pool_. The stopping powers are calculated using model_, or using
+  * Material if model_ is NULL.
+  */
+bool RangeTable::InitAdaptive(const double &startE_, const double &stopE_, const double &Z_, const double &mass_, Material *mat_, const double &tolerance_/*=1E-6*/, const unsigned int &max_entries_/*=100000*/, ThreadPool *pool_/*=NULL*/, StoppingPowerModel *model_/*=NULL*/){
+	if(use_table || !(startE_ > 0.0) || !(stopE_ > startE_) || !(tolerance_ > 0.0)){ return false; }
+
+	// Start from 10 entries for each factor of 10 in energy.
+	unsigned int intervals = (unsigned int)std::ceil(10*std::log10(stopE_/startE_));
+	if(intervals < 4){ intervals = 4; }
+	std::vector<double> middle, finerMiddle;
+	_fillLog(intervals+1, startE_, stopE_, Z_, mass_, mat_, pool_, model_, middle);
+
+	// The range is not defined where the stopping power is not positive, so start above the last such energy.
+	unsigned int last = num_entries;
+	for(unsigned int i = 0; i < num_entries; i++){
+		if(!(dedx[i] < 0.0) || (i > 0 && !(middle[i] < 0.0))){ last = i; }
+	}
+	if(last == num_entries-1){
+		std::stringstream warning;
+		warning << " Warning! Stopping power in " << mat_->GetName() << " is not positive at " << stopE_ << " MeV! Unable to build range table.\n";
+		std::cout << warning.str();
+		return false;
+	}
+	else if(last < num_entries){
+		// Start at the maximum of the stopping power, which lies above the energies where the model breaks down.
+		unsigned int peak = last+1;
+		while(peak+2 < num_entries && dedx[peak+1] < dedx[peak]){ peak++; }
+		const double peakE = energy[peak];
+		intervals = (unsigned int)std::ceil(10*std::log10(stopE_/peakE));
+		if(intervals < 4){ intervals = 4; }
+		_fillLog(intervals+1, peakE, stopE_, Z_, mass_, mat_, pool_, model_, middle);
+	}
+	use_table = true;
+	uniform = true;
+	logarithmic = true;
+
+	RangeTable finer;
+	bool converged = false;
+	while(2*intervals+1 <= max_entries_){
+		// Every other entry of a table with twice as many intervals lies halfway between two entries of this one.
+		finer._refineLog(*this, middle, Z_, mass_, mat_, pool_, model_, finerMiddle);
+		double maxError = 0.0;
+		for(unsigned int i = 1; i < finer.num_entries; i += 2){
+			double error = std::fabs(_interpolate(range, energy, finer.range[i])-finer.energy[i])/finer.energy[i];
+			if(error > maxError){ maxError = error; }
+		}
+		if(maxError <= tolerance_){
+			converged = true;
+			break;
+		}
+
+		energy.swap(finer.energy);
+		dedx.swap(finer.dedx);
+		range.swap(finer.range);
+		middle.swap(finerMiddle);
+		num_entries = finer.num_entries;
+		logStep = finer.logStep;
+		intervals *= 2;
+	}
+	_indexRange();
+
+	// The table is still usable, but energy losses will be less accurate than requested.
+	if(!converged){
+		std::stringstream warning;
+		warning << " Warning! Range table from " << energy[0] << " to " << stopE_ << " MeV in " << mat_->GetName() << " did not reach the relative tolerance of ";
+		warning << tolerance_ << " within " << max_entries_ << " entries! Using " << num_entries << " entries.\n";
+		std::cout << warning.str();
+	}
+
+	return true;
+}
+
 /// Initialize the birks light response array.
 bool RangeTable::InitBirks(double L0_, double kB_, double C_/*=0.0*/){
 	if(!use_table || use_birks){ return false; }
@@ -114,7 +401,8 @@ bool RangeTable::InitBirks(double L0_, double kB_, double C_/*=0.0*/){
 	birks.assign(num_entries, 0.0);
 	
 	for(unsigned int i = 1; i < num_entries; i++){
-		birks[i] = birks[i-1] + L0_*0.5*(1.0/(1.0 + kB_*dedx[i-1] + C_*dedx[i-1]*dedx[i-1]) + 1.0/(1.0 + kB_*dedx[i] + C_*dedx[i]*dedx[i]))*step;
+		const double width = (uniform && !logarithmic ? step : energy[i]-energy[i-1]);
+		birks[i] = birks[i-1] + L0_*0.5*(1.0/(1.0 + kB_*dedx[i-1] + C_*dedx[i-1]*dedx[i-1]) + 1.0/(1.0 + kB_*dedx[i] + C_*dedx[i]*dedx[i]))*width;
 	}
 	
 	use_birks = true;
@@ -125,28 +413,32 @@ bool RangeTable::InitBirks(double L0_, double kB_, double C_/*=0.0*/){
 /// Manually set a data point with an energy and a range.
 bool RangeTable::Set(const unsigned int &pt_, const double &energy_, const double &range_){
 	if(!use_table){ return false; }
-	if(pt_ > num_entries){ return false; }
+	if(pt_ >= num_entries){ return false; }
 	energy[pt_] = energy_;
 	range[pt_] = range_;
+	uniform = false; // The energy array may no longer be evenly spaced.
+	rangeIndex.clear();
 	return true;
 }
 
 /// Get the particle range at a given energy using linear interpolation.
 double RangeTable::GetRange(const double &energy_){
 	if(!use_table){ return -1; }
-	return _interpolate(this->energy, this->range, energy_);
+	return _interpolate(this->energy, this->range, energy_, (uniform ? LOOKUP_ENERGY : LOOKUP_SEARCH));
 }
 
-/// Get the particle energy at a given range using linear interpolation.
+/** Get the particle energy at a given range using linear interpolation. The table interval is found
+  * from the range index, or by a binary search if the table was changed by Set.
+  */
 double RangeTable::GetEnergy(const double &range_){
 	if(!use_table){ return -1; }
-	return _interpolate(this->range, this->energy, range_);
+	return _interpolate(this->range, this->energy, range_, (rangeIndex.empty() ? LOOKUP_SEARCH : LOOKUP_RANGE));
 }
 
 /// Get the scintillator light response due to a particle traversing a material with given kinetic energy.
 double RangeTable::GetLRfromKE(const double &energy_){
 	if(!use_birks){ return -1; }
-	return _interpolate(this->energy, this->birks, energy_);
+	return _interpolate(this->energy, this->birks, energy_, (uniform ? LOOKUP_ENERGY : LOOKUP_SEARCH));
 }
 
 /// Get the kinetic energy of a particle which produces a given light response in a scintillator.
@@ -182,6 +474,86 @@ bool RangeTable::GetEntry(const unsigned int &entry_, double &E, double &R){
 	return true;
 }
 
+/** Write the table to a binary file along with a key describing how it was built. The file is
+  * written under a temporary name and then renamed, so other processes never see a partial file.
+  * Return false if the table is not initialized or the file could not be written.
+  */
+bool RangeTable::Write(const char *filename_, const std::string &key_){
+	if(!use_table){ return false; }
+
+	rangeTableHeader header;
+	memcpy(header.magic, rangeTableMagic, sizeof(header.magic));
+	header.keyLength = key_.size();
+	header.entries = num_entries;
+	header.step = step;
+	header.logStep = logStep;
+	header.logarithmic = (logarithmic ? 1 : 0);
+	header.reserved = 0;
+	std::string paddedKey = key_;
+	paddedKey.resize(paddedKeyLength(key_.size()), '\0');
+
+	std::stringstream tempname;
+	tempname << filename_ << ".tmp" << getpid();
+	std::ofstream file(tempname.str().c_str(), std::ios::binary);
+	if(!file.good()){ return false; }
+	file.write((const char*)&header, sizeof(header));
+	file.write(paddedKey.data(), paddedKey.size());
+	file.write((const char*)energy.data(), num_entries*sizeof(double));
+	file.write((const char*)dedx.data(), num_entries*sizeof(double));
+	file.write((const char*)range.data(), num_entries*sizeof(double));
+	file.close();
+
+	if(file.fail() || rename(tempname.str().c_str(), filename_) != 0){
+		remove(tempname.str().c_str());
+		return false;
+	}
+	return true;
+}
+
+/** Read a table written by Write. The file is memory mapped and only used if it was written with
+  * exactly the same key_ and is complete. Return false if the file could not be used.
+  */
+bool RangeTable::Read(const char *filename_, const std::string &key_){
+	if(use_table){ return false; }
+
+	int fd = open(filename_, O_RDONLY);
+	if(fd < 0){ return false; }
+	struct stat info;
+	if(fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(rangeTableHeader)){
+		close(fd);
+		return false;
+	}
+	const size_t size = info.st_size;
+	void *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(data == MAP_FAILED){ return false; }
+
+	const char *bytes = (const char*)data;
+	rangeTableHeader header;
+	memcpy(&header, bytes, sizeof(header));
+	const size_t keyOffset = sizeof(header);
+	const size_t arrayOffset = keyOffset + paddedKeyLength(header.keyLength);
+	bool valid = (memcmp(header.magic, rangeTableMagic, sizeof(header.magic)) == 0 && header.keyLength == key_.size() && header.entries >= 2 &&
+	              size == arrayOffset + 3*header.entries*sizeof(double) && key_.compare(0, std::string::npos, bytes+keyOffset, header.keyLength) == 0);
+
+	if(valid && _initialize(header.entries)){
+		const size_t arraySize = num_entries*sizeof(double);
+		memcpy(energy.data(), bytes+arrayOffset, arraySize);
+		memcpy(dedx.data(), bytes+arrayOffset+arraySize, arraySize);
+		memcpy(range.data(), bytes+arrayOffset+2*arraySize, arraySize);
+		step = header.step;
+		logStep = header.logStep;
+		logStart = std::log(energy[0]);
+		logarithmic = (header.logarithmic != 0);
+		uniform = (logarithmic ? logStep > 0.0 : step > 0.0);
+		_indexRange();
+	}
+	else{ valid = false; }
+
+	munmap(data, size);
+	return valid;
+}
+
 /// Print range table entries to the screen.
 void RangeTable::Print(){
 	if(!use_table){ return; }
@@ -461,7 +833,8 @@ double Material::_ionpot(unsigned int Z_){
 	return (Z_ > 0 && Z_ <= 100 ? potentials[Z_-1]*1.13E-6 : -1.0);
 }
 
-/** Return the density effect correction term.
+/** Return the density effect correction term. It is not included here, so that Material::StopPower stays the bare
+  * Bethe-Bloch formula. Use TabulatedStoppingPower for stopping powers which include the density effect.
   * See R. Sternheimer, Phys. Rev. B 3, 3681 (1971).
   * \param[in] energy_ The energy of the incident particle in MeV.
   * \return the density effect correction (MeV).
@@ -580,7 +953,7 @@ bool Material::ReadMatFile(const char* filename_){
 	while(true){
 		getline(input_file, line);
 		if(input_file.eof()){ break; }
-		if(line[0] == '#'){ continue; } // Commented line
+		if(line.empty() || line[0] == '#'){ continue; } // Blank or commented line
 		line = Parse(line);
 		
 		if(count == 0){ vikar_name = line; }
@@ -673,6 +1046,31 @@ double Material::Birks(double startE_, double energy_, double Z_, double mass_,
 
 /** Print useful parameters about this material for debugging purposes.
   */ 
+/** Return a string which describes every parameter used to calculate the stopping power in the
+  * material (name, density and the number, Z, A and ionization potential of each element).
+  * Two materials with the same signature give the same stopping power.
+  */
+std::string Material::GetSignature(){
+	std::stringstream stream;
+	stream << std::setprecision(17) << vikar_name << " " << density << " " << num_elements;
+	for(unsigned int i = 0; i < num_elements; i++){
+		stream << " " << num_per_molecule[i] << " " << element_Z[i] << " " << element_A[i] << " " << element_I[i];
+	}
+	return stream.str();
+}
+
+/** Get the atomic number, atomic mass (u), ionization potential (MeV) and fractional weight of one of the
+  * unique elements in the material. Return false if there is no such element.
+  */
+bool Material::GetElement(const unsigned int &index_, double &Z, double &A, double &I, double &weight_){
+	if(index_ >= num_elements){ return false; }
+	Z = element_Z[index_];
+	A = element_A[index_];
+	I = element_I[index_];
+	weight_ = weight[index_];
+	return true;
+}
+
 void Material::Print(){
 	std::cout << " Name: " << vikar_name << std::endl;
 	std::cout << "  Number of unique elements: " << num_elements << std::endl;
@@ -707,6 +1105,312 @@ void Material::Print(std::ofstream *file_){
 	(*file_) << "  Ibar: " << std::exp(lnIbar) << "\n";
 }
 
+/////////////////////////////////////////////////////////////////////
+// StoppingPowerModel
+/////////////////////////////////////////////////////////////////////
+
+/// Return the stopping power (in MeV/m) in a material for a particle with kinetic energy energy_ (in MeV).
+double StoppingPowerModel::StopPower(Material *mat_, const double &energy_, const double &Z_, const double &mass_){
+	double power;
+	StopPower(mat_, Z_, mass_, &energy_, &power, 1);
+	return power;
+}
+
+/////////////////////////////////////////////////////////////////////
+// TabulatedStoppingPower
+/////////////////////////////////////////////////////////////////////
+
+/// The fine structure constant.
+const double fineStructure = 1.0/137.035999;
+
+/// The lowest beta*gamma at which the shell correction of Barkas and Berger is valid.
+const double shellMinEta = 0.13;
+
+/// The plasma energy of a material with a density of 1 g/cm^3 and a Z/A of 1 (MeV).
+const double plasmaEnergy = 28.816E-6;
+
+/// Return the leading coefficient of the Bethe formula, 4*pi*N_A*r_e^2*m_e*c^2 (MeV * cm^2 / mol).
+inline double betheCoefficient(){
+	return 4.0 * pi * avagadro * std::pow(100.0*bohr_e_radius, 2.0) * electron_RME;
+}
+
+/** Constructor. The tables cover proton kinetic energies from minE_ to maxE_ (in MeV), with
+  * entriesPerDecade_ entries for each factor of 10 in energy.
+  */
+TabulatedStoppingPower::TabulatedStoppingPower(const double &minE_/*=1E-4*/, const double &maxE_/*=1E4*/, const unsigned int &entriesPerDecade_/*=200*/){
+	minE = minE_;
+	maxE = maxE_;
+	perDecade = entriesPerDecade_;
+	if(!(minE > 0.0) || !(maxE > minE)){
+		std::cout << " Warning! Invalid stopping power table range (" << minE_ << " to " << maxE_ << " MeV), using 1E-4 to 1E4 MeV instead.\n";
+		minE = 1E-4;
+		maxE = 1E4;
+	}
+	if(perDecade == 0){ perDecade = 1; }
+
+	logMin = std::log(minE);
+	num_entries = (unsigned int)std::ceil(perDecade*std::log10(maxE/minE)) + 1;
+	if(num_entries < 2){ num_entries = 2; }
+	logStep = (std::log(maxE)-logMin)/(num_entries-1);
+}
+
+/// Return a string which describes the model and its settings.
+std::string TabulatedStoppingPower::GetSignature(){
+	std::stringstream stream;
+	stream << std::setprecision(17) << "tabulated " << minE << " " << maxE << " " << perDecade;
+	return stream.str();
+}
+
+/** Calculate the stopping power (in MeV/m) in a material for a particle with charge Z_ and mass mass_
+  * (in MeV/c^2) at count_ kinetic energies (in MeV), and store them in powers. The material is tabulated
+  * the first time it is used. This may be called by several threads at once.
+  */
+void TabulatedStoppingPower::StopPower(Material *mat_, const double &Z_, const double &mass_, const double *energies_, double *powers, const unsigned int &count_){
+	const std::vector<double> &table = _getMaterial(mat_);
+	for(unsigned int i = 0; i < count_; i++){
+		const double energy = energies_[i];
+		if(!(energy > 0.0) || !(Z_ > 0.0)){
+			powers[i] = 0.0;
+			continue;
+		}
+
+		// Scale the stopping power of a proton with the same velocity.
+		double gamma = 1.0 + energy/mass_;
+		double charge = EffectiveCharge(Z_, std::sqrt(1.0 - 1.0/(gamma*gamma)));
+		powers[i] = charge*charge*_interpolate(table, energy*proton_RME/mass_);
+	}
+}
+
+/// Return the number of elements which have been tabulated.
+size_t TabulatedStoppingPower::GetNumElements(){
+	std::lock_guard<std::mutex> guard(lock);
+	return elements.size();
+}
+
+/// Return the number of materials which have been tabulated.
+size_t TabulatedStoppingPower::GetNumMaterials(){
+	std::lock_guard<std::mutex> guard(lock);
+	return materials.size();
+}
+
+/** Calculate the electronic stopping power (in MeV cm^2/g) of an element with atomic number Z_, atomic
+  * mass A_ (in u) and ionization potential I_ (in MeV) for a proton with kinetic energy energy_ (in MeV).
+  * See C. Amsler et al., PL B667, 1 (2008) for the Bethe formula and the shell correction, and
+  * J. Lindhard and M. Scharff, Phys. Rev. 124, 128 (1961) for the low energy stopping.
+  */
+double TabulatedStoppingPower::ElementStopPower(const double &Z_, const double &A_, const double &I_, const double &energy_){
+	const double coefficient = betheCoefficient();
+	double gamma = 1.0 + energy_/proton_RME;
+	double beta2 = 1.0 - 1.0/(gamma*gamma);
+	double eta2 = beta2*gamma*gamma;
+	double tmax = 2.0*electron_RME*eta2/(1.0 + 2.0*gamma*electron_RME/proton_RME + std::pow(electron_RME/proton_RME, 2.0));
+
+	// Shell correction of Barkas and Berger, faded out below its range of validity.
+	double scale = 1.0;
+	if(eta2 < shellMinEta*shellMinEta){
+		scale = eta2/(shellMinEta*shellMinEta);
+		eta2 = shellMinEta*shellMinEta;
+	}
+	double ion = I_*1E6; // eV
+	double shell = (0.422377/eta2 + 0.0304043/std::pow(eta2, 2.0) - 0.00038106/std::pow(eta2, 3.0))*1E-6*std::pow(ion, 2.0);
+	shell += (3.858019/eta2 - 0.1667989/std::pow(eta2, 2.0) + 0.00157955/std::pow(eta2, 3.0))*1E-9*std::pow(ion, 3.0);
+	shell *= scale;
+
+	// Lindhard-Scharff stopping, which is proportional to the velocity.
+	double low = 2.0*coefficient*std::sqrt(beta2)/std::pow(fineStructure, 3.0)*Z_/(A_*std::pow(1.0 + std::pow(Z_, 2.0/3.0), 1.5));
+
+	// The Bethe formula. Its logarithm is replaced by log(1 + x), which is the same at high energy
+	// but stays positive at low energy, where the Lindhard-Scharff stopping takes over.
+	double bracket = std::log(1.0 + std::sqrt(2.0*electron_RME*beta2*gamma*gamma*tmax)/I_) - beta2 - shell/Z_;
+	if(!(bracket > 0.0)){ return low; }
+	double high = coefficient*(Z_/A_)*bracket/beta2;
+
+	return low*high/(low+high);
+}
+
+/** Return the effective charge of an ion with atomic number Z_ moving at beta_ (relative to c), for scaling
+  * the stopping power of a proton with the same velocity. It is never less than one.
+  * See J. F. Ziegler, Handbook of Stopping Cross-Sections for Energetic Ions in All Elements (1980).
+  */
+double TabulatedStoppingPower::EffectiveCharge(const double &Z_, const double &beta_){
+	if(Z_ <= 1.0){ return Z_; }
+	double B = 0.886*(beta_/fineStructure)/std::pow(Z_, 2.0/3.0);
+	double A = B + 0.0378*std::sin(pi*B/2.0);
+	double charge = Z_*(1.0 - std::exp(-A)*(1.034 - 0.1777*std::exp(-0.08114*Z_)));
+	return (charge > 1.0 ? charge : 1.0);
+}
+
+/// Return the table for an element, tabulating it if needed. The lock must be held.
+const std::vector<double> &TabulatedStoppingPower::_getElement(const double &Z_, const double &A_, const double &I_){
+	std::stringstream key;
+	key << std::setprecision(17) << Z_ << " " << A_ << " " << I_;
+	std::unordered_map<std::string, std::vector<double> >::iterator iter = elements.find(key.str());
+	if(iter != elements.end()){ return iter->second; }
+
+	std::vector<double> &table = elements[key.str()];
+	table.resize(num_entries);
+	for(unsigned int i = 0; i < num_entries; i++){
+		double energy = (i == num_entries-1 ? maxE : std::exp(logMin + i*logStep));
+		table[i] = std::log(std::max(ElementStopPower(Z_, A_, I_, energy), std::numeric_limits<double>::min()));
+	}
+
+	return table;
+}
+
+/// Return the table for a material, combining the tables of its elements if needed.
+const std::vector<double> &TabulatedStoppingPower::_getMaterial(Material *mat_){
+	std::string signature = mat_->GetSignature();
+	std::lock_guard<std::mutex> guard(lock);
+	std::unordered_map<std::string, std::vector<double> >::iterator iter = materials.find(signature);
+	if(iter != materials.end()){ return iter->second; }
+
+	// Bragg additivity. Each element contributes in proportion to its fraction of the mass.
+	std::vector<double> sum(num_entries, 0.0);
+	double Z, A, I, weight;
+	double zOverA = 0.0;
+	for(unsigned int j = 0; mat_->GetElement(j, Z, A, I, weight); j++){
+		const std::vector<double> &element = _getElement(Z, A, I);
+		for(unsigned int i = 0; i < num_entries; i++){
+			sum[i] += weight*std::exp(element[i]);
+		}
+		zOverA += weight*Z/A;
+	}
+
+	// The density effect in the high energy limit, which only matters for particles with beta*gamma of several.
+	// See R. Sternheimer, Phys. Rev. B 3, 3681 (1971).
+	const double coefficient = betheCoefficient();
+	const double density = mat_->GetDensity();
+	const double logPlasma = std::log(plasmaEnergy*std::sqrt(density*zOverA)) - mat_->GetLNibar();
+
+	std::vector<double> &table = materials[signature];
+	table.resize(num_entries);
+	for(unsigned int i = 0; i < num_entries; i++){
+		double energy = (i == num_entries-1 ? maxE : std::exp(logMin + i*logStep));
+		double gamma = 1.0 + energy/proton_RME;
+		double beta2 = 1.0 - 1.0/(gamma*gamma);
+		double delta = 2.0*logPlasma + std::log(beta2*gamma*gamma) - 1.0;
+		if(delta > 0.0){ sum[i] -= coefficient*zOverA*delta/(2.0*beta2); }
+		table[i] = std::log(std::max(100.0*density*sum[i], std::numeric_limits<double>::min())); // MeV/m
+	}
+
+	return table;
+}
+
+/** Interpolate the stopping power from a table for a proton with kinetic energy energy_ (in MeV). Below
+  * the table the stopping power is proportional to the velocity, and above it the last interval is extended.
+  */
+double TabulatedStoppingPower::_interpolate(const std::vector<double> &table_, const double &energy_) const {
+	double position = (std::log(energy_)-logMin)/logStep;
+	if(position <= 0.0){ return std::exp(table_[0] + 0.5*position*logStep); }
+	unsigned int i = (position < num_entries-1 ? (unsigned int)position : num_entries-2);
+	return std::exp(table_[i] + (position-i)*(table_[i+1]-table_[i]));
+}
+
+/////////////////////////////////////////////////////////////////////
+// MaterialLibrary
+/////////////////////////////////////////////////////////////////////
+
+/** Add every material (.mat) file in a directory. A file replaces any material with the same name.
+  * Return the number of files added, or -1 if the directory could not be opened.
+  */
+int MaterialLibrary::AddDirectory(const std::string &dirname_){
+	DIR *dir = opendir(dirname_.c_str());
+	if(dir == NULL){ return -1; }
+
+	// Sort the files so that the result does not depend on the order of the directory.
+	std::vector<std::string> filenames;
+	struct dirent *file;
+	while((file = readdir(dir)) != NULL){
+		std::string fname(file->d_name);
+		if(fname.size() > 4 && fname.compare(fname.size()-4, 4, ".mat") == 0){ filenames.push_back(fname); }
+	}
+	closedir(dir);
+	std::sort(filenames.begin(), filenames.end());
+
+	for(std::vector<std::string>::iterator iter = filenames.begin(); iter != filenames.end(); iter++){
+		AddFile(dirname_ + "/" + (*iter));
+	}
+
+	return filenames.size();
+}
+
+/// Add a material file, named after the file without its directory or .mat extension. It replaces any material with the same name.
+void MaterialLibrary::AddFile(const std::string &fname_){
+	size_t start = fname_.find_last_of('/');
+	start = (start == std::string::npos ? 0 : start+1);
+	size_t stop = fname_.find_last_of('.');
+	if(stop == std::string::npos || stop < start){ stop = fname_.size(); }
+
+	entry &item = entries[fname_.substr(start, stop-start)];
+	item.filename = fname_;
+	item.material = Material();
+	item.loaded = false;
+	item.failed = false;
+}
+
+/// Add a material which has already been built. It replaces any material with the same name.
+void MaterialLibrary::Add(const Material &mat_){
+	Material mat(mat_);
+	entry &item = entries[mat.GetName()];
+	item.filename = "";
+	item.material = mat;
+	item.loaded = true;
+	item.failed = false;
+}
+
+/// Add the materials which were built into vandmc before material files were supported.
+void MaterialLibrary::AddDefaults(){
+	// Natural Gold
+	Add(Material("Au197", 19.311, 79, 196.96657, 1));
+	// BC408 plastic scintillator (polyvinyltoluene (C9H10 118.18 g/mol) base)
+	Add(Material("BC408", 1.032, 6, 12.0107, 9, 1, 1.00794, 10));
+	// Deuterated polyethylene
+	Add(Material("C2D4", 1.06300, 6, 12.0107, 2, 1, 2.01588, 4));
+	// Polyethylene
+	Add(Material("C2H4", 0.95, 6, 12.0107, 2, 1, 1.00794, 4));
+	// Polystyrene
+	Add(Material("C8H8", 1.05, 6, 12.0107, 8, 1, 1.00794, 8));
+	// Natural Carbon
+	Add(Material("C12", 2.2670, 6, 12.0107, 1));
+	// Deuterated polyethylene
+	Add(Material("CD2", 1.06300, 6, 12.0107, 1, 1, 2.01588, 2));
+	// Silicon
+	Add(Material("Si28", 2.3212, 14, 28.0855, 1));
+}
+
+/** Return the material with the given name, reading its file the first time it is requested. The material
+  * is owned by the library. Return NULL if there is no such material or if its file could not be read.
+  */
+Material *MaterialLibrary::Get(const std::string &name_){
+	std::unordered_map<std::string, entry>::iterator iter = entries.find(name_);
+	if(iter == entries.end()){ return NULL; }
+
+	entry &item = iter->second;
+	if(!item.loaded && !item.failed){
+		if(item.material.ReadMatFile(item.filename.c_str())){
+			// The material is always known by the name of its file.
+			item.material.SetName(name_);
+			item.loaded = true;
+			nLoaded++;
+		}
+		else{
+			std::cout << " Warning! Failed to read material file \"" << item.filename << "\"!\n";
+			item.failed = true;
+		}
+	}
+
+	return (item.loaded ? &item.material : NULL);
+}
+
+/// Fill a vector with the names of all materials in the library, in alphabetical order.
+void MaterialLibrary::GetNames(std::vector<std::string> &names) const {
+	names.clear();
+	for(std::unordered_map<std::string, entry>::const_iterator iter = entries.begin(); iter != entries.end(); iter++){
+		names.push_back(iter->first);
+	}
+	std::sort(names.begin(), names.end());
+}
+
 /////////////////////////////////////////////////////////////////////
 // Particle
 /////////////////////////////////////////////////////////////////////
@@ -748,25 +1452,15 @@ double Particle::GetTableNewE(const double &energy_, const double &dist_, double
 /////////////////////////////////////////////////////////////////////
 
 Target::Target() : Particle() {
-	thickness = 0.0;
-	Zthickness = 0.0;
-	density = 1.0;
-	Ndensity = 0.0;
-	Mmass = 1.0;
-	rad_length = 0.0;
-	angle = 0.0;
-	physical = new Primitive();
+	_initialize();
 }
 
 Target::Target(unsigned int num_elements_) : Particle() {
-	thickness = 0.0;
-	Zthickness = 0.0;
-	density = 1.0;
-	Ndensity = 0.0;
-	Mmass = 1.0;
-	rad_length = 0.0;
-	angle = 0.0;
-	physical = new Primitive();
+	_initialize();
+}
+
+Target::~Target(){
+	delete physical;
 }
 
 void Target::SetThickness(double thickness_){ 
@@ -812,21 +1506,128 @@ void Target::SetMolarMass(double Mmass_){
   * \\param[out] interact is the global position where the beam particle reacts inside the target
   */
 double Target::GetInteractionDepth(const Vector3 &offset_, const Vector3 &direction_, Vector3 &intersect, Vector3 &interact){
-	double t1, t2;
-	double zdist = physical->GetApparentThickness(offset_, direction_, intersect, t1, t2); // The target thickness the ray sees
-	if(thickness == -1){ 
+	return GetInteractionDepth(GetDefaultRandomEngine(), offset_, direction_, intersect, interact);
+}
+
+/** Get the depth into the target at which the reaction occurs, using the random number engine rng_
+  * \\param[in] offset_ is the global position where the beam particle originates
+  * \\param[in] direction_ is the direction of the beam particle entering the target
+  * \\param[out] intersect is the global position where the beam particle intersects the front face of the target
+  * \\param[out] interact is the global position where the beam particle reacts inside the target
+  */
+double Target::GetInteractionDepth(RandomEngine &rng_, const Vector3 &offset_, const Vector3 &direction_, Vector3 &intersect, Vector3 &interact){
+	// The target is a thin slab, so the thickness the ray sees only depends on the two face crossings.
+	double tFront, tBack;
+	if(!physical->GetCrossings(offset_, direction_, tFront, tBack) || tFront < 0.0){ 
 		std::cout << " Beam does not travel through target!\n"; 
 		return -1;
 	}
+	intersect = offset_ + direction_*tFront;
+	double zdist = (tBack-tFront)*direction_.Length(); // The target thickness the ray sees
 	
-	zdist *= frand(); // Reaction occurs at a random depth into the target
+	// Reaction occurs at a random depth into the target
+	zdist *= (depthTable.empty() ? rng_.Uniform() : _sampleDepth(rng_.Uniform()));
 	interact = intersect + direction_*zdist;
 	return zdist; 
 }
 
+/** Set the distribution of reaction depths along the path of the beam through the target.
+  * weights_ gives the relative reaction probability at evenly spaced fractions of the path,
+  * from the front face (first entry) to the back face (last entry), and the probability
+  * is interpolated linearly between them. The distribution is converted into an inverse
+  * cumulative distribution with num_bins_ bins so that each depth is drawn in constant time.
+  * Return false if fewer than two weights are given, or if any weight is negative or all are zero.
+  */
+bool Target::SetDepthDistribution(const std::vector<double> &weights_, const unsigned int &num_bins_/*=1000*/){
+	depthTable.clear();
+	if(weights_.size() < 2 || num_bins_ == 0){ return false; }
+
+	// Integrate the piecewise linear distribution over each interval between weights.
+	const size_t intervals = weights_.size()-1;
+	std::vector<double> cdf(weights_.size(), 0.0);
+	for(size_t i = 0; i < intervals; i++){
+		if(weights_[i] < 0.0 || weights_[i+1] < 0.0){ return false; }
+		cdf[i+1] = cdf[i] + 0.5*(weights_[i]+weights_[i+1]);
+	}
+	const double total = cdf.back();
+	if(total <= 0.0){ return false; }
+
+	// Invert the cumulative distribution at evenly spaced probabilities. Within an interval the
+	// cumulative distribution is quadratic in the depth, so each inversion is solved exactly.
+	depthTable.resize(num_bins_+1);
+	size_t interval = 0;
+	for(unsigned int i = 0; i <= num_bins_; i++){
+		double area = total*i/num_bins_;
+		while(interval < intervals-1 && cdf[interval+1] < area){ interval++; }
+		
+		const double w0 = weights_[interval];
+		const double slope = weights_[interval+1]-w0;
+		const double remain = std::max(0.0, area-cdf[interval]);
+		double step; // Fraction of the interval where the integral reaches area.
+		if(std::fabs(slope) < 1E-12*std::max(w0, 1E-300)){ step = (w0 > 0.0 ? remain/w0 : 0.0); }
+		else{ step = (std::sqrt(std::max(0.0, w0*w0 + 2.0*slope*remain))-w0)/slope; }
+		depthTable[i] = (interval + std::min(1.0, std::max(0.0, step)))/intervals;
+	}
+	depthTable.front() = 0.0;
+	depthTable.back() = 1.0;
+	
+	return true;
+}
+
+/** Weight the reaction depth by the reaction cross section at the energy of the beam at each depth.
+  * energy_ and xsection_ give the excitation function (MeV and any units), and beam_table_ is the range
+  * table of the beam in the target. The beam enters the target with energy Ebeam_ (MeV) and travels
+  * the thickness the beam sees along the z-axis. The cross section is zero outside the excitation function.
+  * Return false if the excitation function is empty or the cross section is zero throughout the target.
+  */
+bool Target::SetExcitationFunction(const std::vector<double> &energy_, const std::vector<double> &xsection_, RangeTable &beam_table_, const double &Ebeam_, const unsigned int &num_points_/*=100*/){
+	depthTable.clear();
+	if(energy_.size() < 2 || energy_.size() != xsection_.size() || num_points_ < 2){ return false; }
+
+	std::vector<double> energies(energy_);
+	std::vector<double> xsections(xsection_);
+	std::vector<double> weights(num_points_, 0.0);
+	const double range = beam_table_.GetRange(Ebeam_);
+	const double depth = GetRealZthickness();
+	for(unsigned int i = 0; i < num_points_; i++){
+		// The beam energy at this fraction of the way through the target.
+		double remaining = range - depth*i/(num_points_-1);
+		if(remaining <= 0.0){ break; } // The beam stops in the target.
+		double energy = beam_table_.GetEnergy(remaining);
+		if(!Interpolate(energy, weights[i], energies.data(), xsections.data(), energies.size())){ weights[i] = 0.0; }
+	}
+
+	return SetDepthDistribution(weights);
+}
+
+/// Initialize all variables with default values.
+void Target::_initialize(){
+	thickness = 0.0;
+	Zthickness = 0.0;
+	density = 1.0;
+	Ndensity = 0.0;
+	Mmass = 1.0;
+	rad_length = 0.0;
+	angle = 0.0;
+	physical = new ThinSlab();
+}
+
+/// Return the fraction of the path through the target at which a reaction occurs, for a uniform random number frac_.
+double Target::_sampleDepth(const double &frac_) const {
+	const double bin = frac_*(depthTable.size()-1);
+	const size_t index = std::min((size_t)bin, depthTable.size()-2);
+	return depthTable[index] + (bin-index)*(depthTable[index+1]-depthTable[index]);
+}
+
 // Determine the new direction of a particle inside the target due to angular straggling
 // direction_ and new_direction have x,y,z format and are measured in meters
 bool Target::AngleStraggling(const Vector3 &direction_, double A_, double Z_, double E_, Vector3 &new_direction){
+	return AngleStraggling(GetDefaultRandomEngine(), direction_, A_, Z_, E_, new_direction);
+}
+
+// Determine the new direction of a particle inside the target due to angular straggling, using the random number engine rng_
+// direction_ and new_direction have x,y,z format and are measured in meters
+bool Target::AngleStraggling(RandomEngine &rng_, const Vector3 &direction_, double A_, double Z_, double E_, Vector3 &new_direction){
 	// strag_targ 1.0 written by S.D.Pain on 20/01/2004
 	//
 	// strag_targ 1.1 modified by S.D.Pain on 7/03/2005
@@ -850,9 +1651,9 @@ bool Target::AngleStraggling(const Vector3 &direction_, double A_, double Z_, do
 	straggleA(theta_scatW, E_, Z_, A_, thickness, rad_length); 
 	
 	// Select the scattering angle of the ion wrt its initial direction
-	theta_scat = rndgauss0(theta_scatW); 
+	theta_scat = rndgauss0(rng_, theta_scatW); 
 	theta_scat = std::sqrt(pow(theta_scat, 2.0)*2.0); 
-	phi_scat = frand()*2.0*pi; 
+	phi_scat = rng_.Uniform()*2.0*pi; 
 	
 	// Determine the absolute lab angle to which the ion is scattered
 	Matrix3 matrix(theta_scat, phi_scat);
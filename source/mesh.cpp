@@ -0,0 +1,345 @@
+/** \file mesh.cpp
+ * \brief Detectors whose shape is given by a closed triangle mesh.
+ */
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <limits>
+#include <cstring>
+#include <cstdint>
+#include <cmath>
+
+#include "mesh.hpp"
+#include "detectors.hpp"
+
+/// The largest number of triangles stored in a leaf node of the triangle hierarchy.
+const unsigned int maxTrianglesPerLeaf = 4;
+
+/// Padding added to every node bounding box to guard against rounding errors (m).
+const double meshPadding = 1E-9;
+
+/// Relative distance within which two crossings of the same kind are treated as one crossing of a shared edge or vertex.
+const double crossingTolerance = 1E-12;
+
+/// Read a binary STL file from a buffer. Return false if the buffer is not a complete binary STL file.
+bool readBinarySTL(const std::string &buffer_, std::vector<Vector3> &vertices){
+	if(buffer_.size() < 84){ return false; }
+
+	// An 80 byte header is followed by the number of triangles and 50 bytes per triangle.
+	uint32_t count;
+	std::memcpy(&count, buffer_.data()+80, 4);
+	if(buffer_.size() != 84 + 50*(size_t)count){ return false; }
+
+	float values[12]; // The normal and the three corners of a triangle.
+	for(uint32_t i = 0; i < count; i++){
+		std::memcpy(values, buffer_.data()+84+50*(size_t)i, sizeof(values));
+		for(int j = 1; j <= 3; j++){
+			vertices.push_back(Vector3(values[3*j], values[3*j+1], values[3*j+2]));
+		}
+	}
+	return true;
+}
+
+/// Read an ASCII STL file from a buffer. Return false if the buffer is not an ASCII STL file.
+bool readAsciiSTL(const std::string &buffer_, std::vector<Vector3> &vertices){
+	std::stringstream stream(buffer_);
+	std::string word;
+	if(!(stream >> word) || word != "solid"){ return false; }
+
+	// Only the corners of the triangles are needed. The normals are recalculated from the corners.
+	double x, y, z;
+	while(stream >> word){
+		if(word != "vertex"){ continue; }
+		if(!(stream >> x >> y >> z)){ return false; }
+		vertices.push_back(Vector3(x, y, z));
+	}
+	return (vertices.size() % 3 == 0);
+}
+
+/** Read the triangles of an ASCII or binary STL file into a list of vertices (three per triangle).
+  * Return STL_SUCCESS, STL_READ_FAILED if the file could not be read or STL_PARSE_FAILED if it is not an STL file.
+  */
+STLResult ReadSTL(const std::string &fname_, std::vector<Vector3> &vertices){
+	vertices.clear();
+	std::ifstream file(fname_.c_str(), std::ios::binary);
+	if(!file.good()){ return STL_READ_FAILED; }
+	std::stringstream contents;
+	contents << file.rdbuf();
+	if(file.bad()){ return STL_READ_FAILED; }
+	file.close();
+	const std::string buffer = contents.str();
+
+	// Binary files may also start with "solid", so check for a binary file of the right size first.
+	if(readBinarySTL(buffer, vertices)){ return STL_SUCCESS; }
+	vertices.clear();
+	if(readAsciiSTL(buffer, vertices)){ return STL_SUCCESS; }
+	vertices.clear();
+	return STL_PARSE_FAILED;
+}
+
+/////////////////////////////////////////////////////////////////////
+// Mesh
+/////////////////////////////////////////////////////////////////////
+
+/** Constructor using a NewVIKARdet object. The mesh is loaded from the file given by the entry.
+  * If the file could not be loaded, a warning is printed and the mesh is left empty.
+  */
+Mesh::Mesh(NewVIKARdet *det_) : Primitive(det_) {
+	STLResult result = LoadSTL(det_->filename, (det_->data[6] > 0.0 ? det_->data[6] : 1.0));
+	if(result == STL_READ_FAILED){ std::cout << " Warning! Failed to read mesh file \"" << det_->filename << "\"!\n"; }
+	else if(result == STL_PARSE_FAILED){ std::cout << " Warning! Failed to parse mesh file \"" << det_->filename << "\" as an ASCII or binary STL file!\n"; }
+	else if(result == STL_NO_TRIANGLES){ std::cout << " Warning! Mesh file \"" << det_->filename << "\" contains no triangles with a non-zero area!\n"; }
+}
+
+/** Load the triangles of an ASCII or binary STL file, replacing any existing triangles. All coordinates
+  * are multiplied by scale_ to convert them into m. The size of the detector is set to the size of the
+  * box which contains the mesh. Return STL_SUCCESS, or the step which failed.
+  */
+STLResult Mesh::LoadSTL(const std::string &fname_, const double &scale_/*=1.0*/){
+	std::vector<Vector3> points;
+	STLResult result = ReadSTL(fname_, points);
+	if(result != STL_SUCCESS){ return result; }
+	for(std::vector<Vector3>::iterator iter = points.begin(); iter != points.end(); iter++){
+		(*iter) *= scale_;
+	}
+	return (SetTriangles(points) && !Empty() ? STL_SUCCESS : STL_NO_TRIANGLES);
+}
+
+/** Replace the triangles of the mesh. vertices_ holds three corners (in m, in the local detector frame)
+  * for each triangle, wound counter-clockwise when seen from outside. The size of the detector is set to
+  * the size of the box which contains the mesh. Return false if the number of vertices is not a multiple of 3.
+  */
+bool Mesh::SetTriangles(const std::vector<Vector3> &vertices_){
+	if(vertices_.size() % 3 != 0){ return false; }
+
+	vertices.clear();
+	normals.clear();
+	for(size_t i = 0; i < vertices_.size(); i += 3){
+		// Triangles with no area can never be crossed, so they are dropped.
+		Vector3 normal = (vertices_[i+1]-vertices_[i]).Cross(vertices_[i+2]-vertices_[i]);
+		if(normal.Normalize() == 0.0){ continue; }
+		vertices.insert(vertices.end(), vertices_.begin()+i, vertices_.begin()+i+3);
+		normals.push_back(normal);
+	}
+	_build();
+
+	return true;
+}
+
+/** Get the lower and upper corners of a box which contains the mesh, in the
+  * local detector frame and relative to the position of the detector (in m).
+  */
+void Mesh::GetLocalBounds(Vector3 &lower, Vector3 &upper){
+	if(bounds.Empty()){
+		lower = Vector3(0.0, 0.0, 0.0);
+		upper = Vector3(0.0, 0.0, 0.0);
+		return;
+	}
+	lower = bounds.lower;
+	upper = bounds.upper;
+}
+
+/** Calculate the intersection of a ray of the form (offset_ + t * direction_) with the mesh.
+  * offset_ is the point where the ray originates wrt the global origin.
+  * direction_ is the direction of the ray wrt the global origin.
+  * t1 is the parameter of the front intersection point given by P1 = offset_ + direction_*t1.
+  * t2 is the parameter of the back intersection point given by P2 = offset_ + direction_*t2.
+  * If the ray starts inside the mesh, t1 is the exit point and t2 is not set. For a mesh
+  * which is not convex, only the first part of the mesh which the ray passes through is used.
+  * norm is the outward normal vector to the surface at point P1.
+  * Return true if the mesh is intersected, and false otherwise.
+  */
+bool Mesh::IntersectPrimitive(const Vector3& offset_, const Vector3& direction_, Vector3 &P1, Vector3 &norm, double &t1, double &t2){
+	if(nodes.empty()){ return false; }
+
+	// Transform the ray into the local detector frame. The transformation is a rotation, so the ray parameters are unchanged.
+	Vector3 dP = offset_ - position;
+	Vector3 origin(dP.Dot(detX), dP.Dot(detY), dP.Dot(detZ));
+	Vector3 direction(direction_.Dot(detX), direction_.Dot(detY), direction_.Dot(detZ));
+	if(direction.Square() == 0.0){ return false; }
+
+	crossing found[2];
+	unsigned int count = _findCrossings(origin, direction, found);
+	if(count == 0){ return false; }
+
+	t1 = found[0].t;
+	if(found[0].entering){ t2 = (count > 1 ? found[1].t : t1); }
+
+	P1 = offset_ + direction_*t1;
+
+	// Get the surface normal at point P1.
+	const Vector3 &normal = normals[found[0].triangle];
+	norm = detX*normal.axis[0] + detY*normal.axis[1] + detZ*normal.axis[2];
+
+	return true;
+}
+
+/// Build the triangle hierarchy and set the size of the detector from the triangles.
+void Mesh::_build(){
+	nodes.clear();
+	bounds = BoundingBox();
+	const unsigned int count = GetNumTriangles();
+	if(count == 0){ return; }
+
+	std::vector<unsigned int> order(count);
+	std::vector<Vector3> centers(count);
+	for(unsigned int i = 0; i < count; i++){
+		order[i] = i;
+		centers[i] = (vertices[3*i] + vertices[3*i+1] + vertices[3*i+2])*(1.0/3.0);
+		for(int j = 0; j < 3; j++){ bounds.Extend(vertices[3*i+j]); }
+	}
+
+	// A binary tree with at least one triangle per leaf has fewer than 2*count nodes.
+	nodes.reserve(2*count);
+	nodes.push_back(node());
+	_buildNode(0, 0, count, order, centers);
+
+	// Store the triangles in the order in which the leaves refer to them.
+	std::vector<Vector3> sortedVertices(vertices.size());
+	std::vector<Vector3> sortedNormals(normals.size());
+	for(unsigned int i = 0; i < count; i++){
+		for(int j = 0; j < 3; j++){ sortedVertices[3*i+j] = vertices[3*order[i]+j]; }
+		sortedNormals[i] = normals[order[i]];
+	}
+	vertices.swap(sortedVertices);
+	normals.swap(sortedNormals);
+
+	// The size of the detector is the size of the box which contains the mesh.
+	Vector3 size = bounds.upper - bounds.lower;
+	SetSize(size.axis[1], size.axis[0], size.axis[2]);
+}
+
+/// Recursively build the node nodeIndex_ for the triangles from first_ up to (but not including) last_.
+void Mesh::_buildNode(const unsigned int &nodeIndex_, const unsigned int &first_, const unsigned int &last_, std::vector<unsigned int> &order, const std::vector<Vector3> &centers){
+	BoundingBox box, centerBox;
+	for(unsigned int i = first_; i < last_; i++){
+		for(int j = 0; j < 3; j++){ box.Extend(vertices[3*order[i]+j]); }
+		centerBox.Extend(centers[order[i]]);
+	}
+	box.Pad(meshPadding);
+	nodes[nodeIndex_].box = box;
+
+	// Split the triangles at the median of their centers along the longest axis of the centers.
+	const unsigned int count = last_-first_;
+	Vector3 extent = centerBox.upper - centerBox.lower;
+	int axis = 0;
+	if(extent.axis[1] > extent.axis[axis]){ axis = 1; }
+	if(extent.axis[2] > extent.axis[axis]){ axis = 2; }
+	if(count <= maxTrianglesPerLeaf || extent.axis[axis] <= 0.0){ // Make a leaf.
+		nodes[nodeIndex_].first = first_;
+		nodes[nodeIndex_].count = count;
+		return;
+	}
+
+	const unsigned int middle = first_ + count/2;
+	std::nth_element(order.begin()+first_, order.begin()+middle, order.begin()+last_, [&centers, axis](const unsigned int &lhs, const unsigned int &rhs){ return (centers[lhs].axis[axis] < centers[rhs].axis[axis]); });
+
+	// The children of a branch are stored next to each other.
+	const unsigned int left = nodes.size();
+	nodes[nodeIndex_].first = left;
+	nodes[nodeIndex_].count = 0;
+	nodes.push_back(node());
+	nodes.push_back(node());
+	_buildNode(left, first_, middle, order, centers);
+	_buildNode(left+1, middle, last_, order, centers);
+}
+
+/** Find the closest two crossings of a local ray (origin_ + t * direction_) with the surface for t >= 0.
+  * Return the number of crossings found (0, 1 or 2).
+  */
+unsigned int Mesh::_findCrossings(const Vector3 &origin_, const Vector3 &direction_, crossing *found) const {
+	// Permute the axes so that the ray travels mostly along the last one, and shear the ray onto that axis.
+	int axes[3];
+	axes[2] = 0;
+	if(std::fabs(direction_.axis[1]) > std::fabs(direction_.axis[axes[2]])){ axes[2] = 1; }
+	if(std::fabs(direction_.axis[2]) > std::fabs(direction_.axis[axes[2]])){ axes[2] = 2; }
+	axes[0] = (axes[2]+1) % 3;
+	axes[1] = (axes[0]+1) % 3;
+	if(direction_.axis[axes[2]] < 0.0){ std::swap(axes[0], axes[1]); } // Keep the winding of the triangles.
+	const double shear[3] = {direction_.axis[axes[0]]/direction_.axis[axes[2]],
+	                         direction_.axis[axes[1]]/direction_.axis[axes[2]],
+	                         1.0/direction_.axis[axes[2]]};
+
+	Vector3 invDirection;
+	for(int i = 0; i < 3; i++){
+		invDirection.axis[i] = (direction_.axis[i] != 0.0 ? 1.0/direction_.axis[i] : std::numeric_limits<double>::infinity());
+	}
+
+	unsigned int count = 0;
+	double tLimit = std::numeric_limits<double>::max(); // Crossings beyond the second closest crossing are not needed.
+
+	unsigned int stack[64];
+	unsigned int stackSize = 0;
+	stack[stackSize++] = 0;
+	double tEntry, tExit, t;
+	while(stackSize > 0){
+		const node &current = nodes[stack[--stackSize]];
+		if(!current.box.Intersect(origin_, invDirection, tEntry, tExit) || tEntry > tLimit){ continue; }
+
+		if(current.count == 0){
+			if(stackSize+2 > 64){ continue; } // The tree is never this deep for a median split.
+			stack[stackSize++] = current.first+1;
+			stack[stackSize++] = current.first;
+			continue;
+		}
+
+		for(unsigned int i = current.first; i < current.first+current.count; i++){
+			if(!_intersectTriangle(i, origin_, axes, shear, t) || t > tLimit){ continue; }
+
+			crossing hit;
+			hit.t = t;
+			hit.triangle = i;
+			hit.entering = (normals[i].Dot(direction_) < 0.0);
+
+			// A ray through an edge or vertex shared by several triangles crosses all of them at once.
+			bool duplicate = false;
+			for(unsigned int j = 0; j < count && !duplicate; j++){
+				duplicate = (found[j].entering == hit.entering && std::fabs(found[j].t-t) <= crossingTolerance*std::max(1.0, t));
+			}
+			if(duplicate){ continue; }
+
+			// Keep the two closest crossings in order.
+			if(count < 2){ found[count++] = hit; }
+			else{ found[1] = hit; }
+			if(count == 2 && found[1].t < found[0].t){ std::swap(found[0], found[1]); }
+			if(count == 2){ tLimit = found[1].t; }
+		}
+	}
+
+	return count;
+}
+
+/** Intersect a local ray with a triangle using the watertight algorithm of Woop, Benthin and Wald (2013).
+  * shear_ holds the shear constants and axes_ the permuted axes of the ray. Return true and set t if the
+  * ray crosses the triangle at t >= 0.
+  */
+bool Mesh::_intersectTriangle(const unsigned int &triangle_, const Vector3 &origin_, const int *axes_, const double *shear_, double &t) const {
+	const Vector3 A = vertices[3*triangle_] - origin_;
+	const Vector3 B = vertices[3*triangle_+1] - origin_;
+	const Vector3 C = vertices[3*triangle_+2] - origin_;
+
+	// Shear and scale the corners so that the ray runs along the z axis from the origin.
+	const double Ax = A.axis[axes_[0]] - shear_[0]*A.axis[axes_[2]];
+	const double Ay = A.axis[axes_[1]] - shear_[1]*A.axis[axes_[2]];
+	const double Bx = B.axis[axes_[0]] - shear_[0]*B.axis[axes_[2]];
+	const double By = B.axis[axes_[1]] - shear_[1]*B.axis[axes_[2]];
+	const double Cx = C.axis[axes_[0]] - shear_[0]*C.axis[axes_[2]];
+	const double Cy = C.axis[axes_[1]] - shear_[1]*C.axis[axes_[2]];
+
+	// Scaled barycentric coordinates. The ray passes inside (or on an edge of) the triangle if they all have the same sign.
+	const double U = Cx*By - Cy*Bx;
+	const double V = Ax*Cy - Ay*Cx;
+	const double W = Bx*Ay - By*Ax;
+	if((U < 0.0 || V < 0.0 || W < 0.0) && (U > 0.0 || V > 0.0 || W > 0.0)){ return false; }
+
+	const double det = U + V + W;
+	if(det == 0.0){ return false; } // The ray lies in the plane of the triangle.
+
+	// Scaled distance to the crossing, which must be in front of the ray origin.
+	const double T = U*shear_[2]*A.axis[axes_[2]] + V*shear_[2]*B.axis[axes_[2]] + W*shear_[2]*C.axis[axes_[2]];
+	if((det > 0.0 && T < 0.0) || (det < 0.0 && T > 0.0)){ return false; }
+
+	t = T/det;
+	return true;
+}
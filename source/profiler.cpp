@@ -0,0 +1,43 @@
+/** \file profiler.cpp
+ * \brief A low overhead profiler for timing the stages of a loop.
+ */
+#include "profiler.hpp"
+
+/////////////////////////////////////////////////////////////////////
+// StageProfiler
+/////////////////////////////////////////////////////////////////////
+
+/// Profiler constructor. nStages_ is the number of stages to time.
+StageProfiler::StageProfiler(const unsigned int &nStages_/*=0*/) : enabled(false), times(nStages_, std::chrono::steady_clock::duration::zero()), calls(nStages_, 0) {
+}
+
+/// Return the total time spent in a stage (in seconds).
+double StageProfiler::GetTime(const unsigned int &stage_) const {
+	if(stage_ >= times.size()){ return 0.0; }
+	return std::chrono::duration<double>(times[stage_]).count();
+}
+
+/// Return the total time spent in all stages (in seconds).
+double StageProfiler::GetTotalTime() const {
+	std::chrono::steady_clock::duration total = std::chrono::steady_clock::duration::zero();
+	for(std::vector<std::chrono::steady_clock::duration>::const_iterator iter = times.begin(); iter != times.end(); iter++){
+		total += (*iter);
+	}
+	return std::chrono::duration<double>(total).count();
+}
+
+/// Add the times and calls of another profiler with the same number of stages.
+void StageProfiler::Merge(const StageProfiler &other_){
+	for(unsigned int i = 0; i < times.size() && i < other_.times.size(); i++){
+		times[i] += other_.times[i];
+		calls[i] += other_.calls[i];
+	}
+}
+
+/// Zero the times and calls of all stages.
+void StageProfiler::Reset(){
+	for(unsigned int i = 0; i < times.size(); i++){
+		times[i] = std::chrono::steady_clock::duration::zero();
+		calls[i] = 0;
+	}
+}
@@ -0,0 +1,554 @@
+/** \file slabKernel.cpp
+ * \brief Vectorised slab method kernels for intersecting rays with rectangular boxes.
+ */
+#include <limits>
+
+#include "slabKernel.hpp"
+
+// The vector kernels need x86 intrinsics and the GCC (or clang) target attribute,
+// which lets the AVX2 kernels be built without compiling the whole program for AVX2.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__)
+#define SLAB_KERNEL_X86
+#include <immintrin.h>
+#endif
+
+/////////////////////////////////////////////////////////////////////
+// Scalar kernels
+/////////////////////////////////////////////////////////////////////
+
+/** Clip the range [tEntry, tExit] of a ray against the pair of faces at -half_ and +half_ along one
+  * local axis. The minimum and maximum are written so that they match _mm_min_pd and _mm_max_pd
+  * (or _mm_min_ps and _mm_max_ps) exactly, including for NaN, so the scalar and vector kernels always agree.
+  */
+template <typename T>
+inline void clipScalar(const T &origin_, const T &direction_, const T &half_, T &tEntry, T &tExit){
+	const T tLower = (-half_-origin_)/direction_;
+	const T tUpper = (half_-origin_)/direction_;
+	const T tNear = (tLower < tUpper ? tLower : tUpper);
+	const T tFar = (tLower > tUpper ? tLower : tUpper);
+	tEntry = (tNear > tEntry ? tNear : tEntry);
+	tExit = (tFar < tExit ? tFar : tExit);
+}
+
+/// Clip a ray, given relative to the center of box s_, against the box.
+template <typename T>
+inline void clipBoxScalar(const T &dPx_, const T &dPy_, const T &dPz_, const T &dx_, const T &dy_, const T &dz_,
+                          const SlabBoxesT<T> &boxes_, const unsigned int &s_, T &tEntry, T &tExit){
+	const T originX = dPx_*boxes_.xAxisX[s_] + dPy_*boxes_.xAxisY[s_] + dPz_*boxes_.xAxisZ[s_];
+	const T originY = dPx_*boxes_.yAxisX[s_] + dPy_*boxes_.yAxisY[s_] + dPz_*boxes_.yAxisZ[s_];
+	const T originZ = dPx_*boxes_.zAxisX[s_] + dPy_*boxes_.zAxisY[s_] + dPz_*boxes_.zAxisZ[s_];
+	const T directionX = dx_*boxes_.xAxisX[s_] + dy_*boxes_.xAxisY[s_] + dz_*boxes_.xAxisZ[s_];
+	const T directionY = dx_*boxes_.yAxisX[s_] + dy_*boxes_.yAxisY[s_] + dz_*boxes_.yAxisZ[s_];
+	const T directionZ = dx_*boxes_.zAxisX[s_] + dy_*boxes_.zAxisY[s_] + dz_*boxes_.zAxisZ[s_];
+	tEntry = -std::numeric_limits<T>::max();
+	tExit = std::numeric_limits<T>::max();
+	clipScalar(originX, directionX, boxes_.halfX[s_], tEntry, tExit);
+	clipScalar(originY, directionY, boxes_.halfY[s_], tEntry, tExit);
+	clipScalar(originZ, directionZ, boxes_.halfZ[s_], tEntry, tExit);
+}
+
+/// Scalar version of SlabRayVsBoxes, starting at box first_.
+template <typename T>
+void rayVsBoxesScalar(const T *origin_, const T *direction_, const SlabBoxesT<T> &boxes_, const unsigned int *indices_, const size_t &count_, T *tEntry, T *tExit, const size_t &first_=0){
+	for(size_t i = first_; i < count_; i++){
+		const unsigned int s = indices_[i];
+		clipBoxScalar<T>(origin_[0]-boxes_.posX[s], origin_[1]-boxes_.posY[s], origin_[2]-boxes_.posZ[s],
+		                 direction_[0], direction_[1], direction_[2], boxes_, s, tEntry[i], tExit[i]);
+	}
+}
+
+/// Scalar version of SlabRaysVsBox, starting at ray first_.
+template <typename T>
+void raysVsBoxScalar(const T *originX_, const T *originY_, const T *originZ_, const T *directionX_, const T *directionY_, const T *directionZ_,
+                     const size_t &count_, const SlabBoxesT<T> &boxes_, const unsigned int &index_, T *tEntry, T *tExit, const size_t &first_=0){
+	for(size_t i = first_; i < count_; i++){
+		clipBoxScalar<T>(originX_[i]-boxes_.posX[index_], originY_[i]-boxes_.posY[index_], originZ_[i]-boxes_.posZ[index_],
+		                 directionX_[i], directionY_[i], directionZ_[i], boxes_, index_, tEntry[i], tExit[i]);
+	}
+}
+
+#ifdef SLAB_KERNEL_X86
+
+/////////////////////////////////////////////////////////////////////
+// SSE2 kernels
+/////////////////////////////////////////////////////////////////////
+
+/// Load the values of two boxes from an array.
+inline __m128d gather2(const double *array_, const unsigned int *indices_){
+	return _mm_set_pd(array_[indices_[1]], array_[indices_[0]]);
+}
+
+/// Clip two rays against one pair of faces. The same operations as clipScalar.
+inline void clip2(const __m128d &origin_, const __m128d &direction_, const __m128d &half_, __m128d &tEntry, __m128d &tExit){
+	const __m128d negHalf = _mm_xor_pd(half_, _mm_set1_pd(-0.0));
+	const __m128d tLower = _mm_div_pd(_mm_sub_pd(negHalf, origin_), direction_);
+	const __m128d tUpper = _mm_div_pd(_mm_sub_pd(half_, origin_), direction_);
+	tEntry = _mm_max_pd(_mm_min_pd(tLower, tUpper), tEntry);
+	tExit = _mm_min_pd(_mm_max_pd(tLower, tUpper), tExit);
+}
+
+/// Return the dot product of two vectors given by their components, in the same order as Vector3::Dot.
+inline __m128d dot2(const __m128d &x1_, const __m128d &y1_, const __m128d &z1_, const __m128d &x2_, const __m128d &y2_, const __m128d &z2_){
+	return _mm_add_pd(_mm_add_pd(_mm_mul_pd(x1_, x2_), _mm_mul_pd(y1_, y2_)), _mm_mul_pd(z1_, z2_));
+}
+
+/// Clip two rays, given relative to the center of their boxes, against the boxes.
+inline void clipBox2(const __m128d &dPx_, const __m128d &dPy_, const __m128d &dPz_, const __m128d &dx_, const __m128d &dy_, const __m128d &dz_,
+                     const __m128d *axes_, const __m128d *half_, double *tEntry, double *tExit){
+	__m128d entry = _mm_set1_pd(-std::numeric_limits<double>::max());
+	__m128d exit = _mm_set1_pd(std::numeric_limits<double>::max());
+	for(int i = 0; i < 3; i++){
+		const __m128d origin = dot2(dPx_, dPy_, dPz_, axes_[3*i], axes_[3*i+1], axes_[3*i+2]);
+		const __m128d direction = dot2(dx_, dy_, dz_, axes_[3*i], axes_[3*i+1], axes_[3*i+2]);
+		clip2(origin, direction, half_[i], entry, exit);
+	}
+	_mm_storeu_pd(tEntry, entry);
+	_mm_storeu_pd(tExit, exit);
+}
+
+/// SSE2 version of SlabRayVsBoxes. Tests two boxes at a time.
+void rayVsBoxesSSE2(const double *origin_, const double *direction_, const SlabBoxes &boxes_, const unsigned int *indices_, const size_t &count_, double *tEntry, double *tExit){
+	const __m128d ox = _mm_set1_pd(origin_[0]), oy = _mm_set1_pd(origin_[1]), oz = _mm_set1_pd(origin_[2]);
+	const __m128d dx = _mm_set1_pd(direction_[0]), dy = _mm_set1_pd(direction_[1]), dz = _mm_set1_pd(direction_[2]);
+	__m128d axes[9], half[3];
+	size_t i = 0;
+	for(; i+2 <= count_; i += 2){
+		const unsigned int *s = indices_+i;
+		axes[0] = gather2(boxes_.xAxisX, s); axes[1] = gather2(boxes_.xAxisY, s); axes[2] = gather2(boxes_.xAxisZ, s);
+		axes[3] = gather2(boxes_.yAxisX, s); axes[4] = gather2(boxes_.yAxisY, s); axes[5] = gather2(boxes_.yAxisZ, s);
+		axes[6] = gather2(boxes_.zAxisX, s); axes[7] = gather2(boxes_.zAxisY, s); axes[8] = gather2(boxes_.zAxisZ, s);
+		half[0] = gather2(boxes_.halfX, s); half[1] = gather2(boxes_.halfY, s); half[2] = gather2(boxes_.halfZ, s);
+		clipBox2(_mm_sub_pd(ox, gather2(boxes_.posX, s)), _mm_sub_pd(oy, gather2(boxes_.posY, s)), _mm_sub_pd(oz, gather2(boxes_.posZ, s)),
+		         dx, dy, dz, axes, half, tEntry+i, tExit+i);
+	}
+	rayVsBoxesScalar(origin_, direction_, boxes_, indices_, count_, tEntry, tExit, i);
+}
+
+/// SSE2 version of SlabRaysVsBox. Tests two rays at a time.
+void raysVsBoxSSE2(const double *originX_, const double *originY_, const double *originZ_, const double *directionX_, const double *directionY_, const double *directionZ_,
+                   const size_t &count_, const SlabBoxes &boxes_, const unsigned int &index_, double *tEntry, double *tExit){
+	const unsigned int s = index_;
+	const __m128d px = _mm_set1_pd(boxes_.posX[s]), py = _mm_set1_pd(boxes_.posY[s]), pz = _mm_set1_pd(boxes_.posZ[s]);
+	const __m128d axes[9] = {_mm_set1_pd(boxes_.xAxisX[s]), _mm_set1_pd(boxes_.xAxisY[s]), _mm_set1_pd(boxes_.xAxisZ[s]),
+	                         _mm_set1_pd(boxes_.yAxisX[s]), _mm_set1_pd(boxes_.yAxisY[s]), _mm_set1_pd(boxes_.yAxisZ[s]),
+	                         _mm_set1_pd(boxes_.zAxisX[s]), _mm_set1_pd(boxes_.zAxisY[s]), _mm_set1_pd(boxes_.zAxisZ[s])};
+	const __m128d half[3] = {_mm_set1_pd(boxes_.halfX[s]), _mm_set1_pd(boxes_.halfY[s]), _mm_set1_pd(boxes_.halfZ[s])};
+	size_t i = 0;
+	for(; i+2 <= count_; i += 2){
+		clipBox2(_mm_sub_pd(_mm_loadu_pd(originX_+i), px), _mm_sub_pd(_mm_loadu_pd(originY_+i), py), _mm_sub_pd(_mm_loadu_pd(originZ_+i), pz),
+		         _mm_loadu_pd(directionX_+i), _mm_loadu_pd(directionY_+i), _mm_loadu_pd(directionZ_+i), axes, half, tEntry+i, tExit+i);
+	}
+	raysVsBoxScalar(originX_, originY_, originZ_, directionX_, directionY_, directionZ_, count_, boxes_, index_, tEntry, tExit, i);
+}
+
+/////////////////////////////////////////////////////////////////////
+// AVX2 kernels
+/////////////////////////////////////////////////////////////////////
+
+/// Load the values of four boxes from an array. The masked gather avoids reading an undefined source register.
+__attribute__((target("avx2"))) inline __m256d gather4(const double *array_, const __m128i &indices_){
+	return _mm256_mask_i32gather_pd(_mm256_setzero_pd(), array_, indices_, _mm256_castsi256_pd(_mm256_set1_epi64x(-1)), 8);
+}
+
+/// Clip four rays against one pair of faces. The same operations as clipScalar.
+__attribute__((target("avx2"))) inline void clip4(const __m256d &origin_, const __m256d &direction_, const __m256d &half_, __m256d &tEntry, __m256d &tExit){
+	const __m256d negHalf = _mm256_xor_pd(half_, _mm256_set1_pd(-0.0));
+	const __m256d tLower = _mm256_div_pd(_mm256_sub_pd(negHalf, origin_), direction_);
+	const __m256d tUpper = _mm256_div_pd(_mm256_sub_pd(half_, origin_), direction_);
+	tEntry = _mm256_max_pd(_mm256_min_pd(tLower, tUpper), tEntry);
+	tExit = _mm256_min_pd(_mm256_max_pd(tLower, tUpper), tExit);
+}
+
+/// Return the dot product of two vectors given by their components, in the same order as Vector3::Dot.
+__attribute__((target("avx2"))) inline __m256d dot4(const __m256d &x1_, const __m256d &y1_, const __m256d &z1_, const __m256d &x2_, const __m256d &y2_, const __m256d &z2_){
+	return _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(x1_, x2_), _mm256_mul_pd(y1_, y2_)), _mm256_mul_pd(z1_, z2_));
+}
+
+/// Clip four rays, given relative to the center of their boxes, against the boxes.
+__attribute__((target("avx2"))) inline void clipBox4(const __m256d &dPx_, const __m256d &dPy_, const __m256d &dPz_, const __m256d &dx_, const __m256d &dy_, const __m256d &dz_,
+                                                     const __m256d *axes_, const __m256d *half_, double *tEntry, double *tExit){
+	__m256d entry = _mm256_set1_pd(-std::numeric_limits<double>::max());
+	__m256d exit = _mm256_set1_pd(std::numeric_limits<double>::max());
+	for(int i = 0; i < 3; i++){
+		const __m256d origin = dot4(dPx_, dPy_, dPz_, axes_[3*i], axes_[3*i+1], axes_[3*i+2]);
+		const __m256d direction = dot4(dx_, dy_, dz_, axes_[3*i], axes_[3*i+1], axes_[3*i+2]);
+		clip4(origin, direction, half_[i], entry, exit);
+	}
+	_mm256_storeu_pd(tEntry, entry);
+	_mm256_storeu_pd(tExit, exit);
+}
+
+/// Clip one ray against four boxes. If contiguous_ is true, the boxes are stored next to each other starting at s_[0].
+__attribute__((target("avx2"))) inline void rayVsBoxes4(const __m256d *origin_, const __m256d *direction_, const SlabBoxes &boxes_, const unsigned int *s_, const bool &contiguous_, double *tEntry, double *tExit){
+	__m256d pos[3], axes[9], half[3];
+	if(contiguous_){ // Load the boxes directly, which is much faster than a gather.
+		const unsigned int s = s_[0];
+		pos[0] = _mm256_loadu_pd(boxes_.posX+s); pos[1] = _mm256_loadu_pd(boxes_.posY+s); pos[2] = _mm256_loadu_pd(boxes_.posZ+s);
+		axes[0] = _mm256_loadu_pd(boxes_.xAxisX+s); axes[1] = _mm256_loadu_pd(boxes_.xAxisY+s); axes[2] = _mm256_loadu_pd(boxes_.xAxisZ+s);
+		axes[3] = _mm256_loadu_pd(boxes_.yAxisX+s); axes[4] = _mm256_loadu_pd(boxes_.yAxisY+s); axes[5] = _mm256_loadu_pd(boxes_.yAxisZ+s);
+		axes[6] = _mm256_loadu_pd(boxes_.zAxisX+s); axes[7] = _mm256_loadu_pd(boxes_.zAxisY+s); axes[8] = _mm256_loadu_pd(boxes_.zAxisZ+s);
+		half[0] = _mm256_loadu_pd(boxes_.halfX+s); half[1] = _mm256_loadu_pd(boxes_.halfY+s); half[2] = _mm256_loadu_pd(boxes_.halfZ+s);
+	}
+	else{
+		const __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s_));
+		pos[0] = gather4(boxes_.posX, s); pos[1] = gather4(boxes_.posY, s); pos[2] = gather4(boxes_.posZ, s);
+		axes[0] = gather4(boxes_.xAxisX, s); axes[1] = gather4(boxes_.xAxisY, s); axes[2] = gather4(boxes_.xAxisZ, s);
+		axes[3] = gather4(boxes_.yAxisX, s); axes[4] = gather4(boxes_.yAxisY, s); axes[5] = gather4(boxes_.yAxisZ, s);
+		axes[6] = gather4(boxes_.zAxisX, s); axes[7] = gather4(boxes_.zAxisY, s); axes[8] = gather4(boxes_.zAxisZ, s);
+		half[0] = gather4(boxes_.halfX, s); half[1] = gather4(boxes_.halfY, s); half[2] = gather4(boxes_.halfZ, s);
+	}
+	clipBox4(_mm256_sub_pd(origin_[0], pos[0]), _mm256_sub_pd(origin_[1], pos[1]), _mm256_sub_pd(origin_[2], pos[2]),
+	         direction_[0], direction_[1], direction_[2], axes, half, tEntry, tExit);
+}
+
+/// Return true if the four indices at s_ are consecutive.
+inline bool isContiguous4(const unsigned int *s_){
+	return (s_[1] == s_[0]+1 && s_[2] == s_[0]+2 && s_[3] == s_[0]+3);
+}
+
+/** AVX2 version of SlabRayVsBoxes. Tests eight boxes per iteration, then four, then the remainder with SSE2.
+  * Runs of consecutive indices, such as a whole shape group, are loaded directly instead of gathered.
+  */
+__attribute__((target("avx2"))) void rayVsBoxesAVX2(const double *origin_, const double *direction_, const SlabBoxes &boxes_, const unsigned int *indices_, const size_t &count_, double *tEntry, double *tExit){
+	const __m256d origin[3] = {_mm256_set1_pd(origin_[0]), _mm256_set1_pd(origin_[1]), _mm256_set1_pd(origin_[2])};
+	const __m256d direction[3] = {_mm256_set1_pd(direction_[0]), _mm256_set1_pd(direction_[1]), _mm256_set1_pd(direction_[2])};
+	size_t i = 0;
+	for(; i+8 <= count_; i += 8){
+		rayVsBoxes4(origin, direction, boxes_, indices_+i, isContiguous4(indices_+i), tEntry+i, tExit+i);
+		rayVsBoxes4(origin, direction, boxes_, indices_+i+4, isContiguous4(indices_+i+4), tEntry+i+4, tExit+i+4);
+	}
+	if(i+4 <= count_){
+		rayVsBoxes4(origin, direction, boxes_, indices_+i, isContiguous4(indices_+i), tEntry+i, tExit+i);
+		i += 4;
+	}
+	if(i < count_){ rayVsBoxesSSE2(origin_, direction_, boxes_, indices_+i, count_-i, tEntry+i, tExit+i); }
+}
+
+/// Clip the four rays starting at ray i_ against one box.
+__attribute__((target("avx2"))) inline void raysVsBox4(const double *originX_, const double *originY_, const double *originZ_, const double *directionX_, const double *directionY_, const double *directionZ_,
+                                                       const size_t &i_, const __m256d *pos_, const __m256d *axes_, const __m256d *half_, double *tEntry, double *tExit){
+	clipBox4(_mm256_sub_pd(_mm256_loadu_pd(originX_+i_), pos_[0]), _mm256_sub_pd(_mm256_loadu_pd(originY_+i_), pos_[1]), _mm256_sub_pd(_mm256_loadu_pd(originZ_+i_), pos_[2]),
+	         _mm256_loadu_pd(directionX_+i_), _mm256_loadu_pd(directionY_+i_), _mm256_loadu_pd(directionZ_+i_), axes_, half_, tEntry+i_, tExit+i_);
+}
+
+/// AVX2 version of SlabRaysVsBox. Tests eight rays per iteration, then four, then the remainder with SSE2.
+__attribute__((target("avx2"))) void raysVsBoxAVX2(const double *originX_, const double *originY_, const double *originZ_, const double *directionX_, const double *directionY_, const double *directionZ_,
+                                                   const size_t &count_, const SlabBoxes &boxes_, const unsigned int &index_, double *tEntry, double *tExit){
+	const unsigned int s = index_;
+	const __m256d pos[3] = {_mm256_set1_pd(boxes_.posX[s]), _mm256_set1_pd(boxes_.posY[s]), _mm256_set1_pd(boxes_.posZ[s])};
+	const __m256d axes[9] = {_mm256_set1_pd(boxes_.xAxisX[s]), _mm256_set1_pd(boxes_.xAxisY[s]), _mm256_set1_pd(boxes_.xAxisZ[s]),
+	                         _mm256_set1_pd(boxes_.yAxisX[s]), _mm256_set1_pd(boxes_.yAxisY[s]), _mm256_set1_pd(boxes_.yAxisZ[s]),
+	                         _mm256_set1_pd(boxes_.zAxisX[s]), _mm256_set1_pd(boxes_.zAxisY[s]), _mm256_set1_pd(boxes_.zAxisZ[s])};
+	const __m256d half[3] = {_mm256_set1_pd(boxes_.halfX[s]), _mm256_set1_pd(boxes_.halfY[s]), _mm256_set1_pd(boxes_.halfZ[s])};
+	size_t i = 0;
+	for(; i+8 <= count_; i += 8){
+		raysVsBox4(originX_, originY_, originZ_, directionX_, directionY_, directionZ_, i, pos, axes, half, tEntry, tExit);
+		raysVsBox4(originX_, originY_, originZ_, directionX_, directionY_, directionZ_, i+4, pos, axes, half, tEntry, tExit);
+	}
+	if(i+4 <= count_){
+		raysVsBox4(originX_, originY_, originZ_, directionX_, directionY_, directionZ_, i, pos, axes, half, tEntry, tExit);
+		i += 4;
+	}
+	if(i < count_){ raysVsBoxSSE2(originX_+i, originY_+i, originZ_+i, directionX_+i, directionY_+i, directionZ_+i, count_-i, boxes_, index_, tEntry+i, tExit+i); }
+}
+
+/////////////////////////////////////////////////////////////////////
+// SSE2 single precision kernels
+/////////////////////////////////////////////////////////////////////
+
+/// Load the values of four boxes from an array.
+inline __m128 gather4f(const float *array_, const unsigned int *indices_){
+	return _mm_set_ps(array_[indices_[3]], array_[indices_[2]], array_[indices_[1]], array_[indices_[0]]);
+}
+
+/// Clip four rays against one pair of faces. The same operations as clipScalar.
+inline void clip4f(const __m128 &origin_, const __m128 &direction_, const __m128 &half_, __m128 &tEntry, __m128 &tExit){
+	const __m128 negHalf = _mm_xor_ps(half_, _mm_set1_ps(-0.0f));
+	const __m128 tLower = _mm_div_ps(_mm_sub_ps(negHalf, origin_), direction_);
+	const __m128 tUpper = _mm_div_ps(_mm_sub_ps(half_, origin_), direction_);
+	tEntry = _mm_max_ps(_mm_min_ps(tLower, tUpper), tEntry);
+	tExit = _mm_min_ps(_mm_max_ps(tLower, tUpper), tExit);
+}
+
+/// Return the dot product of two vectors given by their components, in the same order as Vector3::Dot.
+inline __m128 dot4f(const __m128 &x1_, const __m128 &y1_, const __m128 &z1_, const __m128 &x2_, const __m128 &y2_, const __m128 &z2_){
+	return _mm_add_ps(_mm_add_ps(_mm_mul_ps(x1_, x2_), _mm_mul_ps(y1_, y2_)), _mm_mul_ps(z1_, z2_));
+}
+
+/// Clip four rays, given relative to the center of their boxes, against the boxes.
+inline void clipBox4f(const __m128 &dPx_, const __m128 &dPy_, const __m128 &dPz_, const __m128 &dx_, const __m128 &dy_, const __m128 &dz_,
+                      const __m128 *axes_, const __m128 *half_, float *tEntry, float *tExit){
+	__m128 entry = _mm_set1_ps(-std::numeric_limits<float>::max());
+	__m128 exit = _mm_set1_ps(std::numeric_limits<float>::max());
+	for(int i = 0; i < 3; i++){
+		const __m128 origin = dot4f(dPx_, dPy_, dPz_, axes_[3*i], axes_[3*i+1], axes_[3*i+2]);
+		const __m128 direction = dot4f(dx_, dy_, dz_, axes_[3*i], axes_[3*i+1], axes_[3*i+2]);
+		clip4f(origin, direction, half_[i], entry, exit);
+	}
+	_mm_storeu_ps(tEntry, entry);
+	_mm_storeu_ps(tExit, exit);
+}
+
+/// SSE2 version of the single precision SlabRayVsBoxes. Tests four boxes at a time.
+void rayVsBoxesSSE2(const float *origin_, const float *direction_, const SlabBoxesF &boxes_, const unsigned int *indices_, const size_t &count_, float *tEntry, float *tExit){
+	const __m128 ox = _mm_set1_ps(origin_[0]), oy = _mm_set1_ps(origin_[1]), oz = _mm_set1_ps(origin_[2]);
+	const __m128 dx = _mm_set1_ps(direction_[0]), dy = _mm_set1_ps(direction_[1]), dz = _mm_set1_ps(direction_[2]);
+	__m128 axes[9], half[3];
+	size_t i = 0;
+	for(; i+4 <= count_; i += 4){
+		const unsigned int *s = indices_+i;
+		axes[0] = gather4f(boxes_.xAxisX, s); axes[1] = gather4f(boxes_.xAxisY, s); axes[2] = gather4f(boxes_.xAxisZ, s);
+		axes[3] = gather4f(boxes_.yAxisX, s); axes[4] = gather4f(boxes_.yAxisY, s); axes[5] = gather4f(boxes_.yAxisZ, s);
+		axes[6] = gather4f(boxes_.zAxisX, s); axes[7] = gather4f(boxes_.zAxisY, s); axes[8] = gather4f(boxes_.zAxisZ, s);
+		half[0] = gather4f(boxes_.halfX, s); half[1] = gather4f(boxes_.halfY, s); half[2] = gather4f(boxes_.halfZ, s);
+		clipBox4f(_mm_sub_ps(ox, gather4f(boxes_.posX, s)), _mm_sub_ps(oy, gather4f(boxes_.posY, s)), _mm_sub_ps(oz, gather4f(boxes_.posZ, s)),
+		          dx, dy, dz, axes, half, tEntry+i, tExit+i);
+	}
+	rayVsBoxesScalar(origin_, direction_, boxes_, indices_, count_, tEntry, tExit, i);
+}
+
+/// SSE2 version of the single precision SlabRaysVsBox. Tests four rays at a time.
+void raysVsBoxSSE2(const float *originX_, const float *originY_, const float *originZ_, const float *directionX_, const float *directionY_, const float *directionZ_,
+                   const size_t &count_, const SlabBoxesF &boxes_, const unsigned int &index_, float *tEntry, float *tExit){
+	const unsigned int s = index_;
+	const __m128 px = _mm_set1_ps(boxes_.posX[s]), py = _mm_set1_ps(boxes_.posY[s]), pz = _mm_set1_ps(boxes_.posZ[s]);
+	const __m128 axes[9] = {_mm_set1_ps(boxes_.xAxisX[s]), _mm_set1_ps(boxes_.xAxisY[s]), _mm_set1_ps(boxes_.xAxisZ[s]),
+	                        _mm_set1_ps(boxes_.yAxisX[s]), _mm_set1_ps(boxes_.yAxisY[s]), _mm_set1_ps(boxes_.yAxisZ[s]),
+	                        _mm_set1_ps(boxes_.zAxisX[s]), _mm_set1_ps(boxes_.zAxisY[s]), _mm_set1_ps(boxes_.zAxisZ[s])};
+	const __m128 half[3] = {_mm_set1_ps(boxes_.halfX[s]), _mm_set1_ps(boxes_.halfY[s]), _mm_set1_ps(boxes_.halfZ[s])};
+	size_t i = 0;
+	for(; i+4 <= count_; i += 4){
+		clipBox4f(_mm_sub_ps(_mm_loadu_ps(originX_+i), px), _mm_sub_ps(_mm_loadu_ps(originY_+i), py), _mm_sub_ps(_mm_loadu_ps(originZ_+i), pz),
+		          _mm_loadu_ps(directionX_+i), _mm_loadu_ps(directionY_+i), _mm_loadu_ps(directionZ_+i), axes, half, tEntry+i, tExit+i);
+	}
+	raysVsBoxScalar(originX_, originY_, originZ_, directionX_, directionY_, directionZ_, count_, boxes_, index_, tEntry, tExit, i);
+}
+
+/////////////////////////////////////////////////////////////////////
+// AVX2 single precision kernels
+/////////////////////////////////////////////////////////////////////
+
+/// Load the values of eight boxes from an array. The masked gather avoids reading an undefined source register.
+__attribute__((target("avx2"))) inline __m256 gather8f(const float *array_, const __m256i &indices_){
+	return _mm256_mask_i32gather_ps(_mm256_setzero_ps(), array_, indices_, _mm256_castsi256_ps(_mm256_set1_epi32(-1)), 4);
+}
+
+/// Clip eight rays against one pair of faces. The same operations as clipScalar.
+__attribute__((target("avx2"))) inline void clip8f(const __m256 &origin_, const __m256 &direction_, const __m256 &half_, __m256 &tEntry, __m256 &tExit){
+	const __m256 negHalf = _mm256_xor_ps(half_, _mm256_set1_ps(-0.0f));
+	const __m256 tLower = _mm256_div_ps(_mm256_sub_ps(negHalf, origin_), direction_);
+	const __m256 tUpper = _mm256_div_ps(_mm256_sub_ps(half_, origin_), direction_);
+	tEntry = _mm256_max_ps(_mm256_min_ps(tLower, tUpper), tEntry);
+	tExit = _mm256_min_ps(_mm256_max_ps(tLower, tUpper), tExit);
+}
+
+/// Return the dot product of two vectors given by their components, in the same order as Vector3::Dot.
+__attribute__((target("avx2"))) inline __m256 dot8f(const __m256 &x1_, const __m256 &y1_, const __m256 &z1_, const __m256 &x2_, const __m256 &y2_, const __m256 &z2_){
+	return _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x1_, x2_), _mm256_mul_ps(y1_, y2_)), _mm256_mul_ps(z1_, z2_));
+}
+
+/// Clip eight rays, given relative to the center of their boxes, against the boxes.
+__attribute__((target("avx2"))) inline void clipBox8f(const __m256 &dPx_, const __m256 &dPy_, const __m256 &dPz_, const __m256 &dx_, const __m256 &dy_, const __m256 &dz_,
+                                                      const __m256 *axes_, const __m256 *half_, float *tEntry, float *tExit){
+	__m256 entry = _mm256_set1_ps(-std::numeric_limits<float>::max());
+	__m256 exit = _mm256_set1_ps(std::numeric_limits<float>::max());
+	for(int i = 0; i < 3; i++){
+		const __m256 origin = dot8f(dPx_, dPy_, dPz_, axes_[3*i], axes_[3*i+1], axes_[3*i+2]);
+		const __m256 direction = dot8f(dx_, dy_, dz_, axes_[3*i], axes_[3*i+1], axes_[3*i+2]);
+		clip8f(origin, direction, half_[i], entry, exit);
+	}
+	_mm256_storeu_ps(tEntry, entry);
+	_mm256_storeu_ps(tExit, exit);
+}
+
+/// Clip one ray against eight boxes. If contiguous_ is true, the boxes are stored next to each other starting at s_[0].
+__attribute__((target("avx2"))) inline void rayVsBoxes8f(const __m256 *origin_, const __m256 *direction_, const SlabBoxesF &boxes_, const unsigned int *s_, const bool &contiguous_, float *tEntry, float *tExit){
+	__m256 pos[3], axes[9], half[3];
+	if(contiguous_){ // Load the boxes directly, which is much faster than a gather.
+		const unsigned int s = s_[0];
+		pos[0] = _mm256_loadu_ps(boxes_.posX+s); pos[1] = _mm256_loadu_ps(boxes_.posY+s); pos[2] = _mm256_loadu_ps(boxes_.posZ+s);
+		axes[0] = _mm256_loadu_ps(boxes_.xAxisX+s); axes[1] = _mm256_loadu_ps(boxes_.xAxisY+s); axes[2] = _mm256_loadu_ps(boxes_.xAxisZ+s);
+		axes[3] = _mm256_loadu_ps(boxes_.yAxisX+s); axes[4] = _mm256_loadu_ps(boxes_.yAxisY+s); axes[5] = _mm256_loadu_ps(boxes_.yAxisZ+s);
+		axes[6] = _mm256_loadu_ps(boxes_.zAxisX+s); axes[7] = _mm256_loadu_ps(boxes_.zAxisY+s); axes[8] = _mm256_loadu_ps(boxes_.zAxisZ+s);
+		half[0] = _mm256_loadu_ps(boxes_.halfX+s); half[1] = _mm256_loadu_ps(boxes_.halfY+s); half[2] = _mm256_loadu_ps(boxes_.halfZ+s);
+	}
+	else{
+		const __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s_));
+		pos[0] = gather8f(boxes_.posX, s); pos[1] = gather8f(boxes_.posY, s); pos[2] = gather8f(boxes_.posZ, s);
+		axes[0] = gather8f(boxes_.xAxisX, s); axes[1] = gather8f(boxes_.xAxisY, s); axes[2] = gather8f(boxes_.xAxisZ, s);
+		axes[3] = gather8f(boxes_.yAxisX, s); axes[4] = gather8f(boxes_.yAxisY, s); axes[5] = gather8f(boxes_.yAxisZ, s);
+		axes[6] = gather8f(boxes_.zAxisX, s); axes[7] = gather8f(boxes_.zAxisY, s); axes[8] = gather8f(boxes_.zAxisZ, s);
+		half[0] = gather8f(boxes_.halfX, s); half[1] = gather8f(boxes_.halfY, s); half[2] = gather8f(boxes_.halfZ, s);
+	}
+	clipBox8f(_mm256_sub_ps(origin_[0], pos[0]), _mm256_sub_ps(origin_[1], pos[1]), _mm256_sub_ps(origin_[2], pos[2]),
+	          direction_[0], direction_[1], direction_[2], axes, half, tEntry, tExit);
+}
+
+/// Return true if the eight indices at s_ are consecutive.
+inline bool isContiguous8(const unsigned int *s_){
+	return (s_[7] == s_[0]+7 && isContiguous4(s_) && s_[4] == s_[0]+4 && isContiguous4(s_+4));
+}
+
+/** AVX2 version of the single precision SlabRayVsBoxes. Tests sixteen boxes per iteration, then eight,
+  * then the remainder with SSE2. Runs of consecutive indices are loaded directly instead of gathered.
+  */
+__attribute__((target("avx2"))) void rayVsBoxesAVX2(const float *origin_, const float *direction_, const SlabBoxesF &boxes_, const unsigned int *indices_, const size_t &count_, float *tEntry, float *tExit){
+	const __m256 origin[3] = {_mm256_set1_ps(origin_[0]), _mm256_set1_ps(origin_[1]), _mm256_set1_ps(origin_[2])};
+	const __m256 direction[3] = {_mm256_set1_ps(direction_[0]), _mm256_set1_ps(direction_[1]), _mm256_set1_ps(direction_[2])};
+	size_t i = 0;
+	for(; i+16 <= count_; i += 16){
+		rayVsBoxes8f(origin, direction, boxes_, indices_+i, isContiguous8(indices_+i), tEntry+i, tExit+i);
+		rayVsBoxes8f(origin, direction, boxes_, indices_+i+8, isContiguous8(indices_+i+8), tEntry+i+8, tExit+i+8);
+	}
+	if(i+8 <= count_){
+		rayVsBoxes8f(origin, direction, boxes_, indices_+i, isContiguous8(indices_+i), tEntry+i, tExit+i);
+		i += 8;
+	}
+	if(i < count_){ rayVsBoxesSSE2(origin_, direction_, boxes_, indices_+i, count_-i, tEntry+i, tExit+i); }
+}
+
+/// Clip the eight rays starting at ray i_ against one box.
+__attribute__((target("avx2"))) inline void raysVsBox8f(const float *originX_, const float *originY_, const float *originZ_, const float *directionX_, const float *directionY_, const float *directionZ_,
+                                                        const size_t &i_, const __m256 *pos_, const __m256 *axes_, const __m256 *half_, float *tEntry, float *tExit){
+	clipBox8f(_mm256_sub_ps(_mm256_loadu_ps(originX_+i_), pos_[0]), _mm256_sub_ps(_mm256_loadu_ps(originY_+i_), pos_[1]), _mm256_sub_ps(_mm256_loadu_ps(originZ_+i_), pos_[2]),
+	          _mm256_loadu_ps(directionX_+i_), _mm256_loadu_ps(directionY_+i_), _mm256_loadu_ps(directionZ_+i_), axes_, half_, tEntry+i_, tExit+i_);
+}
+
+/// AVX2 version of the single precision SlabRaysVsBox. Tests sixteen rays per iteration, then eight, then the remainder with SSE2.
+__attribute__((target("avx2"))) void raysVsBoxAVX2(const float *originX_, const float *originY_, const float *originZ_, const float *directionX_, const float *directionY_, const float *directionZ_,
+                                                   const size_t &count_, const SlabBoxesF &boxes_, const unsigned int &index_, float *tEntry, float *tExit){
+	const unsigned int s = index_;
+	const __m256 pos[3] = {_mm256_set1_ps(boxes_.posX[s]), _mm256_set1_ps(boxes_.posY[s]), _mm256_set1_ps(boxes_.posZ[s])};
+	const __m256 axes[9] = {_mm256_set1_ps(boxes_.xAxisX[s]), _mm256_set1_ps(boxes_.xAxisY[s]), _mm256_set1_ps(boxes_.xAxisZ[s]),
+	                        _mm256_set1_ps(boxes_.yAxisX[s]), _mm256_set1_ps(boxes_.yAxisY[s]), _mm256_set1_ps(boxes_.yAxisZ[s]),
+	                        _mm256_set1_ps(boxes_.zAxisX[s]), _mm256_set1_ps(boxes_.zAxisY[s]), _mm256_set1_ps(boxes_.zAxisZ[s])};
+	const __m256 half[3] = {_mm256_set1_ps(boxes_.halfX[s]), _mm256_set1_ps(boxes_.halfY[s]), _mm256_set1_ps(boxes_.halfZ[s])};
+	size_t i = 0;
+	for(; i+16 <= count_; i += 16){
+		raysVsBox8f(originX_, originY_, originZ_, directionX_, directionY_, directionZ_, i, pos, axes, half, tEntry, tExit);
+		raysVsBox8f(originX_, originY_, originZ_, directionX_, directionY_, directionZ_, i+8, pos, axes, half, tEntry, tExit);
+	}
+	if(i+8 <= count_){
+		raysVsBox8f(originX_, originY_, originZ_, directionX_, directionY_, directionZ_, i, pos, axes, half, tEntry, tExit);
+		i += 8;
+	}
+	if(i < count_){ raysVsBoxSSE2(originX_+i, originY_+i, originZ_+i, directionX_+i, directionY_+i, directionZ_+i, count_-i, boxes_, index_, tEntry+i, tExit+i); }
+}
+
+#endif
+
+/////////////////////////////////////////////////////////////////////
+// Dispatch
+/////////////////////////////////////////////////////////////////////
+
+/// Return the widest instruction set supported by both the build and the CPU.
+SimdLevel GetSimdSupport(){
+#ifdef SLAB_KERNEL_X86
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2")){ return SIMD_AVX2; }
+	return SIMD_SSE2;
+#else
+	return SIMD_SCALAR;
+#endif
+}
+
+/// The instruction set used by the slab kernels. Set to the widest supported level the first time it is needed.
+SimdLevel &currentLevel(){
+	static SimdLevel level = GetSimdSupport();
+	return level;
+}
+
+/// Return the instruction set currently used by the slab kernels.
+SimdLevel GetSimdLevel(){
+	return currentLevel();
+}
+
+/** Select the instruction set used by the slab kernels. Levels which are not supported are
+  * reduced to the widest supported level. This is not thread safe, so it should be called before
+  * any threads are started. Return the level which was selected.
+  */
+SimdLevel SetSimdLevel(const SimdLevel &level_){
+	SimdLevel support = GetSimdSupport();
+	currentLevel() = (level_ < support ? level_ : support);
+	return currentLevel();
+}
+
+/// Return the name of an instruction set.
+const char *GetSimdName(const SimdLevel &level_){
+	if(level_ == SIMD_AVX2){ return "AVX2"; }
+	else if(level_ == SIMD_SSE2){ return "SSE2"; }
+	return "scalar";
+}
+
+/** Clip the ray (origin_ + t * direction_) against count_ boxes, given by their indices_ into boxes_.
+  * tEntry[i] and tExit[i] are set to the ray parameters at which the ray enters and leaves box
+  * indices_[i]. The ray crosses the box in front of its origin if (tEntry[i] <= tExit[i] && tExit[i] >= 0).
+  * The direction must not be the zero vector.
+  */
+void SlabRayVsBoxes(const double *origin_, const double *direction_, const SlabBoxes &boxes_, const unsigned int *indices_, const size_t &count_, double *tEntry, double *tExit){
+#ifdef SLAB_KERNEL_X86
+	const SimdLevel level = currentLevel();
+	if(level == SIMD_AVX2){
+		rayVsBoxesAVX2(origin_, direction_, boxes_, indices_, count_, tEntry, tExit);
+		return;
+	}
+	if(level == SIMD_SSE2){
+		rayVsBoxesSSE2(origin_, direction_, boxes_, indices_, count_, tEntry, tExit);
+		return;
+	}
+#endif
+	rayVsBoxesScalar(origin_, direction_, boxes_, indices_, count_, tEntry, tExit);
+}
+
+/** Clip count_ rays against the box at index_ in boxes_. The origins and directions of the rays
+  * are given as structures of arrays. tEntry[i] and tExit[i] are the same as for SlabRayVsBoxes,
+  * for ray i. None of the directions may be the zero vector.
+  */
+void SlabRaysVsBox(const double *originX_, const double *originY_, const double *originZ_, const double *directionX_, const double *directionY_, const double *directionZ_,
+                   const size_t &count_, const SlabBoxes &boxes_, const unsigned int &index_, double *tEntry, double *tExit){
+#ifdef SLAB_KERNEL_X86
+	const SimdLevel level = currentLevel();
+	if(level == SIMD_AVX2){
+		raysVsBoxAVX2(originX_, originY_, originZ_, directionX_, directionY_, directionZ_, count_, boxes_, index_, tEntry, tExit);
+		return;
+	}
+	if(level == SIMD_SSE2){
+		raysVsBoxSSE2(originX_, originY_, originZ_, directionX_, directionY_, directionZ_, count_, boxes_, index_, tEntry, tExit);
+		return;
+	}
+#endif
+	raysVsBoxScalar(originX_, originY_, originZ_, directionX_, directionY_, directionZ_, count_, boxes_, index_, tEntry, tExit);
+}
+
+/// Single precision version of SlabRayVsBoxes.
+void SlabRayVsBoxes(const float *origin_, const float *direction_, const SlabBoxesF &boxes_, const unsigned int *indices_, const size_t &count_, float *tEntry, float *tExit){
+#ifdef SLAB_KERNEL_X86
+	const SimdLevel level = currentLevel();
+	if(level == SIMD_AVX2){
+		rayVsBoxesAVX2(origin_, direction_, boxes_, indices_, count_, tEntry, tExit);
+		return;
+	}
+	if(level == SIMD_SSE2){
+		rayVsBoxesSSE2(origin_, direction_, boxes_, indices_, count_, tEntry, tExit);
+		return;
+	}
+#endif
+	rayVsBoxesScalar(origin_, direction_, boxes_, indices_, count_, tEntry, tExit);
+}
+
+/// Single precision version of SlabRaysVsBox.
+void SlabRaysVsBox(const float *originX_, const float *originY_, const float *originZ_, const float *directionX_, const float *directionY_, const float *directionZ_,
+                   const size_t &count_, const SlabBoxesF &boxes_, const unsigned int &index_, float *tEntry, float *tExit){
+#ifdef SLAB_KERNEL_X86
+	const SimdLevel level = currentLevel();
+	if(level == SIMD_AVX2){
+		raysVsBoxAVX2(originX_, originY_, originZ_, directionX_, directionY_, directionZ_, count_, boxes_, index_, tEntry, tExit);
+		return;
+	}
+	if(level == SIMD_SSE2){
+		raysVsBoxSSE2(originX_, originY_, originZ_, directionX_, directionY_, directionZ_, count_, boxes_, index_, tEntry, tExit);
+		return;
+	}
+#endif
+	raysVsBoxScalar(originX_, originY_, originZ_, directionX_, directionY_, directionZ_, count_, boxes_, index_, tEntry, tExit);
+}
@@ -0,0 +1,88 @@
+/** \file threadPool.cpp
+ * \brief A small fixed-size pool of worker threads.
+ */
+#include "threadPool.hpp"
+
+/////////////////////////////////////////////////////////////////////
+// ThreadPool
+/////////////////////////////////////////////////////////////////////
+
+/** Pool constructor. nThreads_ is the number of threads to use. If nThreads_
+  * is less than two, no threads are started and all jobs run on the calling thread.
+  */
+ThreadPool::ThreadPool(const unsigned int &nThreads_/*=1*/) : job(NULL), nThreads(nThreads_ > 0 ? nThreads_ : 1), nJobs(0), nextJob(0), nFinished(0), generation(0), quit(false) {
+	if(nThreads < 2){ return; }
+	for(unsigned int i = 0; i < nThreads; i++){
+		threads.push_back(std::thread(&ThreadPool::_work, this));
+	}
+}
+
+/// Destructor. Stops and joins all worker threads.
+ThreadPool::~ThreadPool(){
+	{
+		std::unique_lock<std::mutex> guard(lock);
+		quit = true;
+	}
+	startCondition.notify_all();
+	for(std::vector<std::thread>::iterator iter = threads.begin(); iter != threads.end(); iter++){
+		iter->join();
+	}
+}
+
+/** Call func_(index) for every index in [0, nJobs_) using all available threads.
+  * The order in which jobs are started is not defined. Block until all jobs are done.
+  */
+void ThreadPool::Execute(const unsigned int &nJobs_, const std::function<void(const unsigned int &)> &func_){
+	if(nJobs_ == 0){ return; }
+
+	if(threads.empty()){ // Run everything on the calling thread.
+		for(unsigned int i = 0; i < nJobs_; i++){
+			func_(i);
+		}
+		return;
+	}
+
+	std::unique_lock<std::mutex> guard(lock);
+	job = &func_;
+	nJobs = nJobs_;
+	nextJob = 0;
+	nFinished = 0;
+	generation++;
+	startCondition.notify_all();
+
+	// Wait for all jobs to finish.
+	while(nFinished < nJobs){
+		doneCondition.wait(guard);
+	}
+	job = NULL;
+}
+
+/// Return the number of hardware threads available on this machine (at least 1).
+unsigned int ThreadPool::GetHardwareThreads(){
+	unsigned int retval = std::thread::hardware_concurrency();
+	return (retval > 0 ? retval : 1);
+}
+
+/// Main loop for each of the worker threads.
+void ThreadPool::_work(){
+	unsigned int lastGeneration = 0;
+	std::unique_lock<std::mutex> guard(lock);
+	while(true){
+		while(!quit && (generation == lastGeneration || nextJob >= nJobs)){
+			if(generation != lastGeneration){ lastGeneration = generation; }
+			startCondition.wait(guard);
+		}
+		if(quit){ break; }
+		lastGeneration = generation;
+
+		// Grab jobs until there are none left in this batch.
+		while(nextJob < nJobs){
+			unsigned int index = nextJob++;
+			const std::function<void(const unsigned int &)> *func = job;
+			guard.unlock();
+			(*func)(index);
+			guard.lock();
+			if(++nFinished == nJobs){ doneCondition.notify_all(); }
+		}
+	}
+}
@@ -9,9 +9,15 @@
  * \author C. R. Thornsberry
  * \date Feb. 26th, 2016
  */
+#include <algorithm>
 #include <fstream>
+#include <iomanip>
 #include <iostream>
 #include <time.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#include "threadPool.hpp"
 
 // ROOT
 #include "TFile.h"
@@ -35,6 +41,20 @@ void SetName(std::vector<TNamed*> &named, std::string name_, const T &value_, st
 	named.push_back(new TNamed(name_.c_str(), stream.str().c_str()));
 }
 
+/// Names of the event loop stages timed by the profiler.
+const char *stageNames[PROFILE_STAGES] = {"beamGeneration", "interactionDepth", "beamEnergyLoss", "angularStraggling", "kinematics", "frameRotation", "productEnergyLoss",
+                                          "vetoTracing", "recoilTracing", "ejectileTracing", "gammaTracing", "detectorEnergyLoss", "eventOutput", "background", "treeFill"};
+
+/// Return a list of config file parameter overrides as a string of the form "NAME=VALUE, NAME=VALUE".
+std::string GetOverrideString(const std::vector<vandmcParameter> &overrides_){
+	std::stringstream stream;
+	for(std::vector<vandmcParameter>::const_iterator iter = overrides_.begin(); iter != overrides_.end(); iter++){
+		if(iter != overrides_.begin()){ stream << ", "; }
+		stream << iter->GetName() << "=" << iter->GetValue();
+	}
+	return stream.str();
+}
+
 double MeV2MeVee(const double &Tp_){
 	// Coefficients for NE102 (BC408)
 	const double Acoeff = 0.95;
@@ -152,6 +172,23 @@ bool vandmcParameterReader::FindString(const std::string &str, std::string &val)
 	return true;
 }
 
+bool vandmcParameterReader::IsValidName(const std::string &str){
+	for(std::vector<vandmcParameter>::iterator iter = validParameters.begin(); iter != validParameters.end(); iter++){
+		if(iter->Compare(str)) return true;
+	}
+	return false;
+}
+
+bool vandmcParameterReader::SetValue(const std::string &str, const std::string &val){
+	if(!IsValidName(str)) return false;
+	for(std::vector<vandmcParameter>::iterator iter = parameters.begin(); iter != parameters.end();){
+		if(iter->Compare(str)) iter = parameters.erase(iter);
+		else iter++;
+	}
+	parameters.push_back(vandmcParameter(str, "", val));
+	return true;
+}
+
 vandmcParameter *vandmcParameterReader::findParam(const std::string &str){
 	for(std::vector<vandmcParameter>::iterator iter = parameters.begin(); iter != parameters.end(); iter++){
 		if(iter->Compare(str)){
@@ -173,6 +210,7 @@ void vandmcParameterReader::initialize(){
 	                                             "TARG_MATERIAL",
 	                                             "TARG_THICKNESS",
 	                                             "TARG_ANGLE",
+	                                             "TARG_EXCITATION",
 	                                             "RECOIL_Z",
 	                                             "RECOIL_A",
 	                                             "RECOIL_AMU",
@@ -198,21 +236,246 @@ void vandmcParameterReader::initialize(){
 	                                             "BACKGROUND_WAIT",
 	                                             "REQUIRE_COINCIDENCE",
 	                                             "WRITE_REACTION_INFO",
-	                                             "SIMULATE_252CF"};
+	                                             "SIMULATE_252CF",
+	                                             "RANGE_TOLERANCE",
+	                                             "MATERIAL_DIR",
+	                                             "STOPPING_MODEL"};
 
 	for(std::vector<std::string>::const_iterator iter = paramNames.begin(); iter != paramNames.end(); iter++){
 		validParameters.push_back(vandmcParameter(*iter));
 	}
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// class vandmcCache
+///////////////////////////////////////////////////////////////////////////////
+
+/// Version of the range table calculation. Increase it whenever Material::StopPower, TabulatedStoppingPower, RangeTable::Init or RangeTable::InitAdaptive change, so that old cached tables are not used.
+const unsigned int rangeTableVersion = 4;
+
+/// Return the 64 bit FNV-1a hash of a string.
+uint64_t hashString(const std::string &str_){
+	uint64_t hash = 14695981039346656037ULL;
+	for(std::string::const_iterator iter = str_.begin(); iter != str_.end(); iter++){
+		hash ^= (unsigned char)(*iter);
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+bool vandmcCache::tableKey::operator < (const tableKey &rhs) const {
+	if(material != rhs.material) return (material < rhs.material);
+	if(model != rhs.model) return (model < rhs.model);
+	if(entries != rhs.entries) return (entries < rhs.entries);
+	if(tolerance != rhs.tolerance) return (tolerance < rhs.tolerance);
+	if(startE != rhs.startE) return (startE < rhs.startE);
+	if(stopE != rhs.stopE) return (stopE < rhs.stopE);
+	if(Z != rhs.Z) return (Z < rhs.Z);
+	return (mass < rhs.mass);
+}
+
+vandmcCache::~vandmcCache(){
+	for(std::map<tableKey, RangeTable*>::iterator iter = tables.begin(); iter != tables.end(); iter++){
+		delete iter->second;
+	}
+	tables.clear();
+	for(std::map<std::string, MaterialLibrary*>::iterator iter = libraries.begin(); iter != libraries.end(); iter++){
+		delete iter->second;
+	}
+	libraries.clear();
+	delete tabulated;
+}
+
+/** Return the library of materials for a directory of material (.mat) files, building it the first time it
+  * is requested. The library also contains the materials built into vandmc, which are replaced by any files
+  * with the same name. An empty dirname_ gives only the built-in materials. The library is owned by the cache.
+  * Return NULL if the directory could not be opened.
+  */
+MaterialLibrary *vandmcCache::GetMaterialLibrary(const std::string &dirname_){
+	std::map<std::string, MaterialLibrary*>::iterator iter = libraries.find(dirname_);
+	if(iter != libraries.end()) return iter->second;
+
+	MaterialLibrary *library = new MaterialLibrary();
+	library->AddDefaults();
+	if(!dirname_.empty() && library->AddDirectory(dirname_) < 0){
+		delete library;
+		return NULL;
+	}
+
+	libraries[dirname_] = library;
+	return library;
+}
+
+/** Return the stopping power model with a given name, used to build range tables. "tabulated" gives a
+  * TabulatedStoppingPower, which is built the first time it is requested and is owned by the cache. Return
+  * NULL for "bethe" (and any other name), which builds range tables using Material::StopPower.
+  */
+StoppingPowerModel *vandmcCache::GetStoppingPowerModel(const std::string &name_){
+	if(name_ != "tabulated") return NULL;
+	if(!tabulated) tabulated = new TabulatedStoppingPower();
+	return tabulated;
+}
+
+/** Set the directory used to store range tables between runs, creating it if needed. An empty
+  * string disables the directory. Return false if the directory could not be created.
+  */
+bool vandmcCache::SetDirectory(const std::string &directory_){
+	directory = "";
+	if(directory_.empty()) return true;
+	if(mkdir(directory_.c_str(), 0755) != 0 && errno != EEXIST) return false;
+	struct stat info;
+	if(stat(directory_.c_str(), &info) != 0 || !S_ISDIR(info.st_mode)) return false;
+	directory = directory_;
+	return true;
+}
+
+RangeTable *vandmcCache::GetRangeTable(const unsigned int &num_entries_, const double &startE_, const double &stopE_, const double &Z_, const double &mass_, Material *mat_, StoppingPowerModel *model_/*=NULL*/){
+	return getRangeTable(num_entries_, 0.0, startE_, stopE_, Z_, mass_, mat_, model_);
+}
+
+RangeTable *vandmcCache::GetAdaptiveRangeTable(const double &startE_, const double &stopE_, const double &Z_, const double &mass_, Material *mat_, const double &tolerance_/*=1E-6*/, StoppingPowerModel *model_/*=NULL*/){
+	return getRangeTable(0, tolerance_, startE_, stopE_, Z_, mass_, mat_, model_);
+}
+
+/** Find, load or build the log-spaced range tables for a list of requests, and set the table of each request.
+  * Tables which must be built are built using pool_. If there are at least as many of them as there are threads,
+  * several tables are built at once. Otherwise the tables are built one at a time, with the entries of each table
+  * split between the threads. The tables are the same however they are built. The stopping powers are calculated
+  * using model_, or using Material if model_ is NULL.
+  */
+void vandmcCache::GetAdaptiveRangeTables(std::vector<tableRequest> &requests_, const double &tolerance_, ThreadPool *pool_, StoppingPowerModel *model_/*=NULL*/){
+	std::vector<tableRequest*> missing;
+	std::vector<std::string> missingKeys;
+	for(std::vector<tableRequest>::iterator iter = requests_.begin(); iter != requests_.end(); iter++){
+		bool filled;
+		std::string tableKey;
+		iter->table = findRangeTable(0, tolerance_, iter->startE, iter->stopE, iter->Z, iter->mass, iter->mat, model_, filled, tableKey);
+		if(filled) continue;
+		missing.push_back(&(*iter));
+		missingKeys.push_back(tableKey);
+	}
+	if(missing.empty()) return;
+
+	if(pool_ == NULL || missing.size() >= pool_->GetNumThreads()){
+		std::function<void(const unsigned int &)> job = [&](const unsigned int &index_){
+			tableRequest *request = missing[index_];
+			request->table->InitAdaptive(request->startE, request->stopE, request->Z, request->mass, request->mat, tolerance_, 100000, NULL, model_);
+		};
+		if(pool_) pool_->Execute(missing.size(), job);
+		else{
+			for(unsigned int i = 0; i < missing.size(); i++) job(i);
+		}
+	}
+	else{
+		for(std::vector<tableRequest*>::iterator iter = missing.begin(); iter != missing.end(); iter++){
+			(*iter)->table->InitAdaptive((*iter)->startE, (*iter)->stopE, (*iter)->Z, (*iter)->mass, (*iter)->mat, tolerance_, 100000, pool_, model_);
+		}
+	}
+
+	for(unsigned int i = 0; i < missing.size(); i++){
+		storeRangeTable(missing[i]->table, missingKeys[i]);
+	}
+}
+
+/// Find, load or build a range table with num_entries_ linear entries, or an adaptive table if num_entries_ is zero.
+RangeTable *vandmcCache::getRangeTable(const unsigned int &num_entries_, const double &tolerance_, const double &startE_, const double &stopE_, const double &Z_, const double &mass_, Material *mat_, StoppingPowerModel *model_){
+	bool filled;
+	std::string tableKey;
+	RangeTable *table = findRangeTable(num_entries_, tolerance_, startE_, stopE_, Z_, mass_, mat_, model_, filled, tableKey);
+	if(filled) return table;
+
+	if(num_entries_ == 0){ table->InitAdaptive(startE_, stopE_, Z_, mass_, mat_, tolerance_, 100000, NULL, model_); }
+	else{ table->Init(num_entries_, startE_, stopE_, Z_, mass_, mat_, model_); }
+	storeRangeTable(table, tableKey);
+
+	return table;
+}
+
+/** Return a range table with num_entries_ linear entries (or an adaptive table if num_entries_ is zero) which has
+  * already been built, or load it from the cache directory, and set filled to true. Otherwise, add a new empty
+  * table, set filled to false and set tableKey_ to the key which must be passed to storeRangeTable once it is filled.
+  */
+RangeTable *vandmcCache::findRangeTable(const unsigned int &num_entries_, const double &tolerance_, const double &startE_, const double &stopE_, const double &Z_, const double &mass_, Material *mat_, StoppingPowerModel *model_, bool &filled, std::string &tableKey_){
+	tableKey key;
+	key.material = mat_->GetSignature();
+	key.model = (model_ ? model_->GetSignature() : "");
+	key.entries = num_entries_;
+	key.tolerance = (num_entries_ == 0 ? tolerance_ : 0.0);
+	key.startE = startE_;
+	key.stopE = stopE_;
+	key.Z = Z_;
+	key.mass = mass_;
+
+	filled = true;
+	std::map<tableKey, RangeTable*>::iterator iter = tables.find(key);
+	if(iter != tables.end()){
+		nTableHits++;
+		return iter->second;
+	}
+
+	RangeTable *table = new RangeTable();
+	tables[key] = table;
+
+	// Look for the table in the cache directory.
+	if(!directory.empty()){
+		tableKey_ = getTableKey(num_entries_, key.tolerance, startE_, stopE_, Z_, mass_, mat_, model_);
+		if(table->Read(getTableFilename(tableKey_).c_str(), tableKey_)){
+			nDiskHits++;
+			return table;
+		}
+	}
+
+	filled = false;
+	return table;
+}
+
+/// Store a newly filled range table in the cache directory, if there is one.
+void vandmcCache::storeRangeTable(RangeTable *table_, const std::string &tableKey_){
+	if(directory.empty()) return;
+	if(!table_->Write(getTableFilename(tableKey_).c_str(), tableKey_) && !directoryWarning){
+		std::cout << " Warning! Failed to write range table to cache directory \"" << directory << "\"!\n";
+		directoryWarning = true;
+	}
+}
+
+/// Return the name of the file in the cache directory which stores the range table with a given key.
+std::string vandmcCache::getTableFilename(const std::string &tableKey_) const {
+	std::stringstream filename;
+	filename << directory << "/range_" << std::hex << std::setfill('0') << std::setw(16) << hashString(tableKey_) << ".dat";
+	return filename.str();
+}
+
+/// Return a string which describes everything used to build a range table.
+std::string vandmcCache::getTableKey(const unsigned int &num_entries_, const double &tolerance_, const double &startE_, const double &stopE_, const double &Z_, const double &mass_, Material *mat_, StoppingPowerModel *model_){
+	std::stringstream stream;
+	stream << std::setprecision(17) << "version " << rangeTableVersion << "\n";
+	stream << "material " << mat_->GetSignature() << "\n";
+	stream << "stopping " << (model_ ? model_->GetSignature() : "bethe") << "\n";
+	stream << "particle " << Z_ << " " << mass_ << "\n";
+	if(num_entries_ == 0){ stream << "energy " << startE_ << " " << stopE_ << " adaptive " << tolerance_ << "\n"; }
+	else{ stream << "energy " << startE_ << " " << stopE_ << " " << num_entries_ << "\n"; }
+	return stream.str();
+}
+
+int vandmcCache::GetDetectors(const std::string &fname_, std::vector<Primitive*> &detectors_, std::vector<DetectorArray*> *arrays_/*=NULL*/){
+	std::map<std::string, std::vector<NewVIKARdet> >::iterator iter = detectorFiles.find(fname_);
+	if(iter != detectorFiles.end()){
+		nDetectorHits++;
+		return BuildDetectors(iter->second, detectors_, arrays_);
+	}
+
+	std::vector<NewVIKARdet> entries;
+	if(ReadDetFile(fname_.c_str(), entries) < 0) return -1;
+	detectorFiles[fname_] = entries;
+
+	return BuildDetectors(entries, detectors_, arrays_);
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // class vandmc
 ///////////////////////////////////////////////////////////////////////////////
 
 void vandmc::initialize(){
-	// Seed randomizer
-	srand(time(NULL));
-
 	num_materials = 0;
 	
 	// Physics Variables
@@ -222,22 +485,20 @@ void vandmc::initialize(){
 	gsQvalue = 0.0;
 
 	// Energy variables
-	Ebeam = 0.0, Ebeam0 = 0.0;
-	ErecoilMod = 0.0;
-	EejectMod = 0.0;
-	Egamma = 0.0;
+	Ebeam0 = 0.0;
 		
 	// Beam variables
 	beamspot = 0.0; // Beamspot diameter (m) (on the surface of the target)
 	beamEspread = 0.0; // Beam energy spread (MeV)
 	beamAngdiv = 0.0; // Beam angular divergence (radians)
+	rangeTolerance = 1E-6; // Relative energy tolerance of the range tables
+	stoppingModel = "bethe"; // Stopping power model used to build the range tables
 
 	timeRes = 2E-9; // Pixie-16 time resolution (s)
 	BeamRate = 0.0; // Beam rate (1/s)
 
 	// Background variables
 	backgroundRate = 0;
-	backgroundWait = 0;
 	detWindow = 0.0;
 	bgPerDetection = false;
 	
@@ -258,6 +519,12 @@ void vandmc::initialize(){
 	NdetGamma = 0; // Total number of gamma detectors
 	NdetVeto = 0; // Total number of particle vetos
 	BeamType = 0; // The type of beam to simulate (0=gaussian, 1=cylindrical, 2=halo)
+	beam_stopped = 0;
+	recoil_stopped = 0;
+	eject_stopped = 0;
+	WgoodDetections = 0.0;
+	nThreads = 1; // Number of event loop threads
+	randomSeed = time(NULL); // Seed used to generate the random number stream of each thread
 
 	// Default options
 	InverseKinematics = true;
@@ -268,8 +535,13 @@ void vandmc::initialize(){
 	SupplyRates = false;
 	BeamFocus = false;
 	DoRutherford = false;
+	use_target_eloss = true;
+	useBias = false;
+	doProfile = false;
+	acceptance = NULL;
 	echoMode = false;
 	printParams = false;
+	batchMode = false;
 	ADists = 0;
 	
 	// Detector options
@@ -281,11 +553,22 @@ void vandmc::initialize(){
 	// Output filename string
 	output_filename = "vandmc.root";
 
+	// Sweep variables
+	sweepIndex = -1;
+	cache = NULL;
+
 	handler.add(optionExt("input", required_argument, NULL, 'i', "<filename>", "Specify an input configuration file."));
 	handler.add(optionExt("output", required_argument, NULL, 'o', "<filename>", "Specify the name of the output file."));
 	handler.add(optionExt("detector", required_argument, NULL, 'd', "<filename>", "Specify the name of the detector file."));
 	handler.add(optionExt("echo", no_argument, NULL, 'e', "", "Echo values read from the config file."));
 	handler.add(optionExt("print", no_argument, NULL, 0x0, "", "Print simulation parameters."));
+	handler.add(optionExt("threads", required_argument, NULL, 't', "<N>", "Run the event loop with N threads (0 uses all available cores)."));
+	handler.add(optionExt("seed", required_argument, NULL, 0x0, "<seed>", "Specify the random number seed (default uses the current time)."));
+	handler.add(optionExt("bias", no_argument, NULL, 0x0, "", "Sample reactions preferentially inside the ejectile detector acceptance and write event weights."));
+	handler.add(optionExt("profile", no_argument, NULL, 0x0, "", "Time each stage of the event loop and write the results to the output file."));
+	handler.add(optionExt("batch", no_argument, NULL, 'b', "", "Run without prompting for confirmation or pausing."));
+	handler.add(optionExt("sweep", required_argument, NULL, 0x0, "<filename>", "Run one simulation for each line of parameter overrides in a sweep file (implies --batch)."));
+	handler.add(optionExt("cache", required_argument, NULL, 0x0, "<directory>", "Store range tables in a directory and reuse them in later runs."));
 }
 
 void vandmc::titleCard(){
@@ -307,7 +590,7 @@ void vandmc::titleCard(){
 	std::cout << "  Loading the input configuration file...\n";
 	
 	std::cout << "\n ==  ==  ==  ==  == \n\n";
-	sleep(1);
+	if(!batchMode) sleep(1);
 }
 
 bool vandmc::readConfig(const char *fname){
@@ -317,6 +600,15 @@ bool vandmc::readConfig(const char *fname){
 
 	std::cout << " Reading from file " << fname << std::endl;
 
+	// Replace parameters from the input file with any overrides.
+	for(std::vector<vandmcParameter>::iterator iter = overrides.begin(); iter != overrides.end(); iter++){
+		if(!reader.SetValue(iter->GetName(), iter->GetValue())){
+			std::cout << " FATAL ERROR! Encountered unrecognized override parameter name (" << iter->GetName() << ").\n";
+			return false;
+		}
+		std::cout << "  Overriding " << iter->GetName() << "=" << iter->GetValue() << std::endl;
+	}
+
 	std::string str;
 	double dval;
 	
@@ -415,6 +707,9 @@ bool vandmc::readConfig(const char *fname){
 
 	// Target material name
 	reader.FindString("TARG_MATERIAL", targ_mat_name);
+
+	// Directory of material files
+	reader.FindString("MATERIAL_DIR", material_dirname);
 		
 	// Target thickness
 	if(reader.FindDouble("TARG_THICKNESS", dval)){
@@ -428,6 +723,9 @@ bool vandmc::readConfig(const char *fname){
 	if(reader.FindDouble("TARG_ANGLE", dval))
 		targ.SetAngle(dval*deg2rad);
 
+	// Excitation function used to weight the reaction depth in the target
+	reader.FindString("TARG_EXCITATION", excitation_filename);
+
 	// Detector efficiencies
 	if(reader.FindString("SMALL_EFFICIENCY", str)){
 		bar_eff.ReadSmall(str.c_str());
@@ -454,8 +752,6 @@ bool vandmc::readConfig(const char *fname){
 	if(backgroundRate > 0){ 
 		// Get the detection ToF window
 		reader.FindDouble("BACKGROUND_WINDOW", detWindow); // in ns
-			
-		backgroundWait = backgroundRate;
 
 		reader.FindBool("BACKGROUND_PER_RECOIL", bgPerDetection);
 	}
@@ -464,6 +760,19 @@ bool vandmc::readConfig(const char *fname){
 	reader.FindBool("WRITE_REACTION_INFO", WriteReaction);
 	reader.FindBool("SIMULATE_252CF", NeutronSource);
 
+	// Relative energy tolerance of the range tables
+	if(reader.FindDouble("RANGE_TOLERANCE", dval)){
+		if(dval > 0.0) rangeTolerance = dval;
+		else std::cout << " Warning! Invalid range table tolerance (" << dval << "), using " << rangeTolerance << " instead.\n";
+	}
+
+	// Stopping power model used to build the range tables
+	std::string model;
+	if(reader.FindString("STOPPING_MODEL", model)){
+		if(model == "bethe" || model == "tabulated") stoppingModel = model;
+		else std::cout << " Warning! Unknown stopping power model \"" << model << "\", using " << stoppingModel << " instead.\n";
+	}
+
 	return true;
 }
 
@@ -498,7 +807,43 @@ bool vandmc::setup(int argc, char *argv[]){
 	if(handler.getOption(4)->active){
 		printParams = true;
 	}	
-	
+
+	// Set the number of event loop threads
+	if(handler.getOption(5)->active){
+		nThreads = strtoul(handler.getOption(5)->argument.c_str(), NULL, 10);
+		if(nThreads == 0){ nThreads = ThreadPool::GetHardwareThreads(); }
+	}
+
+	// Set the random number seed
+	if(handler.getOption(6)->active){
+		randomSeed = strtoull(handler.getOption(6)->argument.c_str(), NULL, 10);
+	}
+
+	// Set acceptance-biased reaction sampling
+	if(handler.getOption(7)->active){
+		useBias = true;
+	}
+
+	// Set event loop profiling
+	if(handler.getOption(8)->active){
+		doProfile = true;
+	}
+
+	// Set non-interactive batch mode
+	if(handler.getOption(9)->active){
+		batchMode = true;
+	}
+
+	// Set the parameter sweep filename
+	if(handler.getOption(10)->active){
+		sweep_filename = handler.getOption(10)->argument;
+		batchMode = true;
+	}
+
+	// Set the range table cache directory
+	if(handler.getOption(11)->active){
+		cache_dirname = handler.getOption(11)->argument;
+	}
 
 	return true;
 }
@@ -559,12 +904,18 @@ void vandmc::print(){
 				std::cout << "   Production rate for state " << i+1 << ": " << AngDist_fname.at(i) << " per event.\n";
 		}
 	}
+	if(!material_dirname.empty())
+		std::cout << "  Material Directory: " << material_dirname << std::endl;
 	std::cout << "  Target Material: " << targ_mat_name << std::endl;
 	if(targ_mat_name != "NONE")
 		std::cout << "  Target Thickness: " << targ.GetThickness() << " mg/cm^2\n";	
 	else
 		std::cout << "  Target Thickness: " << targ.GetRealThickness() << " m\n";	
 	std::cout << "  Target Angle: " << targ.GetAngle()*rad2deg << " degrees\n";
+	if(!excitation_filename.empty())
+		std::cout << "  Target Excitation Function: " << excitation_filename << std::endl;
+	std::cout << "  Range Table Tolerance: " << rangeTolerance << std::endl;
+	std::cout << "  Stopping Power Model: " << stoppingModel << std::endl;
 	std::cout << "  Perfect Detectors: " << (PerfectDet ? "YES" : "NO") << "\n";
 	if(bar_eff.GetNsmall() > 0)
 		std::cout << "   Found " << bar_eff.GetNsmall() << " small bar efficiency data points.\n";
@@ -588,6 +939,158 @@ void vandmc::print(){
 	std::cout << "  Simulate 252Cf source: " << (NeutronSource ? "YES" : "NO") << std::endl;
 }
 
+/** Copy a material from a library to the array of materials, unless it is already in the array.
+  * Return false if the library does not contain the material.
+  */
+bool vandmc::addMaterial(MaterialLibrary *library_, const std::string &name_){
+	if(material_ids.find(name_) != material_ids.end()) return true;
+	Material *mat = library_->Get(name_);
+	if(!mat) return false;
+	material_ids[name_] = materials.size();
+	materials.push_back(*mat);
+	return true;
+}
+
+/** Setup a kinematics object for nStates_ recoil states using the reaction parameters.
+  * This repeats the setup of the main kinematics object without printing anything.
+  */
+bool vandmc::initKinematics(Kindeux &kind_, const unsigned int &nStates_){
+	kind_.Initialize(beam_part.GetA(), targ.GetA(), recoil_part.GetA(), eject_part.GetA(), gsQvalue, nStates_, ExRecoilStates);
+
+	// Set the simulated 252Cf source.
+	if(NeutronSource){ kind_.ToggleNeutronSource(); }
+
+	if((ADists == 1 || ADists == 2) && !DoRutherford){ 
+		if(ADists == 1){ kind_.SetDist(AngDist_fname, BeamRate, &targ); }
+		else{ kind_.SetDist(AngDist_fname); }
+	}
+	else if(DoRutherford){
+		double e = 1.60217657E-19; // C
+		double k = 8.987551E9; // N*m^2/C^2
+		double coefficient = k*beam_part.GetZ()*targ.GetZ()*e*e/(4.0*Ebeam0*1.60218E-13); // m^2
+		kind_.SetRutherford(coefficient*coefficient);
+	}
+
+	return kind_.IsInit();
+}
+
+/// Return the wall time since the start of the event loop (in seconds).
+float vandmc::getElapsedTime(){
+	return std::chrono::duration<float>(std::chrono::steady_clock::now()-timer).count();
+}
+
+/** Read a sweep file. Each line of the file defines one variant of the input configuration
+  * as a tab-separated list of NAME=VALUE overrides. Return false if the file cannot be read.
+  */
+bool vandmc::readSweep(const char *fname, std::vector<std::vector<vandmcParameter> > &variants){
+	std::ifstream ifile(fname);
+	if(!ifile.good()) return false;
+
+	std::string line;
+	unsigned int lineNumber = 0;
+	while(getline(ifile, line)){
+		lineNumber++;
+	
+		// Check for blank lines or comment lines.
+		if(line.empty() || line[0] == '#') continue;
+
+		// Split the string into NAME=VALUE pairs.
+		std::vector<std::string> args;
+		split_str(line, args, '\t');
+
+		std::vector<vandmcParameter> variant;
+		for(std::vector<std::string>::iterator iter = args.begin(); iter != args.end(); iter++){
+			if(iter->empty()) continue;
+			if((*iter)[0] == '#') break; // Trailing comment.
+			size_t index = iter->find('=');
+			if(index == std::string::npos){
+				std::cout << " FATAL ERROR! Expected NAME=VALUE on line " << lineNumber << " of sweep file (" << *iter << ").\n";
+				return false;
+			}
+			std::string name = iter->substr(0, index);
+			if(!reader.IsValidName(name)){
+				std::cout << " FATAL ERROR! Encountered unrecognized parameter name on line " << lineNumber << " of sweep file (" << name << ").\n";
+				return false;
+			}
+			variant.push_back(vandmcParameter(name, "", iter->substr(index+1)));
+		}
+
+		if(!variant.empty()) variants.push_back(variant);
+	}
+	ifile.close();
+
+	return true;
+}
+
+/// Run one simulation for each variant in the sweep file, sharing setup data between them.
+bool vandmc::runSweep(){
+	std::vector<std::vector<vandmcParameter> > variants;
+	if(!readSweep(sweep_filename.c_str(), variants)){
+		std::cout << " FATAL ERROR! Failed to read sweep file \"" << sweep_filename << "\"!\n";
+		return false;
+	}
+	else if(variants.empty()){
+		std::cout << " FATAL ERROR! Found no variants in sweep file \"" << sweep_filename << "\"!\n";
+		return false;
+	}
+
+	std::cout << " Running " << variants.size() << " variants of " << input_filename << " from sweep file " << sweep_filename << std::endl;
+
+	// Number the output file of each variant, e.g. vandmc.root becomes vandmc_000.root.
+	std::string prefix = output_filename;
+	std::string suffix;
+	size_t index = prefix.find_last_of('.');
+	if(index != std::string::npos && prefix.find('/', index) == std::string::npos){
+		suffix = prefix.substr(index);
+		prefix = prefix.substr(0, index);
+	}
+
+	// All variants use the same command line options, including the random number seed.
+	vandmcCache sweepCache;
+	std::vector<unsigned int> failed;
+	for(unsigned int i = 0; i < variants.size(); i++){
+		vandmc variant;
+		variant.input_filename = input_filename;
+		variant.detector_filename = detector_filename;
+		variant.cache_dirname = cache_dirname;
+		variant.echoMode = echoMode;
+		variant.printParams = printParams;
+		variant.batchMode = true;
+		variant.nThreads = nThreads;
+		variant.randomSeed = randomSeed;
+		variant.useBias = useBias;
+		variant.doProfile = doProfile;
+		variant.overrides = variants[i];
+		variant.sweepIndex = i;
+
+		std::stringstream stream;
+		stream << prefix << "_" << std::setfill('0') << std::setw(3) << i << suffix;
+		variant.output_filename = stream.str();
+
+		std::cout << "\n ==  ==  ==  ==  == \n\n";
+		std::cout << " Sweep variant " << i+1 << " of " << variants.size() << ": " << GetOverrideString(variants[i]) << "\n\n";
+
+		if(!variant.Run(&sweepCache)){
+			std::cout << " Warning! Sweep variant " << i+1 << " failed!\n";
+			failed.push_back(i+1);
+		}
+	}
+
+	std::cout << "\n --------------- Sweep Complete -----------------\n";
+	std::cout << " Completed " << variants.size()-failed.size() << " of " << variants.size() << " variants\n";
+	std::cout << " Reused " << sweepCache.GetNumTableHits() << " range tables and " << sweepCache.GetNumDetectorHits() << " detector files\n";
+	if(!cache_dirname.empty()) std::cout << " Loaded " << sweepCache.GetNumDiskHits() << " range tables from cache directory " << cache_dirname << std::endl;
+	if(!failed.empty()){
+		std::cout << " Failed variants:";
+		for(std::vector<unsigned int>::iterator iter = failed.begin(); iter != failed.end(); iter++){
+			std::cout << " " << *iter;
+		}
+		std::cout << std::endl;
+	}
+
+	return failed.empty();
+}
+
 bool vandmc::Execute(int argc, char *argv[]){ 
 	// Set all variables to default values.
 	initialize();
@@ -597,7 +1100,27 @@ bool vandmc::Execute(int argc, char *argv[]){
 
 	// Display the vandmc welcome screen.
 	titleCard();
-	
+
+	// Run every variant of the input file in a parameter sweep.
+	if(!sweep_filename.empty()) return runSweep();
+
+	return Run();
+}
+
+/** Run a single simulation using the current options. Shared setup data is taken from
+  * cache_, or built from scratch if cache_ is NULL.
+  */
+bool vandmc::Run(vandmcCache *cache_/*=NULL*/){
+	vandmcCache localCache;
+	cache = (cache_ ? cache_ : &localCache);
+
+	// Functions which are not passed an explicit engine also follow the random number seed.
+	SetDefaultRandomSeed(randomSeed);
+
+	if(cache_dirname != cache->GetDirectory() && !cache->SetDirectory(cache_dirname)){
+		std::cout << " Warning! Failed to open range table cache directory \"" << cache_dirname << "\"!\n";
+	}
+
 	// Read the input config file.
 	if(!readConfig(input_filename.c_str())){
 		std::cout << " FATAL ERROR! Failed to read configuration file \"" << input_filename << "\"!\n";
@@ -620,7 +1143,7 @@ bool vandmc::Execute(int argc, char *argv[]){
 		
 	std::cout << "\n ==  ==  ==  ==  == \n\n";
 
-	if(printParams && !Prompt(" Are the above settings correct?")){ // Make sure the input variables are correct
+	if(printParams && !batchMode && !Prompt(" Are the above settings correct?")){ // Make sure the input variables are correct
 		std::cout << "  ABORTING...\n\n";
 		return false;
 	}
@@ -635,7 +1158,7 @@ bool vandmc::Execute(int argc, char *argv[]){
 
 	// Read the detector setup file
 	std::cout << " Reading in NewVANDMC detector setup file...\n";
-	Ndet = ReadDetFile(detector_filename.c_str(), vandle_bars);
+	Ndet = cache->GetDetectors(detector_filename, vandle_bars, &detector_arrays);
 	if(Ndet < 0){ // Failed to load setup file
 		std::cout << " FATAL ERROR! failed to load detector setup file!\n";
 		return false; 
@@ -644,10 +1167,17 @@ bool vandmc::Execute(int argc, char *argv[]){
 		std::cout << " FATAL ERROR! Found no detectors in the detector setup file!\n"; 
 		return false;
 	}
+
+	// The detectors are shared between threads and by the detector trees, so they must not change from here on.
+	for(std::vector<Primitive*>::iterator iter = vandle_bars.begin(); iter != vandle_bars.end(); iter++){
+		(*iter)->Freeze();
+	}
 	
+	// The names of the detector materials, in the order they first appear.
 	std::vector<std::string> needed_materials;
+	std::unordered_map<std::string, bool> is_needed;
 	for(std::vector<Primitive*>::iterator iter = vandle_bars.begin(); iter != vandle_bars.end(); iter++){
-		if(!IsInVector((*iter)->GetMaterialName(), needed_materials)){
+		if(is_needed.insert(std::make_pair((*iter)->GetMaterialName(), true)).second){
 			needed_materials.push_back((*iter)->GetMaterialName());
 		}
 		
@@ -657,6 +1187,24 @@ bool vandmc::Execute(int argc, char *argv[]){
 		if((*iter)->IsVeto()){ NdetVeto++; }
 	}
 
+	// Sort the detectors by role so the event loop only visits the detectors it needs.
+	for(std::vector<Primitive*>::iterator iter = vandle_bars.begin(); iter != vandle_bars.end(); iter++){
+		if((*iter)->IsVeto()){ veto_dets.push_back(*iter); }
+		if((*iter)->IsRecoilDet()){ recoil_dets.push_back(*iter); }
+		if((*iter)->IsEjectileDet()){ eject_dets.push_back(*iter); }
+		if((*iter)->IsGammaDet()){ gamma_dets.push_back(*iter); }
+		if((*iter)->IsEjectileDet() || (*iter)->IsRecoilDet()){ particle_dets.push_back(*iter); }
+	}
+
+	// Build a single bounding volume hierarchy over all detectors so each ray finds every detector it may
+	// hit, whatever its role, in one pass. Walls and rings are stored as a single leaf, and the bars they
+	// contain are found directly.
+	detector_tree.Build(vandle_bars, detector_arrays);
+
+	// Compile the detectors into a detector store which intersects the detectors by shape. The role
+	// of each detector is kept in the store, so each particle only intersects the detectors it needs.
+	detector_store.Build(vandle_bars);
+
 	if(NdetRecoil > 0){ have_recoil_det = true; }
 	if(NdetEject > 0){ have_ejectile_det = true; }
 	if(NdetGamma > 0){ have_gamma_det = true; }
@@ -686,97 +1234,134 @@ bool vandmc::Execute(int argc, char *argv[]){
 
 	std::cout << "\n Setting up VANDMC materials...\n";
 
-	// Natural Gold
-	materials.push_back(Material("Au197", 19.311, 79, 196.96657, 1));
-	// BC408 plastic scintillator (polyvinyltoluene (C9H10 118.18 g/mol) base)
-	materials.push_back(Material("BC408", 1.032, 6, 12.0107, 9, 1, 1.00794, 10));
-	// Deuterated polyethylene
-	materials.push_back(Material("C2D4", 1.06300, 6, 12.0107, 2, 1, 2.01588, 4));
-	// Polyethylene
-	materials.push_back(Material("C2H4", 0.95, 6, 12.0107, 2, 1, 1.00794, 4));
-	// Polystyrene
-	materials.push_back(Material("C8H8", 1.05, 6, 12.0107, 8, 1, 1.00794, 8));
-	// Natural Carbon
-	materials.push_back(Material("C12", 2.2670, 6, 12.0107, 1));
-	// Deuterated polyethylene
-	materials.push_back(Material("CD2", 1.06300, 6, 12.0107, 1, 1, 2.01588, 2));	
-	// Silicon
-	materials.push_back(Material("Si28", 2.3212, 14, 28.0855, 1));
+	MaterialLibrary *library = cache->GetMaterialLibrary(material_dirname);
+	if(!library){
+		std::cout << " FATAL ERROR! Failed to open material directory \"" << material_dirname << "\"!\n";
+		return false;
+	}
+
+	// Only the materials used by the target and the detectors are loaded.
+	materials.clear();
+	material_ids.clear();
+	if(targ_mat_name != "NONE"){ addMaterial(library, targ_mat_name); }
+	for(std::vector<std::string>::iterator iter = needed_materials.begin(); iter != needed_materials.end(); iter++){
+		if(!addMaterial(library, *iter) && !iter->empty() && *iter != "none" && *iter != "NONE"){
+			std::cout << " Warning! Detector material \"" << (*iter) << "\" was not found, so it will not be used for energy loss.\n";
+		}
+	}
 
 	num_materials = materials.size();
-	std::cout << " Successfully setup " << num_materials << " materials\n";
+	std::cout << " Successfully setup " << num_materials << " of " << library->GetNumMaterials() << " available materials\n";
 
-	bool use_target_eloss = true;
+	use_target_eloss = true;
 	targ_mat_id = 0;
 	
 	if(targ_mat_name == "NONE"){ // Use no target.
 		std::cout << "  Target Material: DISABLED\n";
 		use_target_eloss = false;
 	}
-	else{ // Use a pre-loaded material target.
-		bool found_valid_material = false;
+	else{ // Use a material from the library.
 		std::cout << "  Target Material: " << targ_mat_name;
-		for(targ_mat_id = 0; targ_mat_id < num_materials; targ_mat_id++){
-			if(targ_mat_name == materials[targ_mat_id].GetName()){
-				found_valid_material = true;
-				break;
-			}
-		}
-		if(!found_valid_material){ 
+		std::unordered_map<std::string, unsigned int>::iterator iter = material_ids.find(targ_mat_name);
+		if(iter != material_ids.end()){ targ_mat_id = iter->second; }
+		else{
 			std::cout << " (not found)"; 
 			use_target_eloss = false;			
 		}
 		std::cout << std::endl;
 	}
 	
+	// The thread pool is created before the range tables, so that it may be used to build them.
+	ThreadPool pool(nThreads);
+
 	if(use_target_eloss){
 		targ.SetDensity(materials[targ_mat_id].GetDensity());
 		targ.SetRadLength(materials[targ_mat_id].GetRadLength());
+		targ.SetMolarMass(materials[targ_mat_id].GetMolarMass());
 		std::cout << "  Target Radiation Length: " << targ.GetRadLength() << " mg/cm^2\n\n";
-	
-		// Calculate the stopping power table for the reactino particles in the target
+	}
+
+	// List every range table which is needed, so that they may all be built at once using every thread.
+	std::vector<vandmcCache::tableRequest> requests;
+	std::vector<RangeTable*> destinations;
+	std::vector<std::string> descriptions;
+	if(use_target_eloss){
+		// Calculate the stopping power table for the reaction particles in the target
 		if(beam_part.GetZ() > 0){ // The beam is a charged particle (not a neutron)
-			std::cout << " Calculating range table for beam in " << materials[targ_mat_id].GetName() << "...";
-			beam_targ.Init(1000, 0.1, (Ebeam0+2*beamEspread), beam_part.GetZ(), beam_part.GetA()/mev2amu, &materials[targ_mat_id]);
-			std::cout << " Done!\n";
+			requests.push_back(vandmcCache::tableRequest(0.1, (Ebeam0+2*beamEspread), beam_part.GetZ(), beam_part.GetA()/mev2amu, &materials[targ_mat_id]));
+			destinations.push_back(&beam_targ);
+			descriptions.push_back("beam in " + materials[targ_mat_id].GetName());
 		}
 		if(eject_part.GetZ() > 0){
-			std::cout << " Calculating range table for ejectile in " << materials[targ_mat_id].GetName() << "...";
-			eject_targ.Init(1000, 0.1, (Ebeam0+2*beamEspread), eject_part.GetZ(), eject_part.GetA()/mev2amu, &materials[targ_mat_id]);
-			std::cout << " Done!\n";
+			requests.push_back(vandmcCache::tableRequest(0.1, (Ebeam0+2*beamEspread), eject_part.GetZ(), eject_part.GetA()/mev2amu, &materials[targ_mat_id]));
+			destinations.push_back(&eject_targ);
+			descriptions.push_back("ejectile in " + materials[targ_mat_id].GetName());
 		}
 		if(recoil_part.GetZ() > 0){
-			std::cout << " Calculating range table for recoil in " << materials[targ_mat_id].GetName() << "...";
-			recoil_targ.Init(1000, 0.1, (Ebeam0+2*beamEspread), recoil_part.GetZ(), recoil_part.GetA()/mev2amu, &materials[targ_mat_id]);
-			std::cout << " Done!\n";
+			requests.push_back(vandmcCache::tableRequest(0.1, (Ebeam0+2*beamEspread), recoil_part.GetZ(), recoil_part.GetA()/mev2amu, &materials[targ_mat_id]));
+			destinations.push_back(&recoil_targ);
+			descriptions.push_back("recoil in " + materials[targ_mat_id].GetName());
 		}
 	}
 
-	// Set the molar mass of the target.
-	targ.SetMolarMass(materials[targ_mat_id].GetMolarMass());
-
 	// Calculate the stopping power table for the ejectiles in the materials
 	if(eject_part.GetZ() > 0){ // The ejectile is a charged particle (not a neutron)
 		eject_tables.assign(num_materials, RangeTable());
-		for(unsigned int i = 0; i < num_materials; i++){
-			if(!IsInVector(materials[i].GetName(), needed_materials)){ continue; }
-			std::cout << " Calculating ejectile range table for " << materials[i].GetName() << "...";
-			eject_tables[i].Init(1000, eject_part.GetKEfromV(0.02*c), (Ebeam0+2*beamEspread), eject_part.GetZ(), eject_part.GetA()/mev2amu, &materials[i]);
-			std::cout << " Done!\n";
+		for(std::vector<std::string>::iterator iter = needed_materials.begin(); iter != needed_materials.end(); iter++){
+			std::unordered_map<std::string, unsigned int>::iterator id = material_ids.find(*iter);
+			if(id == material_ids.end()){ continue; }
+			requests.push_back(vandmcCache::tableRequest(eject_part.GetKEfromV(0.02*c), (Ebeam0+2*beamEspread), eject_part.GetZ(), eject_part.GetA()/mev2amu, &materials[id->second]));
+			destinations.push_back(&eject_tables[id->second]);
+			descriptions.push_back("ejectile detectors made of " + (*iter));
 		}
 	}
 
 	// Calculate the stopping power table for the recoils in the materials
 	if(recoil_part.GetZ() > 0){ // The recoil is a charged particle (not a neutron)
 		recoil_tables.assign(num_materials, RangeTable());
-		for(unsigned int i = 0; i < num_materials; i++){
-			if(!IsInVector(materials[i].GetName(), needed_materials)){ continue; }
-			std::cout << " Calculating recoil range table for " << materials[i].GetName() << "...";
-			recoil_tables[i].Init(1000, recoil_part.GetKEfromV(0.02*c), (Ebeam0+2*beamEspread), recoil_part.GetZ(), recoil_part.GetA()/mev2amu, &materials[i]);
-			std::cout << " Done!\n";
+		for(std::vector<std::string>::iterator iter = needed_materials.begin(); iter != needed_materials.end(); iter++){
+			std::unordered_map<std::string, unsigned int>::iterator id = material_ids.find(*iter);
+			if(id == material_ids.end()){ continue; }
+			requests.push_back(vandmcCache::tableRequest(recoil_part.GetKEfromV(0.02*c), (Ebeam0+2*beamEspread), recoil_part.GetZ(), recoil_part.GetA()/mev2amu, &materials[id->second]));
+			destinations.push_back(&recoil_tables[id->second]);
+			descriptions.push_back("recoil detectors made of " + (*iter));
 		}
 	}
-	
+
+	if(!requests.empty()){
+		for(std::vector<std::string>::iterator iter = descriptions.begin(); iter != descriptions.end(); iter++){
+			std::cout << " Range table for " << (*iter) << std::endl;
+		}
+		std::cout << " Calculating " << requests.size() << " range tables using " << pool.GetNumThreads() << " threads...";
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		cache->GetAdaptiveRangeTables(requests, rangeTolerance, &pool, cache->GetStoppingPowerModel(stoppingModel));
+		for(unsigned int i = 0; i < requests.size(); i++){
+			*destinations[i] = *requests[i].table;
+		}
+		std::cout << " Done! (" << 1E3*std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count() << " ms)\n";
+	}
+
+	if(use_target_eloss){
+		// Weight the reaction depth by the cross section at the beam energy reached at each depth.
+		if(!excitation_filename.empty()){
+			std::vector<double> energies, xsections;
+			std::ifstream excitation_file(excitation_filename.c_str());
+			double energy, xsection;
+			while(excitation_file >> energy >> xsection){
+				energies.push_back(energy);
+				xsections.push_back(xsection);
+			}
+			excitation_file.close();
+			
+			if(beam_part.GetZ() == 0){ std::cout << " Warning! Ignoring target excitation function for a neutral beam.\n"; }
+			else if(!targ.SetExcitationFunction(energies, xsections, beam_targ, Ebeam0)){
+				std::cout << " FATAL ERROR! Failed to load target excitation function from file \"" << excitation_filename << "\"!\n";
+				return false;
+			}
+			else{ std::cout << " Loaded target excitation function with " << energies.size() << " points from " << excitation_filename << std::endl; }
+		}
+	}
+
 	// Calculate the beam focal point (if it exists)
 	lab_beam_focus = Vector3(0.0, 0.0, 0.0);
 	if(beamAngdiv >= 0.000174532925199){
@@ -785,21 +1370,25 @@ bool vandmc::Execute(int argc, char *argv[]){
 		BeamFocus = true;
 	}
 
-	// For cylindrical beams, the beam direction is given by the z-axis
-	if(!BeamFocus){ lab_beam_trajectory = Vector3(0.0, 0.0, 1.0); }
+	// Build an angular lookup grid of all detectors around the region where reactions occur. The region
+	// covers the beam spot (out to several standard deviations for a gaussian beam) and the thickness
+	// of the target seen by the beam. Reactions outside the region fall back to the detector trees.
+	Vector3 targ_center;
+	targ.GetPrimitive()->GetPosition(targ_center);
+	double spot_radius = 1.5*beamspot;
+	double spot_depth = targ.GetRealZthickness() + spot_radius*std::fabs(std::tan(targ.GetAngle()));
+	double grid_radius = std::sqrt(spot_radius*spot_radius + spot_depth*spot_depth) + 0.001;
+	detector_grid.Build(vandle_bars, targ_center, grid_radius);
 
 	std::cout << "\n Setting detector material types...\n";
 	for(std::vector<Primitive*>::iterator iter = vandle_bars.begin(); iter != vandle_bars.end(); iter++){ // Set the detector material for energy loss calculations
-		for(unsigned int j = 0; j < num_materials; j++){
-			if((*iter)->GetMaterialName() == materials[j].GetName()){
-				if(((*iter)->IsRecoilDet() && recoil_part.GetZ() > 0) || ((*iter)->IsEjectileDet() && eject_part.GetZ() > 0)){ 
-					// Only set detector to use material if the particle it is responsible for detecting has
-					// a Z greater than zero. Particles with Z == 0 will not have calculated range tables
-					// and thus cannot use energy loss considerations.
-					(*iter)->SetMaterial(j);  
-				}
-				break; 
-			}
+		std::unordered_map<std::string, unsigned int>::iterator id = material_ids.find((*iter)->GetMaterialName());
+		if(id == material_ids.end()){ continue; }
+		if(((*iter)->IsRecoilDet() && recoil_part.GetZ() > 0) || ((*iter)->IsEjectileDet() && eject_part.GetZ() > 0)){ 
+			// Only set detector to use material if the particle it is responsible for detecting has
+			// a Z greater than zero. Particles with Z == 0 will not have calculated range tables
+			// and thus cannot use energy loss considerations.
+			(*iter)->SetMaterial(id->second);  
 		}
 	}
 
@@ -849,10 +1438,52 @@ bool vandmc::Execute(int argc, char *argv[]){
 		kind.SetRutherford(coefficient);
 	}
 
+	// Build the ejectile detector acceptance map for biased sampling.
+	if(useBias){
+		if(NeutronSource){
+			std::cout << "\n Warning! Acceptance-biased sampling is not available for 252Cf source simulations.\n";
+			std::cout << " Note: Sampling all reactions without bias!\n";
+		}
+		else if(!have_ejectile_det){
+			std::cout << "\n Warning! Acceptance-biased sampling requires at least one ejectile detector.\n";
+			std::cout << " Note: Sampling all reactions without bias!\n";
+		}
+		else{
+			std::cout << "\n Building ejectile detector acceptance map...\n";
+
+			// Estimate the range of reaction energies from the beam energy spread and the target thickness.
+			double Elow = Ebeam0 - 2.0*beamEspread;
+			double Ehigh = Ebeam0 + 2.0*beamEspread;
+			if(use_target_eloss && Elow > 0.0){
+				double range = beam_targ.GetRange(Elow) - targ.GetRealZthickness();
+				Elow = (range > 0.0 ? beam_targ.GetEnergy(range) : 0.0);
+			}
+			Elow = (Elow > 0.001 ? Elow - 0.001 : 0.0);
+			Ehigh += 0.001;
+
+			Vector3 origin;
+			targ.GetPrimitive()->GetPosition(origin);
+
+			acceptance = new AcceptanceMap();
+			if(acceptance->Build(&kind, eject_dets, origin, Elow, Ehigh)){
+				std::cout << " Mapped reaction energies from " << Elow << " to " << Ehigh << " MeV.\n";
+				for(unsigned int i = 0; i < (NRecoilStates > 0 ? NRecoilStates : 1); i++){
+					std::cout << "  State " << i+1 << ": " << 100.0*acceptance->GetAcceptedFraction(i) << "% of CoM phase space accepted\n";
+				}
+			}
+			else{
+				std::cout << " Warning! Failed to build the acceptance map.\n";
+				std::cout << " Note: Sampling all reactions without bias!\n";
+				delete acceptance;
+				acceptance = NULL;
+			}
+		}
+	}
+
 	std::cout << "\n ==  ==  ==  ==  == \n\n";
 
 	// Last chance to abort
-	if(!Prompt(" Setup is complete. Is everything correct?")){
+	if(!batchMode && !Prompt(" Setup is complete. Is everything correct?")){
 		std::cout << "  ABORTING...\n";
 		return false;
 	}
@@ -861,20 +1492,16 @@ bool vandmc::Execute(int argc, char *argv[]){
 	// End of Input Section
 	//---------------------------------------------------------------------------
 		
-	// Root stuff
-	TFile *file = new TFile(output_filename.c_str(), "RECREATE");
-	TTree *VANDMCtree = new TTree("data", "VANDMC output tree");
-	
-	ReactionProductStructure EJECTdata;
-	ReactionProductStructure RECOILdata;
-	ReactionObjectStructure REACTIONdata;
-	
-	if(NdetEject > 0 || NdetGamma > 0)
-		VANDMCtree->Branch("eject", &EJECTdata);
-	if(NdetRecoil > 0)
-		VANDMCtree->Branch("recoil", &RECOILdata);
-	if(WriteReaction)
-		VANDMCtree->Branch("reaction", &REACTIONdata);
+	// Root stuff. The output file and tree are owned by the writer, which fills the tree on its
+	// own thread. Each worker fills one buffer while the previous round of buffers is written.
+	const unsigned int eventsPerRound = 1000;
+	vandmcWriter writer(2*nThreads, eventsPerRound);
+	writer.GetProfiler()->SetEnabled(doProfile); // Must be set before the writer thread is started.
+	if(!writer.Open(output_filename, (NdetEject > 0 || NdetGamma > 0), (NdetRecoil > 0), WriteReaction, (acceptance != NULL))){
+		std::cout << " FATAL ERROR! Failed to open output file \"" << output_filename << "\"!\n";
+		return false;
+	}
+	TFile *file = writer.GetFile();
 
 	// Write reaction info to the file.
 	std::vector<TNamed*> named;
@@ -920,10 +1547,14 @@ bool vandmc::Execute(int argc, char *argv[]){
 		}
 	}
 	else{ SetName(named, "xsections", "No"); }
+	if(!material_dirname.empty()){ SetName(named, "materialDirectory", material_dirname); }
 	SetName(named, "targetMaterial", targ_mat_name);
 	if(targ_mat_name != "NONE"){ SetName(named, "targetMaterial", targ.GetThickness(), "mg/cm^2"); }	
 	else{ SetName(named, "targetThickness", targ.GetRealThickness(), "m"); }	
 	SetName(named, "targetAngle", targ.GetAngle()*rad2deg, "deg");
+	if(!excitation_filename.empty()){ SetName(named, "targetExcitation", excitation_filename); }
+	SetName(named, "rangeTolerance", rangeTolerance);
+	SetName(named, "stoppingModel", stoppingModel);
 	if(PerfectDet){ SetName(named, "perfectDetectors", "Yes"); }
 	else{ SetName(named, "perfectDetectors", "No"); }
 	SetName(named, "detectorFilename", detector_filename);
@@ -938,6 +1569,18 @@ bool vandmc::Execute(int argc, char *argv[]){
 	else{ SetName(named, "recoilCoincidence", "No"); }
 	if(WriteReaction){ SetName(named, "writeReaction", "Yes"); }
 	else{ SetName(named, "writeReaction", "No"); }
+	SetName(named, "threads", nThreads);
+	SetName(named, "randomEngine", "xoshiro256**");
+	SetName(named, "randomSeed", randomSeed);
+	std::stringstream streamIDs; streamIDs << "0";
+	if(nThreads > 1){ streamIDs << "-" << nThreads-1; }
+	SetName(named, "randomStreams", streamIDs.str());
+	if(acceptance){ SetName(named, "acceptanceBias", acceptance->GetMixing(), "unbiased fraction"); }
+	else{ SetName(named, "acceptanceBias", "No"); }
+	if(sweepIndex >= 0){
+		SetName(named, "sweepVariant", sweepIndex);
+		SetName(named, "sweepOverrides", GetOverrideString(overrides));
+	}
 
 	// Create a directory for storing setup information.
 	file->mkdir("config");
@@ -969,9 +1612,27 @@ bool vandmc::Execute(int argc, char *argv[]){
 	}
 	named.clear();
 	
+	// Setup the event loop workers. Each worker gets its own random number stream.
+	std::vector<vandmcWorker*> workers;
+	for(unsigned int i = 0; i < nThreads; i++){
+		workers.push_back(new vandmcWorker(this, i, randomSeed));
+		if(!workers.back()->Initialize()){
+			std::cout << " FATAL ERROR! Failed to initialize event loop thread " << i << "!\n";
+			for(std::vector<vandmcWorker*>::iterator iter = workers.begin(); iter != workers.end(); iter++){
+				delete (*iter);
+			}
+			return false;
+		}
+	}
+
+	// The target is shared between threads, so it must not change from here on.
+	targ.GetPrimitive()->Freeze();
+
 	// Begin the simulation
 	std::cout << " ---------- Simulation Setup Complete -----------\n"; 
-	std::cout << "\n Beginning simulating " << Nwanted << " events....\n"; 
+	std::cout << "\n Beginning simulating " << Nwanted << " events";
+	if(nThreads > 1){ std::cout << " using " << nThreads << " threads"; }
+	std::cout << "....\n"; 
 
 	//---------------------------------------------------------------------------
 	// The Event Loop
@@ -979,96 +1640,480 @@ bool vandmc::Execute(int argc, char *argv[]){
 	// (Just to make it obvious)
 	//---------------------------------------------------------------------------
 
-	Vector3 temp_vector;
-	Vector3 temp_vector_sphere;
-	Vector3 dummy_vector;
-	double dummy_t1, dummy_t2;
-	double dist_traveled = 0.0, QDC = 0.0;
-	double fpath1 = 0.0, fpath2 = 0.0;
-	double recoil_tof = 0.0;
-	double eject_tof = 0.0;
-	double gamma_tof = 0.0;
+	// Split the wanted detections evenly between the workers. The event loop is run
+	// in rounds. All workers simulate a fixed number of good detections in parallel,
+	// then the output of each worker is queued for writing in worker order. This
+	// makes the output depend only on the random seed and the number of threads.
+	std::vector<unsigned int> remaining(nThreads, Nwanted/nThreads);
+	std::vector<unsigned int> thisRound(nThreads, 0);
+	for(unsigned int i = 0; i < Nwanted%nThreads; i++){ remaining[i]++; }
+
+	std::function<void(const unsigned int &)> job = [&](const unsigned int &index_){ workers[index_]->Process(thisRound[index_]); };
+
+	// Give each worker a buffer to fill and start writing events.
+	for(std::vector<vandmcWorker*>::iterator iter = workers.begin(); iter != workers.end(); iter++){
+		(*iter)->SwapBuffer(writer.GetFreeBuffer());
+	}
+	writer.Start();
+
 	float totTime = 0.0;
-	int counter = 1;
-	bool flag = false;
-	bool hit = false;
-	bool veto_event = false;
+	unsigned int counter = 1;
 	unsigned int chunk = Nwanted/10;
-	unsigned int beam_stopped = 0;
-	unsigned int recoil_stopped = 0;
-	unsigned int eject_stopped = 0;
-	timer = clock();
-	
-	int detector_type = 0;
-	
-	int recoil_detections = 0;
-	int eject_detections = 0;
-	int gamma_detections = 0;
-	
-	// Struct for storing reaction information.
-	reactData rdata;
-	
+	timer = std::chrono::steady_clock::now();
+
 	while(NgoodDetections < Nwanted){
+		for(unsigned int i = 0; i < nThreads; i++){
+			thisRound[i] = (remaining[i] < eventsPerRound ? remaining[i] : eventsPerRound);
+			remaining[i] -= thisRound[i];
+		}
+	
+		// Simulate events on all threads.
+		pool.Execute(nThreads, job);
+
+		// Queue the staged events for writing. The workers continue with empty buffers.
+		NgoodDetections = 0;
+		Nsimulated = 0;
+		Ndetected = 0;
+		NdetHit = 0;
+		Nreactions = 0;
+		WgoodDetections = 0.0;
+		for(std::vector<vandmcWorker*>::iterator iter = workers.begin(); iter != workers.end(); iter++){
+			writer.Push((*iter)->SwapBuffer(writer.GetFreeBuffer()));
+			
+			NgoodDetections += (*iter)->NgoodDetections;
+			Nsimulated += (*iter)->Nsimulated;
+			Ndetected += (*iter)->Ndetected;
+			NdetHit += (*iter)->NdetHit;
+			Nreactions += (*iter)->Nreactions;
+			WgoodDetections += (*iter)->WgoodDetections;
+		}
+
 		// ****************Time Estimate**************
-		if(flag && (NgoodDetections % chunk == 0)){
-			flag = false;
-			totTime = (float)(clock()-timer)/CLOCKS_PER_SEC;
+		while(chunk > 0 && counter < 10 && NgoodDetections >= counter*chunk){
+			// When sampling with bias, efficiencies and beam times use the event weights.
+			double goodDetections = (acceptance ? WgoodDetections : NgoodDetections);
+			double beamScale = (acceptance && WgoodDetections > 0.0 ? NgoodDetections/WgoodDetections : 1.0);
+			totTime = getElapsedTime();
 			std::cout << "\n ------------------------------------------------\n"; 
 			std::cout << " Number of particles Simulated: " << Nsimulated << std::endl; 
 			std::cout << " Number of particles Detected: " << Ndetected << std::endl;
 			std::cout << " Number of ejecile particles Detected: " << NgoodDetections << std::endl; 
+			if(acceptance){ std::cout << " Weighted ejectile particles Detected: " << WgoodDetections << std::endl; }
 			if(SupplyRates && ADists){ std::cout << " Number of Reactions: " << Nreactions << std::endl; }
 		
 			std::cout << " " << NgoodDetections*100.0/Nwanted << "% of simulation complete...\n"; 
-			if(PerfectDet){ std::cout << "  Detection Efficiency: " << NgoodDetections*100.0/Nreactions << "%\n"; }
+			if(PerfectDet){ std::cout << "  Detection Efficiency: " << goodDetections*100.0/Nreactions << "%\n"; }
 			else{
 				std::cout << "  Geometric Efficiency: " << NdetHit*100.0/Nreactions << "%\n";
-				std::cout << "  Detection Efficiency: " << NgoodDetections*100.0/Nreactions << "%\n"; 
+				std::cout << "  Detection Efficiency: " << goodDetections*100.0/Nreactions << "%\n"; 
 			}
-			if(SupplyRates){ std::cout << "  Beam Time: " << Nsimulated/BeamRate << " seconds\n"; }
+			if(SupplyRates){ std::cout << "  Beam Time: " << beamScale*Nsimulated/BeamRate << " seconds\n"; }
 		
 			std::cout << "  Simulation Time: " << totTime << " seconds\n";
 			std::cout << "  Time reamining: " << (totTime/counter)*(10-counter) << " seconds\n";
 			counter++; 
 		}
+	} // Main simulation loop
+	// ==  ==  ==  ==  ==  ==  == 
 
-		recoil_detections = 0;
-		eject_detections = 0;
-		gamma_detections = 0;
-
-		if(backgroundWait != 0){ // Simulating background events
-			backgroundWait--;
+	// Wait for all events to be written before using the output file.
+	writer.Finish();
+
+	// Sum the counters from all threads.
+	for(std::vector<vandmcWorker*>::iterator iter = workers.begin(); iter != workers.end(); iter++){
+		NvetoEvents += (*iter)->NvetoEvents;
+		NrecoilHits += (*iter)->NrecoilHits;
+		NejectileHits += (*iter)->NejectileHits;
+		NgammaHits += (*iter)->NgammaHits;
+		beam_stopped += (*iter)->beam_stopped;
+		recoil_stopped += (*iter)->recoil_stopped;
+		eject_stopped += (*iter)->eject_stopped;
+	}
 
-			// Process the background event for each detector
-			for(std::vector<Primitive*>::iterator iter = vandle_bars.begin(); iter != vandle_bars.end(); iter++){
-				if(!((*iter)->IsEjectileDet() || (*iter)->IsRecoilDet())){ continue; } // This detector cannot detect particles
+	// Sum the stage timers from all threads, including the writer thread.
+	StageProfiler profiler(PROFILE_STAGES);
+	if(doProfile){
+		for(std::vector<vandmcWorker*>::iterator iter = workers.begin(); iter != workers.end(); iter++){
+			profiler.Merge(*(*iter)->GetProfiler());
+		}
+		profiler.Merge(*writer.GetProfiler());
+	}
+
+	// Create a directory for storing end of simulation information.
+	file->mkdir("simulation");
+	file->cd("simulation");
+
+	SetName(named, "simulationTime", getElapsedTime(), "seconds");
+	SetName(named, "totalEvents", Nreactions);
+	SetName(named, "totalDetectorHits", NdetHit);
+	SetName(named, "totalDetectedEvents", Ndetected);
+	SetName(named, "vetoedEvents", NvetoEvents);
+	SetName(named, "recoilHits", NrecoilHits);
+	SetName(named, "ejectileHits", NejectileHits);
+	SetName(named, "gammaHits", NgammaHits);
+	if(acceptance){ SetName(named, "weightedDetections", WgoodDetections); }
+	if(doProfile){
+		for(unsigned int i = 0; i < PROFILE_STAGES; i++){
+			std::string name = stageNames[i];
+			name[0] = toupper(name[0]);
+			std::stringstream stream; stream << "s, " << profiler.GetCalls(i) << " calls";
+			SetName(named, "profile"+name, profiler.GetTime(i), stream.str());
+		}
+	}
+
+	// Write the configuration TNameds to file.
+	for(std::vector<TNamed*>::iterator iter = named.begin(); iter != named.end(); iter++){
+		(*iter)->Write();
+		delete (*iter);
+	}
+	named.clear();
+	
+	// Information output and cleanup
+	std::cout << "\n ------------- Simulation Complete --------------\n";
+	std::cout << " Simulation Time: " << getElapsedTime() << " seconds\n"; 
+	std::cout << " Total MC Events: " << Nreactions << "\n";
+	std::cout << " Total Detector Hits: " << NdetHit << "\n";
+	std::cout << "  Vetoed Events: " << NvetoEvents << " (" << (100.0*NvetoEvents)/Nreactions << "%)\n";
+	std::cout << "  Recoil Hits:   " << NrecoilHits << " (" << (100.0*NrecoilHits)/Nreactions << "%)\n";
+	std::cout << "  Ejectile Hits: " << NejectileHits << " (" << (100.0*NejectileHits)/Nreactions << "%)\n";
+	std::cout << "  Gamma Hits:    " << NgammaHits << " (" << (100.0*NgammaHits)/Nreactions << "%)\n";
+	if(acceptance){
+		std::cout << " Weighted Ejectile Detections: " << WgoodDetections << "\n";
+		std::cout << "  Detection Efficiency: " << (100.0*WgoodDetections)/Nreactions << "%\n";
+	}
+	if(beam_stopped > 0 || eject_stopped > 0 || recoil_stopped > 0){
+		std::cout << " Particles Stopped in Target:\n";
+		if(beam_stopped > 0){ std::cout << "  Beam: " << beam_stopped << " (" << 100.0*beam_stopped/Nsimulated << "%)\n"; }
+		if(eject_stopped > 0){ std::cout << "  Ejectiles: " << eject_stopped << " (" << 100.0*eject_stopped/Nsimulated << "%)\n"; }
+		if(recoil_stopped > 0){ std::cout << "  Recoils: " << recoil_stopped << " (" << 100.0*recoil_stopped/Nsimulated << "%)\n"; }
+	}
+	if(SupplyRates){ 
+		double beamTime = 0.0;
+		for(std::vector<vandmcWorker*>::iterator iter = workers.begin(); iter != workers.end(); iter++){
+			Kindeux *workerKind = (*iter)->GetKindeux();
+			for(unsigned int i = 0; i < NRecoilStates; i++){
+				beamTime += workerKind->GetDistribution(i)->GetRate()*workerKind->GetNreactions(i);
+			}
+		}
+		if(acceptance && WgoodDetections > 0.0){ beamTime *= NgoodDetections/WgoodDetections; }
+		std::cout << " Beam Time: " << beamTime << " seconds (" << beamTime/3600 << " hrs.)\n"; 
+	}
+	if(doProfile){
+		// Times are summed over all threads, so the total may exceed the simulation time.
+		double totalTime = profiler.GetTotalTime();
+		std::cout << " Event Loop Profile (summed over " << nThreads << " event loop thread(s) and the writer thread):\n";
+		std::cout << "  " << std::left << std::setw(20) << "Stage" << std::right << std::setw(12) << "Time (s)" << std::setw(9) << "Time (%)";
+		std::cout << std::setw(14) << "Calls" << std::setw(14) << "Per Call (us)" << "\n";
+		for(unsigned int i = 0; i < PROFILE_STAGES; i++){
+			if(profiler.GetCalls(i) == 0 && profiler.GetTime(i) == 0.0){ continue; }
+			std::cout << "  " << std::left << std::setw(20) << stageNames[i] << std::right << std::setw(12) << profiler.GetTime(i);
+			std::cout << std::setw(9) << (totalTime > 0.0 ? 100.0*profiler.GetTime(i)/totalTime : 0.0) << std::setw(14) << profiler.GetCalls(i);
+			std::cout << std::setw(14) << (profiler.GetCalls(i) > 0 ? 1E6*profiler.GetTime(i)/profiler.GetCalls(i) : 0.0) << "\n";
+		}
+	}
+	
+	writer.Close();
+
+	std::cout << "  Wrote file " << output_filename << "\n";
+	std::cout << "   Wrote " << writer.GetEntries() << " tree entries for VANDMC\n";
+	
+	delete[] ExRecoilStates;
+	delete[] totXsect;
+	delete acceptance;
+
+	for(std::vector<vandmcWorker*>::iterator iter = workers.begin(); iter != workers.end(); iter++){
+		delete (*iter);
+	}
+	workers.clear();
+
+	for(std::vector<Primitive*>::iterator iter = vandle_bars.begin(); iter != vandle_bars.end(); iter++){
+		delete *iter;
+	}
+	vandle_bars.clear();
+	for(std::vector<DetectorArray*>::iterator iter = detector_arrays.begin(); iter != detector_arrays.end(); iter++){
+		delete *iter;
+	}
+	detector_arrays.clear();
+	veto_dets.clear();
+	recoil_dets.clear();
+	eject_dets.clear();
+	gamma_dets.clear();
+	particle_dets.clear();
+	detector_tree.Clear();
+	detector_store.Clear();
+	detector_grid.Clear();
+	
+	return true;
+} 
+
+///////////////////////////////////////////////////////////////////////////////
+// class vandmcEventBuffer
+///////////////////////////////////////////////////////////////////////////////
+
+/// Buffer constructor. capacity_ is the number of events to allocate up front.
+vandmcEventBuffer::vandmcEventBuffer(const size_t &capacity_/*=1*/) : nEvents(0) {
+	events.reserve(capacity_ > 0 ? capacity_ : 1);
+	for(size_t i = 0; i < events.capacity(); i++){
+		events.push_back(new vandmcEvent());
+	}
+}
+
+/// Destructor.
+vandmcEventBuffer::~vandmcEventBuffer(){
+	for(std::vector<vandmcEvent*>::iterator iter = events.begin(); iter != events.end(); iter++){
+		delete (*iter);
+	}
+	events.clear();
+}
+
+/// Mark the current event as complete. Return a pointer to the next (zeroed) event to fill.
+vandmcEvent *vandmcEventBuffer::Commit(){
+	if(++nEvents >= events.size()){ events.push_back(new vandmcEvent()); }
+	events[nEvents]->Zero();
+	return events[nEvents];
+}
+
+/// Discard all completed events.
+void vandmcEventBuffer::Clear(){
+	nEvents = 0;
+	events.front()->Zero();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// class vandmcWriter
+///////////////////////////////////////////////////////////////////////////////
+
+/** Writer constructor. nBuffers_ is the number of event buffers in the pool and
+  * capacity_ is the number of events to allocate up front for each buffer.
+  */
+vandmcWriter::vandmcWriter(const unsigned int &nBuffers_, const size_t &capacity_) : 
+	file(NULL), tree(NULL), nEntries(0), EVENTweight(1.0), writeReaction(false), profiler(PROFILE_STAGES), running(false), quit(false) {
+	for(unsigned int i = 0; i < (nBuffers_ > 0 ? nBuffers_ : 1); i++){
+		buffers.push_back(new vandmcEventBuffer(capacity_));
+		freeBuffers.push_back(buffers.back());
+	}
+}
+
+/// Destructor. Stops the writer thread and closes the output file, if needed.
+vandmcWriter::~vandmcWriter(){
+	Finish();
+	Close();
+	for(std::vector<vandmcEventBuffer*>::iterator iter = buffers.begin(); iter != buffers.end(); iter++){
+		delete (*iter);
+	}
+	buffers.clear();
+}
 
+/// Return the number of entries in the output tree.
+long long vandmcWriter::GetEntries(){
+	return (tree ? tree->GetEntries() : nEntries);
+}
+
+/** Open the output file and create the output tree. The eject_, recoil_, reaction_ and weight_
+  * flags select which branches are added to the tree. Return false if the file cannot be opened.
+  */
+bool vandmcWriter::Open(const std::string &filename_, const bool &eject_, const bool &recoil_, const bool &reaction_, const bool &weight_){
+	if(file){ return false; }
+
+	file = new TFile(filename_.c_str(), "RECREATE");
+	if(!file->IsOpen()){
+		delete file;
+		file = NULL;
+		return false;
+	}
+
+	tree = new TTree("data", "VANDMC output tree");
+	if(eject_)
+		tree->Branch("eject", &EJECTdata);
+	if(recoil_)
+		tree->Branch("recoil", &RECOILdata);
+	if(reaction_)
+		tree->Branch("reaction", &REACTIONdata);
+	if(weight_)
+		tree->Branch("weight", &EVENTweight);
+	writeReaction = reaction_;
+
+	return true;
+}
+
+/** Start the writer thread. The output file must not be used by any other thread until
+  * Finish() is called.
+  */
+void vandmcWriter::Start(){
+	if(running || !tree){ return; }
+	quit = false;
+	running = true;
+	thread = std::thread(&vandmcWriter::_write, this);
+}
+
+/// Return an empty buffer from the pool, waiting for the writer thread if none are free.
+vandmcEventBuffer *vandmcWriter::GetFreeBuffer(){
+	std::unique_lock<std::mutex> guard(lock);
+	freeCondition.wait(guard, [this]{ return !freeBuffers.empty(); });
+	vandmcEventBuffer *buffer = freeBuffers.front();
+	freeBuffers.pop_front();
+	return buffer;
+}
+
+/// Add a filled buffer to the end of the write queue.
+void vandmcWriter::Push(vandmcEventBuffer *buffer_){
+	if(!buffer_){ return; }
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		fullBuffers.push_back(buffer_);
+	}
+	fullCondition.notify_one();
+}
+
+/// Wait until all queued buffers are written and stop the writer thread.
+void vandmcWriter::Finish(){
+	if(!running){ return; }
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		quit = true;
+	}
+	fullCondition.notify_one();
+	thread.join();
+	running = false;
+}
+
+/// Write the output tree to the output file and close it.
+void vandmcWriter::Close(){
+	if(!file){ return; }
+	file->cd();
+	tree->Write();
+	nEntries = tree->GetEntries();
+	file->Close();
+	delete file; // The tree is owned by the file.
+	file = NULL;
+	tree = NULL;
+}
+
+/// Main loop for the writer thread.
+void vandmcWriter::_write(){
+	while(true){
+		std::unique_lock<std::mutex> guard(lock);
+		fullCondition.wait(guard, [this]{ return (quit || !fullBuffers.empty()); });
+		if(fullBuffers.empty()){ return; } // All buffers have been written.
+		vandmcEventBuffer *buffer = fullBuffers.front();
+		fullBuffers.pop_front();
+		guard.unlock();
+
+		// Fill the tree. This is where ROOT compresses and flushes baskets.
+		profiler.Start();
+		for(size_t i = 0; i < buffer->GetNumEvents(); i++){
+			vandmcEvent *evt = buffer->GetEvent(i);
+			EJECTdata = evt->eject;
+			RECOILdata = evt->recoil;
+			if(writeReaction){ REACTIONdata = evt->reaction; }
+			EVENTweight = evt->weight;
+			tree->Fill();
+		}
+		profiler.Mark(PROFILE_TREE_FILL);
+		buffer->Clear();
+
+		guard.lock();
+		freeBuffers.push_back(buffer);
+		guard.unlock();
+		freeCondition.notify_one();
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// class vandmcWorker
+///////////////////////////////////////////////////////////////////////////////
+
+/** Worker constructor. sim_ is the simulation object which holds the setup, id_ is the
+  * index of this worker and seed_ is the seed of its random number stream. The
+  * worker uses stream number id_ of the random number engine.
+  */
+vandmcWorker::vandmcWorker(vandmc *sim_, const unsigned int &id_, const uint64_t &seed_) : 
+	NgoodDetections(0), Ndetected(0), Nsimulated(0), NdetHit(0), Nreactions(0), NrecoilHits(0), NejectileHits(0), 
+	NgammaHits(0), NvetoEvents(0), beam_stopped(0), recoil_stopped(0), eject_stopped(0), WgoodDetections(0.0), sim(sim_), id(id_), 
+	rng(seed_, id_), profiler(PROFILE_STAGES), backgroundWait(sim_->backgroundRate), buffer(NULL), current(NULL), 
+	hit_x(0.0), hit_y(0.0), hit_z(0.0), recoil_tof(0.0), Zdepth(0.0), range_beam(0.0), Ebeam(0.0), ErecoilMod(0.0), EejectMod(0.0), Egamma(0.0), 
+	recoil_detections(0), eject_detections(0), gamma_detections(0) {
+	profiler.SetEnabled(sim->doProfile);
+}
+
+/// Destructor.
+vandmcWorker::~vandmcWorker(){
+}
+
+/// Initialize the kinematics object for this worker. Return false if setup fails.
+bool vandmcWorker::Initialize(){
+	// For cylindrical beams, the beam direction is given by the z-axis
+	if(!sim->BeamFocus){ lab_beam_trajectory = Vector3(0.0, 0.0, 1.0); }
+
+	// Draw all reaction random numbers from this worker's stream.
+	kind.SetRandomEngine(&rng);
+
+	// Use the shared acceptance map when sampling with bias.
+	kind.SetAcceptanceMap(sim->acceptance);
+
+	return sim->initKinematics(kind, sim->kind.GetNrecoilStates());
+}
+
+/** Give the worker an empty event buffer to fill and return the buffer it was filling.
+  * The buffers are not owned by the worker.
+  */
+vandmcEventBuffer *vandmcWorker::SwapBuffer(vandmcEventBuffer *buffer_){
+	vandmcEventBuffer *filled = buffer;
+	buffer = buffer_;
+	current = (buffer ? buffer->GetCurrent() : NULL);
+	return filled;
+}
+
+/// Move the current event into the staging buffer and start a new one.
+void vandmcWorker::commitEvent(){
+	current = buffer->Commit();
+}
+
+/// Simulate events until nWanted_ more good detections have been made.
+void vandmcWorker::Process(const unsigned int &nWanted_){
+	// Start the staging buffer from scratch.
+	current = buffer->GetCurrent();
+	current->Zero();
+
+	Vector3 temp_vector;
+	Vector3 temp_vector_sphere;
+	Vector3 dummy_vector;
+	double dummy_t1, dummy_t2;
+
+	const unsigned int stopDetections = NgoodDetections + nWanted_;
+	
+	while(NgoodDetections < stopDetections){
+		profiler.Start();
+		if(backgroundWait != 0){ // Simulating background events
+			backgroundWait--;
+
+			// Process the background event for each detector
+			for(std::vector<Primitive*>::const_iterator iter = sim->particle_dets.begin(); iter != sim->particle_dets.end(); iter++){
 				// Select the "tof" of the background event. Use the recoil tof, because it doesn't matter.
-				recoil_tof = (double)frand(0, detWindow)*(1E-9);
+				recoil_tof = (double)frand(rng, 0, sim->detWindow)*(1E-9);
 			
 				// Select a random point insde the detector
-				(*iter)->GetRandomPointInside(temp_vector);
+				(*iter)->GetRandomPointInside(temp_vector, rng);
 				Cart2Sphere(temp_vector_sphere);
 			
 				// Calculate the apparent energy of the particle using the tof
 				if((*iter)->IsEjectileDet()){
-					EJECTdata.Append(temp_vector.axis[0], temp_vector.axis[1], temp_vector.axis[2], temp_vector.Length(), temp_vector_sphere.axis[1]*rad2deg,
-									 temp_vector_sphere.axis[2]*rad2deg, 0.0, recoil_tof*(1E9), 0.0, 0.0, 0.0, 0.0, (*iter)->GetLoc(), true);
-					VANDMCtree->Fill(); 
-					EJECTdata.Zero();
+					current->eject.Append(temp_vector.axis[0], temp_vector.axis[1], temp_vector.axis[2], temp_vector.Length(), temp_vector_sphere.axis[1]*rad2deg,
+					                      temp_vector_sphere.axis[2]*rad2deg, 0.0, recoil_tof*(1E9), 0.0, 0.0, 0.0, 0.0, (*iter)->GetLoc(), true);
+					commitEvent();
 				}
 				else if((*iter)->IsRecoilDet()){
-					RECOILdata.Append(temp_vector.axis[0], temp_vector.axis[1], temp_vector.axis[2], temp_vector.Length(), RecoilSphere.axis[1]*rad2deg,
-									  RecoilSphere.axis[2]*rad2deg, 0.0, recoil_tof*(1E9), 0.0, 0.0, 0.0, 0.0, (*iter)->GetLoc(), true);
-					VANDMCtree->Fill();
-					RECOILdata.Zero();
+					current->recoil.Append(temp_vector.axis[0], temp_vector.axis[1], temp_vector.axis[2], temp_vector.Length(), RecoilSphere.axis[1]*rad2deg,
+					                       RecoilSphere.axis[2]*rad2deg, 0.0, recoil_tof*(1E9), 0.0, 0.0, 0.0, 0.0, (*iter)->GetLoc(), true);
+					commitEvent();
 				}
 			}
+			profiler.Mark(PROFILE_BACKGROUND);
 			
 			continue;
 		}
 		else{ // A reaction occured
-			if(!bgPerDetection){ backgroundWait = backgroundRate; }
+			if(!sim->bgPerDetection){ backgroundWait = sim->backgroundRate; }
 
 			Nsimulated++; 
 		
@@ -1076,38 +2121,42 @@ bool vandmc::Execute(int argc, char *argv[]){
 			// Randomly select a point uniformly distributed on the beamspot
 			// Calculate where the beam particle reacts inside the target
 			// beamspot as well as the distance traversed through the target
-			if(lab_beam_focus.axis[2] != 0.0){ 
+			if(sim->lab_beam_focus.axis[2] != 0.0){ 
 				// In this case, lab_beam_focus is the originating point of the beam particle
 				// (or the terminating point for beams focused downstream of the target)
 				// The direction is given by the cartesian vector 'lab_beam_trajectory'
-				if(BeamType == 0){ RandomCircle(beamspot, lab_beam_focus.axis[2], lab_beam_trajectory); } // Gaussian beam
-				else if(BeamType == 1){ RandomGauss(beamspot, lab_beam_focus.axis[2], lab_beam_trajectory); } // Cylindrical beam
-				else if(BeamType == 2){ RandomHalo(beamspot/2.0, lab_beam_focus.axis[2], lab_beam_trajectory); } // Halo beam
+				if(sim->BeamType == 0){ RandomCircle(rng, sim->beamspot, sim->lab_beam_focus.axis[2], lab_beam_trajectory); } // Gaussian beam
+				else if(sim->BeamType == 1){ RandomGauss(rng, sim->beamspot, sim->lab_beam_focus.axis[2], lab_beam_trajectory); } // Cylindrical beam
+				else if(sim->BeamType == 2){ RandomHalo(rng, sim->beamspot/2.0, sim->lab_beam_focus.axis[2], lab_beam_trajectory); } // Halo beam
 				
 				// Normalize the trajectory and calculate the interaction depth.
 				lab_beam_trajectory.Normalize();
-				Zdepth = targ.GetInteractionDepth(lab_beam_focus, lab_beam_trajectory, targ_surface, lab_beam_interaction);
+				profiler.Mark(PROFILE_BEAM);
+				Zdepth = sim->targ.GetInteractionDepth(rng, sim->lab_beam_focus, lab_beam_trajectory, targ_surface, lab_beam_interaction);
 			}
 			else{ 
 				// In this case, lab_beam_start stores the originating point of the beam particle
 				// The direction is given simply by the +z-axis
 				// The 1m offset ensures the particle originates outside the target
-				if(BeamType == 0){ RandomGauss(beamspot/2.0, -1.0, lab_beam_start); } // Gaussian beam
-				else if(BeamType == 1){ RandomCircle(beamspot, -1.0, lab_beam_start); } // Cylindrical beam
-				else if(BeamType == 2){ RandomHalo(beamspot/2.0, -1.0, lab_beam_start); } // Halo beam
+				if(sim->BeamType == 0){ RandomGauss(rng, sim->beamspot/2.0, -1.0, lab_beam_start); } // Gaussian beam
+				else if(sim->BeamType == 1){ RandomCircle(rng, sim->beamspot, -1.0, lab_beam_start); } // Cylindrical beam
+				else if(sim->BeamType == 2){ RandomHalo(rng, sim->beamspot/2.0, -1.0, lab_beam_start); } // Halo beam
 				lab_beam_start.axis[2] *= -1; // This is done to place the beam particle upstream of the target
 				
 				// Normalize the trajectory and calculate the interaction depth.
 				lab_beam_trajectory.Normalize();
-				Zdepth = targ.GetInteractionDepth(lab_beam_start, lab_beam_trajectory, targ_surface, lab_beam_interaction);
+				profiler.Mark(PROFILE_BEAM);
+				Zdepth = sim->targ.GetInteractionDepth(rng, lab_beam_start, lab_beam_trajectory, targ_surface, lab_beam_interaction);
 			}	
+			profiler.Mark(PROFILE_DEPTH);
 
 			// Calculate the beam particle energy, varied with energy spread (in MeV)
-			Ebeam = Ebeam0 + rndgauss0(beamEspread); 
+			Ebeam = sim->Ebeam0 + rndgauss0(rng, sim->beamEspread); 
+			profiler.Mark(PROFILE_BEAM, false);
 
-			if(use_target_eloss){ // Calculate energy loss in the target
+			if(sim->use_target_eloss){ // Calculate energy loss in the target
 				// Calculate the beam particle range in the target (in m)
-				range_beam = beam_targ.GetRange(Ebeam);
+				range_beam = sim->beam_targ.GetRange(Ebeam);
 		
 				// Calculate the new energy
 				if(range_beam - Zdepth <= 0.0){ // The beam stops in the target (no reaction)
@@ -1120,26 +2169,29 @@ bool vandmc::Execute(int argc, char *argv[]){
 						std::cout << "\n ------------------------------------------------\n";
 						std::cout << " Dumping target information!!!\n\n";
 				
-						materials[targ_mat_id].Print();
+						sim->materials[sim->targ_mat_id].Print();
 						std::cout << std::endl;
 				
-						std::cout << " Target thickness: " << targ.GetRealThickness() << " m\n";
-						std::cout << " Effective thickness: " << targ.GetRealZthickness() << " m\n\n";
+						std::cout << " Target thickness: " << sim->targ.GetRealThickness() << " m\n";
+						std::cout << " Effective thickness: " << sim->targ.GetRealZthickness() << " m\n\n";
 						
 						std::cout << " Tracing ray through target... \n";
-						std::cout << "  Target thickness: " << targ.GetPrimitive()->GetApparentThickness(Vector3(0.0, 0.0, -1.0), Vector3(0.0, 0.0, 1.0), dummy_vector, dummy_t1, dummy_t2) << " m\n";
+						std::cout << "  Target thickness: " << sim->targ.GetPrimitive()->GetApparentThickness(Vector3(0.0, 0.0, -1.0), Vector3(0.0, 0.0, 1.0), dummy_vector, dummy_t1, dummy_t2) << " m\n";
 						std::cout << "  Front face intersect = (" << dummy_vector.Dump() << ")\n";
 						std::cout << "  Back face intersect = (" << Vector3(0.0, 0.0, -1 + dummy_t2).Dump() << ")\n";
 					}
 					beam_stopped++;
+					profiler.Mark(PROFILE_BEAM_ELOSS);
 			
 					continue; 
 				}
-				rdata.Ereact = beam_targ.GetEnergy(range_beam - Zdepth);
+				rdata.Ereact = sim->beam_targ.GetEnergy(range_beam - Zdepth);
+				profiler.Mark(PROFILE_BEAM_ELOSS);
 		
 				// Determine the angle of the beam particle's trajectory at the
 				// interaction point, due to angular straggling and the incident trajectory.
-				targ.AngleStraggling(lab_beam_trajectory, beam_part.GetA(), beam_part.GetZ(), Ebeam, lab_beam_stragtraject);
+				sim->targ.AngleStraggling(rng, lab_beam_trajectory, sim->beam_part.GetA(), sim->beam_part.GetZ(), Ebeam, lab_beam_stragtraject);
+				profiler.Mark(PROFILE_STRAGGLING);
 			}
 			else{ 
 				rdata.Ereact = Ebeam;
@@ -1147,7 +2199,9 @@ bool vandmc::Execute(int argc, char *argv[]){
 			}
 
 			// the 2 body kinematics routine to generate the ejectile and recoil
-			if(kind.FillVars(rdata, EjectSphere, RecoilSphere)){ Nreactions++; }
+			bool reacted = kind.FillVars(rdata, EjectSphere, RecoilSphere);
+			profiler.Mark(PROFILE_KINEMATICS);
+			if(reacted){ Nreactions++; }
 			else{ continue; } // A reaction did not occur
 
 			// Convert the reaction vectors to cartesian coordinates
@@ -1161,6 +2215,7 @@ bool vandmc::Execute(int argc, char *argv[]){
 			rotation_matrix.SetRotationMatrixCart(lab_beam_stragtraject); // Turn ON angular straggling effects
 			rotation_matrix.Transform(Ejectile);
 			rotation_matrix.Transform(Recoil);
+			profiler.Mark(PROFILE_ROTATION);
 
 			// Set the outgoing energy of the ejectile and recoil.
 			EejectMod = rdata.Eeject;
@@ -1168,338 +2223,287 @@ bool vandmc::Execute(int argc, char *argv[]){
 			Egamma = rdata.Eexcited;
 
 			// Calculate the energy loss for the ejectile and recoil in the target.
-			if(use_target_eloss){
+			if(sim->use_target_eloss){
 				// Calculate the new energy of the ejectile.
-				if(eject_part.GetZ() > 0){ 
-					targ.GetPrimitive()->IntersectPrimitive(lab_beam_interaction, Ejectile, dummy_vector, Zdepth, dummy_t2);
-					EejectMod = eject_targ.GetNewE(rdata.Eeject, Zdepth); 
+				if(sim->eject_part.GetZ() > 0){ 
+					sim->targ.GetPrimitive()->IntersectPrimitive(lab_beam_interaction, Ejectile, dummy_vector, Zdepth, dummy_t2);
+					EejectMod = sim->eject_targ.GetNewE(rdata.Eeject, Zdepth); 
 				}
 				
 				// Calculate the new energy of the recoil.
-				if(recoil_part.GetZ() > 0){ 
-					targ.GetPrimitive()->IntersectPrimitive(lab_beam_interaction, Recoil, dummy_vector, Zdepth, dummy_t2);
-					ErecoilMod = recoil_targ.GetNewE(rdata.Erecoil, Zdepth); 
+				if(sim->recoil_part.GetZ() > 0){ 
+					sim->targ.GetPrimitive()->IntersectPrimitive(lab_beam_interaction, Recoil, dummy_vector, Zdepth, dummy_t2);
+					ErecoilMod = sim->recoil_targ.GetNewE(rdata.Erecoil, Zdepth); 
 				}
+				profiler.Mark(PROFILE_PRODUCT_ELOSS);
 			}
 		}
 
-		// Set the first detector type to process.
-		if(have_veto_det){ detector_type = -1; }
-		else if(have_recoil_det){ detector_type = 0; }
-		else if(have_ejectile_det){ detector_type = 1; }
-		else if(have_gamma_det){ detector_type = 2; }
-
+		// Reset the per-event detection state.
 		recoil_tof = -1;
-		veto_event = false;
-
-process:
-		// Process the reaction products
-		for(std::vector<Primitive*>::iterator iter = vandle_bars.begin(); iter != vandle_bars.end(); iter++){
-			// Check if we need to process this detector.
-			if(detector_type == -1){
-				if(!(*iter)->IsVeto()){ continue; } // This detector is not a veto detector.
-			}
-			else if(detector_type == 0){
-				if(!(*iter)->IsRecoilDet()){ continue; } // This detector is not able to detect recoils.
-				if(ErecoilMod <= 0.0){ break; } // The recoil has stopped. We're done tracking it.
-			}
-			else if(detector_type == 1){
-				if(!(*iter)->IsEjectileDet()){ continue; } // This detector is not able to detect ejectiles.
-				if(EejectMod <= 0.0){ break; } // The ejectile has stopped. We're done tracking it.
-			}
-			else if(detector_type == 2){
-				if(!(*iter)->IsGammaDet()){ continue; } // This detector is not able to detect gammas.
-				if(Egamma <= 0.0 && !NeutronSource){ break; } // Do not process the ground state.
-			}
-			else{ continue; } // This detector cannot detect particles.
-
-			if(detector_type == -1){ // Process the ejectile and recoil for veto detectors.
-				veto_event = (*iter)->IntersectPrimitive(lab_beam_interaction, Recoil, HitDetect1, fpath1, fpath2) ||
-				             (*iter)->IntersectPrimitive(lab_beam_interaction, Ejectile, HitDetect1, fpath1, fpath2); 
-				      
-				// If the veto detector was triggered, stop this event.
-				if(veto_event){ break; }
-			}
-			else if(detector_type == 0){ // Process the recoil.
-				hit = (*iter)->IntersectPrimitive(lab_beam_interaction, Recoil, HitDetect1, fpath1, fpath2); 
-				
-				// Calculate the vector pointing from the first intersection point to the second
-				if(fpath1 >= 0.0 && fpath2 >= 0.0){ 
-					// The ray originates outside the detector. In this case, HitDetect1 represents the vector
-					// from the origin to the point at which the ray intersects the detector surface.
-					temp_vector = ((lab_beam_interaction + Recoil*fpath2)-HitDetect1); 
-				}
-				else{ 
-					// The ray originates within the detector. HitDetect1 already represents the vector from
-					// the origin to the intersection of the surface of the detector.
-					temp_vector = HitDetect1; 
-				}
-			}
-			else if(detector_type == 1){ // Process the ejectile.
-				hit = (*iter)->IntersectPrimitive(lab_beam_interaction, Ejectile, HitDetect1, fpath1, fpath2); 
-				
-				// Calculate the vector pointing from the first intersection point to the second
-				if(fpath1 >= 0.0 && fpath2 >= 0.0){  
-					// The ray originates outside the detector. In this case, HitDetect1 represents the vector
-					// from the origin to the point at which the ray intersects the detector surface.
-					temp_vector = ((lab_beam_interaction + Ejectile*fpath2)-HitDetect1); 
-				}
-				else{ 
-					// The ray originates within the detector. HitDetect1 already represents the vector from
-					// the origin to the intersection of the surface of the detector.
-					temp_vector = HitDetect1; 
-				}
-			}
-			else if(detector_type == 2){ // Process the gamma ray.
-				// Simulate the gamma emission. The gamma rays are emitted isotropically from the reaction point.
-				UnitSphereRandom(dummy_vector);
-				hit = (*iter)->IntersectPrimitive(lab_beam_interaction, dummy_vector, HitDetect1, fpath1, fpath2);
-			}
-			
-			// If a geometric hit was detected, process the particle
-			if(hit){
-				NdetHit++; 
-
-				// Solve for the energy deposited in the material.
-				if((*iter)->UseMaterial()){ // Do energy loss and range considerations
-					if(detector_type == 0){ 
-						if(recoil_part.GetZ() > 0){ // Calculate energy loss for the recoil in the detector
-							QDC = ErecoilMod - recoil_tables[(*iter)->GetMaterial()].GetNewE(ErecoilMod, temp_vector.Length(), dist_traveled);
-						}
-						else{ std::cout << " ERROR: Doing energy loss on recoil particle with Z == 0???\n"; }
-					}	
-					else if(detector_type == 1){
-						if(eject_part.GetZ() > 0){ // Calculate energy loss for the ejectile in the detector
-							QDC = EejectMod - eject_tables[(*iter)->GetMaterial()].GetNewE(EejectMod, temp_vector.Length(), dist_traveled);
-						}
-						else{ std::cout << " ERROR: Doing energy loss on ejectile particle with Z == 0???\n"; }
-					}
-					else if(detector_type == 2){ std::cout << " ERROR: Doing energy loss on a gamma ray???\n"; }
-				}
-				else{ // Do not do energy loss calculations. The particle leaves all of its energy in the detector.
-					dist_traveled = temp_vector.Length()*frand(); // The particle penetrates a random distance into the detector and stops.
-					if(detector_type == 0){ QDC = ErecoilMod; } // The recoil may leave any portion of its energy inside the detector
-					else if(detector_type == 1){ QDC = EejectMod; } // The ejectile may leave any portion of its energy inside the detector
-					else if(detector_type == 2){ QDC = Egamma; }
-				}
-
-				// If particle originates outside of the detector, add the flight path to the first encountered
-				// detector face. Otherwise, if the particle originates inside the detector (i.e. a detector at
-				// the origin), the distance traveled through the detector is already the total flight path and
-				// the time of flight is irrelevant.
-				if(fpath1 >= 0.0){
-					dist_traveled += fpath1;
-					
-					// Calculate the particle ToF (ns)
-					if(detector_type == 0){ 
-						recoil_tof = (dist_traveled/c)*std::sqrt(0.5*kind.GetMrecoilMeV()/ErecoilMod); 
-						recoil_tof += rndgauss0(timeRes); // Smear tof due to PIXIE resolution
-					}
-					else if(detector_type == 1){ 
-						eject_tof = (dist_traveled/c)*std::sqrt(0.5*kind.GetMejectMeV()/EejectMod);
-						eject_tof += rndgauss0(timeRes); // Smear tof due to PIXIE resolution
-						if(recoil_tof > 0.0){ eject_tof = eject_tof - recoil_tof; }
-					}
-					else if(detector_type == 2){ 
-						gamma_tof = dist_traveled/c;
-						gamma_tof += rndgauss0(timeRes); // Smear tof due to PIXIE resolution
-						if(recoil_tof > 0.0){ gamma_tof = gamma_tof - recoil_tof; }
-					}
-				}
+		recoil_detections = 0;
+		eject_detections = 0;
+		gamma_detections = 0;
 
-				// Get the local coordinates of the intersection point.
-				(*iter)->GetLocalCoords(HitDetect1, hit_x, hit_y, hit_z);
-			
-				// Calculate the lab angles of the detector intersection point. Ignore normalization, we're
-				// going to throw away R anyway.
-				if(detector_type == 0){ Cart2Sphere(HitDetect1, RecoilSphere); }
-				else if(detector_type == 1){ Cart2Sphere(HitDetect1, EjectSphere); }
-				else if(detector_type == 2){ Cart2Sphere(HitDetect1, GammaSphere); }
-			
-				// Calculate the hit detection point in 3d space. This point will lie along the vector pointing
-				// from the origin to the point where the ray intersects a detector and takes finite range of a
-				// particle in a material into account.
-				HitDetect1.Normalize();
-				HitDetect1 = HitDetect1*dist_traveled;
-			
-				// Main output
-				if(detector_type == 0){
-					RECOILdata.Append(HitDetect1.axis[0], HitDetect1.axis[1], HitDetect1.axis[2], HitDetect1.Length(), RecoilSphere.axis[1]*rad2deg,
-					                  RecoilSphere.axis[2]*rad2deg, QDC, recoil_tof*(1E9), rdata.Erecoil, hit_x, hit_y, hit_z, (*iter)->GetLoc(), false);
-				
-					recoil_detections++;
-				
-					// Adjust the recoil energy to take energy loss into account. 
-					ErecoilMod = ErecoilMod - QDC;
-				}
-				else if(detector_type == 1){
-					EJECTdata.Append(HitDetect1.axis[0], HitDetect1.axis[1], HitDetect1.axis[2], HitDetect1.Length(), EjectSphere.axis[1]*rad2deg,
-					                  EjectSphere.axis[2]*rad2deg, QDC, eject_tof*(1E9), rdata.Eeject, hit_x, hit_y, hit_z, (*iter)->GetLoc(), false);
-								
-					eject_detections++;			
-								
-					// Adjust the ejectile energy to take energy loss into account. 
-					EejectMod = EejectMod - QDC;
-				}
-				else if(detector_type == 2){ 
-					EJECTdata.Append(HitDetect1.axis[0], HitDetect1.axis[1], HitDetect1.axis[2], HitDetect1.Length(), GammaSphere.axis[1]*rad2deg,
-					                 GammaSphere.axis[2]*rad2deg, Egamma, gamma_tof*(1E9), 0.0, hit_x, hit_y, hit_z, (*iter)->GetLoc(), true);
-									 
-					gamma_detections++;
-					
-					// Done tracking the gamma ray.		 
-					break;
-				}
-			} // if(hit)
-		} // for(std::vector<Primitive*>::iterator iter = vandle_bars.begin(); iter != vandle_bars.end(); iter++)
-		
-		if(!veto_event){ 
-			// Decide which detector type to process next, if any.
-			if(detector_type == -1){
-				if(have_recoil_det){
-					detector_type = 0;
-					goto process;
-				}
-				else if(have_ejectile_det){ 
-					detector_type = 1; 
-					goto process;
-				}
-				else if(have_gamma_det){
-					detector_type = 2;
-					goto process;
-				}
-			}
-			else if(detector_type == 0){
-				if(have_ejectile_det){ 
-					detector_type = 1; 
-					goto process;
-				}
-				else if(have_gamma_det){
-					detector_type = 2;
-					goto process;
-				}
-			}
-			else if(detector_type == 1){
-				if(have_gamma_det){
-					detector_type = 2;
-					goto process;
-				}
-			}
-			else if(detector_type == 2){
-			}
+		// Process the reaction products. If a veto detector is triggered, stop this event.
+		bool vetoed = traceVeto();
+		profiler.Mark(PROFILE_VETO);
+		if(vetoed){
+			NvetoEvents++;
+			current->Zero();
+			continue;
+		}
+		traceRecoil();
+		profiler.Mark(PROFILE_RECOIL);
+		traceEjectile();
+		profiler.Mark(PROFILE_EJECTILE);
+		traceGamma();
+		profiler.Mark(PROFILE_GAMMA);
+
+		NrecoilHits += recoil_detections;
+		NejectileHits += eject_detections;
+		NgammaHits += gamma_detections;
+
+		// Check to see if anything needs to be written to file.
+		bool writeEvent = false;
+		if(sim->InCoincidence){ // We require coincidence between ejectiles and recoils 
+			writeEvent = (recoil_detections > 0 && (eject_detections > 0 || gamma_detections > 0));
+		}
+		else{ // Coincidence is not required between reaction particles
+			writeEvent = (eject_detections > 0 || recoil_detections > 0 || gamma_detections > 0);
+		}
 
-			NrecoilHits += recoil_detections;
-			NejectileHits += eject_detections;
-			NgammaHits += gamma_detections;
-
-			// Check to see if anything needs to be written to file.
-			if(InCoincidence){ // We require coincidence between ejectiles and recoils 
-				if(recoil_detections > 0 && (eject_detections > 0 || gamma_detections > 0)){ 
-					if(WriteReaction){ // Set some extra reaction data variables.
-						REACTIONdata.Append(rdata.Ereact, rdata.Eeject, rdata.Erecoil, rdata.comAngle*rad2deg, rdata.state,
-							                lab_beam_interaction.axis[0], lab_beam_interaction.axis[1], lab_beam_interaction.axis[2],
-							                lab_beam_stragtraject.axis[0], lab_beam_stragtraject.axis[1], lab_beam_stragtraject.axis[2]);
-					}
-					if(bgPerDetection){ backgroundWait = backgroundRate; }
-					VANDMCtree->Fill(); 
-					Ndetected++;
-					
-					// Ignore background and gamma events for true detection count.
-					if(eject_detections > 0){ 
-						if(!flag){ flag = true; }
-						NgoodDetections++; 
-					}
-				}
+		if(writeEvent){
+			if(sim->WriteReaction){ // Set some extra reaction data variables.
+				current->reaction.Append(rdata.Ereact, rdata.Eeject, rdata.Erecoil, rdata.comAngle*rad2deg, rdata.state,
+				                         lab_beam_interaction.axis[0], lab_beam_interaction.axis[1], lab_beam_interaction.axis[2],
+				                         lab_beam_stragtraject.axis[0], lab_beam_stragtraject.axis[1], lab_beam_stragtraject.axis[2]);
 			}
-			else{ // Coincidence is not required between reaction particles
-				if(eject_detections > 0 || recoil_detections > 0 || gamma_detections > 0){ 
-					if(WriteReaction){
-						REACTIONdata.Append(rdata.Ereact, rdata.Eeject, rdata.Erecoil, rdata.comAngle*rad2deg, rdata.state,
-							                lab_beam_interaction.axis[0], lab_beam_interaction.axis[1], lab_beam_interaction.axis[2],
-							                lab_beam_stragtraject.axis[0], lab_beam_stragtraject.axis[1], lab_beam_stragtraject.axis[2]);
-					}
-					if(bgPerDetection){ backgroundWait = backgroundRate; }
-					VANDMCtree->Fill(); 
-					Ndetected++;
-					
-					// Ignore background and gamma events for true detection count.
-					if(eject_detections > 0){ 
-						if(!flag){ flag = true; }
-						NgoodDetections++; 
-					}
-				}
+			if(sim->bgPerDetection){ backgroundWait = sim->backgroundRate; }
+			current->weight = rdata.weight;
+			commitEvent();
+			Ndetected++;
+			
+			// Ignore background and gamma events for true detection count.
+			if(eject_detections > 0){ 
+				NgoodDetections++; 
+				WgoodDetections += rdata.weight;
 			}
 		}
-		else{ NvetoEvents++; }
 		
 		// Zero all output data structures.
-		EJECTdata.Zero();
-		RECOILdata.Zero();
-		if(WriteReaction){ REACTIONdata.Zero(); }
+		current->Zero();
+		profiler.Mark(PROFILE_OUTPUT);
 	} // Main simulation loop
-	// ==  ==  ==  ==  ==  ==  == 
+}
 
-	// Create a directory for storing end of simulation information.
-	file->mkdir("simulation");
-	file->cd("simulation");
+/** Find the detectors hit by the ejectile and recoil. Each particle is traced through its own detectors and
+  * the veto detectors in a single pass, and the hits are kept for traceRecoil and traceEjectile. Return true
+  * if either of them hits a veto detector.
+  */
+bool vandmcWorker::traceVeto(){
+	bool vetoed = false;
+	if(findHits(Recoil, DETECTOR_RECOIL | DETECTOR_VETO, recoil_hits) > 0){
+		for(std::vector<DetectorHit>::const_iterator iter = recoil_hits.begin(); iter != recoil_hits.end() && !vetoed; iter++){
+			vetoed = ((iter->flags & DETECTOR_VETO) != 0);
+		}
+		if(vetoed){ return true; }
+	}
+	if(findHits(Ejectile, DETECTOR_EJECTILE | DETECTOR_VETO, eject_hits) > 0){
+		for(std::vector<DetectorHit>::const_iterator iter = eject_hits.begin(); iter != eject_hits.end() && !vetoed; iter++){
+			vetoed = ((iter->flags & DETECTOR_VETO) != 0);
+		}
+	}
+	return vetoed;
+}
 
-	SetName(named, "simulationTime", (float)(clock()-timer)/CLOCKS_PER_SEC, "seconds");
-	SetName(named, "totalEvents", Nreactions);
-	SetName(named, "totalDetectorHits", NdetHit);
-	SetName(named, "totalDetectedEvents", Ndetected);
-	SetName(named, "vetoedEvents", NvetoEvents);
-	SetName(named, "recoilHits", NrecoilHits);
-	SetName(named, "ejectileHits", NejectileHits);
-	SetName(named, "gammaHits", NgammaHits);
+/** Trace the recoil through the recoil detectors it hits, in the order it reaches them, so
+  * that energy lost in one detector is taken into account in every detector behind it.
+  */
+void vandmcWorker::traceRecoil(){
+	for(std::vector<DetectorHit>::const_iterator iter = recoil_hits.begin(); iter != recoil_hits.end(); iter++){
+		if(ErecoilMod <= 0.0){ break; } // The recoil has stopped. We're done tracking it.
+		if(iter->flags & DETECTOR_RECOIL){ traceDetector(0, *iter, Recoil); }
+	}
+}
 
-	// Write the configuration TNameds to file.
-	for(std::vector<TNamed*>::iterator iter = named.begin(); iter != named.end(); iter++){
-		(*iter)->Write();
-		delete (*iter);
+/** Trace the ejectile through the ejectile detectors it hits, in the order it reaches them, so
+  * that energy lost in one detector is taken into account in every detector behind it.
+  */
+void vandmcWorker::traceEjectile(){
+	for(std::vector<DetectorHit>::const_iterator iter = eject_hits.begin(); iter != eject_hits.end(); iter++){
+		if(EejectMod <= 0.0){ break; } // The ejectile has stopped. We're done tracking it.
+		if(iter->flags & DETECTOR_EJECTILE){ traceDetector(1, *iter, Ejectile); }
 	}
-	named.clear();
-	
-	// Information output and cleanup
-	std::cout << "\n ------------- Simulation Complete --------------\n";
-	std::cout << " Simulation Time: " << (float)(clock()-timer)/CLOCKS_PER_SEC << " seconds\n"; 
-	std::cout << " Total MC Events: " << Nreactions << "\n";
-	std::cout << " Total Detector Hits: " << NdetHit << "\n";
-	std::cout << "  Vetoed Events: " << NvetoEvents << " (" << (100.0*NvetoEvents)/Nreactions << "%)\n";
-	std::cout << "  Recoil Hits:   " << NrecoilHits << " (" << (100.0*NrecoilHits)/Nreactions << "%)\n";
-	std::cout << "  Ejectile Hits: " << NejectileHits << " (" << (100.0*NejectileHits)/Nreactions << "%)\n";
-	std::cout << "  Gamma Hits:    " << NgammaHits << " (" << (100.0*NgammaHits)/Nreactions << "%)\n";
-	if(beam_stopped > 0 || eject_stopped > 0 || recoil_stopped > 0){
-		std::cout << " Particles Stopped in Target:\n";
-		if(beam_stopped > 0){ std::cout << "  Beam: " << beam_stopped << " (" << 100.0*beam_stopped/Nsimulated << "%)\n"; }
-		if(eject_stopped > 0){ std::cout << "  Ejectiles: " << eject_stopped << " (" << 100.0*eject_stopped/Nsimulated << "%)\n"; }
-		if(recoil_stopped > 0){ std::cout << "  Recoils: " << recoil_stopped << " (" << 100.0*recoil_stopped/Nsimulated << "%)\n"; }
+}
+
+/// Trace a gamma ray through the gamma detectors it hits until it is detected.
+void vandmcWorker::traceGamma(){
+	if(sim->gamma_dets.empty()){ return; }
+	if(Egamma <= 0.0 && !sim->NeutronSource){ return; } // Do not process the ground state.
+
+	// Simulate the gamma emission. The gamma rays are emitted isotropically from the reaction point.
+	Vector3 direction;
+	UnitSphereRandom(rng, direction);
+	findHits(direction, DETECTOR_GAMMA, gamma_hits);
+	for(std::vector<DetectorHit>::const_iterator iter = gamma_hits.begin(); iter != gamma_hits.end(); iter++){
+		if(traceDetector(2, *iter, direction)){ break; } // Done tracking the gamma ray.
 	}
-	if(SupplyRates){ 
-		double beamTime = 0.0;
-		for(unsigned int i = 0; i < NRecoilStates; i++){
-			beamTime += kind.GetDistribution(i)->GetRate()*kind.GetNreactions(i);
+}
+
+/** Find the detectors with any of the roles in mask_ which are hit by a ray from the reaction point.
+  * The angular grid lists the detectors which may be hit by a ray in the direction of the particle.
+  * If the reaction point lies outside the region covered by the grid, the tree selects the detectors
+  * whose bounding box is crossed by the ray instead. The store then intersects the candidates one
+  * shape group at a time, skipping detectors without any of the requested roles. The hits in hits_
+  * are sorted by the point where the ray enters each detector, so a particle passing through several
+  * stacked detectors reaches them in the order it would physically. Return the number of detectors hit.
+  */
+size_t vandmcWorker::findHits(const Vector3 &direction_, const unsigned int &mask_, std::vector<DetectorHit> &hits_){
+	hits_.clear();
+	slots.clear();
+
+	// Sorting the store slots groups the candidates by shape.
+	const DetectorStore &store = sim->detector_store;
+	const unsigned int *cell;
+	size_t count;
+	if(sim->detector_grid.GetCandidates(lab_beam_interaction, direction_, cell, count)){
+		if(count == 0){ return 0; }
+		for(size_t i = 0; i < count; i++){
+			slots.push_back(store.GetSlot(cell[i]));
 		}
-		std::cout << " Beam Time: " << beamTime << " seconds (" << beamTime/3600 << " hrs.)\n"; 
 	}
-	
-	file->cd();
-	VANDMCtree->Write();
+	else{
+		if(sim->detector_tree.GetCandidates(lab_beam_interaction, direction_, candidates) == 0){ return 0; }
+		for(std::vector<BVHCandidate>::const_iterator iter = candidates.begin(); iter != candidates.end(); iter++){
+			slots.push_back(store.GetSlot(iter->index));
+		}
+	}
+	std::sort(slots.begin(), slots.end());
 
-	std::cout << "  Wrote file " << output_filename << "\n";
-	std::cout << "   Wrote " << VANDMCtree->GetEntries() << " tree entries for VANDMC\n";
-	file->Close();
-	
-	delete file;
-	delete[] ExRecoilStates;
-	delete[] totXsect;
+	return store.Trace(lab_beam_interaction, direction_, slots, hits_, mask_);
+}
 
-	for(std::vector<Primitive*>::iterator iter = vandle_bars.begin(); iter != vandle_bars.end(); iter++){
-		delete *iter;
+/** Trace a particle from the reaction point through a single detector and record the hit.
+  * param[in] type_ The type of particle (0=recoil, 1=ejectile, 2=gamma).
+  * param[in] hit_ The intersection of the particle with the detector, from the detector store.
+  * param[in] direction_ The direction of the particle in the lab frame.
+  * Return true once the hit has been recorded.
+  */
+bool vandmcWorker::traceDetector(const int &type_, const DetectorHit &hit_, const Vector3 &direction_){
+	Primitive *det_ = hit_.prim;
+	double fpath1 = hit_.t1;
+	double fpath2 = hit_.t2;
+	HitDetect1 = hit_.P1;
+
+	NdetHit++; 
+
+	// Calculate the vector pointing from the first intersection point to the second
+	Vector3 temp_vector;
+	if(fpath1 >= 0.0 && fpath2 >= 0.0){ 
+		// The ray originates outside the detector. In this case, HitDetect1 represents the vector
+		// from the origin to the point at which the ray intersects the detector surface.
+		temp_vector = ((lab_beam_interaction + direction_*fpath2)-HitDetect1); 
 	}
-	vandle_bars.clear();
+	else{ 
+		// The ray originates within the detector. HitDetect1 already represents the vector from
+		// the origin to the intersection of the surface of the detector.
+		temp_vector = HitDetect1; 
+	}
+
+	// Solve for the energy deposited in the material. Time spent tracing up to this point is
+	// added to the stage for this particle type, without counting a call.
+	double QDC = 0.0;
+	double dist_traveled = 0.0;
+	if(det_->UseMaterial()){ // Do energy loss and range considerations
+		profiler.Mark((type_ == 0 ? PROFILE_RECOIL : (type_ == 1 ? PROFILE_EJECTILE : PROFILE_GAMMA)), false);
+		if(type_ == 0){ 
+			if(sim->recoil_part.GetZ() > 0){ // Calculate energy loss for the recoil in the detector
+				QDC = ErecoilMod - sim->recoil_tables[det_->GetMaterial()].GetNewE(ErecoilMod, temp_vector.Length(), dist_traveled);
+			}
+			else{ std::cout << " ERROR: Doing energy loss on recoil particle with Z == 0???\n"; }
+		}	
+		else if(type_ == 1){
+			if(sim->eject_part.GetZ() > 0){ // Calculate energy loss for the ejectile in the detector
+				QDC = EejectMod - sim->eject_tables[det_->GetMaterial()].GetNewE(EejectMod, temp_vector.Length(), dist_traveled);
+			}
+			else{ std::cout << " ERROR: Doing energy loss on ejectile particle with Z == 0???\n"; }
+		}
+		else if(type_ == 2){ std::cout << " ERROR: Doing energy loss on a gamma ray???\n"; }
+		profiler.Mark(PROFILE_DET_ELOSS);
+	}
+	else{ // Do not do energy loss calculations. The particle leaves all of its energy in the detector.
+		dist_traveled = temp_vector.Length()*rng.Uniform(); // The particle penetrates a random distance into the detector and stops.
+		if(type_ == 0){ QDC = ErecoilMod; } // The recoil may leave any portion of its energy inside the detector
+		else if(type_ == 1){ QDC = EejectMod; } // The ejectile may leave any portion of its energy inside the detector
+		else if(type_ == 2){ QDC = Egamma; }
+	}
+
+	// If particle originates outside of the detector, add the flight path to the first encountered
+	// detector face. Otherwise, if the particle originates inside the detector (i.e. a detector at
+	// the origin), the distance traveled through the detector is already the total flight path and
+	// the time of flight is irrelevant.
+	double tof = 0.0;
+	if(fpath1 >= 0.0){
+		dist_traveled += fpath1;
+		
+		// Calculate the particle ToF (ns)
+		if(type_ == 0){ 
+			recoil_tof = (dist_traveled/c)*std::sqrt(0.5*kind.GetMrecoilMeV()/ErecoilMod); 
+			recoil_tof += rndgauss0(rng, sim->timeRes); // Smear tof due to PIXIE resolution
+		}
+		else if(type_ == 1){ 
+			tof = (dist_traveled/c)*std::sqrt(0.5*kind.GetMejectMeV()/EejectMod);
+			tof += rndgauss0(rng, sim->timeRes); // Smear tof due to PIXIE resolution
+			if(recoil_tof > 0.0){ tof = tof - recoil_tof; }
+		}
+		else if(type_ == 2){ 
+			tof = dist_traveled/c;
+			tof += rndgauss0(rng, sim->timeRes); // Smear tof due to PIXIE resolution
+			if(recoil_tof > 0.0){ tof = tof - recoil_tof; }
+		}
+	}
+	if(type_ == 0){ tof = recoil_tof; }
+
+	// Get the local coordinates of the intersection point.
+	det_->GetLocalCoords(HitDetect1, hit_x, hit_y, hit_z);
+
+	// Calculate the lab angles of the detector intersection point. Ignore normalization, we're
+	// going to throw away R anyway.
+	Vector3 hitSphere;
+	Cart2Sphere(HitDetect1, hitSphere);
+
+	// Calculate the hit detection point in 3d space. This point will lie along the vector pointing
+	// from the origin to the point where the ray intersects a detector and takes finite range of a
+	// particle in a material into account.
+	HitDetect1.Normalize();
+	HitDetect1 = HitDetect1*dist_traveled;
+
+	// Main output
+	if(type_ == 0){
+		current->recoil.Append(HitDetect1.axis[0], HitDetect1.axis[1], HitDetect1.axis[2], HitDetect1.Length(), hitSphere.axis[1]*rad2deg,
+		                       hitSphere.axis[2]*rad2deg, QDC, tof*(1E9), rdata.Erecoil, hit_x, hit_y, hit_z, det_->GetLoc(), false);
+		recoil_detections++;
 	
+		// Adjust the recoil energy to take energy loss into account. 
+		ErecoilMod = ErecoilMod - QDC;
+	}
+	else if(type_ == 1){
+		current->eject.Append(HitDetect1.axis[0], HitDetect1.axis[1], HitDetect1.axis[2], HitDetect1.Length(), hitSphere.axis[1]*rad2deg,
+		                      hitSphere.axis[2]*rad2deg, QDC, tof*(1E9), rdata.Eeject, hit_x, hit_y, hit_z, det_->GetLoc(), false);
+		eject_detections++;
+					
+		// Adjust the ejectile energy to take energy loss into account. 
+		EejectMod = EejectMod - QDC;
+	}
+	else if(type_ == 2){ 
+		current->eject.Append(HitDetect1.axis[0], HitDetect1.axis[1], HitDetect1.axis[2], HitDetect1.Length(), hitSphere.axis[1]*rad2deg,
+		                      hitSphere.axis[2]*rad2deg, Egamma, tof*(1E9), 0.0, hit_x, hit_y, hit_z, det_->GetLoc(), true);
+		gamma_detections++;
+	}
+
 	return true;
-} 
+}
 
 int main(int argc, char *argv[]){
 	vandmc obj;
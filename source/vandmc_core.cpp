@@ -10,6 +10,8 @@
  * \date Feb. 26th, 2016
  */
 #include <iomanip>
+#include <atomic>
+#include <time.h>
 
 #include "vandmc_core.hpp"
 #include "detectors.hpp"
@@ -43,14 +45,14 @@ bool GetT1T2(const Vector3 &p1_, const Vector3 &d1_, const Vector3 &p2_, const V
 	}
 	else if(d1_.axis[1] == 0){ // Line 1 is horizontal.
 		t2 = (p1_.axis[1] - p2_.axis[1]) / d2_.axis[1];
-		t1 = (p2_.axis[1] - p1_.axis[1] + d2_.axis[0]*t2) / d1_.axis[0];		
+		t1 = (p2_.axis[0] - p1_.axis[0] + d2_.axis[0]*t2) / d1_.axis[0];		
 	}
 	else if(d2_.axis[0] == 0){ // Line 2 is vertical.
-		t1 = (p2_.axis[0] - p2_.axis[0]) / d1_.axis[0];
+		t1 = (p2_.axis[0] - p1_.axis[0]) / d1_.axis[0];
 		t2 = (p1_.axis[1] - p2_.axis[1] + d1_.axis[1]*t1) / d2_.axis[1];
 	}
 	else if(d2_.axis[1] == 0){ // Line 2 is horizontal.
-		t1 = (p2_.axis[1] - p2_.axis[1]) / d1_.axis[1];
+		t1 = (p2_.axis[1] - p1_.axis[1]) / d1_.axis[1];
 		t2 = (p1_.axis[0] - p2_.axis[0] + d1_.axis[0]*t1) / d2_.axis[0];
 	}
 	
@@ -208,6 +210,88 @@ bool Line::Intersect(const Ray &ray_, Vector3 &p){
 	return false;
 }
 
+/////////////////////////////////////////////////////////////////////
+// RandomEngine
+/////////////////////////////////////////////////////////////////////
+
+/// Reset the engine to the start of stream number stream_ of seed seed_.
+void RandomEngine::Seed(const uint64_t &seed_, const unsigned int &stream_/*=0*/){
+	seed = seed_;
+	stream = stream_;
+
+	// Fill the state using the splitmix64 generator, as recommended by the authors.
+	uint64_t x = seed;
+	for(int i = 0; i < 4; i++){
+		uint64_t z = (x += 0x9e3779b97f4a7c15ULL);
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+		state[i] = z ^ (z >> 31);
+	}
+
+	// Skip ahead to the start of the requested stream.
+	for(unsigned int i = 0; i < stream; i++){
+		Jump();
+	}
+}
+
+/// Advance the engine by 2^128 draws.
+void RandomEngine::Jump(){
+	static const uint64_t jump[] = { 0x180ec6d33cfd0abaULL, 0xd5a61266f0c9392cULL, 0xa9582618e03fc9aaULL, 0x39abdc4529b1661cULL };
+
+	uint64_t s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+	for(int i = 0; i < 4; i++){
+		for(int b = 0; b < 64; b++){
+			if(jump[i] & (1ULL << b)){
+				s0 ^= state[0];
+				s1 ^= state[1];
+				s2 ^= state[2];
+				s3 ^= state[3];
+			}
+			Next();
+		}
+	}
+
+	state[0] = s0;
+	state[1] = s1;
+	state[2] = s2;
+	state[3] = s3;
+}
+
+/// Mixed into the default seed, so the default engines never share a stream with an engine built from the same seed.
+const uint64_t defaultSeedSalt = 0x6a09e667f3bcc909ULL;
+
+/// The seed of the default random number engines (see SetDefaultRandomSeed).
+std::atomic<uint64_t> defaultRandomSeed(time(NULL));
+
+/// Incremented each time the default seed is set, so that every thread knows to reseed its default engine.
+std::atomic<unsigned int> defaultRandomGeneration(1);
+
+/// The stream number given to the next thread which asks for its default engine.
+std::atomic<unsigned int> defaultRandomStream(0);
+
+/** Set the seed of the random number engines used by functions which are not passed an explicit engine.
+  * Each thread reseeds its engine with its own stream of seed_ the next time it asks for it.
+  */
+void SetDefaultRandomSeed(const uint64_t &seed_){
+	defaultRandomSeed = seed_;
+	defaultRandomStream = 0;
+	defaultRandomGeneration++;
+}
+
+/** Return the random number engine used by functions which are not passed an explicit engine. Each thread
+  * gets its own stream of the default seed, numbered in the order in which the threads first ask for it.
+  */
+RandomEngine &GetDefaultRandomEngine(){
+	static thread_local RandomEngine engine;
+	static thread_local unsigned int generation = 0;
+	const unsigned int current = defaultRandomGeneration;
+	if(generation != current){
+		engine.Seed(defaultRandomSeed ^ defaultSeedSalt, defaultRandomStream++);
+		generation = current;
+	}
+	return engine;
+}
+
 /////////////////////////////////////////////////////////////////////
 // AngularDist
 /////////////////////////////////////////////////////////////////////
@@ -343,15 +427,14 @@ bool AngularDist::Initialize(const double &xsection_){
 	return (init = true);	
 }
 
-/** Return a random angle sampled from the distribution (rad).
-  * return the center of mass angle (rad) sampled from the distributionj
-  * and return -1 if the sampling fails for any reason.
+/** Return the angle at which the cumulative distribution reaches a fraction frac_ of the total (rad).
+  * frac_ must be in the range [0, 1]. Return -1 if the angle cannot be found for any reason.
   */
-double AngularDist::Sample(){
+double AngularDist::GetAngle(const double &frac_){
 	if(!init){ return -1; }
 	
 	if(num_points > 0){ // Standard (non-isotropic) cross section.
-		double rand_xsect = frand()*reaction_xsection;
+		double rand_xsect = frac_*reaction_xsection;
 		for(unsigned int i = 0; i < num_points-1; i++){
 			if(integral[i] <= rand_xsect && rand_xsect <= integral[i+1]){ 
 				return (com_theta[i] + (rand_xsect-integral[i])*(com_theta[i+1]-com_theta[i])/(integral[i+1]-integral[i]));
@@ -359,12 +442,20 @@ double AngularDist::Sample(){
 		}
 	}
 	else{ // Isotropic cross section.
-		return (frand()*pi);
+		return (frac_*pi);
 	}
 	
 	return -1;
 }
 
+/** Return a random angle sampled from the distribution (rad).
+  * return the center of mass angle (rad) sampled from the distributionj
+  * and return -1 if the sampling fails for any reason.
+  */
+double AngularDist::Sample(RandomEngine &rng_){
+	return GetAngle(rng_.Uniform());
+}
+
 /////////////////////////////////////////////////////////////////////
 // Support Functions
 /////////////////////////////////////////////////////////////////////
@@ -382,9 +473,13 @@ bool IsInVector(const std::string &input_, const std::vector<std::string> &str_v
 // offset_ is the offset in the negative z-direction (in m)
 // beam is a 2d vector in the xy-plane (z=0) pointing from the origin to a point inside the target beamspot
 void RandomGauss(double fwhm_, double offset_, Vector3 &beam){
+	RandomGauss(GetDefaultRandomEngine(), fwhm_, offset_, beam);
+}
+
+void RandomGauss(RandomEngine &rng_, double fwhm_, double offset_, Vector3 &beam){
 	// Uniformly sample the gaussian profile
-	double ranX = rndgauss0(fwhm_);
-	double ranY = rndgauss0(fwhm_);
+	double ranX = rndgauss0(rng_, fwhm_);
+	double ranY = rndgauss0(rng_, fwhm_);
 	
 	beam = Vector3(ranX, ranY, -offset_);
 }
@@ -394,9 +489,13 @@ void RandomGauss(double fwhm_, double offset_, Vector3 &beam){
 // offset_ is the offset in the negative z-direction (in m)
 // beam is a 2d vector in the xy-plane (z=0) pointing from the origin to a point inside the target beamspot
 void RandomCircle(double radius_, double offset_, Vector3 &beam){
+	RandomCircle(GetDefaultRandomEngine(), radius_, offset_, beam);
+}
+
+void RandomCircle(RandomEngine &rng_, double radius_, double offset_, Vector3 &beam){
 	// Uniformly sample the circular profile
-	double ranT = 2*pi*frand();
-	double ranU = frand() + frand();
+	double ranT = 2*pi*rng_.Uniform();
+	double ranU = rng_.Uniform() + rng_.Uniform();
 	double ranR;
 	
 	if(ranU > 1){ ranR = 2 - ranU; }
@@ -411,8 +510,12 @@ void RandomCircle(double radius_, double offset_, Vector3 &beam){
 // offset_ is the offset in the negative z-direction (in m)
 // beam is a 2d vector in the xy-plane (z=0) pointing from the origin to a point inside the target beamspot
 void RandomHalo(double radius_, double offset_, Vector3 &beam){
+	RandomHalo(GetDefaultRandomEngine(), radius_, offset_, beam);
+}
+
+void RandomHalo(RandomEngine &rng_, double radius_, double offset_, Vector3 &beam){
 	// Uniformly sample the circular profile
-	double ranT = 2*pi*frand();
+	double ranT = 2*pi*rng_.Uniform();
 	
 	beam = Vector3(radius_*std::cos(ranT), radius_*std::sin(ranT), -offset_);
 }
@@ -487,18 +590,33 @@ double max(double v1, double v2){
 
 // Return a random number between low and high
 double frand(double low, double high){
-	return low+(double(rand())/RAND_MAX)*(high-low);
+	return low+GetDefaultRandomEngine().Uniform()*(high-low);
+}
+
+// Return a random number between low and high
+double frand(RandomEngine &rng_, double low, double high){
+	return low+rng_.Uniform()*(high-low);
 }
 
 // Mimic the fortran rand() function
 double frand(){
-	return double(rand())/RAND_MAX;
+	return GetDefaultRandomEngine().Uniform();
+}
+
+// Mimic the fortran rand() function
+double frand(RandomEngine &rng_){
+	return rng_.Uniform();
 }
 
 // Sample a point on the surface of the unit sphere
 void UnitSphereRandom(Vector3 &vec){
-	double u = 2*frand()-1;
-	double theta = 2*pi*frand();
+	UnitSphereRandom(GetDefaultRandomEngine(), vec);
+}
+
+// Sample a point on the surface of the unit sphere
+void UnitSphereRandom(RandomEngine &rng_, Vector3 &vec){
+	double u = 2*rng_.Uniform()-1;
+	double theta = 2*pi*rng_.Uniform();
 	vec.axis[0] = std::sqrt(1-u*u)*std::cos(theta);
 	vec.axis[1] = std::sqrt(1-u*u)*std::sin(theta);
 	vec.axis[2] = u;
@@ -506,13 +624,23 @@ void UnitSphereRandom(Vector3 &vec){
 
 // Sample a point on the surface of the unit sphere
 void UnitSphereRandom(double &theta, double &phi){
-	phi = 2*pi*frand();
-	theta = std::acos(2*frand()-1);
+	UnitSphereRandom(GetDefaultRandomEngine(), theta, phi);
+}
+
+// Sample a point on the surface of the unit sphere
+void UnitSphereRandom(RandomEngine &rng_, double &theta, double &phi){
+	phi = 2*pi*rng_.Uniform();
+	theta = std::acos(2*rng_.Uniform()-1);
 }
 
 // Sample a point on the unit circle
 double UnitCircleRandom(){
-	return 2*pi*frand();
+	return 2*pi*GetDefaultRandomEngine().Uniform();
+}
+
+// Sample a point on the unit circle
+double UnitCircleRandom(RandomEngine &rng_){
+	return 2*pi*rng_.Uniform();
 }
 
 // Calculate proper bar spacing for a wall of VANDLE bars
@@ -585,6 +713,10 @@ double radlength(unsigned int A, unsigned int Z){
 /////////////////////////////////////////////////////////////////////
 
 double rndgauss0(double w){
+	return rndgauss0(GetDefaultRandomEngine(), w);
+}
+
+double rndgauss0(RandomEngine &rng_, double w){
 	// rndgauss0, a cut down version of rndgauss1; 
 	// returns a random number with FWHM w centred at 0;
 
@@ -595,7 +727,7 @@ double rndgauss0(double w){
 	const double d1=1.432788, d2=0.189269, d3=0.001308; 
 	const double widthfact=0.424628450; 
 
-	t = frand(); 
+	t = rng_.Uniform(); 
 
 	if(t > 0.5){ t = t-0.5; }
 	if(t < 1e-30){ t = 11.46380587; }
@@ -608,7 +740,7 @@ double rndgauss0(double w){
 	t=t-(c0+c1*t+c2*tsq)/(1.00+d1*t+(d2+d3*t)*tsq);
 	
 	//     now randomize x in positive and negative direction
-	if(frand() > 0.5){ t = -t; }
+	if(rng_.Uniform() > 0.5){ t = -t; }
 	
 	//     now correct for standard deviation
 	return widthfact*w*t; 
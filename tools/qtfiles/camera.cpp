@@ -5,6 +5,7 @@
 #include "ui_camera.h"
 
 #include "detectors.hpp"
+#include "bvh.hpp"
 
 RGBcolor::RGBcolor(int color_/*=0xFFFFFF*/){
 	SetColor(color_);
@@ -221,13 +222,18 @@ void Camera::Render() {
     unsigned char red, green, blue;
 
     float luminosity; // Intensity of the color of the drawing pen.
-    int index; // Current detector index in the Primitive vector.
     int detector = 0; // Index of visible detector in the Primitive vector.
     double currentX; // Current pixel along the x-axis.
     double currentY; // Current pixel along the y-axis.
     double depth; // Distance of the "pixel" from the viewer.
     double t1; // "Distance" parameter such that P1 = position + ray*t1.
     double t2; // Not used.
+
+    // Build a bounding volume hierarchy so each pixel only tests the detectors its ray may hit.
+    // The tree is rebuilt for every render since detectors may be moved between renders.
+    DetectorBVH tree(primitives);
+    std::vector<BVHCandidate> candidates;
+
     for(int i = 0; i < sizeY; i++){
     	ui->progressBar->setValue((float(i)*100/sizeY));
         currentY = (pixelY/2.0) + i*pixelY;
@@ -240,16 +246,16 @@ void Camera::Render() {
             depth = 9999;
             luminosity = 0;
             
-            // Loop over all pixels in this row.
-           index = 0;
-            for(std::vector<Primitive*>::iterator iter = primitives.begin(); iter != primitives.end(); iter++){
-                if((*iter)->IntersectPrimitive(pos, ray, p1, normal, t1, t2) && t1 < depth){
+            // Loop over all detectors along the ray, in order of distance from the viewer.
+            tree.GetCandidates(pos, ray, candidates);
+            for(std::vector<BVHCandidate>::iterator iter = candidates.begin(); iter != candidates.end(); iter++){
+                if(iter->tEntry > depth){ break; } // No remaining detector can be closer.
+                if(iter->prim->IntersectPrimitive(pos, ray, p1, normal, t1, t2) && t1 < depth){
 			        luminosity = fabs(ray.CosAngle(normal));
 			        if(luminosity < 0.0 || luminosity > 1.0){ continue; }
-			        detector = index;
+			        detector = iter->index;
                 	depth = t1;
                 }
-                index++;
             }
             
             // Only draw the pixel if we found a valid intersection.
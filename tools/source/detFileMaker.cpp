@@ -1,22 +1,70 @@
-
-
-
 #include <iostream>
 #include <fstream>
 #include <string>
 
 #include "vandmc_core.hpp"
 
+// Get the length, width and depth of a VANDLE bar size (m). Return false if the size is unknown.
+bool getBarSize(const std::string &size_, double &length, double &width, double &depth){
+	if(size_ == "small"){ length = 0.6; width = 0.03; depth = 0.03; }
+	else if(size_ == "medium"){ length = 1.2; width = 0.06; depth = 0.03; }
+	else if(size_ == "large"){ length = 2.0; width = 0.05; depth = 0.05; }
+	else{ return false; }
+	return true;
+}
+
 int main(){
-	double radius;
-	double spacing;
-	double startAngle;
+	std::string arrayType;
+	std::cout << " Enter array type (ring or wall): "; std::cin >> arrayType;
+	if(arrayType != "ring" && arrayType != "wall"){
+		std::cout << "  ERROR! Unknown array type \"" << arrayType << "\"!\n";
+		return -1;
+	}
+
+	std::string barSize;
+	double length, width, depth;
+	std::cout << " Enter bar size (small, medium or large): "; std::cin >> barSize;
+	if(!getBarSize(barSize, length, width, depth)){
+		std::cout << "  ERROR! Unknown bar size \"" << barSize << "\"!\n";
+		return -1;
+	}
+
 	int Ndet;
+	double x = 0.0, y = 0.0, z = 0.0;
+	double angle = 0.0;
+	double param1, param2 = 0.0;
+	if(arrayType == "ring"){
+		double radius;
+		double spacing;
+		double startAngle;
+
+		std::cout << " Enter detector radius (m): "; std::cin >> radius;
+		std::cout << " Enter detector spacing (deg): "; std::cin >> spacing;
+		std::cout << " Enter number of detectors: "; std::cin >> Ndet;
+		std::cout << " Enter angle of 1st det (deg): "; std::cin >> startAngle;
+
+		angle = startAngle*deg2rad;
+		param1 = radius;
+		param2 = spacing*deg2rad;
+	}
+	else{
+		double distance;
+		double spacing;
+
+		std::cout << " Enter wall distance along the beam axis (m): "; std::cin >> distance;
+		std::cout << " Enter wall angle (deg): "; std::cin >> angle;
+		std::cout << " Enter gap between bars (m): "; std::cin >> spacing;
+		std::cout << " Enter number of detectors: "; std::cin >> Ndet;
 
-	std::cout << " Enter detector radius (m): "; std::cin >> radius;
-	std::cout << " Enter detector spacing (deg): "; std::cin >> spacing;
-	std::cout << " Enter number of detectors: "; std::cin >> Ndet;
-	std::cout << " Enter angle of 1st det (deg): "; std::cin >> startAngle;
+		angle *= deg2rad;
+		Sphere2Cart(distance, angle, 0, x, y, z);
+		param1 = spacing;
+	}
+
+	if(Ndet <= 0){
+		std::cout << "  ERROR! Number of detectors must be greater than zero!\n";
+		return -1;
+	}
 
 	std::string filename;
 	std::cout << " Enter detector filename: "; std::cin >> filename;
@@ -27,14 +75,15 @@ int main(){
 		return -1;
 	}
 
-	file << "#x\ty\tz\ttheta\tphi\tpsi\ttype\tsybtype\tlength\twidth\tdepth\tmaterial\n";
+	// Write the whole array as a single entry. The bars are generated when the file is read.
+	file << "#x\ty\tz\ttheta\tphi\tpsi\ttype\tsybtype\tlength\twidth\tdepth\tmaterial\tnbars\t";
+	if(arrayType == "ring"){ file << "radius\tstep\n"; }
+	else{ file << "spacing\n"; }
 
-	double x, y, z, angle;
-	for(int i = 0; i < Ndet; i++){
-		angle = startAngle + spacing*i;
-		Sphere2Cart(radius, angle*deg2rad, 0, x, y, z);
-		file << x << "\t" << y << "\t" << z << "\t" << angle*deg2rad << "\t0\t0\tvandle\tsmall\n";
-	}
+	file << x << "\t" << y << "\t" << z << "\t" << angle << "\t0\t0\tvandle\t" << arrayType << "\t";
+	file << length << "\t" << width << "\t" << depth << "\tnone\t" << Ndet << "\t" << param1;
+	if(arrayType == "ring"){ file << "\t" << param2; }
+	file << "\n";
 
 	std::cout << "  Done! Wrote file \"" << filename << "\".\n";
 
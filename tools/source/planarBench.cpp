@@ -0,0 +1,119 @@
+#include <iostream>
+#include <vector>
+#include <chrono>
+
+#include "vandmc_core.hpp"
+#include "geometry.hpp"
+
+// Update the largest difference between two results.
+void compare(const double &val1_, const double &val2_, double &maxDiff){
+	double diff = dabs(val1_-val2_)/(dabs(val2_) > 1.0 ? dabs(val2_) : 1.0);
+	if(diff > maxDiff){ maxDiff = diff; }
+}
+
+// Return a random point inside a box centered on the origin.
+Vector3 randomPoint(RandomEngine &rng_, const double &size_){
+	return Vector3(frand(rng_, -size_, size_), frand(rng_, -size_, size_), frand(rng_, -size_, size_));
+}
+
+void help(char * prog_name_){
+	std::cout << "  SYNTAX: " << prog_name_ << " [detectors] [rays]\n";
+	std::cout << "   detectors | Number of randomly placed bars to test (default=1000).\n";
+	std::cout << "   rays      | Number of random rays to trace through each bar (default=1000).\n";
+}
+
+int main(int argc, char* argv[]){
+	if(argc > 3){
+		std::cout << " Error: Invalid number of arguments to " << argv[0] << ". Expected at most 2, received " << argc-1 << ".\n";
+		help(argv[0]);
+		return 1;
+	}
+
+	unsigned int nDetectors = (argc > 1 ? strtoul(argv[1], NULL, 10) : 1000);
+	unsigned int nRays = (argc > 2 ? strtoul(argv[2], NULL, 10) : 1000);
+	if(nDetectors == 0 || nRays == 0){
+		help(argv[0]);
+		return 1;
+	}
+
+	RandomEngine rng(1);
+
+	// Generate bars of random size, position and rotation.
+	std::vector<Planar> bars(nDetectors);
+	for(std::vector<Planar>::iterator iter = bars.begin(); iter != bars.end(); iter++){
+		iter->SetSize(frand(rng, 0.01, 2.0), frand(rng, 0.01, 0.2), frand(rng, 0.01, 0.1));
+		iter->SetPosition(randomPoint(rng, 1.0));
+		iter->SetRotation(frand(rng, 0.0, 2*pi), frand(rng, 0.0, 2*pi), frand(rng, 0.0, 2*pi));
+		iter->Freeze();
+	}
+
+	// Generate rays which start anywhere (including inside the bar) and point near each bar.
+	std::vector<Vector3> offsets(nDetectors*nRays), directions(nDetectors*nRays);
+	for(unsigned int i = 0; i < nDetectors; i++){
+		Vector3 position;
+		bars[i].GetPosition(position);
+		double size = bars[i].GetLength();
+		for(unsigned int j = 0; j < nRays; j++){
+			unsigned int index = i*nRays+j;
+			if(j % 10 == 0){ bars[i].GetRandomPointInside(offsets[index], rng); }
+			else{ offsets[index] = randomPoint(rng, 2.0); }
+			directions[index] = position + randomPoint(rng, 0.6*size) - offsets[index];
+		}
+	}
+
+	// Compare the slab method to the reference face-by-face intersection.
+	Vector3 P1, P1ref, norm, normRef;
+	double t1, t2, t1ref, t2ref;
+	unsigned int nHits = 0, nHitMismatch = 0, nFaceMismatch = 0;
+	double maxT1Diff = 0.0, maxT2Diff = 0.0;
+	for(unsigned int i = 0; i < nDetectors; i++){
+		for(unsigned int j = 0; j < nRays; j++){
+			unsigned int index = i*nRays+j;
+			t2 = t2ref = -1.0;
+			bool hit = bars[i].IntersectPrimitive(offsets[index], directions[index], P1, norm, t1, t2);
+			bool hitRef = bars[i].Primitive::IntersectPrimitive(offsets[index], directions[index], P1ref, normRef, t1ref, t2ref);
+			if(hit != hitRef){
+				nHitMismatch++;
+				continue;
+			}
+			if(!hit){ continue; }
+			nHits++;
+			compare(t1, t1ref, maxT1Diff);
+			compare(t2, t2ref, maxT2Diff);
+			if(norm.Dot(normRef) < 0.999){ nFaceMismatch++; }
+		}
+	}
+	std::cout << " Traced " << nDetectors*nRays << " rays (" << nHits << " hits):\n";
+	std::cout << "  Hit mismatches:  " << nHitMismatch << "\n";
+	std::cout << "  Face mismatches: " << nFaceMismatch << "\n";
+	std::cout << "  Largest t1 difference: " << maxT1Diff << "\n";
+	std::cout << "  Largest t2 difference: " << maxT2Diff << "\n";
+
+	// Time both versions.
+	double sum1 = 0.0, sum2 = 0.0;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for(unsigned int i = 0; i < nDetectors; i++){
+		for(unsigned int j = 0; j < nRays; j++){
+			unsigned int index = i*nRays+j;
+			if(bars[i].IntersectPrimitive(offsets[index], directions[index], P1, norm, t1, t2)){ sum1 += t1; }
+		}
+	}
+	double slabTime = std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+
+	start = std::chrono::steady_clock::now();
+	for(unsigned int i = 0; i < nDetectors; i++){
+		for(unsigned int j = 0; j < nRays; j++){
+			unsigned int index = i*nRays+j;
+			if(bars[i].Primitive::IntersectPrimitive(offsets[index], directions[index], P1, norm, t1, t2)){ sum2 += t1; }
+		}
+	}
+	double faceTime = std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+
+	std::cout << "\n Timing " << nDetectors*nRays << " calls to IntersectPrimitive:\n";
+	std::cout << "  Slab method:  " << slabTime << " s (" << 1E9*slabTime/(nDetectors*nRays) << " ns per call)\n";
+	std::cout << "  Face by face: " << faceTime << " s (" << 1E9*faceTime/(nDetectors*nRays) << " ns per call)\n";
+	std::cout << "  Speedup: " << faceTime/slabTime << "x\n";
+	std::cout << "  Checksum difference: " << dabs(sum1-sum2) << "\n";
+
+	return (nHitMismatch == 0 && nFaceMismatch == 0 && maxT1Diff < 1E-9 && maxT2Diff < 1E-9 ? 0 : 1);
+}
@@ -0,0 +1,258 @@
+#include <iostream>
+#include <vector>
+#include <chrono>
+
+#include "vandmc_core.hpp"
+#include "materials.hpp"
+#include "threadPool.hpp"
+
+// Reference linear scan interpolation (the original RangeTable lookup).
+double linear_interpolate(const std::vector<double> &x_, const std::vector<double> &y_, const double &val_){
+	if(val_ < x_[0]){ return 0.0; }
+	for(unsigned int i = 0; i < x_.size()-1; i++){
+		if(val_ == x_[i]){ return y_[i]; }
+		else if(val_ == x_[i+1]){ return y_[i+1]; }
+		else if(val_ >= x_[i] && val_ <= x_[i+1]){
+			return (((y_[i+1]-y_[i])/(x_[i+1]-x_[i]))*(val_-x_[i])+y_[i]);
+		}
+	}
+	return -1;
+}
+
+// Reference version of RangeTable::GetNewE using the linear scan.
+double linear_newE(const std::vector<double> &E_, const std::vector<double> &R_, const double &energy_, const double &dist_){
+	double dist_traveled = linear_interpolate(E_, R_, energy_);
+	if(dist_traveled < 0.0){ return -1; }
+	if(dist_traveled - dist_ > 0.0){ return linear_interpolate(R_, E_, dist_traveled - dist_); }
+	return 0.0;
+}
+
+// Fill arrays with the entries of a range table.
+void getEntries(RangeTable &table_, std::vector<double> &E_, std::vector<double> &R_){
+	E_.resize(table_.GetEntries());
+	R_.resize(table_.GetEntries());
+	for(unsigned int i = 0; i < table_.GetEntries(); i++){
+		table_.GetEntry(i, E_[i], R_[i]);
+	}
+}
+
+// Return the time taken to build a range table (in s).
+double timeBuild(RangeTable &table_, const unsigned int &entries_, const double &maxE_, Material *mat_){
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	if(entries_ == 0){ table_.InitAdaptive(0.1, maxE_, 1, 2.0/mev2amu, mat_); }
+	else{ table_.Init(entries_, 0.1, maxE_, 1, 2.0/mev2amu, mat_); }
+	return std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+}
+
+// Return true if two range tables have exactly the same entries.
+bool sameEntries(RangeTable &table1_, RangeTable &table2_){
+	if(table1_.GetEntries() != table2_.GetEntries()){ return false; }
+	double E1, R1, E2, R2;
+	for(unsigned int i = 0; i < table1_.GetEntries(); i++){
+		table1_.GetEntry(i, E1, R1);
+		table2_.GetEntry(i, E2, R2);
+		if(E1 != E2 || R1 != R2){ return false; }
+	}
+	return true;
+}
+
+// Update the largest difference between two results.
+void compare(const double &val1_, const double &val2_, double &maxDiff){
+	double diff = dabs(val1_-val2_)/(dabs(val2_) > 0.0 ? dabs(val2_) : 1.0);
+	if(diff > maxDiff){ maxDiff = diff; }
+}
+
+void help(char * prog_name_){
+	std::cout << "  SYNTAX: " << prog_name_ << " [maxE] [lookups]\n";
+	std::cout << "   maxE    | Maximum energy of the range table in MeV (default=50).\n";
+	std::cout << "   lookups | Number of random lookups to time (default=1000000).\n";
+}
+
+int main(int argc, char* argv[]){
+	if(argc > 3){
+		std::cout << " Error: Invalid number of arguments to " << argv[0] << ". Expected at most 2, received " << argc-1 << ".\n";
+		help(argv[0]);
+		return 1;
+	}
+
+	double maxE = (argc > 1 ? strtod(argv[1], NULL) : 50.0);
+	unsigned int lookups = (argc > 2 ? strtoul(argv[2], NULL, 10) : 1000000);
+	if(maxE <= 0.1 || lookups == 0){
+		help(argv[0]);
+		return 1;
+	}
+
+	// Deuterons in deuterated polyethylene, as used for the beam in the target.
+	Material mat("CD2", 1.06300, 6, 12.0107, 1, 1, 2.01588, 2);
+	RangeTable table;
+	std::cout << " Calculating range table for deuterons in CD2 from 0.1 to " << maxE << " MeV...";
+	table.Init(1000, 0.1, maxE, 1, 2.0/mev2amu, &mat);
+	std::cout << " Done!\n";
+
+	std::vector<double> E, R;
+	getEntries(table, E, R);
+	double maxR = R.back();
+
+	// Generate random energies, ranges and distances (including some outside the table).
+	RandomEngine rng(1);
+	std::vector<double> energies(lookups), ranges(lookups), dists(lookups);
+	for(unsigned int i = 0; i < lookups; i++){
+		energies[i] = frand(rng, 0.0, 1.05*maxE);
+		ranges[i] = frand(rng, 0.0, 1.05*maxR);
+		dists[i] = frand(rng, 0.0, 0.5*maxR);
+	}
+
+	// Compare the table lookups to the reference linear scan.
+	double maxRangeDiff = 0.0, maxEnergyDiff = 0.0, maxNewEDiff = 0.0;
+	for(unsigned int i = 0; i < lookups; i++){
+		compare(table.GetRange(energies[i]), linear_interpolate(E, R, energies[i]), maxRangeDiff);
+		compare(table.GetEnergy(ranges[i]), linear_interpolate(R, E, ranges[i]), maxEnergyDiff);
+		compare(table.GetNewE(energies[i], dists[i]), linear_newE(E, R, energies[i], dists[i]), maxNewEDiff);
+	}
+	std::cout << "\n Largest relative difference from the linear scan:\n";
+	std::cout << "  GetRange:  " << maxRangeDiff << "\n";
+	std::cout << "  GetEnergy: " << maxEnergyDiff << "\n";
+	std::cout << "  GetNewE:   " << maxNewEDiff << "\n";
+
+	// Time both versions of GetNewE, which does one lookup in each direction.
+	double sum1 = 0.0, sum2 = 0.0;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for(unsigned int i = 0; i < lookups; i++){
+		sum1 += table.GetNewE(energies[i], dists[i]);
+	}
+	double tableTime = std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+
+	start = std::chrono::steady_clock::now();
+	for(unsigned int i = 0; i < lookups; i++){
+		sum2 += linear_newE(E, R, energies[i], dists[i]);
+	}
+	double linearTime = std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+
+	std::cout << "\n Timing " << lookups << " calls to GetNewE:\n";
+	std::cout << "  RangeTable:  " << tableTime << " s (" << 1E9*tableTime/lookups << " ns per call)\n";
+	std::cout << "  Linear scan: " << linearTime << " s (" << 1E9*linearTime/lookups << " ns per call)\n";
+	std::cout << "  Speedup: " << linearTime/tableTime << "x\n";
+	std::cout << "  Checksum difference: " << dabs(sum1-sum2) << "\n";
+
+	// Build tables with log-spaced energies. The lookups into them must also match a linear scan of their entries.
+	RangeTable adaptive, reference;
+	double adaptiveTime = timeBuild(adaptive, 0, maxE, &mat);
+	double linearBuildTime = timeBuild(reference, 1000, maxE, &mat);
+	reference = RangeTable();
+	reference.InitAdaptive(0.1, maxE, 1, 2.0/mev2amu, &mat, 1E-10, 1000000);
+
+	std::vector<double> adaptiveE, adaptiveR, referenceE, referenceR;
+	getEntries(adaptive, adaptiveE, adaptiveR);
+	getEntries(reference, referenceE, referenceR);
+	double maxAdaptiveDiff = 0.0;
+	for(unsigned int i = 0; i < lookups; i++){
+		compare(adaptive.GetRange(energies[i]), linear_interpolate(adaptiveE, adaptiveR, energies[i]), maxAdaptiveDiff);
+		compare(adaptive.GetEnergy(ranges[i]), linear_interpolate(adaptiveR, adaptiveE, ranges[i]), maxAdaptiveDiff);
+	}
+	std::cout << "\n Largest relative difference of the log-spaced table from the linear scan: " << maxAdaptiveDiff << "\n";
+
+	// Compare the accuracy of both tables to a log-spaced table with a very small tolerance. The error is taken
+	// relative to the starting energy, since the energy of a particle which almost stops is the difference
+	// between two nearly equal ranges. Particles which leave with less than 0.11 MeV in any table are skipped,
+	// since the energy jumps from the bottom of the table (0.1 MeV) to zero when the particle stops.
+	double linearError = 0.0, adaptiveError = 0.0;
+	for(unsigned int i = 0; i < lookups; i++){
+		if(energies[i] < 0.1 || energies[i] > maxE){ continue; }
+		double exact = reference.GetNewE(energies[i], dists[i]);
+		double linearE = table.GetNewE(energies[i], dists[i]);
+		double adaptiveE = adaptive.GetNewE(energies[i], dists[i]);
+		if(exact < 0.11 || linearE < 0.11 || adaptiveE < 0.11){ continue; }
+		double diff = dabs(linearE-exact)/energies[i];
+		if(diff > linearError){ linearError = diff; }
+		diff = dabs(adaptiveE-exact)/energies[i];
+		if(diff > adaptiveError){ adaptiveError = diff; }
+	}
+	std::cout << "\n Largest error of GetNewE relative to the starting energy (compared to a table with " << reference.GetEntries() << " entries):\n";
+	std::cout << "  Linear, " << table.GetEntries() << " entries: " << linearError << " (built in " << 1E6*linearBuildTime << " us)\n";
+	std::cout << "  Log-spaced, " << adaptive.GetEntries() << " entries: " << adaptiveError << " (built in " << 1E6*adaptiveTime << " us)\n";
+
+	// Time GetNewE for the log-spaced table.
+	start = std::chrono::steady_clock::now();
+	for(unsigned int i = 0; i < lookups; i++){
+		sum2 += adaptive.GetNewE(energies[i], dists[i]);
+	}
+	double adaptiveLookupTime = std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+	std::cout << "  Log-spaced GetNewE: " << 1E9*adaptiveLookupTime/lookups << " ns per call\n";
+
+	// Build the tables for a heavy recoil in several materials, one after another and then using every thread,
+	// first with several tables at once and then one table at a time with its entries split between the threads.
+	std::vector<Material> materials;
+	materials.push_back(Material("Au197", 19.311, 79, 196.96657, 1));
+	materials.push_back(Material("BC408", 1.032, 6, 12.0107, 9, 1, 1.00794, 10));
+	materials.push_back(Material("C2H4", 0.95, 6, 12.0107, 2, 1, 1.00794, 4));
+	materials.push_back(Material("C8H8", 1.05, 6, 12.0107, 8, 1, 1.00794, 8));
+	materials.push_back(Material("C12", 2.2670, 6, 12.0107, 1));
+	materials.push_back(mat);
+	materials.push_back(Material("Si28", 2.3212, 14, 28.0855, 1));
+	const unsigned int nTables = materials.size();
+	Particle recoil("13N", 7, 13);
+	const double startE = recoil.GetKEfromV(0.02*c);
+
+	ThreadPool pool(ThreadPool::GetHardwareThreads());
+	std::vector<RangeTable> serial(nTables), byTable(nTables), byEntry(nTables);
+	std::function<void(const unsigned int &)> job = [&](const unsigned int &index_){
+		byTable[index_].InitAdaptive(startE, 10*maxE, 7, 13/mev2amu, &materials[index_]);
+	};
+
+	start = std::chrono::steady_clock::now();
+	for(unsigned int i = 0; i < nTables; i++){
+		serial[i].InitAdaptive(startE, 10*maxE, 7, 13/mev2amu, &materials[i]);
+	}
+	double serialTime = std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+
+	start = std::chrono::steady_clock::now();
+	pool.Execute(nTables, job);
+	double byTableTime = std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+
+	start = std::chrono::steady_clock::now();
+	for(unsigned int i = 0; i < nTables; i++){
+		byEntry[i].InitAdaptive(startE, 10*maxE, 7, 13/mev2amu, &materials[i], 1E-6, 100000, &pool);
+	}
+	double byEntryTime = std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+
+	unsigned int nDifferent = 0;
+	for(unsigned int i = 0; i < nTables; i++){
+		if(!sameEntries(serial[i], byTable[i]) || !sameEntries(serial[i], byEntry[i])){ nDifferent++; }
+	}
+	std::cout << "\n Building " << nTables << " range tables for 13N up to " << 10*maxE << " MeV using " << pool.GetNumThreads() << " threads:\n";
+	std::cout << "  One table at a time:    " << 1E3*serialTime << " ms\n";
+	std::cout << "  Several tables at once: " << 1E3*byTableTime << " ms (" << serialTime/byTableTime << "x faster)\n";
+	std::cout << "  Entries split:          " << 1E3*byEntryTime << " ms (" << serialTime/byEntryTime << "x faster)\n";
+	std::cout << "  Tables which differ: " << nDifferent << "\n";
+
+	// Build the same tables using the tabulated stopping power model. Each material is tabulated the first
+	// time it is used, so the tables are built twice to separate that from the cost of building the tables.
+	TabulatedStoppingPower model;
+	std::vector<RangeTable> tabulated(nTables), retabulated(nTables);
+	start = std::chrono::steady_clock::now();
+	for(unsigned int i = 0; i < nTables; i++){
+		tabulated[i].InitAdaptive(startE, 10*maxE, 7, 13/mev2amu, &materials[i], 1E-6, 100000, NULL, &model);
+	}
+	double firstTime = std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+
+	start = std::chrono::steady_clock::now();
+	for(unsigned int i = 0; i < nTables; i++){
+		retabulated[i].InitAdaptive(startE, 10*maxE, 7, 13/mev2amu, &materials[i], 1E-6, 100000, &pool, &model);
+	}
+	double secondTime = std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+
+	unsigned int nTabulatedDifferent = 0;
+	for(unsigned int i = 0; i < nTables; i++){
+		if(!sameEntries(tabulated[i], retabulated[i])){ nTabulatedDifferent++; }
+	}
+	std::cout << "\n Building the same tables using the tabulated stopping power (" << model.GetNumElements() << " elements, " << model.GetEntries() << " entries each):\n";
+	std::cout << "  Including tabulation: " << 1E3*firstTime << " ms\n";
+	std::cout << "  Already tabulated:    " << 1E3*secondTime << " ms\n";
+	std::cout << "  Tables which differ:  " << nTabulatedDifferent << "\n";
+	std::cout << "  Stopping power of 13N in " << materials.back().GetName() << " (MeV/um), Bethe and tabulated:\n";
+	for(double energy = 0.5; energy <= 10*maxE; energy *= 4){
+		std::cout << "   " << energy << " MeV: " << 1E-6*materials.back().StopPower(energy, 7, 13/mev2amu) << ", " << 1E-6*model.StopPower(&materials.back(), energy, 7, 13/mev2amu) << "\n";
+	}
+
+	return (nDifferent == 0 && nTabulatedDifferent == 0 && maxRangeDiff < 1E-12 && maxEnergyDiff < 1E-12 && maxNewEDiff < 1E-12 && maxAdaptiveDiff < 1E-12 && adaptiveError < 1E-3 ? 0 : 1);
+}
@@ -1,9 +1,12 @@
 #include <iostream>
 #include <sstream>
 #include <fstream>
+#include <algorithm>
 
 #include "vandmc_core.hpp"
 #include "detectors.hpp"
+#include "bvh.hpp"
+#include "detectorStore.hpp"
 
 #include "comConverter.hpp"
 #include "dataPack.hpp"
@@ -37,15 +40,15 @@ double proper_value(const std::string &prompt_, const double &min_=0.0, bool ge_
 // Generates one output root file named 'mcarlo.root'
 // fwhm_ (m) allows the use of a gaussian particle "source". If fwhm_ == 0.0, a point source is used
 // angle_ (rad) allows the rotation of the particle source about the y-axis
-unsigned int TestDetSetup(dataPack *pack, const std::vector<Primitive*> &bar_array, unsigned int num_trials, bool WriteRXN_, double fwhm_, double angle_, bool ejectile_=true, comConverter *conv=0x0){
+// arrays_ holds the walls and rings of bar_array, whose bars are found directly by the detector tree
+unsigned int TestDetSetup(dataPack *pack, const std::vector<Primitive*> &bar_array, const std::vector<DetectorArray*> &arrays_, unsigned int num_trials, bool WriteRXN_, double fwhm_, double angle_, bool ejectile_=true, comConverter *conv=0x0){
 	if(!pack){ return 0; }
 	double dummyR, hitTheta, hitPhi;
 	double comAngle;
-	double t1, t2;
+	double t2;
 	unsigned int count, total;
 	Vector3 flight_path;
 	Vector3 temp_vector;
-	Vector3 temp_normal;
 	Vector3 temp_ray, offset, dummyVector;
 	int type;
 	bool found_hit;
@@ -64,6 +67,18 @@ unsigned int TestDetSetup(dataPack *pack, const std::vector<Primitive*> &bar_arr
 		matrix.SetRotationMatrixSphere(angle_, 0.0);
 	}
 	
+	// Build a bounding volume hierarchy from the detectors which are valid for this type of event.
+	std::vector<Primitive*> valid_dets;
+	for(std::vector<Primitive*>::const_iterator iter = bar_array.begin(); iter != bar_array.end(); iter++){
+		if(ejectile_ ? (*iter)->IsEjectileDet() : (*iter)->IsRecoilDet()){ valid_dets.push_back(*iter); }
+	}
+	DetectorBVH tree(valid_dets, arrays_);
+	DetectorStore store(valid_dets);
+	std::vector<BVHCandidate> candidates;
+	std::vector<unsigned int> slots;
+	std::vector<unsigned int> order(valid_dets.size());
+	std::vector<DetectorHit> hits;
+	
 	unsigned int num_trials_chunk = num_trials/10;
 	unsigned int chunk_num = 1;
 	
@@ -99,31 +114,37 @@ unsigned int TestDetSetup(dataPack *pack, const std::vector<Primitive*> &bar_arr
 			if(use_rotated_source){ matrix.Transform(offset); } // This will rotate the "source" about the y-axis
 		}
 
-		for(std::vector<Primitive*>::const_iterator iter = bar_array.begin(); iter != bar_array.end(); iter++){
-			if((*iter)->IsEjectileDet()){
-				if((*iter)->IsRecoilDet()){ type = 2; } // Both ejectile & recoil
+		// Check for intersections with the detectors along the ray. The store tests the candidates
+		// found by the tree one shape at a time, so the hits are put back in order of distance.
+		tree.GetCandidates(offset, temp_ray, candidates);
+		slots.clear();
+		for(unsigned int i = 0; i < candidates.size(); i++){
+			slots.push_back(store.GetSlot(candidates[i].index));
+			order[candidates[i].index] = i;
+		}
+		std::sort(slots.begin(), slots.end());
+		hits.clear();
+		store.Intersect(offset, temp_ray, slots, hits);
+		std::sort(hits.begin(), hits.end(), [&order](const DetectorHit &lhs, const DetectorHit &rhs){ return (order[lhs.index] < order[rhs.index]); });
+		for(std::vector<DetectorHit>::const_iterator iter = hits.begin(); iter != hits.end(); iter++){
+			if(iter->prim->IsEjectileDet()){
+				if(iter->prim->IsRecoilDet()){ type = 2; } // Both ejectile & recoil
 				else{ type = 0; } // Ejectile
 			}
-			else if((*iter)->IsRecoilDet()){ type = 1; } // Recoil
-			else{ continue; }
-		
-			// Is this detector valid for this type of event?
-			if(ejectile_ && type == 1){ continue; }
-			else if(!ejectile_ && type == 0){ continue; }
+			else{ type = 1; } // Recoil
 			
-			// Check for intersections with detectors.
-			if((*iter)->IntersectPrimitive(offset, temp_ray, temp_vector, temp_normal, t1, t2)){
-				if(t2 > 0){ dummyVector = (offset + temp_ray * t2); }
-				else{ dummyVector = Vector3(0,0,0); }
-				
-				Cart2Sphere(temp_vector, dummyR, hitTheta, hitPhi);
-				
-				pack->MCARLOdata.Append(temp_vector.axis[0], temp_vector.axis[1], temp_vector.axis[2],
-									   dummyVector.axis[0], dummyVector.axis[1], dummyVector.axis[2],
-									   hitTheta*rad2deg, hitPhi*rad2deg, 0, 0, (*iter)->GetLoc(), type);
-									   
-				found_hit = true;
-			}
+			temp_vector = iter->P1;
+			t2 = iter->t2;
+			if(t2 > 0){ dummyVector = (offset + temp_ray * t2); }
+			else{ dummyVector = Vector3(0,0,0); }
+			
+			Cart2Sphere(temp_vector, dummyR, hitTheta, hitPhi);
+			
+			pack->MCARLOdata.Append(temp_vector.axis[0], temp_vector.axis[1], temp_vector.axis[2],
+								   dummyVector.axis[0], dummyVector.axis[1], dummyVector.axis[2],
+								   hitTheta*rad2deg, hitPhi*rad2deg, 0, 0, iter->prim->GetLoc(), type);
+								   
+			found_hit = true;
 		}
 		
 		if(WriteRXN_){
@@ -165,9 +186,10 @@ int main(int argc, char *argv[]){
 	}
 
 	std::vector<Primitive*> detectors;
+	std::vector<DetectorArray*> arrays;
 
 	std::cout << " Reading in NewVIKAR detector setup file...\n";
-	int Ndet = ReadDetFile(argv[1], detectors);
+	int Ndet = ReadDetFile(argv[1], detectors, &arrays);
 	if(Ndet < 0){
 		std::cout << " Error: failed to load detector setup file!\n";
 		return 1; 
@@ -225,7 +247,7 @@ int main(int argc, char *argv[]){
 		// Process ejectile detectors
 		if(Nwanted > 0){
 			std::cout << "  Performing Monte Carlo test on ejectile detectors...\n";
-			total_found = TestDetSetup(&pack, detectors, Nwanted, WriteReaction, beamspot, targangle, true, conv);
+			total_found = TestDetSetup(&pack, detectors, arrays, Nwanted, WriteReaction, beamspot, targangle, true, conv);
 		
 			std::cout << "  Found " << Nwanted << " ejectile events in " << total_found << " trials (" << 100.0*Nwanted/total_found << "%)\n\n";
 
@@ -250,7 +272,7 @@ int main(int argc, char *argv[]){
 		// Process recoil detectors
 		if(Nwanted > 0){
 			std::cout << "  Performing Monte Carlo test on recoil detectors...\n";
-			total_found = TestDetSetup(&pack, detectors, Nwanted, WriteReaction, beamspot, targangle, false, conv);
+			total_found = TestDetSetup(&pack, detectors, arrays, Nwanted, WriteReaction, beamspot, targangle, false, conv);
 			
 			std::cout << "  Found " << Nwanted << " recoil events in " << total_found << " trials (" << 100.0*Nwanted/total_found << "%)\n\n";
 
@@ -275,6 +297,10 @@ int main(int argc, char *argv[]){
 		delete *iter;
 	}
 	detectors.clear();
+	for(std::vector<DetectorArray*>::iterator iter = arrays.begin(); iter != arrays.end(); iter++){
+		delete *iter;
+	}
+	arrays.clear();
 
 	if(pack.Close())
 		std::cout << "  Wrote monte carlo file 'mcarlo.root'\n";